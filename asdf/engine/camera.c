@@ -64,12 +64,10 @@ void Walk( CAMERA* cam, GLfloat units, GLboolean lockY )
 }
 
 /*** Función: Rotación en el eje "derecha" ***/
+// Los giros son de -units: mismo sentido que la matriz de glRotatef
+// aplicada por filas(transpuesta) como se hacía antes
 void Pitch( CAMERA* cam, GLfloat units, GLboolean lockPitch )
 {
-    GLfloat m[16];
-
-    glPushMatrix(); // Guardo la matriz
-    
     if( lockPitch )
     {
 	static GLfloat angle = 0.0f;
@@ -78,41 +76,23 @@ void Pitch( CAMERA* cam, GLfloat units, GLboolean lockPitch )
 	angle += units;
     }
 
-    glLoadIdentity();
-    glRotatef( units, cam->right.x, cam->right.y, cam->right.z );
-    glGetFloatv( GL_MODELVIEW_MATRIX, m );
-    cam->up   = TransformCoordFromMatrix( cam->up  , m );
-    cam->look = TransformCoordFromMatrix( cam->look, m );
-
-    glPopMatrix(); // Restauro la matriz
+    QUATERNION q = AxisAngleQuaternion( -units, cam->right );
+    cam->up   = RotateVector( q, cam->up   );
+    cam->look = RotateVector( q, cam->look );
 }
 
 /*** Función: Rotación en el eje "arriba" ***/
 void Yaw( CAMERA* cam, GLfloat units, GLboolean upYaw )
 {
-    GLfloat m[16];
-
-    glPushMatrix(); // Guardo la matriz
-    
-    glLoadIdentity();
-    if( upYaw )
-	glRotatef( units, 0.0f, 1.0f, 0.0f );
-    else
-	glRotatef( units, cam->up.x, cam->up.y, cam->up.z );
-    glGetFloatv( GL_MODELVIEW_MATRIX, m );
-    cam->right = TransformCoordFromMatrix( cam->right, m );
-    cam->look  = TransformCoordFromMatrix( cam->look , m );
-
-    glPopMatrix(); // Restauro la matriz
+    VECTOR     axis = { 0.0f, 1.0f, 0.0f };
+    QUATERNION q    = AxisAngleQuaternion( -units, upYaw ? axis : cam->up );
+    cam->right = RotateVector( q, cam->right );
+    cam->look  = RotateVector( q, cam->look  );
 }
 
 /*** Función: Rotación en el eje "dirección" ***/
 void Roll( CAMERA* cam, GLfloat units, GLboolean lockRoll )
 {
-    GLfloat m[16];
-
-    glPushMatrix(); // Guardo la matriz
-
     if( lockRoll )
     {
 	static GLfloat angle = 0.0f;
@@ -121,13 +101,75 @@ void Roll( CAMERA* cam, GLfloat units, GLboolean lockRoll )
 	angle += units;
     }
     
-    glLoadIdentity();
-    glRotatef( units, cam->look.x, cam->look.y, cam->look.z );
-    glGetFloatv( GL_MODELVIEW_MATRIX, m );
-    cam->right = TransformCoordFromMatrix( cam->right, m );
-    cam->up    = TransformCoordFromMatrix( cam->up   , m );
+    QUATERNION q = AxisAngleQuaternion( -units, cam->look );
+    cam->right = RotateVector( q, cam->right );
+    cam->up    = RotateVector( q, cam->up    );
+}
+
+/*** Función: Volumen de visión de la cámara, sin opengl ***/
+// Misma vista que gluPerspective( fovy, aspect, zNear, zFar ) con
+// gluLookAt( pos, pos + look, (0, 1, 0) )
+FRUSTUM CameraFrustum( CAMERA* cam,
+		       GLfloat fovy  ,   // Ángulo de visión vertical
+		       GLfloat aspect,   // Ancho / alto
+		       GLfloat zNear , GLfloat zFar )
+{
+    VECTOR  worldUp = { 0.0f, 1.0f, 0.0f };
+    VECTOR  look    = NormalizeVector( cam->look );
+    VECTOR  side    = NormalizeVector( CrossProduct( look, worldUp ) );
+    VECTOR  up      = CrossProduct( side, look );
+    GLfloat tanY    = tanf( fovy * 0.5f * M_PI / 180.0f );
+    GLfloat tanX    = tanY * aspect;
+
+    /* Planos laterales: pasan por la posición de la cámara */
+    VECTOR n[4];
+    n[0] = NormalizeVector( SumVector( MulVector( look, tanX ), side ) );
+    n[1] = NormalizeVector( ResVector( MulVector( look, tanX ), side ) );
+    n[2] = NormalizeVector( SumVector( MulVector( look, tanY ), up ) );
+    n[3] = NormalizeVector( ResVector( MulVector( look, tanY ), up ) );
+
+    FRUSTUM frustum;
+    unsigned int i;
+    for( i = 0; i < 4; i++ )
+    {
+	frustum.planes[i].n = n[i];
+	frustum.planes[i].d = -DotProduct( n[i], cam->pos );
+    }
+
+    /* Planos cercano y lejano */
+    GLfloat dist = DotProduct( look, cam->pos );
+    frustum.planes[4].n = look;
+    frustum.planes[4].d = -dist - zNear;
+    frustum.planes[5].n = MulVector( look, -1.0f );
+    frustum.planes[5].d = dist + zFar;
+    return frustum;
+}
 
-    glPopMatrix(); // Restauro la matriz
+/*** Función: Rayo desde un punto(x, y) de la ventana, sin opengl ***/
+// Misma vista que gluPerspective( fovy, width/height, ... ) con
+// gluLookAt( pos, pos + look, (0, 1, 0) ); "y" crece hacia abajo(SDL)
+RAY CameraRay( CAMERA* cam,
+	       GLfloat fovy ,               // Ángulo de visión vertical
+	       GLint   width, GLint height, // Dimensión de la ventana
+	       GLfloat x    , GLfloat y )   // Punto en la ventana
+{
+    VECTOR  worldUp = { 0.0f, 1.0f, 0.0f };
+    VECTOR  look    = NormalizeVector( cam->look );
+    VECTOR  side    = NormalizeVector( CrossProduct( look, worldUp ) );
+    VECTOR  up      = CrossProduct( side, look );
+    GLfloat tanY    = tanf( fovy * 0.5f * M_PI / 180.0f );
+    GLfloat tanX    = tanY * (GLfloat)width / (GLfloat)height;
+
+    /* Punto en coordenadas normalizadas [-1, 1] */
+    GLfloat nx = 2.0f * x / width  - 1.0f;
+    GLfloat ny = 1.0f - 2.0f * y / height;
+
+    RAY ray;
+    ray.p0 = cam->pos;
+    ray.u  = NormalizeVector( SumVector( look,
+					 SumVector( MulVector( side, nx * tanX ),
+						    MulVector( up  , ny * tanY ) ) ) );
+    return ray;
 }
 
 /*_________*/
@@ -8,49 +8,1057 @@
 
 //--- Estructuras ---//
 
+/*** Estructura de Dato: TRIBATCH ***/
+// Lote de 4 triángulos en columnas(SoA) para CollisionDetectionTri4
+typedef struct tribatch
+{
+  GLfloat x0[4], y0[4], z0[4]; // 1er punto
+  GLfloat x1[4], y1[4], z1[4]; // 2do punto
+  GLfloat x2[4], y2[4], z2[4]; // 3er punto
+  GLuint  count;               // Triángulos en el lote
+} TRIBATCH;
+
+/*** Estructura de Dato: CONTACTCACHE ***/
+// Triángulos candidatos de un objeto que se mueve. Se reutilizan entre
+// iteraciones y cuadros mientras el recorrido quede dentro de "bound".
+typedef struct contactcache
+{
+  GLfloat   padding;        // Holgura de la caja al recolectar
+  GLboolean valid;          // Los candidatos sirven
+  GLuint    stamp;          // AABBTREE.stamp al recolectar(sigue al dueño)
+  BOX       bound;          // Caja cubierta por los candidatos
+  TRIBATCH* batches;        // Lotes de triángulos(en el mundo)
+  BOX*      boxes;          // Caja de cada lote
+  GLuint*   owners;         // Objeto de cada lote(el propio: terreno)
+  GLuint    nBatches;       // Número de lotes
+  GLuint    batchCapacity;  // Lotes reservados
+  BOX*      groups;         // Cajas de los grupos de lotes(árbol implícito)
+  GLuint    nLeaves;        // Hojas del árbol(potencia de 2 >= nBatches)
+  GLuint    groupCapacity;  // Cajas de grupos reservadas
+  GLuint*   objects;        // Objetos recolectados(en orden)
+  GLfloat*  matrices;       // Matriz de cada objeto al recolectar
+  GLuint    nObjects;       // Número de objetos recolectados
+  GLuint    objectCapacity; // Objetos reservados
+} CONTACTCACHE;
+
+/*** Estructura de Dato: CONVEX ***/
+// Nube de puntos del mundo vista desde la esfera unitaria de una elipse:
+// (p / axes) - origin, sin copiarla
+typedef struct convex
+{
+  VECTOR* points; // Puntos en el mundo
+  GLuint  count;  // Número de puntos
+  VECTOR  axes;   // Ejes de la elipse
+  VECTOR  origin; // Centro de la esfera(espacio de la elipse)
+} CONVEX;
+
+/*** Estructura de Dato: AABBNODE ***/
+typedef struct aabbnode
+{
+  BOX    box;    // Caja(holgada en las hojas)
+  GLint  parent; // Nodo padre(-1 en la raíz, siguiente libre si está libre)
+  GLint  left;   // Hijo izquierdo(-1 en las hojas)
+  GLint  right;  // Hijo derecho(-1 en las hojas)
+  GLint  height; // Altura del subárbol(0 en hojas, -1 libre)
+  GLuint object; // Índice del objeto(sólo hojas)
+} AABBNODE;
+
+/*** Estructura de Dato: AABBTREE ***/
+// Árbol dinámico de cajas de los objetos del mundo(broad phase)
+typedef struct aabbtree
+{
+  AABBNODE* nodes;    // Nodos
+  GLuint    capacity; // Nodos reservados
+  GLint     root;     // Raíz(-1 si está vacío)
+  GLint     freeList; // Primer nodo libre
+  GLfloat   margin;   // Holgura de las cajas de las hojas
+  GLuint    stamp;    // Cambia cada vez que se mueve un objeto
+} AABBTREE;
+
 /*** Estructura de Dato: OBJECT ***/
+// Las cachés de triángulos y envolventes se crean al colisionar; la
+// estructura debe iniciar en cero y liberarse con FreeVolumes.
 typedef struct volumes
 {
-  ELLIPSOID   ellipsoid;    // Bounding Ellipsoid
-  SPHERE      sphere;       // Bounding Sphere
-  BOX         box;          // Bounding Box
-  GLfloat     matrix[16];   // World Matrix
+  ELLIPSOID     ellipsoid;       // Bounding Ellipsoid
+  SPHERE        sphere;          // Bounding Sphere
+  BOX           box;             // Bounding Box
+  GLfloat       matrix[16];      // World Matrix
+  VECTOR*       triangles;       // Triángulos del modelo en el mundo(BVH)
+  BOX*          nodes;           // Cajas de la BVH en el mundo
+  GLfloat       cacheMatrix[16]; // Matriz usada para la caché
+  VECTOR*       hullPoints;      // Puntos de las envolventes en el mundo
+  BOX*          hullBoxes;       // Caja de cada envolvente en el mundo
+  GLfloat       hullMatrix[16];  // Matriz usada para las envolventes
+  AABBTREE*     tree;            // Árbol del mundo(NULL si no está)
+  GLint         proxy;           // Hoja del objeto en el árbol
+  CONTACTCACHE* contacts;        // Candidatos guardados(NULL: sin caché)
 } VOLUMES;
 
+/*** Estructura de Dato: ACTOR ***/
+// Objeto que se mueve con CollisionAndResponseBatch
+typedef struct actor
+{
+  VOLUMES* volumes;      // Volúmenes del actor
+  GLuint   object;       // Índice en la lista del mundo(-1 si no está)
+  VECTOR   displacement; // Desplazamiento esperado
+  VECTOR   moved;        // Desplazamiento final(salida)
+} ACTOR;
+
+/*** Estructura de Dato: ACTORBATCH ***/
+// Datos compartidos por los hilos de CollisionAndResponseBatch
+typedef struct actorbatch
+{
+  GLuint    nIterations; // No. de iteraciones en col.
+  GLfloat   epsilon;     // Exactitud de la respuesta
+  TERRAIN*  terrain;     // Terreno del mundo
+  MODEL**   models;      // Modelos del mundo
+  VOLUMES** volumes;     // Volúmenes del mundo
+  GLuint    nObjects;    // No. de objetos del mundo
+  ACTOR*    actors;      // Actores
+  VOLUMES*  results;     // Volúmenes movidos de cada actor
+} ACTORBATCH;
+
+/*** Estructura de Dato: PICK ***/
+// Resultado de PickScene
+typedef struct pick
+{
+  GLint   object;   // Objeto tocado(-1: el terreno)
+  GLfloat time;     // Tiempo en el rayo
+  VECTOR  position; // Punto tocado
+  VECTOR  normal;   // Normal de la superficie(contra el rayo)
+} PICK;
+
+/*** Estructura de Dato: CULLSTATS ***/
+// Resultado de CullVolumes
+typedef struct cullstats
+{
+  GLuint tested;       // Objetos probados
+  GLuint visible;      // Objetos dentro o tocando el volumen de visión
+  GLuint culledSphere; // Descartados con la esfera
+  GLuint culledBox;    // Descartados con la caja(la esfera tocaba)
+} CULLSTATS;
+
 //--- Funciones ---//
 
+/*--- Árbol de cajas ---*/
+
+/*** Función: Inicializa un árbol de cajas vacío ***/
+void InitAABBTree( AABBTREE* tree, GLfloat margin )
+{
+  tree->nodes    = NULL;
+  tree->capacity = 0;
+  tree->root     = -1;
+  tree->freeList = -1;
+  tree->margin   = margin;
+  tree->stamp    = 0;
+}
+
+/*** Función: Libera los nodos de un árbol de cajas ***/
+void FreeAABBTree( AABBTREE* tree )
+{
+  free( tree->nodes );
+  InitAABBTree( tree, tree->margin );
+}
+
+/*** Función: Toma un nodo libre(crece el arreglo si es necesario) ***/
+GLint AllocateAABBNode( AABBTREE* tree )
+{
+  if( tree->freeList == -1 )
+    {
+      GLuint i, old = tree->capacity;
+      tree->capacity = old == 0 ? 16 : old * 2;
+      tree->nodes    = realloc( tree->nodes,
+				sizeof(AABBNODE) * tree->capacity );
+      for( i = old; i < tree->capacity; i++ )
+	{
+	  tree->nodes[i].parent = i + 1 < tree->capacity ? (GLint)(i + 1) : -1;
+	  tree->nodes[i].height = -1;
+	}
+      tree->freeList = old;
+    }
+
+  GLint     index = tree->freeList;
+  AABBNODE* node  = &tree->nodes[index];
+  tree->freeList  = node->parent;
+  node->parent    = -1;
+  node->left      = -1;
+  node->right     = -1;
+  node->height    = 0;
+  node->object    = 0;
+  return index;
+}
+
+/*** Función: Devuelve un nodo a la lista de libres ***/
+void FreeAABBNode( AABBTREE* tree, GLint index )
+{
+  tree->nodes[index].parent = tree->freeList;
+  tree->nodes[index].height = -1;
+  tree->freeList            = index;
+}
+
+/*** Función: Rota el subárbol "a" si está desbalanceado ***/
+// Devuelve la nueva raíz del subárbol
+GLint BalanceAABBTree( AABBTREE* tree, GLint a )
+{
+  AABBNODE* n = tree->nodes;
+  if( n[a].left == -1 || n[a].height < 2 )
+    return a;
+
+  GLint b       = n[a].left;
+  GLint c       = n[a].right;
+  GLint balance = n[c].height - n[b].height;
+  if( balance > -2 && balance < 2 )
+    return a;
+
+  /* Subo el hijo más alto(p) y bajo "a" */
+  GLint p = balance > 0 ? c : b; // Hijo que sube
+  GLint q = balance > 0 ? b : c; // Hijo que se queda
+  GLint f = n[p].left;
+  GLint g = n[p].right;
+
+  n[p].left   = a;
+  n[p].parent = n[a].parent;
+  n[a].parent = p;
+  if( n[p].parent != -1 )
+    {
+      if( n[n[p].parent].left == a )
+	n[n[p].parent].left = p;
+      else
+	n[n[p].parent].right = p;
+    }
+  else
+    tree->root = p;
+
+  // El nieto más alto se queda con "p", el otro pasa a "a"
+  GLint keep = n[f].height > n[g].height ? f : g;
+  GLint move = keep == f ? g : f;
+  n[p].right    = keep;
+  n[move].parent = a;
+  if( balance > 0 )
+    n[a].right = move;
+  else
+    n[a].left  = move;
+
+  n[a].box    = MergeBox( n[q].box, n[move].box );
+  n[a].height = 1 + MAXVALUE( n[q].height, n[move].height );
+  n[p].box    = MergeBox( n[a].box, n[keep].box );
+  n[p].height = 1 + MAXVALUE( n[a].height, n[keep].height );
+  return p;
+}
+
+/*** Función: Recalcula cajas y alturas desde un nodo hasta la raíz ***/
+void RefitAABBTree( AABBTREE* tree, GLint index )
+{
+  while( index != -1 )
+    {
+      index = BalanceAABBTree( tree, index );
+      AABBNODE* n     = tree->nodes;
+      GLint     left  = n[index].left;
+      GLint     right = n[index].right;
+      n[index].box    = MergeBox( n[left].box, n[right].box );
+      n[index].height = 1 + MAXVALUE( n[left].height, n[right].height );
+      index = n[index].parent;
+    }
+}
+
+/*** Función: Inserta una hoja donde menos crezca el área del árbol ***/
+void InsertAABBLeaf( AABBTREE* tree, GLint leaf )
+{
+  if( tree->root == -1 )
+    {
+      tree->root = leaf;
+      tree->nodes[leaf].parent = -1;
+      return;
+    }
+
+  /* Busco el mejor hermano */
+  BOX   leafBox = tree->nodes[leaf].box;
+  GLint index   = tree->root;
+  while( tree->nodes[index].left != -1 )
+    {
+      AABBNODE* node     = &tree->nodes[index];
+      GLfloat   area     = BoxArea( node->box );
+      GLfloat   combined = BoxArea( MergeBox( node->box, leafBox ) );
+      // Costo de crear un padre nuevo aquí y costo heredado al bajar
+      GLfloat   cost     = 2.0f * combined;
+      GLfloat   inherit  = 2.0f * ( combined - area );
+
+      GLint   child[2] = { node->left, node->right };
+      GLfloat childCost[2];
+      unsigned int k;
+      for( k = 0; k < 2; k++ )
+	{
+	  AABBNODE* c = &tree->nodes[child[k]];
+	  childCost[k] = BoxArea( MergeBox( c->box, leafBox ) ) + inherit;
+	  if( c->left != -1 )
+	    childCost[k] -= BoxArea( c->box );
+	}
+
+      if( cost < childCost[0] && cost < childCost[1] )
+	break;
+      index = childCost[0] < childCost[1] ? child[0] : child[1];
+    }
+
+  /* Nuevo padre del hermano y la hoja */
+  GLint sibling   = index;
+  GLint oldParent = tree->nodes[sibling].parent;
+  GLint newParent = AllocateAABBNode( tree );
+  AABBNODE* n     = tree->nodes;
+  n[newParent].parent = oldParent;
+  n[newParent].box    = MergeBox( leafBox, n[sibling].box );
+  n[newParent].height = n[sibling].height + 1;
+  n[newParent].left   = sibling;
+  n[newParent].right  = leaf;
+  n[sibling].parent   = newParent;
+  n[leaf].parent      = newParent;
+  if( oldParent != -1 )
+    {
+      if( n[oldParent].left == sibling )
+	n[oldParent].left = newParent;
+      else
+	n[oldParent].right = newParent;
+    }
+  else
+    tree->root = newParent;
+
+  RefitAABBTree( tree, newParent );
+}
+
+/*** Función: Quita una hoja del árbol(sin liberarla) ***/
+void RemoveAABBLeaf( AABBTREE* tree, GLint leaf )
+{
+  if( leaf == tree->root )
+    {
+      tree->root = -1;
+      return;
+    }
+
+  AABBNODE* n           = tree->nodes;
+  GLint     parent      = n[leaf].parent;
+  GLint     grandParent = n[parent].parent;
+  GLint     sibling     = n[parent].left == leaf ? n[parent].right : n[parent].left;
+
+  /* El hermano toma el lugar del padre */
+  n[sibling].parent = grandParent;
+  if( grandParent != -1 )
+    {
+      if( n[grandParent].left == parent )
+	n[grandParent].left = sibling;
+      else
+	n[grandParent].right = sibling;
+    }
+  else
+    tree->root = sibling;
+  FreeAABBNode( tree, parent );
+
+  RefitAABBTree( tree, grandParent );
+}
+
+/*** Función: Caja holgada de unos volúmenes(extendida en el desplazamiento) ***/
+BOX FatBox( AABBTREE* tree, VOLUMES* volumes, VECTOR displacement )
+{
+  VECTOR margin = { tree->margin, tree->margin, tree->margin };
+  BOX    box    = { ResVector( volumes->box.min, margin ),
+		    SumVector( volumes->box.max, margin ) };
+
+  // Anticipo el siguiente desplazamiento
+  if( displacement.x < 0.0f ) box.min.x += displacement.x; else box.max.x += displacement.x;
+  if( displacement.y < 0.0f ) box.min.y += displacement.y; else box.max.y += displacement.y;
+  if( displacement.z < 0.0f ) box.min.z += displacement.z; else box.max.z += displacement.z;
+  return box;
+}
+
+/*** Función: Marca un cambio de unos volúmenes en su árbol ***/
+// La caché de candidatos del mismo objeto sigue al árbol si estaba al día:
+// sólo los cambios de los demás objetos la obligan a verificarse.
+void StampVolumes( VOLUMES* volumes )
+{
+  CONTACTCACHE* cache = volumes->contacts;
+  if( cache != NULL && cache->stamp == volumes->tree->stamp )
+    cache->stamp++;
+  volumes->tree->stamp++;
+}
+
+/*** Función: Agrega los volúmenes de un objeto al árbol ***/
+void InsertVolumes( AABBTREE* tree, VOLUMES* volumes, GLuint object )
+{
+  VECTOR zero = { 0.0f, 0.0f, 0.0f };
+  GLint  leaf = AllocateAABBNode( tree );
+  tree->nodes[leaf].box    = FatBox( tree, volumes, zero );
+  tree->nodes[leaf].object = object;
+  InsertAABBLeaf( tree, leaf );
+  volumes->tree  = tree;
+  volumes->proxy = leaf;
+  StampVolumes( volumes );
+}
+
+/*** Función: Quita los volúmenes de un objeto del árbol ***/
+void RemoveVolumes( VOLUMES* volumes )
+{
+  if( volumes->tree == NULL )
+    return;
+  StampVolumes( volumes );
+  RemoveAABBLeaf( volumes->tree, volumes->proxy );
+  FreeAABBNode( volumes->tree, volumes->proxy );
+  volumes->tree  = NULL;
+  volumes->proxy = -1;
+}
+
+/*** Función: Reinserta los volúmenes si salieron de su caja holgada ***/
+// Se llama cada vez que cambian los volúmenes(ver StampVolumes)
+void MoveVolumes( VOLUMES* volumes, VECTOR displacement )
+{
+  AABBTREE* tree = volumes->tree;
+  if( tree == NULL )
+    return;
+  StampVolumes( volumes );
+  if( BoxContains( tree->nodes[volumes->proxy].box, volumes->box ) )
+    return;
+
+  RemoveAABBLeaf( tree, volumes->proxy );
+  tree->nodes[volumes->proxy].box = FatBox( tree, volumes, displacement );
+  InsertAABBLeaf( tree, volumes->proxy );
+}
+
+/*** Función: Objetos cuyas cajas tocan una caja ***/
+// Devuelve el número de objetos escritos en "out"(a lo más "maxOut")
+GLuint QueryAABBTree( AABBTREE* tree, BOX box, GLuint* out, GLuint maxOut )
+{
+  GLint  stack[256];
+  GLuint top = 0, count = 0;
+
+  if( tree->root != -1 )
+    stack[top++] = tree->root;
+  while( top > 0 && count < maxOut )
+    {
+      AABBNODE* node = &tree->nodes[stack[--top]];
+      if( !BoxOverlap( node->box, box ) )
+	continue;
+      if( node->left == -1 )
+	out[count++] = node->object;
+      else
+	{
+	  stack[top++] = node->left;
+	  stack[top++] = node->right;
+	}
+    }
+  return count;
+}
+
+/*** Función: Pares de objetos cuyas cajas se solapan ***/
+// Escribe pares(a < b) en "pairs"; devuelve el número de pares
+GLuint QueryAABBPairs( AABBTREE* tree, GLuint* pairs, GLuint maxPairs )
+{
+  GLuint count = 0;
+  GLuint i;
+  for( i = 0; i < tree->capacity && count < maxPairs; i++ )
+    {
+      AABBNODE* leaf = &tree->nodes[i];
+      if( leaf->height != 0 )
+	continue;
+
+      /* Recorro el árbol con la caja de la hoja */
+      GLint  stack[256];
+      GLuint top = 0;
+      stack[top++] = tree->root;
+      while( top > 0 && count < maxPairs )
+	{
+	  AABBNODE* node = &tree->nodes[stack[--top]];
+	  if( !BoxOverlap( node->box, leaf->box ) )
+	    continue;
+	  if( node->left == -1 )
+	    {
+	      if( leaf->object < node->object )
+		{
+		  pairs[count * 2 + 0] = leaf->object;
+		  pairs[count * 2 + 1] = node->object;
+		  count++;
+		}
+	    }
+	  else
+	    {
+	      stack[top++] = node->left;
+	      stack[top++] = node->right;
+	    }
+	}
+    }
+  return count;
+}
+
+/*_______*/
+
+/*--- Envolventes convexas(GJK/EPA) ---*/
+
+/*** Función: Punto de una nube con mayor proyección en una dirección ***/
+// Escalar y trasladar no cambian cuál es el extremo: se busca en el mundo
+// con la dirección escalada y sólo se convierte el punto elegido.
+VECTOR SupportPoint( CONVEX* convex, VECTOR dir )
+{
+  VECTOR* points = convex->points;
+  VECTOR  d      = DivVector( dir, convex->axes );
+  GLuint  best   = 0;
+  GLfloat max    = DotProduct( points[0], d );
+  unsigned int i;
+  for( i = 1; i < convex->count; i++ )
+    if( DotProduct( points[i], d ) > max )
+      {
+	max  = DotProduct( points[i], d );
+	best = i;
+      }
+  return ResVector( DivVector( points[best], convex->axes ), convex->origin );
+}
+
+/*** Función: Punto más cercano al origen en un triángulo del simplex ***/
+// Reduce "s" a los vértices de la región de Voronoi del punto; devuelve
+// cuántos quedan(Ericson, Real-Time Collision Detection 5.1.5)
+GLuint SimplexTriangle( VECTOR* s, VECTOR* closest )
+{
+  VECTOR  a  = s[0], b = s[1], c = s[2];
+  VECTOR  ab = ResVector( b, a ), ac = ResVector( c, a ), bc = ResVector( c, b );
+  GLfloat d1 = -DotProduct( ab, a ), d2 = -DotProduct( ac, a );
+  GLfloat d3 = -DotProduct( ab, b ), d4 = -DotProduct( ac, b );
+  GLfloat d5 = -DotProduct( ab, c ), d6 = -DotProduct( ac, c );
+  GLfloat va, vb, vc;
+
+  if( d1 <= 0.0f && d2 <= 0.0f )
+    {
+      *closest = a;
+      return 1;
+    }
+  if( d3 >= 0.0f && d4 <= d3 )
+    {
+      *closest = s[0] = b;
+      return 1;
+    }
+  vc = d1 * d4 - d3 * d2;
+  if( vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f )
+    {
+      *closest = SumVector( a, MulVector( ab, d1 / (d1 - d3) ) );
+      return 2;
+    }
+  if( d6 >= 0.0f && d5 <= d6 )
+    {
+      *closest = s[0] = c;
+      return 1;
+    }
+  vb = d5 * d2 - d1 * d6;
+  if( vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f )
+    {
+      *closest = SumVector( a, MulVector( ac, d2 / (d2 - d6) ) );
+      s[1] = c;
+      return 2;
+    }
+  va = d3 * d6 - d5 * d4;
+  if( va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f )
+    {
+      *closest = SumVector( b, MulVector( bc, (d4 - d3) /
+					  ((d4 - d3) + (d5 - d6)) ) );
+      s[0] = b;
+      s[1] = c;
+      return 2;
+    }
+  GLfloat denom = 1.0f / (va + vb + vc);
+  *closest = SumVector( a, SumVector( MulVector( ab, vb * denom ),
+				      MulVector( ac, vc * denom ) ) );
+  return 3;
+}
+
+/*** Función: Punto más cercano al origen en el simplex de GJK ***/
+// Reduce "s" a los vértices que lo generan; 4 indica que el origen está
+// dentro del tetraedro
+GLuint SimplexClosest( VECTOR* s, GLuint n, VECTOR* closest )
+{
+  switch( n )
+    {
+    case 1:
+      *closest = s[0];
+      return 1;
+
+    case 2:
+      {
+	VECTOR  ab = ResVector( s[1], s[0] );
+	GLfloat t  = -DotProduct( s[0], ab ) / DotProduct( ab, ab );
+	if( t <= 0.0f )
+	  {
+	    *closest = s[0];
+	    return 1;
+	  }
+	if( t >= 1.0f )
+	  {
+	    *closest = s[0] = s[1];
+	    return 1;
+	  }
+	*closest = SumVector( s[0], MulVector( ab, t ) );
+	return 2;
+      }
+
+    case 3:
+      return SimplexTriangle( s, closest );
+
+    default:
+      {
+	// Caras del tetraedro que ven al origen(con su vértice opuesto)
+	static const int faces[4][4] =
+	  { { 0, 1, 2, 3 }, { 0, 2, 3, 1 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 } };
+	GLfloat best = INFINITY;
+	GLuint  count = 4;
+	VECTOR  face[3];
+	int     f;
+	for( f = 0; f < 4; f++ )
+	  {
+	    VECTOR a = s[faces[f][0]], b = s[faces[f][1]], c = s[faces[f][2]];
+	    VECTOR d = s[faces[f][3]];
+	    VECTOR normal = CrossProduct( ResVector( b, a ), ResVector( c, a ) );
+	    GLfloat signO = -DotProduct( a, normal );
+	    GLfloat signD = DotProduct( ResVector( d, a ), normal );
+	    if( signO * signD > 0.0f )
+	      continue;
+
+	    VECTOR tri[3] = { a, b, c };
+	    VECTOR point;
+	    GLuint m = SimplexTriangle( tri, &point );
+	    if( Norm2Vector( point ) < best )
+	      {
+		best     = Norm2Vector( point );
+		*closest = point;
+		count    = m;
+		memcpy( face, tri, sizeof(VECTOR) * m );
+	      }
+	  }
+	if( count < 4 )
+	  memcpy( s, face, sizeof(VECTOR) * count );
+	else
+	  closest->x = closest->y = closest->z = 0.0f;
+	return count;
+      }
+    }
+}
+
+/*** Función: Distancia del origen a la envolvente de una nube(GJK) ***/
+// Devuelve GL_TRUE si el origen está dentro; si no, "closest" es el punto
+// más cercano. "simplex" queda con el último simplex(para EPA).
+GLboolean ConvexClosest( CONVEX* convex , // Nube de puntos
+			 VECTOR* closest, // Punto más cercano al origen
+			 VECTOR* simplex, // Simplex final(4 vectores)
+			 GLuint* nSimplex ) // Vértices del simplex
+{
+  VECTOR v = ResVector( DivVector( convex->points[0], convex->axes ),
+			convex->origin );
+  GLuint n = 0, iteration;
+  unsigned int i;
+
+  for( iteration = 0; iteration < 64; iteration++ )
+    {
+      GLfloat vv = Norm2Vector( v );
+      if( vv < 1e-12f )
+	break;
+
+      // Nuevo punto de soporte; termina si ya no acerca
+      VECTOR w = SupportPoint( convex, MulVector( v, -1.0f ) );
+      if( vv - DotProduct( v, w ) <= 1e-6f * vv )
+	break;
+      for( i = 0; i < n; i++ )
+	if( w.x == simplex[i].x && w.y == simplex[i].y && w.z == simplex[i].z )
+	  break;
+      if( i < n )
+	break;
+
+      simplex[n++] = w;
+      VECTOR last = v;
+      n = SimplexClosest( simplex, n, &v );
+      if( n == 4 )
+	break;
+      // Sin avance(error numérico): me quedo con el anterior
+      if( iteration > 0 && Norm2Vector( v ) >= vv )
+	{
+	  v = last;
+	  break;
+	}
+    }
+
+  *nSimplex = n;
+  if( n == 4 || Norm2Vector( v ) < 1e-12f )
+    {
+      closest->x = closest->y = closest->z = 0.0f;
+      return GL_TRUE;
+    }
+  *closest = v;
+  return GL_FALSE;
+}
+
+/*** Función: Dirección de menor penetración del origen en una nube(EPA) ***/
+// Parte del simplex de GJK que contiene al origen. Devuelve GL_FALSE si
+// la envolvente es plana.
+GLboolean ConvexPenetration( CONVEX* convex , // Nube de puntos
+			     VECTOR* simplex, // Simplex de GJK
+			     GLuint  n      , // Vértices del simplex
+			     VECTOR* normal , // Normal hacia afuera
+			     GLfloat* depth ) // Profundidad
+{
+  VECTOR  vertices[64];
+  GLint   faces[128][3];
+  VECTOR  normals[128];
+  GLfloat dists[128];
+  GLint   edges[64][2];
+  GLuint  nVertices, nFaces = 0, iteration;
+  unsigned int i, j, k;
+
+  /* Completo el tetraedro inicial */
+  memcpy( vertices, simplex, sizeof(VECTOR) * n );
+  nVertices = n;
+  static const VECTOR axes[6] =
+    { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 },
+      { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+  for( i = 0; i < 6 && nVertices < 4; i++ )
+    {
+      VECTOR dir = axes[i];
+      if( nVertices == 3 )
+	{
+	  dir = CrossProduct( ResVector( vertices[1], vertices[0] ),
+			      ResVector( vertices[2], vertices[0] ) );
+	  if( i % 2 == 1 )
+	    dir = MulVector( dir, -1.0f );
+	}
+      else if( nVertices == 2 )
+	dir = CrossProduct( ResVector( vertices[1], vertices[0] ), axes[i] );
+
+      VECTOR w = SupportPoint( convex, dir );
+      GLboolean repeated = GL_FALSE;
+      for( j = 0; j < nVertices; j++ )
+	if( Norm2Vector( ResVector( w, vertices[j] ) ) < 1e-12f )
+	  repeated = GL_TRUE;
+      if( !repeated )
+	vertices[nVertices++] = w;
+    }
+  if( nVertices < 4 )
+    return GL_FALSE;
+
+  /* Caras del tetraedro hacia afuera */
+  static const int tetra[4][3] = { { 0, 1, 2 }, { 0, 3, 1 },
+				   { 0, 2, 3 }, { 1, 3, 2 } };
+  for( i = 0; i < 4; i++ )
+    {
+      faces[i][0] = tetra[i][0];
+      faces[i][1] = tetra[i][1];
+      faces[i][2] = tetra[i][2];
+    }
+  nFaces = 4;
+  VECTOR volume = CrossProduct( ResVector( vertices[1], vertices[0] ),
+				ResVector( vertices[2], vertices[0] ) );
+  GLfloat sign = DotProduct( ResVector( vertices[3], vertices[0] ), volume );
+  if( fabs( sign ) < 1e-12f )
+    return GL_FALSE;
+  if( sign > 0.0f )
+    // El 4to vértice está del lado de la normal: invierto las caras
+    for( i = 0; i < 4; i++ )
+      {
+	GLint t = faces[i][1];
+	faces[i][1] = faces[i][2];
+	faces[i][2] = t;
+      }
+
+  for( iteration = 0; iteration < 32; iteration++ )
+    {
+      /* Normales y distancias de las caras nuevas */
+      GLuint closest = 0;
+      for( i = 0; i < nFaces; i++ )
+	{
+	  VECTOR a = vertices[faces[i][0]];
+	  normals[i] = NormalizeVector(
+	    CrossProduct( ResVector( vertices[faces[i][1]], a ),
+			  ResVector( vertices[faces[i][2]], a ) ) );
+	  dists[i] = DotProduct( normals[i], a );
+	  if( dists[i] < dists[closest] )
+	    closest = i;
+	}
+
+      /* Termina si la cara más cercana ya es frontera */
+      VECTOR w = SupportPoint( convex, normals[closest] );
+      *normal = normals[closest];
+      *depth  = dists[closest];
+      if( DotProduct( w, normals[closest] ) - dists[closest] < 1e-4f ||
+	  nVertices == 64 )
+	return GL_TRUE;
+
+      /* Quito las caras que ve el nuevo punto y guardo el horizonte */
+      GLuint nEdges = 0;
+      for( i = 0; i < nFaces; )
+	{
+	  if( DotProduct( normals[i],
+			  ResVector( w, vertices[faces[i][0]] ) ) <= 0.0f )
+	    {
+	      i++;
+	      continue;
+	    }
+	  for( j = 0; j < 3; j++ )
+	    {
+	      GLint a = faces[i][j], b = faces[i][(j + 1) % 3];
+	      for( k = 0; k < nEdges; k++ )
+		if( edges[k][0] == b && edges[k][1] == a )
+		  break;
+	      if( k < nEdges )
+		{
+		  edges[k][0] = edges[nEdges - 1][0];
+		  edges[k][1] = edges[nEdges - 1][1];
+		  nEdges--;
+		}
+	      else if( nEdges < 64 )
+		{
+		  edges[nEdges][0] = a;
+		  edges[nEdges][1] = b;
+		  nEdges++;
+		}
+	    }
+	  nFaces--;
+	  memcpy( faces[i], faces[nFaces], sizeof(faces[i]) );
+	  normals[i] = normals[nFaces];
+	  dists[i]   = dists[nFaces];
+	}
+
+      /* Caras nuevas del horizonte al nuevo punto */
+      if( nFaces + nEdges > 128 )
+	return GL_TRUE;
+      vertices[nVertices] = w;
+      for( k = 0; k < nEdges; k++ )
+	{
+	  faces[nFaces][0] = edges[k][0];
+	  faces[nFaces][1] = edges[k][1];
+	  faces[nFaces][2] = nVertices;
+	  nFaces++;
+	}
+      nVertices++;
+    }
+  return GL_TRUE;
+}
+
+/*** Función: Actualiza las envolventes de un modelo en el espacio del mundo ***/
+// Sólo se recalculan si la matriz de los volúmenes cambió
+void UpdateHullCache( MODEL* model, VOLUMES* volumes )
+{
+  GLuint nPoints = 0;
+  unsigned int i, k;
+
+  if( volumes->hullPoints != NULL &&
+      memcmp( volumes->hullMatrix, volumes->matrix,
+	      sizeof(GLfloat) * 16 ) == 0 )
+    return;
+
+  if( volumes->hullPoints == NULL )
+    {
+      for( i = 0; i < model->hullCount; i++ )
+	nPoints += model->hulls[i].pointCount;
+      volumes->hullPoints = malloc( sizeof(VECTOR) * nPoints );
+      volumes->hullBoxes  = malloc( sizeof(BOX) * model->hullCount );
+    }
+  memcpy( volumes->hullMatrix, volumes->matrix, sizeof(GLfloat) * 16 );
+
+  /* Puntos de las envolventes seguidos y la caja de cada una */
+  VECTOR* points = volumes->hullPoints;
+  for( i = 0; i < model->hullCount; i++ )
+    {
+      HULL*  hull = &model->hulls[i];
+      VECTOR min  = {  INFINITY,  INFINITY,  INFINITY };
+      VECTOR max  = { -INFINITY, -INFINITY, -INFINITY };
+      for( k = 0; k < hull->pointCount; k++ )
+	{
+	  VECTOR v = TransformCoordFromMatrix( hull->points[k], volumes->matrix );
+	  min.x = MINVALUE( min.x, v.x ); max.x = MAXVALUE( max.x, v.x );
+	  min.y = MINVALUE( min.y, v.y ); max.y = MAXVALUE( max.y, v.y );
+	  min.z = MINVALUE( min.z, v.z ); max.z = MAXVALUE( max.z, v.z );
+	  points[k] = v;
+	}
+      volumes->hullBoxes[i].min = min;
+      volumes->hullBoxes[i].max = max;
+      points += hull->pointCount;
+    }
+}
+
+/*** Función: Colisión de la elipse contra una envolvente convexa ***/
+// Avance conservador con GJK: la esfera unitaria(espacio de la elipse)
+// avanza la distancia libre hasta tocar la envolvente. Actualiza
+// minTime/outPos(espacio de la elipse) si la colisión es más temprana.
+GLboolean CollisionDetectionHull( VECTOR*  points , // Envolvente(en el mundo)
+				  GLuint   count  , // Número de puntos
+				  VECTOR   axes   , // Ejes de la elipse
+				  VECTOR   ePos   , // Posición del objeto
+				  VECTOR   eDisp  , // Desplazamiento
+				  GLfloat* minTime, // Tiempo más temprano
+				  VECTOR*  outPos ) // Posición de colisión
+{
+  CONVEX  convex = { points, count, axes, ePos };
+  VECTOR  simplex[4];
+  GLuint  nSimplex, iteration;
+  GLfloat time = 0.0f;
+
+  VECTOR center, closest;
+  for( iteration = 0; ; iteration++ )
+    {
+      /* Envolvente relativa al centro de la esfera en "time" */
+      center = SumVector( ePos, MulVector( eDisp, time ) );
+      convex.origin = center;
+
+      if( ConvexClosest( &convex, &closest, simplex, &nSimplex ) )
+	{
+	  // Centro dentro de la envolvente: sale por la cara más cercana;
+	  // sólo se detiene si se sigue hundiendo
+	  VECTOR  normal;
+	  GLfloat depth;
+	  if( !ConvexPenetration( &convex, simplex, nSimplex,
+				  &normal, &depth ) ||
+	      DotProduct( eDisp, normal ) >= 0.0f )
+	    return GL_FALSE;
+	  closest = MulVector( normal, -1.0f );
+	  break;
+	}
+
+      /* Se aleja: no hay colisión(aunque esté incrustada) */
+      GLfloat dist  = NormVector( closest );
+      GLfloat speed = DotProduct( eDisp, closest ) / dist;
+      if( speed <= 0.0f )
+	return GL_FALSE;
+
+      /* Toca la esfera(o ya estaba incrustada) */
+      if( dist <= 1.0f + 1e-4f )
+	break;
+
+      /* Sin tocarla al agotar las iteraciones(roce): no hay colisión */
+      if( iteration == 31 )
+	return GL_FALSE;
+
+      /* Avanzo lo que la esfera puede moverse sin tocar */
+      time += (dist - 1.0f) / speed;
+      if( time > 1.0f )
+	return GL_FALSE;
+    }
+
+  /* Punto de contacto: el más cercano de la envolvente */
+  if( time < *minTime )
+    {
+      *minTime = time;
+      *outPos  = SumVector( center, closest );
+      return GL_TRUE;
+    }
+  return GL_FALSE;
+}
+
+/*** Función: Indica si un modelo colisiona con sus envolventes ***/
+GLboolean HullCollision( MODEL* model )
+{
+  return model->hullCount > 0 && !model->exactCollision;
+}
+
+/*** Función: Colisión de la elipse contra las envolventes de un modelo ***/
+GLboolean CollisionDetectionHulls( MODEL*   model  , // Modelo a verificar
+				   VOLUMES* mObj   , // Geometría del modelo
+				   VOLUMES* cObj   , // Geometría a colisionar
+				   BOX*     box    , // Caja del recorrido
+				   VECTOR   ePos   , // Posición(espacio elipse)
+				   VECTOR   eDisp  , // Desplazamiento(esp. elipse)
+				   GLfloat* minTime, // Tiempo más temprano
+				   VECTOR*  outPos ) // Posición de colisión
+{
+  GLboolean found = GL_FALSE;
+  unsigned int i;
+
+  /* Envolventes en el mundo y descarte por cajas */
+  UpdateHullCache( model, mObj );
+  VECTOR* points = mObj->hullPoints;
+  for( i = 0; i < model->hullCount; i++ )
+    {
+      GLuint count = model->hulls[i].pointCount;
+      if( BoxOverlap( mObj->hullBoxes[i], *box ) &&
+	  CollisionDetectionHull( points, count, cObj->ellipsoid.axes,
+				  ePos, eDisp, minTime, outPos ) )
+	found = GL_TRUE;
+      points += count;
+    }
+  return found;
+}
+
+/*_______*/
+
+/*** Función: Copia la matriz de los volúmenes(NULL: identidad) ***/
+void SetVolumesMatrix( VOLUMES* volumes, GLfloat* matrix )
+{
+  if( matrix == NULL )
+    IdentityMatrix( volumes->matrix );
+  else
+    memcpy( volumes->matrix, matrix, sizeof(GLfloat) * 16 );
+}
+
+/*** Función: Reubica los volúmenes en el árbol y los imprime ***/
+void PlaceBoundingVolumes( VOLUMES* volumes, GLboolean verbose )
+{
+  /* Árbol del mundo */
+  VECTOR zero = { 0.0f, 0.0f, 0.0f };
+  MoveVolumes( volumes, zero );
+
+  if( verbose )
+    {
+      fprintf( stderr, "-Bounding Volumes-\n" );
+      PrintVector( volumes->box.min         , "\tBox Minimum      " );
+      PrintVector( volumes->box.max         , "\tBox Maximum      " );
+      PrintVector( volumes->sphere.center   , "\tSphere Center    " );
+      fprintf( stderr, "\tSphere Radius    : %.2f\n", volumes->sphere.radius );
+      PrintVector( volumes->ellipsoid.center, "\tEllipsoid Center " );
+      PrintVector( volumes->ellipsoid.axes  , "\tEllipsoid Axes   " );
+    }
+}
+
 /*** Función: Actualiza la matriz de transformación de los objetos ***/
+// O(1) con la caja y la esfera locales del modelo: la caja es la local
+// transformada(exacta sin giros), la esfera se escala con la matriz y la
+// elipse circunscribe a la caja. ExactBoundingVolumes recorre los vértices.
 void BoundingVolumes( MODEL*    model  ,  // Modelo a sacar los volúmenes
 		      VOLUMES*  volumes,  // Salida de los datos de los volúmenes
-		      GLfloat*  matrix ,  // Transformación(NULL usa la opengl)
+		      GLfloat*  matrix ,  // Transformación(NULL: identidad)
 		      GLboolean verbose ) // Imprime los volumenes calculados
 {
-  /* Matriz */
-  if( matrix == NULL )
-    glGetFloatv( GL_TRANSPOSE_MODELVIEW_MATRIX, volumes->matrix );
-  else
-    memcpy( volumes->matrix, matrix, sizeof(GLfloat) * 16 );
+  SetVolumesMatrix( volumes, matrix );
+  GLfloat* M = volumes->matrix;
+
+  // Caja: centro transformado más la mitad proyectada en cada eje
+  VECTOR half   = MulVector( ResVector( model->bounds.max,
+					model->bounds.min ), 0.5f );
+  VECTOR center = TransformCoordFromMatrix( model->sphere.center, M );
+  VECTOR extent = { fabsf( M[0] ) * half.x + fabsf( M[1] ) * half.y +
+		    fabsf( M[ 2] ) * half.z,
+		    fabsf( M[4] ) * half.x + fabsf( M[5] ) * half.y +
+		    fabsf( M[ 6] ) * half.z,
+		    fabsf( M[8] ) * half.x + fabsf( M[9] ) * half.y +
+		    fabsf( M[10] ) * half.z };
+  volumes->box.min = ResVector( center, extent );
+  volumes->box.max = SumVector( center, extent );
+
+  // Esfera y elipse
+  volumes->sphere.center    = center;
+  volumes->sphere.radius    = model->sphere.radius * MatrixScale( M );
+  volumes->ellipsoid.center = center;
+  volumes->ellipsoid.axes   = MulVector( extent, sqrt( 3.0f ) );
+
+  PlaceBoundingVolumes( volumes, verbose );
+}
+
+/*** Función: Volúmenes exactos con todos los vértices transformados ***/
+// Caja mínima y esferas ajustadas; recorre el modelo(operaciones en lote)
+void ExactBoundingVolumes( MODEL*    model  ,  // Modelo a sacar los volúmenes
+			   VOLUMES*  volumes,  // Salida de los volúmenes
+			   GLfloat*  matrix ,  // Transformación(NULL: identidad)
+			   GLboolean verbose ) // Imprime los volumenes
+{
+  SetVolumesMatrix( volumes, matrix );
 
   /* Volumenes */
-  VECTOR  min    = {  INFINITY,  INFINITY,  INFINITY };
-  VECTOR  max    = { -INFINITY, -INFINITY, -INFINITY };
+  VECTORARRAY vertices;
+  if( !InitVectorArray( &vertices, model->vertexCount ) )
+    return;
+  LoadVectorArray( &vertices, model->vertexBuffer, model->vertexCount );
+  TransformVectors( volumes->matrix, &vertices, &vertices );
 
   // Caja
-  volumes->box.min = min;
-  volumes->box.max = max;
+  volumes->box = BoundVectors( &vertices );
   unsigned int i;
-  for( i = 0; i < model->vertexCount; i++ )
-    {
-      VECTOR vertex = TransformCoordFromMatrix( model->vertexBuffer[i],
-						volumes->matrix );
-      
-      volumes->box.min.x = MINVALUE(vertex.x,volumes->box.min.x);
-      volumes->box.min.y = MINVALUE(vertex.y,volumes->box.min.y);
-      volumes->box.min.z = MINVALUE(vertex.z,volumes->box.min.z);
-      volumes->box.max.x = MAXVALUE(vertex.x,volumes->box.max.x);
-      volumes->box.max.y = MAXVALUE(vertex.y,volumes->box.max.y);
-      volumes->box.max.z = MAXVALUE(vertex.z,volumes->box.max.z);
-    }
 
   // Esfera y elipse
   GLfloat eradius         = 0.0f;
@@ -67,8 +1075,7 @@ void BoundingVolumes( MODEL*    model  ,  // Modelo a sacar los volúmenes
     {
       // Esfera
       GLfloat radius;
-      VECTOR vertex = TransformCoordFromMatrix( model->vertexBuffer[i],
-						volumes->matrix );
+      VECTOR vertex = GetVectorArray( &vertices, i );
 
       radius = Norm2Vector( ResVector( vertex, center ) );
       volumes->sphere.radius = MAXVALUE( volumes->sphere.radius, radius );
@@ -81,17 +1088,9 @@ void BoundingVolumes( MODEL*    model  ,  // Modelo a sacar los volúmenes
     }
   volumes->sphere.radius  = sqrt( volumes->sphere.radius );
   volumes->ellipsoid.axes = MulVector( dist, sqrt(eradius) );
+  FreeVectorArray( &vertices );
 
-  if( verbose )
-    {
-      fprintf( stderr, "-Bounding Volumes-\n" );
-      PrintVector( volumes->box.min         , "\tBox Minimum      " );
-      PrintVector( volumes->box.max         , "\tBox Maximum      " );
-      PrintVector( volumes->sphere.center   , "\tSphere Center    " );
-      fprintf( stderr, "\tSphere Radius    : %.2f\n", volumes->sphere.radius );
-      PrintVector( volumes->ellipsoid.center, "\tEllipsoid Center " );
-      PrintVector( volumes->ellipsoid.axes  , "\tEllipsoid Axes   " );
-    }
+  PlaceBoundingVolumes( volumes, verbose );
 }
 
 /*** Función: Crea los volúmenes de una cámara con los ejes de la elipse  ***/
@@ -108,6 +1107,10 @@ void CreateCameraVolume( CAMERA camera, VECTOR axes, VOLUMES* volumes )
 			 0.0f, 0.0f, 1.0f, 0.0f,
 			 0.0f, 0.0f, 0.0f, 1.0f };
   memcpy( volumes->matrix, matrix, sizeof(GLfloat) * 16 );
+
+  /* Árbol del mundo */
+  VECTOR zero = { 0.0f, 0.0f, 0.0f };
+  MoveVolumes( volumes, zero );
 }
 
 /*** Función: Actuliza los volúmenes si el objeto se desea desplazar ***/
@@ -123,13 +1126,16 @@ void UpdateVolumes( VOLUMES* volumes, VECTOR displacement )
   volumes->ellipsoid.center = SumVector( volumes->ellipsoid.center,
 					 displacement );
 
-  // Update world matrix
-  glPushMatrix();
-  glLoadIdentity();
-  glTranslatef( displacement.x, displacement.y, displacement.z );
-  glMultTransposeMatrixf( volumes->matrix );
-  glGetFloatv( GL_TRANSPOSE_MODELVIEW_MATRIX, volumes->matrix );
-  glPopMatrix();
+  // Update world matrix(traslación por la izquierda, sin OpenGL para
+  // poder llamarse desde los hilos de CollisionAndResponseBatch)
+  GLfloat d[3] = { displacement.x, displacement.y, displacement.z };
+  unsigned int i, k;
+  for( i = 0; i < 3; i++ )
+    for( k = 0; k < 4; k++ )
+      volumes->matrix[i * 4 + k] += d[i] * volumes->matrix[12 + k];
+
+  // Update broad phase
+  MoveVolumes( volumes, displacement );
 }
 
 /*** Función: Detecta si un objeto está solapado dentro de una esfera ***/
@@ -402,59 +1408,588 @@ GLboolean CollisionDetectionTri( TRIANGLE eTri   , // Triangulo a verificar
 	}
     }
 
-  /* Decisión si se encontró colisión o no */
-  if( INTERVAL( time ) )
+  /* Decisión si se encontró colisión o no */
+  if( INTERVAL( time ) )
+    {
+      *outTime = time;
+      *outPos  = pos;
+      return GL_TRUE;
+    }
+  
+  /* No encontró una colisión */
+  return GL_FALSE;
+}
+
+/*** Función: Pone un triángulo en un carril del lote ***/
+void SetBatchTriangle( TRIBATCH* batch, GLuint lane,
+		       VECTOR p0, VECTOR p1, VECTOR p2 )
+{
+  batch->x0[lane] = p0.x; batch->y0[lane] = p0.y; batch->z0[lane] = p0.z;
+  batch->x1[lane] = p1.x; batch->y1[lane] = p1.y; batch->z1[lane] = p1.z;
+  batch->x2[lane] = p2.x; batch->y2[lane] = p2.y; batch->z2[lane] = p2.z;
+}
+
+#ifdef __SSE2__
+/* Operaciones auxiliares del kernel SIMD */
+#define SIMD_SELECT(m,a,b) _mm_or_ps( _mm_and_ps( m, a ), _mm_andnot_ps( m, b ) )
+#define SIMD_INTERVAL(x)   _mm_and_ps( _mm_cmpge_ps( x, _mm_setzero_ps() ), \
+				       _mm_cmple_ps( x, _mm_set1_ps( 1.0f ) ) )
+
+/*** Función: f + x*x evaluado en double(como "f + pow(x,2.0f)") ***/
+__m128 SimdAddSquare( __m128 f, __m128 x )
+{
+  __m128d fLo = _mm_cvtps_pd( f );
+  __m128d fHi = _mm_cvtps_pd( _mm_movehl_ps( f, f ) );
+  __m128d xLo = _mm_cvtps_pd( x );
+  __m128d xHi = _mm_cvtps_pd( _mm_movehl_ps( x, x ) );
+  __m128  lo  = _mm_cvtpd_ps( _mm_add_pd( fLo, _mm_mul_pd( xLo, xLo ) ) );
+  __m128  hi  = _mm_cvtpd_ps( _mm_add_pd( fHi, _mm_mul_pd( xHi, xHi ) ) );
+  return _mm_movelh_ps( lo, hi );
+}
+
+/*** Función: Raíces de 4 ecuaciones cuadráticas(como SolveQuadratic) ***/
+// Devuelve la máscara de carriles con solución real
+__m128 SimdSolveQuadratic( __m128 a, __m128 b, __m128 c,
+			   __m128* r1, __m128* r2 )
+{
+  __m128 det   = _mm_sub_ps( _mm_mul_ps( b, b ),
+			     _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 4.0f ), a ), c ) );
+  __m128 s     = _mm_sqrt_ps( det );
+  __m128 twoA  = _mm_mul_ps( _mm_set1_ps( 2.0f ), a );
+  __m128 sign  = _mm_set1_ps( -0.0f );
+  __m128 root1 = _mm_div_ps( _mm_xor_ps( _mm_sub_ps( b, s ), sign ), twoA );
+  __m128 root2 = _mm_div_ps( _mm_xor_ps( _mm_add_ps( b, s ), sign ), twoA );
+  *r1 = _mm_min_ps( root1, root2 );
+  *r2 = _mm_max_ps( root1, root2 );
+  return _mm_cmpnlt_ps( det, _mm_setzero_ps() );
+}
+#endif
+
+/*** Función: Colisión contra un lote de 4 triángulos(SIMD) ***/
+// Los triángulos del lote están en el mundo; ePos y eDisp en el espacio
+// de la elipse. Actualiza minTime/outPos(espacio de la elipse) si
+// encuentra una colisión más temprana, igual que CollisionDetectionTri.
+GLboolean CollisionDetectionTri4( TRIBATCH* batch  , // Triángulos(SoA)
+				  VECTOR    axes   , // Ejes de la elipse
+				  VECTOR    ePos   , // Posición del objeto
+				  VECTOR    eDisp  , // Desplazamiento
+				  GLfloat*  minTime, // Tiempo más temprano
+				  VECTOR*   outPos ) // Posición de colisión
+{
+  GLboolean found = GL_FALSE;
+  unsigned int i;
+#ifdef __SSE2__
+  GLfloat laneTime[4], laneX[4], laneY[4], laneZ[4];
+  __m128 inf  = _mm_set1_ps( INFINITY );
+  __m128 one  = _mm_set1_ps( 1.0f );
+  __m128 zero = _mm_setzero_ps();
+
+  /* Triángulos al espacio de la elipse */
+  __m128 ax  = _mm_set1_ps( axes.x );
+  __m128 ay  = _mm_set1_ps( axes.y );
+  __m128 az  = _mm_set1_ps( axes.z );
+  __m128 p0x = _mm_div_ps( _mm_loadu_ps( batch->x0 ), ax );
+  __m128 p0y = _mm_div_ps( _mm_loadu_ps( batch->y0 ), ay );
+  __m128 p0z = _mm_div_ps( _mm_loadu_ps( batch->z0 ), az );
+  __m128 p1x = _mm_div_ps( _mm_loadu_ps( batch->x1 ), ax );
+  __m128 p1y = _mm_div_ps( _mm_loadu_ps( batch->y1 ), ay );
+  __m128 p1z = _mm_div_ps( _mm_loadu_ps( batch->z1 ), az );
+  __m128 p2x = _mm_div_ps( _mm_loadu_ps( batch->x2 ), ax );
+  __m128 p2y = _mm_div_ps( _mm_loadu_ps( batch->y2 ), ay );
+  __m128 p2z = _mm_div_ps( _mm_loadu_ps( batch->z2 ), az );
+  __m128 ex  = _mm_set1_ps( ePos.x );
+  __m128 ey  = _mm_set1_ps( ePos.y );
+  __m128 ez  = _mm_set1_ps( ePos.z );
+  __m128 dx  = _mm_set1_ps( eDisp.x );
+  __m128 dy  = _mm_set1_ps( eDisp.y );
+  __m128 dz  = _mm_set1_ps( eDisp.z );
+
+  /* Plano del triángulo */
+  __m128 e1x = _mm_sub_ps( p2x, p0x ), e1y = _mm_sub_ps( p2y, p0y ), e1z = _mm_sub_ps( p2z, p0z );
+  __m128 e2x = _mm_sub_ps( p1x, p0x ), e2y = _mm_sub_ps( p1y, p0y ), e2z = _mm_sub_ps( p1z, p0z );
+  __m128 nx  = _mm_sub_ps( _mm_mul_ps( e1y, e2z ), _mm_mul_ps( e1z, e2y ) );
+  __m128 ny  = _mm_sub_ps( _mm_mul_ps( e1z, e2x ), _mm_mul_ps( e1x, e2z ) );
+  __m128 nz  = _mm_sub_ps( _mm_mul_ps( e1x, e2y ), _mm_mul_ps( e1y, e2x ) );
+  __m128 len = _mm_sqrt_ps( SIMD_DOT( nx, ny, nz, nx, ny, nz ) );
+  nx = _mm_div_ps( nx, len );
+  ny = _mm_div_ps( ny, len );
+  nz = _mm_div_ps( nz, len );
+  __m128 d   = _mm_xor_ps( SIMD_DOT( nx, ny, nz, p0x, p0y, p0z ), _mm_set1_ps( -0.0f ) );
+
+  __m128 pDistance    = _mm_add_ps( SIMD_DOT( nx, ny, nz, ex, ey, ez ), d );
+  __m128 dotNormalVel = SIMD_DOT( nx, ny, nz, dx, dy, dz );
+
+  /* Tiempos de colisión con el plano */
+  __m128 moving = _mm_cmpneq_ps( dotNormalVel, zero );
+  __m128 ti     = _mm_div_ps( _mm_sub_ps( one, pDistance ), dotNormalVel );
+  __m128 tf     = _mm_div_ps( _mm_sub_ps( _mm_xor_ps( one, _mm_set1_ps( -0.0f ) ), pDistance ),
+			      dotNormalVel );
+  __m128 t0     = _mm_min_ps( ti, tf );
+  __m128 t1     = _mm_max_ps( ti, tf );
+  __m128 reject = _mm_and_ps( moving, _mm_or_ps( _mm_cmpgt_ps( t0, one ),
+						 _mm_cmplt_ps( t1, zero ) ) );
+  t0 = SIMD_SELECT( SIMD_INTERVAL( t0 ), t0, inf );
+  t1 = SIMD_SELECT( SIMD_INTERVAL( t1 ), t1, inf );
+  // Recorrido paralelo al plano
+  __m128 absDist  = _mm_andnot_ps( _mm_set1_ps( -0.0f ), pDistance );
+  __m128 far      = _mm_andnot_ps( moving, _mm_cmpge_ps( absDist, one ) );
+  __m128 embedded = _mm_andnot_ps( moving, _mm_cmplt_ps( absDist, one ) );
+  reject = _mm_or_ps( reject, far );
+  t0     = SIMD_SELECT( embedded, zero, t0 );
+  t1     = SIMD_SELECT( embedded, one , t1 );
+
+  /* Colisión dentro del triángulo */
+  __m128 time = _mm_min_ps( t0, t1 );
+  __m128 cx   = _mm_sub_ps( _mm_add_ps( ex, _mm_mul_ps( dx, time ) ), nx );
+  __m128 cy   = _mm_sub_ps( _mm_add_ps( ey, _mm_mul_ps( dy, time ) ), ny );
+  __m128 cz   = _mm_sub_ps( _mm_add_ps( ez, _mm_mul_ps( dz, time ) ), nz );
+  __m128 v2x  = _mm_sub_ps( cx, p0x ), v2y = _mm_sub_ps( cy, p0y ), v2z = _mm_sub_ps( cz, p0z );
+  __m128 v0v0 = SIMD_DOT( e2x, e2y, e2z, e2x, e2y, e2z );
+  __m128 v1v1 = SIMD_DOT( e1x, e1y, e1z, e1x, e1y, e1z );
+  __m128 v0v1 = SIMD_DOT( e2x, e2y, e2z, e1x, e1y, e1z );
+  __m128 v0v2 = SIMD_DOT( e2x, e2y, e2z, v2x, v2y, v2z );
+  __m128 v1v2 = SIMD_DOT( e1x, e1y, e1z, v2x, v2y, v2z );
+  __m128 den  = _mm_sub_ps( _mm_mul_ps( v0v0, v1v1 ), _mm_mul_ps( v0v1, v0v1 ) );
+  __m128 u    = _mm_div_ps( _mm_sub_ps( _mm_mul_ps( v1v1, v0v2 ), _mm_mul_ps( v0v1, v1v2 ) ), den );
+  __m128 v    = _mm_div_ps( _mm_sub_ps( _mm_mul_ps( v0v0, v1v2 ), _mm_mul_ps( v0v1, v0v2 ) ), den );
+  __m128 inside = _mm_and_ps( _mm_and_ps( SIMD_INTERVAL( u ), SIMD_INTERVAL( v ) ),
+			      SIMD_INTERVAL( _mm_add_ps( u, v ) ) );
+  __m128 planeHit = _mm_andnot_ps( _mm_or_ps( reject, embedded ), inside );
+  __m128 planeTime = t0;
+
+  /* Colisión con vértices */
+  __m128 nan  = _mm_set1_ps( NAN );
+  __m128 px   = nan, py = nan, pz = nan;
+  __m128 a    = SIMD_DOT( dx, dy, dz, dx, dy, dz );
+  __m128 vx[3] = { p0x, p1x, p2x };
+  __m128 vy[3] = { p0y, p1y, p2y };
+  __m128 vz[3] = { p0z, p1z, p2z };
+  __m128 r1, r2, ok, m, update;
+  time = inf;
+  for( i = 0; i < 3; i++ )
+    {
+      __m128 b  = _mm_mul_ps( _mm_set1_ps( 2.0f ),
+			      SIMD_DOT( dx, dy, dz,
+					_mm_sub_ps( ex, vx[i] ),
+					_mm_sub_ps( ey, vy[i] ),
+					_mm_sub_ps( ez, vz[i] ) ) );
+      __m128 wx = _mm_sub_ps( vx[i], ex ), wy = _mm_sub_ps( vy[i], ey ), wz = _mm_sub_ps( vz[i], ez );
+      __m128 c  = _mm_sub_ps( SIMD_DOT( wx, wy, wz, wx, wy, wz ), one );
+      ok     = SimdSolveQuadratic( a, b, c, &r1, &r2 );
+      r1     = SIMD_SELECT( SIMD_INTERVAL( r1 ), r1, inf );
+      r2     = SIMD_SELECT( SIMD_INTERVAL( r2 ), r2, inf );
+      m      = _mm_min_ps( r1, r2 );
+      update = _mm_and_ps( ok, _mm_cmpgt_ps( time, m ) );
+      time   = SIMD_SELECT( update, m, time );
+      px     = SIMD_SELECT( update, vx[i], px );
+      py     = SIMD_SELECT( update, vy[i], py );
+      pz     = SIMD_SELECT( update, vz[i], pz );
+    }
+
+  /* Colisión con extremos(p0-p1, p1-p2, p2-p0) */
+  __m128 disp2 = SIMD_DOT( dx, dy, dz, dx, dy, dz );
+  for( i = 0; i < 3; i++ )
+    {
+      GLuint j = ( i + 1 ) % 3;
+      __m128 edx   = _mm_sub_ps( vx[j], vx[i] ), edy = _mm_sub_ps( vy[j], vy[i] ), edz = _mm_sub_ps( vz[j], vz[i] );
+      __m128 dsx   = _mm_sub_ps( vx[i], ex ), dsy = _mm_sub_ps( vy[i], ey ), dsz = _mm_sub_ps( vz[i], ez );
+      __m128 edge2 = SIMD_DOT( edx, edy, edz, edx, edy, edz );
+      __m128 eDotD = SIMD_DOT( edx, edy, edz, dx, dy, dz );
+      __m128 eDotS = SIMD_DOT( edx, edy, edz, dsx, dsy, dsz );
+      __m128 ea    = SimdAddSquare( _mm_mul_ps( _mm_mul_ps( edge2, _mm_set1_ps( -1.0f ) ), disp2 ),
+				    eDotD );
+      __m128 eb    = _mm_sub_ps( _mm_mul_ps( _mm_mul_ps( edge2, _mm_set1_ps( 2.0f ) ),
+					     SIMD_DOT( dx, dy, dz, dsx, dsy, dsz ) ),
+				 _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( 2.0f ), eDotD ), eDotS ) );
+      __m128 ec    = SimdAddSquare( _mm_mul_ps( edge2,
+						_mm_sub_ps( one, SIMD_DOT( dsx, dsy, dsz,
+									   dsx, dsy, dsz ) ) ),
+				    eDotS );
+      ok = SimdSolveQuadratic( ea, eb, ec, &r1, &r2 );
+      r1 = SIMD_SELECT( SIMD_INTERVAL( r1 ), r1, inf );
+      r2 = SIMD_SELECT( SIMD_INTERVAL( r2 ), r2, inf );
+      m  = _mm_min_ps( r1, r2 );
+      __m128 frac = _mm_div_ps( _mm_sub_ps( _mm_mul_ps( m, eDotD ), eDotS ), edge2 );
+      update = _mm_and_ps( _mm_and_ps( ok, _mm_cmpgt_ps( time, m ) ),
+			   SIMD_INTERVAL( frac ) );
+      time   = SIMD_SELECT( update, m, time );
+      px     = SIMD_SELECT( update, _mm_add_ps( vx[i], _mm_mul_ps( edx, frac ) ), px );
+      py     = SIMD_SELECT( update, _mm_add_ps( vy[i], _mm_mul_ps( edy, frac ) ), py );
+      pz     = SIMD_SELECT( update, _mm_add_ps( vz[i], _mm_mul_ps( edz, frac ) ), pz );
+    }
+
+  /* Resultado por carril */
+  time = SIMD_SELECT( SIMD_INTERVAL( time ), time, inf );
+  time = SIMD_SELECT( planeHit, planeTime, time );
+  time = SIMD_SELECT( reject, inf, time );
+  px   = SIMD_SELECT( planeHit, cx, px );
+  py   = SIMD_SELECT( planeHit, cy, py );
+  pz   = SIMD_SELECT( planeHit, cz, pz );
+  _mm_storeu_ps( laneTime, time );
+  _mm_storeu_ps( laneX, px );
+  _mm_storeu_ps( laneY, py );
+  _mm_storeu_ps( laneZ, pz );
+
+  /* El más temprano(en orden de carril) */
+  for( i = 0; i < batch->count; i++ )
+    if( *minTime > laneTime[i] )
+      {
+	*minTime  = laneTime[i];
+	outPos->x = laneX[i];
+	outPos->y = laneY[i];
+	outPos->z = laneZ[i];
+	found     = GL_TRUE;
+      }
+#else
+  /* Sin SIMD: versión escalar */
+  for( i = 0; i < batch->count; i++ )
+    {
+      GLfloat  time = INFINITY;
+      VECTOR   pos  = { NAN, NAN, NAN };
+      VECTOR   p0   = { batch->x0[i], batch->y0[i], batch->z0[i] };
+      VECTOR   p1   = { batch->x1[i], batch->y1[i], batch->z1[i] };
+      VECTOR   p2   = { batch->x2[i], batch->y2[i], batch->z2[i] };
+      TRIANGLE eTri = { DivVector( p0, axes ),
+			DivVector( p1, axes ),
+			DivVector( p2, axes ) };
+      if( CollisionDetectionTri( eTri, ePos, eDisp, &time, &pos ) )
+	if( *minTime > time )
+	  {
+	    *minTime = time;
+	    *outPos  = pos;
+	    found    = GL_TRUE;
+	  }
+    }
+#endif
+  return found;
+}
+
+/*** Función: Caja que envuelve el recorrido de la elipse de un objeto ***/
+BOX SweptBox( VOLUMES* volumes, VECTOR displacement )
+{
+  VECTOR start = volumes->ellipsoid.center;
+  VECTOR end   = SumVector( start, displacement );
+  VECTOR axes  = volumes->ellipsoid.axes;
+  BOX    box;
+
+  box.min.x = MINVALUE( start.x, end.x ) - axes.x;
+  box.min.y = MINVALUE( start.y, end.y ) - axes.y;
+  box.min.z = MINVALUE( start.z, end.z ) - axes.z;
+  box.max.x = MAXVALUE( start.x, end.x ) + axes.x;
+  box.max.y = MAXVALUE( start.y, end.y ) + axes.y;
+  box.max.z = MAXVALUE( start.z, end.z ) + axes.z;
+
+  return box;
+}
+
+/*** Función: Calcula y detecta la colisión de un objeto con otro ***/
+GLboolean CollisionDetectionTerr( TERRAIN* terrain , // Terreno a verificar
+				  VOLUMES* cObj    , // Geometría a colisionar
+				  VECTOR   disp    , // Desplazamiento del objeto
+				  GLfloat* outTime , // Tiempo de colisión
+				  VECTOR*  outPos  ) // Posición de colisión
+{
+  GLfloat minTime = INFINITY;
+  GLuint  minRow, maxRow, minCol, maxCol;
+  unsigned int i, j, k;
+
+  BOX      box   = SweptBox( cObj, disp );
+  VECTOR   ePos  = DivVector( cObj->ellipsoid.center, cObj->ellipsoid.axes );
+  VECTOR   eDisp = DivVector( disp, cObj->ellipsoid.axes );
+  TRIBATCH batch = { .count = 0 };
+
+  /* Sólo las celdas bajo el recorrido de la elipse, en cada mosaico */
+  for( ; terrain != NULL; terrain = terrain->next )
+    {
+      if( !TerrainCellRange( terrain, box, &minRow, &maxRow, &minCol, &maxCol ) )
+	continue;
+      for( i = minRow; i <= maxRow; i++ )
+	for( j = minCol; j <= maxCol; j++ )
+	  {
+	    unsigned int base = (i * (terrain->vertsPerRow - 1) + j) * 2 * 3;
+	    GLuint* index = &terrain->indexBuffer[base];
+
+	    /* Descarto la celda si su altura no cruza la caja */
+	    GLfloat hMin = INFINITY, hMax = -INFINITY;
+	    for( k = 0; k < 6; k++ )
+	      {
+		hMin = MINVALUE( hMin, terrain->vertexBuffer[index[k]].p.y );
+		hMax = MAXVALUE( hMax, terrain->vertexBuffer[index[k]].p.y );
+	      }
+	    if( hMax < box.min.y || hMin > box.max.y )
+	      continue;
+
+	    /* Los 2 triángulos de la celda al lote */
+	    for( k = 0; k < 6; k += 3 )
+	      {
+		POINT  p0 = terrain->vertexBuffer[index[k+0]].p;
+		POINT  p1 = terrain->vertexBuffer[index[k+1]].p;
+		POINT  p2 = terrain->vertexBuffer[index[k+2]].p;
+		VECTOR v0 = { p0.x, p0.y, p0.z };
+		VECTOR v1 = { p1.x, p1.y, p1.z };
+		VECTOR v2 = { p2.x, p2.y, p2.z };
+		SetBatchTriangle( &batch, batch.count++, v0, v1, v2 );
+
+		/* Detecto la colisión con el lote lleno */
+		if( batch.count == 4 )
+		  {
+		    CollisionDetectionTri4( &batch, cObj->ellipsoid.axes,
+					    ePos, eDisp, &minTime, outPos );
+		    batch.count = 0;
+		  }
+	      }
+	  }
+    }
+  if( batch.count > 0 )
+    CollisionDetectionTri4( &batch, cObj->ellipsoid.axes,
+			    ePos, eDisp, &minTime, outPos );
+  if( INTERVAL( minTime ) )
+    {
+      *outTime   = minTime;
+      outPos->x *= cObj->ellipsoid.axes.x;
+      outPos->y *= cObj->ellipsoid.axes.y;
+      outPos->z *= cObj->ellipsoid.axes.z;
+      return GL_TRUE;
+    }
+  return GL_FALSE;
+}
+
+/*** Función: Tramo de una esfera en movimiento sobre un bloque del terreno ***/
+// Caja XZ del bloque agrandada por el radio; GL_FALSE si no la toca
+GLboolean TerrainSphereSpan( TERRAIN* terrain, GLuint level,
+			     GLuint   row    , GLuint col  ,
+			     SPHERE   sphere , VECTOR disp ,
+			     GLfloat* t0     , GLfloat* t1 ) // Tramo(entrada)
+{
+  GLfloat size = terrain->cellSpacing * (1 << level);
+  GLfloat r    = sphere.radius;
+  GLfloat x    = terrain->originX + col * size;
+  GLfloat z    = terrain->originZ + row * size;
+  if( !ClipInterval( sphere.center.x, disp.x, x - r, x + size + r, t0, t1 ) ||
+      !ClipInterval( sphere.center.z, disp.z, z - r, z + size + r, t0, t1 ) )
+    return GL_FALSE;
+
+  /* La altura de la esfera en el tramo debe cruzar la del bloque */
+  HEIGHTRANGE* range = TerrainBlock( terrain, level, row, col );
+  GLfloat y0 = sphere.center.y + disp.y * *t0;
+  GLfloat y1 = sphere.center.y + disp.y * *t1;
+  return MINVALUE( y0, y1 ) - r <= range->max &&
+    MAXVALUE( y0, y1 ) + r >= range->min;
+}
+
+/*** Función: Colisión recursiva de una esfera con un bloque del terreno ***/
+// Visita los hijos en el orden en que la esfera los alcanza
+void TerrainSphereBlock( TERRAIN* terrain, GLuint level,
+			 GLuint   row    , GLuint col    ,
+			 SPHERE   sphere , VECTOR disp   ,
+			 GLfloat* minTime, VECTOR* outPos )
+{
+  unsigned int i, j;
+
+  /* Celda: los 2 triángulos en el espacio de la esfera unitaria */
+  if( level == 0 )
+    {
+      TRIANGLE triangles[2];
+      VECTOR   axes  = { sphere.radius, sphere.radius, sphere.radius };
+      VECTOR   ePos  = DivVector( sphere.center, axes );
+      VECTOR   eDisp = DivVector( disp, axes );
+      TerrainCellTriangles( terrain, row, col, triangles );
+      for( i = 0; i < 2; i++ )
+	{
+	  GLfloat  time;
+	  VECTOR   pos;
+	  TRIANGLE eTri = { DivVector( triangles[i].p0, axes ),
+			    DivVector( triangles[i].p1, axes ),
+			    DivVector( triangles[i].p2, axes ) };
+	  if( CollisionDetectionTri( eTri, ePos, eDisp, &time, &pos ) &&
+	      time < *minTime )
+	    {
+	      *minTime = time;
+	      *outPos  = MulVector( pos, sphere.radius );
+	    }
+	}
+      return;
+    }
+
+  /* Hijos que toca la esfera, ordenados por tiempo de entrada */
+  GLuint  rows, cols, count = 0;
+  GLuint  children[4][2];
+  GLfloat entries[4];
+  TerrainLevelSize( terrain, level - 1, &rows, &cols );
+  for( i = 2 * row; i <= 2 * row + 1 && i < rows; i++ )
+    for( j = 2 * col; j <= 2 * col + 1 && j < cols; j++ )
+      {
+	GLfloat t0 = 0.0f, t1 = MINVALUE( *minTime, 1.0f );
+	if( !TerrainSphereSpan( terrain, level - 1, i, j, sphere, disp, &t0, &t1 ) )
+	  continue;
+	// Inserción ordenada
+	GLuint k = count++;
+	for( ; k > 0 && entries[k - 1] > t0; k-- )
+	  {
+	    entries[k]     = entries[k - 1];
+	    children[k][0] = children[k - 1][0];
+	    children[k][1] = children[k - 1][1];
+	  }
+	entries[k]     = t0;
+	children[k][0] = i;
+	children[k][1] = j;
+      }
+  for( i = 0; i < count && entries[i] <= *minTime; i++ )
+    TerrainSphereBlock( terrain, level - 1, children[i][0], children[i][1],
+			sphere, disp, minTime, outPos );
+}
+
+/*** Función: Colisión de una esfera que se desplaza "disp" con el terreno ***/
+// Recorre la pirámide de alturas de cada mosaico. "outTime" en [0, 1].
+GLboolean TerrainSweptSphere( TERRAIN* terrain,
+			      SPHERE   sphere , // Esfera al inicio
+			      VECTOR   disp   , // Desplazamiento de la esfera
+			      GLfloat* outTime, // Tiempo de colisión
+			      VECTOR*  outPos ) // Punto de contacto
+{
+  GLfloat minTime = INFINITY;
+  for( ; terrain != NULL; terrain = terrain->next )
+    {
+      GLuint  top = terrain->pyramidLevels - 1;
+      GLfloat t0 = 0.0f, t1 = MINVALUE( minTime, 1.0f );
+      if( TerrainSphereSpan( terrain, top, 0, 0, sphere, disp, &t0, &t1 ) )
+	TerrainSphereBlock( terrain, top, 0, 0, sphere, disp, &minTime, outPos );
+    }
+  if( INTERVAL( minTime ) )
+    {
+      *outTime = minTime;
+      return GL_TRUE;
+    }
+  return GL_FALSE;
+}
+
+/*** Función: Actualiza los triángulos de un modelo en el espacio del mundo ***/
+// Sólo se recalculan si la matriz de los volúmenes cambió
+void UpdateTriangleCache( MODEL* model, VOLUMES* volumes )
+{
+  GLuint nTriangles = model->indexCount / 3;
+  unsigned int i, k;
+
+  if( volumes->triangles != NULL &&
+      memcmp( volumes->cacheMatrix, volumes->matrix,
+	      sizeof(GLfloat) * 16 ) == 0 )
+    return;
+
+  if( volumes->triangles == NULL )
+    {
+      volumes->triangles = malloc( sizeof(VECTOR) * nTriangles * 3 );
+      volumes->nodes     = malloc( sizeof(BOX) * model->bvhCount );
+    }
+  memcpy( volumes->cacheMatrix, volumes->matrix, sizeof(GLfloat) * 16 );
+
+  /* Triángulos en el orden de las hojas */
+  for( i = 0; i < nTriangles; i++ )
+    for( k = 0; k < 3; k++ )
+      volumes->triangles[i * 3 + k] =
+	TransformCoordFromMatrix( model->vertexBuffer[model->indexBuffer[model->bvhTriangles[i] * 3 + k]],
+				  volumes->matrix );
+
+  /* Cajas de los nodos(los hijos siempre van después del padre) */
+  for( i = model->bvhCount; i-- > 0; )
+    {
+      BVHNODE* node = &model->bvh[i];
+      BOX*     box  = &volumes->nodes[i];
+      if( node->count > 0 )
+	{
+	  VECTOR min = {  INFINITY,  INFINITY,  INFINITY };
+	  VECTOR max = { -INFINITY, -INFINITY, -INFINITY };
+	  for( k = node->first * 3; k < (node->first + node->count) * 3; k++ )
+	    {
+	      VECTOR v = volumes->triangles[k];
+	      min.x = MINVALUE( min.x, v.x ); max.x = MAXVALUE( max.x, v.x );
+	      min.y = MINVALUE( min.y, v.y ); max.y = MAXVALUE( max.y, v.y );
+	      min.z = MINVALUE( min.z, v.z ); max.z = MAXVALUE( max.z, v.z );
+	    }
+	  box->min = min;
+	  box->max = max;
+	}
+      else
+	*box = MergeBox( volumes->nodes[i + 1], volumes->nodes[node->right] );
+    }
+}
+
+/*** Función: Libera las cachés de triángulos y envolventes ***/
+void FreeVolumes( VOLUMES* volumes )
+{
+  free( volumes->triangles );
+  free( volumes->nodes );
+  free( volumes->hullPoints );
+  free( volumes->hullBoxes );
+  volumes->triangles  = NULL;
+  volumes->nodes      = NULL;
+  volumes->hullPoints = NULL;
+  volumes->hullBoxes  = NULL;
+}
+
+/*** Función: Recorre la BVH y prueba los triángulos que toca la caja ***/
+void CollisionDetectionBVH( MODEL*   model  , // Modelo a verificar
+			    VOLUMES* mObj   , // Geometría a verificar(caché)
+			    GLuint   node   , // Nodo actual
+			    BOX*     box    , // Caja del recorrido
+			    VECTOR   ePos   , // Posición(espacio elipse)
+			    VECTOR   eDisp  , // Desplazamiento(espacio elipse)
+			    VECTOR   axes   , // Ejes de la elipse
+			    GLfloat* minTime, // Tiempo más temprano
+			    VECTOR*  outPos ) // Posición de colisión
+{
+  if( !BoxOverlap( mObj->nodes[node], *box ) )
+    return;
+
+  BVHNODE* n = &model->bvh[node];
+  if( n->count == 0 )
+    {
+      CollisionDetectionBVH( model, mObj, node + 1, box,
+			     ePos, eDisp, axes, minTime, outPos );
+      CollisionDetectionBVH( model, mObj, n->right, box,
+			     ePos, eDisp, axes, minTime, outPos );
+      return;
+    }
+
+  /* Triángulos de la hoja(a lo más 4: un lote) */
+  TRIBATCH batch = { .count = 0 };
+  unsigned int i;
+  for( i = n->first; i < n->first + n->count; i++ )
     {
-      *outTime = time;
-      *outPos  = pos;
-      return GL_TRUE;
+      VECTOR* tri = &mObj->triangles[i * 3];
+      SetBatchTriangle( &batch, batch.count++, tri[0], tri[1], tri[2] );
     }
-  
-  /* No encontró una colisión */
-  return GL_FALSE;
+  CollisionDetectionTri4( &batch, axes, ePos, eDisp, minTime, outPos );
 }
 
 /*** Función: Calcula y detecta la colisión de un objeto con otro ***/
-GLboolean CollisionDetectionTerr( TERRAIN* terrain , // Terreno a verificar
-				  VOLUMES* cObj    , // Geometría a colisionar
-				  VECTOR   disp    , // Desplazamiento del objeto
-				  GLfloat* outTime , // Tiempo de colisión
-				  VECTOR*  outPos  ) // Posición de colisión
+GLboolean CollisionDetectionObj( MODEL*   model  , // Modelo a verificar 
+				 VOLUMES* mObj   , // Geometría a verificar
+				 VOLUMES* cObj   , // Geometría a colisionar
+				 VECTOR   disp   , // Desplazamiento del objeto
+				 GLfloat* outTime, // Tiempo de colisión
+				 VECTOR*  outPos ) // Posición de colisión
 {
   GLfloat minTime = INFINITY;
-  unsigned int i;
-  unsigned int nIndices = (terrain->vertsPerRow - 1) * 
-    (terrain->vertsPerCol - 1) * 2 * 3;
-  /* Todos los triángulos del terreno */
-  for( i = 0; i < nIndices; i += 3 )
-    {
-      GLfloat time  = INFINITY;
-      VECTOR  pos   = { NAN, NAN, NAN };
-      VECTOR  ePos  = DivVector( cObj->ellipsoid.center, cObj->ellipsoid.axes );
-      VECTOR  eDisp = DivVector( disp, cObj->ellipsoid.axes );
-      VECTOR p0 = { terrain->vertexBuffer[terrain->indexBuffer[i+0]].p.x,
-		    terrain->vertexBuffer[terrain->indexBuffer[i+0]].p.y, 
-		    terrain->vertexBuffer[terrain->indexBuffer[i+0]].p.z };
-      VECTOR p1 = { terrain->vertexBuffer[terrain->indexBuffer[i+1]].p.x, 
-		    terrain->vertexBuffer[terrain->indexBuffer[i+1]].p.y, 
-		    terrain->vertexBuffer[terrain->indexBuffer[i+1]].p.z };
-      VECTOR p2 = { terrain->vertexBuffer[terrain->indexBuffer[i+2]].p.x, 
-		    terrain->vertexBuffer[terrain->indexBuffer[i+2]].p.y, 
-		    terrain->vertexBuffer[terrain->indexBuffer[i+2]].p.z };
-      TRIANGLE eTri  = 
-	{ DivVector( p0, cObj->ellipsoid.axes ),
-	  DivVector( p1, cObj->ellipsoid.axes ),
-	  DivVector( p2, cObj->ellipsoid.axes ) };
-		       
-      /* Detecto la colisión con un triángulo */
-      if( CollisionDetectionTri( eTri, ePos, eDisp, &time, &pos ) )
-	if( minTime > time )
-	  {
-	    /* Actualizo los datos en caso de colisión más temprana */
-	    minTime = time;
-	    *outPos = pos;
-	  }
+  BOX     box     = SweptBox( cObj, disp );
+  VECTOR  ePos    = DivVector( cObj->ellipsoid.center, cObj->ellipsoid.axes );
+  VECTOR  eDisp   = DivVector( disp, cObj->ellipsoid.axes );
+
+  if( HullCollision( model ) )
+    {
+      /* Envolventes convexas */
+      CollisionDetectionHulls( model, mObj, cObj, &box, ePos, eDisp,
+			       &minTime, outPos );
+    }
+  else
+    {
+      /* Triángulos en el mundo y recorrido de la jerarquía */
+      if( model->bvhCount == 0 )
+	return GL_FALSE;
+      UpdateTriangleCache( model, mObj );
+      CollisionDetectionBVH( model, mObj, 0, &box, ePos, eDisp,
+			     cObj->ellipsoid.axes, &minTime, outPos );
     }
+
   if( INTERVAL( minTime ) )
     {
       *outTime   = minTime;
@@ -466,37 +2001,359 @@ GLboolean CollisionDetectionTerr( TERRAIN* terrain , // Terreno a verificar
   return GL_FALSE;
 }
 
-/*** Función: Calcula y detecta la colisión de un objeto con otro ***/
-GLboolean CollisionDetectionObj( MODEL*   model  , // Modelo a verificar 
-				 VOLUMES* mObj   , // Geometría a verificar
-				 VOLUMES* cObj   , // Geometría a colisionar
-				 VECTOR   disp   , // Desplazamiento del objeto
-				 GLfloat* outTime, // Tiempo de colisión
-				 VECTOR*  outPos ) // Posición de colisión
+/*** Función: Inicia una caché de candidatos vacía ***/
+void InitContactCache( CONTACTCACHE* cache, GLfloat padding )
 {
-  GLfloat minTime = INFINITY;
+  memset( cache, 0, sizeof(CONTACTCACHE) );
+  cache->padding = padding;
+}
+
+/*** Función: Libera una caché de candidatos ***/
+void FreeContactCache( CONTACTCACHE* cache )
+{
+  free( cache->batches );
+  free( cache->boxes );
+  free( cache->groups );
+  free( cache->owners );
+  free( cache->objects );
+  free( cache->matrices );
+  InitContactCache( cache, cache->padding );
+}
+
+/*** Función: Agrega un triángulo a la caché(en el lote de su objeto) ***/
+void AddContactTriangle( CONTACTCACHE* cache, GLuint owner,
+			 VECTOR p0, VECTOR p1, VECTOR p2 )
+{
+  GLuint last = cache->nBatches - 1;
+  if( cache->nBatches == 0 || cache->owners[last] != owner ||
+      cache->batches[last].count == 4 )
+    {
+      if( cache->nBatches == cache->batchCapacity )
+	{
+	  cache->batchCapacity = MAXVALUE( 16, cache->batchCapacity * 2 );
+	  cache->batches = realloc( cache->batches,
+				    sizeof(TRIBATCH) * cache->batchCapacity );
+	  cache->boxes   = realloc( cache->boxes,
+				    sizeof(BOX) * cache->batchCapacity );
+	  cache->owners  = realloc( cache->owners,
+				    sizeof(GLuint) * cache->batchCapacity );
+	}
+      last = cache->nBatches++;
+      cache->batches[last].count = 0;
+      cache->boxes[last].min     = p0;
+      cache->boxes[last].max     = p0;
+      cache->owners[last]        = owner;
+    }
+  TRIBATCH* batch = &cache->batches[last];
+  BOX*      box   = &cache->boxes[last];
+  SetBatchTriangle( batch, batch->count++, p0, p1, p2 );
+  box->min.x = MINVALUE( box->min.x, MINVALUE( p0.x, MINVALUE( p1.x, p2.x ) ) );
+  box->min.y = MINVALUE( box->min.y, MINVALUE( p0.y, MINVALUE( p1.y, p2.y ) ) );
+  box->min.z = MINVALUE( box->min.z, MINVALUE( p0.z, MINVALUE( p1.z, p2.z ) ) );
+  box->max.x = MAXVALUE( box->max.x, MAXVALUE( p0.x, MAXVALUE( p1.x, p2.x ) ) );
+  box->max.y = MAXVALUE( box->max.y, MAXVALUE( p0.y, MAXVALUE( p1.y, p2.y ) ) );
+  box->max.z = MAXVALUE( box->max.z, MAXVALUE( p0.z, MAXVALUE( p1.z, p2.z ) ) );
+}
+
+/*** Función: Caja del nodo "k" del árbol de lotes de la caché ***/
+// El nodo k tiene hijos 2k y 2k + 1; las hojas nLeaves + i son los lotes
+// (vacías después del último lote).
+BOX ContactGroupBox( CONTACTCACHE* cache, GLuint k )
+{
+  BOX empty = { {  INFINITY,  INFINITY,  INFINITY },
+		{ -INFINITY, -INFINITY, -INFINITY } };
+  if( k < cache->nLeaves )
+    return cache->groups[k];
+  if( k - cache->nLeaves < cache->nBatches )
+    return cache->boxes[k - cache->nLeaves];
+  return empty;
+}
+
+/*** Función: Arma el árbol de cajas sobre los lotes de la caché ***/
+// Los lotes quedan en el orden en que se agregaron(celdas vecinas del
+// terreno y hojas de la BVH en profundidad), así que los grupos son
+// compactos y la consulta descarta la mayoría sin verlos.
+void BuildContactGroups( CONTACTCACHE* cache )
+{
+  GLuint k;
+  for( cache->nLeaves = 1; cache->nLeaves < cache->nBatches; cache->nLeaves *= 2 )
+    ;
+  if( cache->nLeaves > cache->groupCapacity )
+    {
+      cache->groupCapacity = cache->nLeaves;
+      cache->groups = realloc( cache->groups, sizeof(BOX) * cache->groupCapacity );
+    }
+  for( k = cache->nLeaves - 1; k > 0; k-- )
+    cache->groups[k] = MergeBox( ContactGroupBox( cache, 2 * k ),
+				 ContactGroupBox( cache, 2 * k + 1 ) );
+}
+
+/*** Función: Agrega a la caché las hojas de la BVH que tocan la caja ***/
+void GatherContactsBVH( CONTACTCACHE* cache, MODEL* model, VOLUMES* mObj,
+			GLuint owner, GLuint node )
+{
+  if( !BoxOverlap( mObj->nodes[node], cache->bound ) )
+    return;
+
+  BVHNODE* n = &model->bvh[node];
+  if( n->count == 0 )
+    {
+      GatherContactsBVH( cache, model, mObj, owner, node + 1 );
+      GatherContactsBVH( cache, model, mObj, owner, n->right );
+      return;
+    }
+
   unsigned int i;
-  /* Todos los triángulos de un objeto */
-  for( i = 0; i < model->indexCount; i += 3 )
-    {
-      GLfloat  time  = INFINITY;
-      VECTOR   pos   = { NAN, NAN, NAN };
-      VECTOR   ePos  = DivVector( cObj->ellipsoid.center, cObj->ellipsoid.axes );
-      VECTOR   eDisp = DivVector( disp, cObj->ellipsoid.axes );
-      TRIANGLE eTri  = 
-	{ DivVector( TransformCoordFromMatrix( model->vertexBuffer[model->indexBuffer[i+0]], mObj->matrix ), cObj->ellipsoid.axes ),
-	  DivVector( TransformCoordFromMatrix( model->vertexBuffer[model->indexBuffer[i+1]], mObj->matrix ), cObj->ellipsoid.axes ),
-	  DivVector( TransformCoordFromMatrix( model->vertexBuffer[model->indexBuffer[i+2]], mObj->matrix ), cObj->ellipsoid.axes ) };
-		       
-      /* Detecto la colisión con un triángulo */
-      if( CollisionDetectionTri( eTri, ePos, eDisp, &time, &pos ) )
-	if( minTime > time )
+  for( i = n->first; i < n->first + n->count; i++ )
+    {
+      VECTOR* tri = &mObj->triangles[i * 3];
+      AddContactTriangle( cache, owner, tri[0], tri[1], tri[2] );
+    }
+}
+
+/*** Función: Indica si la geometría de colisión de un objeto toca una caja ***/
+// Usa las envolventes o la raíz de la BVH según cómo colisiona el modelo
+GLboolean ContactOverlap( MODEL* model, VOLUMES* mObj, BOX box )
+{
+  unsigned int i;
+
+  if( HullCollision( model ) )
+    {
+      UpdateHullCache( model, mObj );
+      for( i = 0; i < model->hullCount; i++ )
+	if( BoxOverlap( mObj->hullBoxes[i], box ) )
+	  return GL_TRUE;
+      return GL_FALSE;
+    }
+  if( model->bvhCount == 0 )
+    return GL_FALSE;
+  UpdateTriangleCache( model, mObj );
+  return BoxOverlap( mObj->nodes[0], box );
+}
+
+/*** Función: Objetos con triángulos dentro de una caja(en orden) ***/
+// "out" debe tener espacio para nObjects índices
+GLuint ContactObjects( MODEL*    models[] , // Modelos del mundo
+		       VOLUMES*  volumes[], // Volúmenes del mundo
+		       GLuint    nObjects , // No. de objetos del mundo
+		       GLuint    nObj     , // Objeto a ignorar
+		       AABBTREE* tree     , // Árbol del mundo(o NULL)
+		       BOX       box      , // Caja a verificar
+		       GLuint*   out      ) // Objetos encontrados
+{
+  GLuint count = 0;
+  unsigned int i, j;
+
+  /* Candidatos del árbol o todos */
+  if( tree != NULL )
+    count = QueryAABBTree( tree, box, out, nObjects );
+  else
+    for( i = 0; i < nObjects; i++ )
+      out[count++] = i;
+
+  /* Sólo modelos cuyas envolventes o BVH tocan la caja */
+  for( i = 0, j = 0; i < count; i++ )
+    {
+      GLuint obj = out[i];
+      if( obj != nObj && models[obj] != NULL &&
+	  ContactOverlap( models[obj], volumes[obj], box ) )
+	out[j++] = obj;
+    }
+  count = j;
+
+  /* Orden ascendente(el árbol los entrega en cualquier orden) */
+  for( i = 1; i < count; i++ )
+    {
+      GLuint obj = out[i];
+      for( j = i; j > 0 && out[j - 1] > obj; j-- )
+	out[j] = out[j - 1];
+      out[j] = obj;
+    }
+  return count;
+}
+
+/*** Función: Invalida la caché si cambiaron los objetos de su caja ***/
+// Con árbol es O(1) mientras ningún otro objeto se mueva(AABBTREE.stamp);
+// si alguno se movió se comparan los objetos dentro de la caja guardada.
+void ValidateContactCache( CONTACTCACHE* cache    , // Caché a verificar
+			   MODEL*        models[] , // Modelos del mundo
+			   VOLUMES*      volumes[], // Volúmenes del mundo
+			   GLuint        nObjects , // No. de objetos del mundo
+			   GLuint        nObj     , // Objeto a ignorar
+			   AABBTREE*     tree     ) // Árbol del mundo(o NULL)
+{
+  GLuint objects[nObjects];
+  GLuint count;
+  unsigned int i;
+
+  if( !cache->valid || ( tree != NULL && cache->stamp == tree->stamp ) )
+    return;
+  count = ContactObjects( models, volumes, nObjects, nObj, tree,
+			  cache->bound, objects );
+  if( count != cache->nObjects )
+    {
+      cache->valid = GL_FALSE;
+      return;
+    }
+  for( i = 0; i < count; i++ )
+    if( objects[i] != cache->objects[i] ||
+	memcmp( volumes[objects[i]]->matrix, &cache->matrices[i * 16],
+		sizeof(GLfloat) * 16 ) != 0 )
+      {
+	cache->valid = GL_FALSE;
+	return;
+      }
+  // Los cambios fueron fuera de la caja
+  if( tree != NULL )
+    cache->stamp = tree->stamp;
+}
+
+/*** Función: Invalida la caché si el terreno cambió dentro de "region" ***/
+// "region" es la caja que devuelve DeformTerrain
+void InvalidateContactCache( CONTACTCACHE* cache, BOX region )
+{
+  if( cache->valid && BoxOverlap( cache->bound, region ) )
+    cache->valid = GL_FALSE;
+}
+
+/*** Función: Recolecta los triángulos alrededor del recorrido ***/
+void GatherContacts( CONTACTCACHE* cache       , // Caché a llenar
+		     TERRAIN*      terrain     , // Terreno del mundo
+		     MODEL*        models[]    , // Modelos del mundo
+		     VOLUMES*      volumes[]   , // Volúmenes del mundo
+		     GLuint        nObjects    , // No. de objetos del mundo
+		     GLuint        nObj        , // Objeto a ignorar
+		     VOLUMES*      cObj        , // Volúmenes a colisionar
+		     AABBTREE*     tree        , // Árbol del mundo(o NULL)
+		     VECTOR        displacement) // Desplazamiento esperado
+{
+  GLuint objects[nObjects];
+  GLuint minRow, maxRow, minCol, maxCol;
+  unsigned int i, j, k;
+
+  /* Caja del recorrido con holgura */
+  VECTOR padding = { cache->padding, cache->padding, cache->padding };
+  BOX    box     = SweptBox( cObj, displacement );
+  cache->bound.min = ResVector( box.min, padding );
+  cache->bound.max = SumVector( box.max, padding );
+  cache->nBatches  = 0;
+  cache->valid     = GL_TRUE;
+  cache->stamp     = tree != NULL ? tree->stamp : 0;
+
+  /* Terreno: las celdas bajo la caja, en cada mosaico */
+  for( ; terrain != NULL; terrain = terrain->next )
+    {
+      if( !TerrainCellRange( terrain, cache->bound,
+			     &minRow, &maxRow, &minCol, &maxCol ) )
+	continue;
+      for( i = minRow; i <= maxRow; i++ )
+	for( j = minCol; j <= maxCol; j++ )
 	  {
-	    /* Actualizo los datos en caso de colisión más temprana */
-	    minTime = time;
-	    *outPos = pos;
+	    unsigned int base = (i * (terrain->vertsPerRow - 1) + j) * 2 * 3;
+	    GLuint* index = &terrain->indexBuffer[base];
+
+	    /* Descarto la celda si su altura no cruza la caja */
+	    GLfloat hMin = INFINITY, hMax = -INFINITY;
+	    for( k = 0; k < 6; k++ )
+	      {
+		hMin = MINVALUE( hMin, terrain->vertexBuffer[index[k]].p.y );
+		hMax = MAXVALUE( hMax, terrain->vertexBuffer[index[k]].p.y );
+	      }
+	    if( hMax < cache->bound.min.y || hMin > cache->bound.max.y )
+	      continue;
+
+	    for( k = 0; k < 6; k += 3 )
+	      {
+		POINT  p0 = terrain->vertexBuffer[index[k+0]].p;
+		POINT  p1 = terrain->vertexBuffer[index[k+1]].p;
+		POINT  p2 = terrain->vertexBuffer[index[k+2]].p;
+		VECTOR v0 = { p0.x, p0.y, p0.z };
+		VECTOR v1 = { p1.x, p1.y, p1.z };
+		VECTOR v2 = { p2.x, p2.y, p2.z };
+		AddContactTriangle( cache, nObj, v0, v1, v2 );
+	      }
 	  }
     }
+
+  /* Objetos: las hojas de su BVH dentro de la caja */
+  cache->nObjects = ContactObjects( models, volumes, nObjects, nObj, tree,
+				    cache->bound, objects );
+  if( cache->nObjects > cache->objectCapacity )
+    {
+      cache->objectCapacity = cache->nObjects;
+      cache->objects  = realloc( cache->objects,
+				 sizeof(GLuint) * cache->objectCapacity );
+      cache->matrices = realloc( cache->matrices,
+				 sizeof(GLfloat) * 16 * cache->objectCapacity );
+    }
+  for( i = 0; i < cache->nObjects; i++ )
+    {
+      GLuint obj = objects[i];
+      cache->objects[i] = obj;
+      memcpy( &cache->matrices[i * 16], volumes[obj]->matrix,
+	      sizeof(GLfloat) * 16 );
+      if( !HullCollision( models[obj] ) )
+	GatherContactsBVH( cache, models[obj], volumes[obj], obj, 0 );
+    }
+  BuildContactGroups( cache );
+}
+
+/*** Función: Detecta la colisión con los triángulos de la caché ***/
+// Recolecta de nuevo si el recorrido sale de la caja guardada
+GLboolean CollisionDetectionCached( TERRAIN*  terrain     , // Terreno
+				    MODEL*    models[]    , // Modelos
+				    VOLUMES*  volumes[]   , // Volúmenes
+				    GLuint    nObjects    , // No. de objetos
+				    GLuint    nObj        , // Objeto a ignorar
+				    VOLUMES*  cObj        , // Volúmenes a colisionar
+				    AABBTREE* tree        , // Árbol(o NULL)
+				    VECTOR    displacement, // Desplazamiento
+				    GLuint*   outObj      , // Objeto colisionado
+				    GLfloat*  outTime     , // Tiempo de colisión
+				    VECTOR*   outPos      ) // Posición de colisión
+{
+  CONTACTCACHE* cache   = cObj->contacts;
+  GLfloat       minTime = INFINITY;
+  BOX           box     = SweptBox( cObj, displacement );
+  GLuint        stack[64], top = 0;
+  unsigned int  i;
+
+  if( !cache->valid || !BoxContains( cache->bound, box ) )
+    GatherContacts( cache, terrain, models, volumes, nObjects, nObj,
+		    cObj, tree, displacement );
+
+  /* Los lotes guardados que tocan el recorrido(en orden, por el árbol) */
+  VECTOR ePos  = DivVector( cObj->ellipsoid.center, cObj->ellipsoid.axes );
+  VECTOR eDisp = DivVector( displacement, cObj->ellipsoid.axes );
+  stack[top++] = 1;
+  while( top > 0 )
+    {
+      GLuint k = stack[--top];
+      if( !BoxOverlap( ContactGroupBox( cache, k ), box ) )
+	continue;
+      if( k < cache->nLeaves )
+	{
+	  // El hijo izquierdo primero: mismo orden que la lista de lotes
+	  stack[top++] = 2 * k + 1;
+	  stack[top++] = 2 * k;
+	  continue;
+	}
+      i = k - cache->nLeaves;
+      if( CollisionDetectionTri4( &cache->batches[i], cObj->ellipsoid.axes,
+				  ePos, eDisp, &minTime, outPos ) )
+	*outObj = cache->owners[i];
+    }
+
+  /* Modelos que colisionan con sus envolventes */
+  for( i = 0; i < cache->nObjects; i++ )
+    {
+      GLuint obj = cache->objects[i];
+      if( HullCollision( models[obj] ) &&
+	  CollisionDetectionHulls( models[obj], volumes[obj], cObj, &box,
+				   ePos, eDisp, &minTime, outPos ) )
+	*outObj = obj;
+    }
+
   if( INTERVAL( minTime ) )
     {
       *outTime   = minTime;
@@ -508,16 +2365,20 @@ GLboolean CollisionDetectionObj( MODEL*   model  , // Modelo a verificar
   return GL_FALSE;
 }
 
-/*** Función: Calcula y detecta la colisión del desplazamiento de un objeto ***/
-GLboolean CollisionDetection( TERRAIN* terrain     , // Terreno del mundo
-			      MODEL*   models[]    , // Modelos del mundo
-			      VOLUMES* volumes[]   , // Volúmenes del mundo
-			      GLuint   nObjects    , // No. de objetos del mundo
-			      GLuint   nObj        , // Objeto el cual colisionar
-			      VECTOR   displacement, // Desplazamiento esperado
-			      GLuint*  outObj      , // Objeto colisionado
-			      GLfloat* outTime     , // Tiempo de colisión
-			      VECTOR*  outPos      ) // Posición de la colisión
+/*** Función: Detecta la colisión del desplazamiento de unos volúmenes ***/
+// "cObj" puede ser una copia de volumes[nObj](o no estar en la lista con
+// nObj = -1); "tree" es el árbol en que se buscan los candidatos.
+GLboolean CollisionDetectionVol( TERRAIN*  terrain     , // Terreno del mundo
+				 MODEL*    models[]    , // Modelos del mundo
+				 VOLUMES*  volumes[]   , // Volúmenes del mundo
+				 GLuint    nObjects    , // No. de objetos del mundo
+				 GLuint    nObj        , // Objeto a ignorar
+				 VOLUMES*  cObj        , // Volúmenes a colisionar
+				 AABBTREE* tree        , // Árbol del mundo(o NULL)
+				 VECTOR    displacement, // Desplazamiento esperado
+				 GLuint*   outObj      , // Objeto colisionado
+				 GLfloat*  outTime     , // Tiempo de colisión
+				 VECTOR*   outPos      ) // Posición de la colisión
 {
   /* Variables sin valor aún */
   outPos->x = NAN;
@@ -525,12 +2386,17 @@ GLboolean CollisionDetection( TERRAIN* terrain     , // Terreno del mundo
   outPos->z = NAN;
   *outObj   = nObj;
   *outTime  = INFINITY;
+  /* Candidatos guardados */
+  if( cObj->contacts != NULL )
+    return CollisionDetectionCached( terrain, models, volumes, nObjects, nObj,
+				     cObj, tree, displacement,
+				     outObj, outTime, outPos );
   /* Variables */
   GLboolean collided = GL_FALSE;
   GLfloat   time     = INFINITY;
   VECTOR    pos      = { NAN, NAN, NAN };
   /* Terreno */
-  if( terrain != NULL && CollisionDetectionTerr( terrain, volumes[nObj],
+  if( terrain != NULL && CollisionDetectionTerr( terrain, cObj,
 						 displacement, &time, &pos ) )
     {
       if( time < *outTime )
@@ -543,27 +2409,68 @@ GLboolean CollisionDetection( TERRAIN* terrain     , // Terreno del mundo
 	}
     }
   
-  /* Todos los objetos */
+  /* Objetos candidatos */
+  GLuint candidates[nObjects];
+  GLuint nCandidates = 0;
   unsigned int i;
-  for( i = 0; i < nObjects; i++ )
-    /* Objeto Ith*/
-    if( i != nObj && InsideSphere( volumes[nObj], volumes[i], 1.0f ) )
-      {
-	/* Detecto la colisión */
-	if( CollisionDetectionObj( models[i], volumes[i], volumes[nObj],
-				   displacement, &time, &pos ) )
-	  if( time < *outTime )
-	    {
-	      /* Actualizo los datos en caso de colisión más temprana */
-	      collided = GL_TRUE;
-	      *outTime = time;
-	      *outPos  = pos;
-	      *outObj  = i;
-	    }
-      }
+  if( tree != NULL )
+    {
+      // Objetos cuyas cajas tocan el recorrido
+      VECTOR tolerance = { 1.0f, 1.0f, 1.0f };
+      BOX    box       = SweptBox( cObj, displacement );
+      box.min = ResVector( box.min, tolerance );
+      box.max = SumVector( box.max, tolerance );
+      nCandidates = QueryAABBTree( tree, box, candidates, nObjects );
+    }
+  else
+    {
+      // Todos los objetos cercanos
+      for( i = 0; i < nObjects; i++ )
+	if( InsideSphere( cObj, volumes[i], 1.0f ) )
+	  candidates[nCandidates++] = i;
+    }
+
+  for( i = 0; i < nCandidates; i++ )
+    {
+      /* Objeto Ith*/
+      GLuint obj = candidates[i];
+      if( obj == nObj || models[obj] == NULL )
+	continue;
+
+      /* Detecto la colisión */
+      if( CollisionDetectionObj( models[obj], volumes[obj], cObj,
+				 displacement, &time, &pos ) )
+	if( time < *outTime )
+	  {
+	    /* Actualizo los datos en caso de colisión más temprana */
+	    collided = GL_TRUE;
+	    *outTime = time;
+	    *outPos  = pos;
+	    *outObj  = obj;
+	  }
+    }
   return collided;
 }
 
+/*** Función: Calcula y detecta la colisión del desplazamiento de un objeto ***/
+GLboolean CollisionDetection( TERRAIN* terrain     , // Terreno del mundo
+			      MODEL*   models[]    , // Modelos del mundo
+			      VOLUMES* volumes[]   , // Volúmenes del mundo
+			      GLuint   nObjects    , // No. de objetos del mundo
+			      GLuint   nObj        , // Objeto el cual colisionar
+			      VECTOR   displacement, // Desplazamiento esperado
+			      GLuint*  outObj      , // Objeto colisionado
+			      GLfloat* outTime     , // Tiempo de colisión
+			      VECTOR*  outPos      ) // Posición de la colisión
+{
+  if( volumes[nObj]->contacts != NULL )
+    ValidateContactCache( volumes[nObj]->contacts, models, volumes,
+			  nObjects, nObj, volumes[nObj]->tree );
+  return CollisionDetectionVol( terrain, models, volumes, nObjects, nObj,
+				volumes[nObj], volumes[nObj]->tree,
+				displacement, outObj, outTime, outPos );
+}
+
 /*** Función: Crea un nuevo desplazamiento en caso de colisionar ***/
 VECTOR CollisionResponse( VOLUMES* volumes     ,  // Volúmenes NO acutalizados
 			  VECTOR   collisionPos,  // Posición de la colisión
@@ -592,16 +2499,19 @@ VECTOR CollisionResponse( VOLUMES* volumes     ,  // Volúmenes NO acutalizados
   return newDisplacement;
 }
 
-/*** Función: Detección de colisiones y respuesta en una cámara ***/
-void CollisionAndResponse( GLuint   nIterations ,  // No. de iteraciones en col.
-			   GLfloat  epsilon     ,  // Exactitud de la respuesta
-			   CAMERA*  camera      ,  // Cámara a colisionar
-			   TERRAIN* terrain     ,  // Terreno del mundo
-			   MODEL*   models[]    ,  // Modelos del mundo
-			   VOLUMES* volumes[]   ,  // Volúmenes del mundo
-			   GLuint   nObjects    ,  // No. de objetos del mundo
-			   GLuint   nObj        ,  // Objeto el cual colisionar
-			   VECTOR   displacement ) // Desplazamiento esperado
+/*** Función: Colisión y deslizamiento iterativo de unos volúmenes ***/
+// Mueve "cObj" y suma cada paso a "position"
+void CollideAndSlide( GLuint    nIterations ,  // No. de iteraciones en col.
+		      GLfloat   epsilon     ,  // Exactitud de la respuesta
+		      TERRAIN*  terrain     ,  // Terreno del mundo
+		      MODEL*    models[]    ,  // Modelos del mundo
+		      VOLUMES*  volumes[]   ,  // Volúmenes del mundo
+		      GLuint    nObjects    ,  // No. de objetos del mundo
+		      GLuint    nObj        ,  // Objeto a ignorar
+		      VOLUMES*  cObj        ,  // Volúmenes a colisionar
+		      AABBTREE* tree        ,  // Árbol del mundo(o NULL)
+		      VECTOR*   position    ,  // Posición a actualizar
+		      VECTOR    displacement ) // Desplazamiento esperado
 {
   GLuint  iteration, outObj;
   GLfloat dispNorm, outTime;
@@ -614,34 +2524,262 @@ void CollisionAndResponse( GLuint   nIterations ,  // No. de iteraciones en col.
        iteration < nIterations && dispNorm > epsilon;
        iteration++, dispNorm = NormVector( displacement ) )
     {
-      if( CollisionDetection( terrain, models, volumes,
-			      nObjects, nObj, displacement,
-			      &outObj, &outTime, &outPos ) )
+      /* Los candidatos guardados sirven si el mundo no cambió en su caja */
+      if( iteration == 0 && cObj->contacts != NULL )
+	ValidateContactCache( cObj->contacts, models, volumes,
+			      nObjects, nObj, tree );
+      if( CollisionDetectionVol( terrain, models, volumes,
+				 nObjects, nObj, cObj, tree, displacement,
+				 &outObj, &outTime, &outPos ) )
 	{
 	  // Desplazamiento sin colisionar(un poco antes de la colisión)
 	  VECTOR newDisp = MulVector( displacement, outTime * ( 1.0f - epsilon ) );
 	  VECTOR nonDisp = MulVector( displacement, outTime * epsilon );
 	  // Respuesta
-	  displacement = CollisionResponse( volumes[nObj], 
+	  displacement = CollisionResponse( cObj, 
 					    ResVector( outPos, nonDisp ), 
 					    displacement );
 	  // Acutalizo volúmenes
-	  UpdateVolumes( volumes[nObj], newDisp );
-	  // Actualizo cámara
-	  camera->pos = SumVector( camera->pos, newDisp );
+	  UpdateVolumes( cObj, newDisp );
+	  // Actualizo posición
+	  *position = SumVector( *position, newDisp );
 	}
       else
 	{
 	  // Actualizo volúmenes
-	  UpdateVolumes( volumes[nObj], displacement );
-	  // Actualizo cámara
-	  camera->pos = SumVector( camera->pos, displacement );
+	  UpdateVolumes( cObj, displacement );
+	  // Actualizo posición
+	  *position = SumVector( *position, displacement );
 	  // Salgo
 	  break;
 	}
     }
 }
 
+/*** Función: Detección de colisiones y respuesta en una cámara ***/
+void CollisionAndResponse( GLuint   nIterations ,  // No. de iteraciones en col.
+			   GLfloat  epsilon     ,  // Exactitud de la respuesta
+			   CAMERA*  camera      ,  // Cámara a colisionar
+			   TERRAIN* terrain     ,  // Terreno del mundo
+			   MODEL*   models[]    ,  // Modelos del mundo
+			   VOLUMES* volumes[]   ,  // Volúmenes del mundo
+			   GLuint   nObjects    ,  // No. de objetos del mundo
+			   GLuint   nObj        ,  // Objeto el cual colisionar
+			   VECTOR   displacement ) // Desplazamiento esperado
+{
+  CollideAndSlide( nIterations, epsilon, terrain, models, volumes,
+		   nObjects, nObj, volumes[nObj], volumes[nObj]->tree,
+		   &camera->pos, displacement );
+}
+
+/*** Función: Tarea de un actor en CollisionAndResponseBatch ***/
+void CollisionAndResponseJob( void* data, GLuint index )
+{
+  ACTORBATCH* batch = data;
+  ACTOR*      actor = &batch->actors[index];
+  VOLUMES*    cObj  = &batch->results[index];
+  VECTOR      zero  = { 0.0f, 0.0f, 0.0f };
+
+  // Copia privada: no toca el árbol ni los volúmenes compartidos
+  *cObj        = *actor->volumes;
+  cObj->tree   = NULL;
+  actor->moved = zero;
+  CollideAndSlide( batch->nIterations, batch->epsilon, batch->terrain,
+		   batch->models, batch->volumes, batch->nObjects,
+		   actor->object, cObj, actor->volumes->tree,
+		   &actor->moved, actor->displacement );
+}
+
+/*** Función: Detección de colisiones y respuesta de varios actores ***/
+// Todos los actores colisionan contra el mundo como estaba al llamar y
+// los resultados se escriben al final en orden, así que el resultado no
+// depende del número de hilos. "pool" puede ser NULL.
+void CollisionAndResponseBatch( WORKERPOOL* pool        , // Hilos de trabajo
+				GLuint      nIterations , // No. de iteraciones
+				GLfloat     epsilon     , // Exactitud
+				TERRAIN*    terrain     , // Terreno del mundo
+				MODEL*      models[]    , // Modelos del mundo
+				VOLUMES*    volumes[]   , // Volúmenes del mundo
+				GLuint      nObjects    , // No. de objetos
+				ACTOR*      actors      , // Actores a mover
+				GLuint      nActors     ) // No. de actores
+{
+  ACTORBATCH batch =
+    { nIterations, epsilon, terrain, models, volumes, nObjects, actors,
+      malloc( sizeof(VOLUMES) * nActors ) };
+  unsigned int i;
+
+  /* Cachés al día: los hilos sólo comparan la matriz y las leen(cada
+     modelo usa la de envolventes o la de triángulos, nunca las dos) */
+  for( i = 0; i < nObjects; i++ )
+    if( models[i] != NULL && HullCollision( models[i] ) )
+      UpdateHullCache( models[i], volumes[i] );
+    else if( models[i] != NULL && models[i]->bvhCount > 0 )
+      UpdateTriangleCache( models[i], volumes[i] );
+
+  /* Colisión en paralelo */
+  RunWorkerPool( pool, CollisionAndResponseJob, &batch, nActors );
+
+  /* Escribo los resultados */
+  for( i = 0; i < nActors; i++ )
+    {
+      AABBTREE* tree = actors[i].volumes->tree;
+      *actors[i].volumes      = batch.results[i];
+      actors[i].volumes->tree = tree;
+      MoveVolumes( actors[i].volumes, actors[i].moved );
+    }
+  free( batch.results );
+}
+
+/*--- Selección con rayos(sin opengl) ---*/
+
+/*** Función: Rayo contra la jerarquía de un modelo(triángulos en el mundo) ***/
+// Visita primero el hijo más cercano; "minTri" es el triángulo más cercano
+void PickBVH( MODEL*   model  , // Modelo a verificar
+	      VOLUMES* mObj   , // Geometría a verificar(caché)
+	      GLuint   node   , // Nodo actual
+	      RAY      ray    , // Rayo
+	      GLfloat* minTime, // Tiempo más temprano
+	      GLint*   minTri ) // Triángulo más cercano
+{
+  BVHNODE* n = &model->bvh[node];
+  unsigned int i;
+
+  if( n->count == 0 )
+    {
+      GLuint  children[2] = { node + 1, n->right };
+      GLfloat entries[2];
+      for( i = 0; i < 2; i++ )
+	{
+	  GLfloat t1 = *minTime;
+	  entries[i] = 0.0f;
+	  if( !RayBox( ray, mObj->nodes[children[i]], &entries[i], &t1 ) )
+	    entries[i] = INFINITY;
+	}
+      if( entries[1] < entries[0] )
+	{
+	  GLuint  c = children[0]; children[0] = children[1]; children[1] = c;
+	  GLfloat e = entries[0];  entries[0]  = entries[1];  entries[1]  = e;
+	}
+      for( i = 0; i < 2; i++ )
+	if( entries[i] <= *minTime )
+	  PickBVH( model, mObj, children[i], ray, minTime, minTri );
+      return;
+    }
+
+  for( i = n->first; i < n->first + n->count; i++ )
+    {
+      VECTOR*  v        = &mObj->triangles[i * 3];
+      TRIANGLE triangle = { v[0], v[1], v[2] };
+      GLfloat  time;
+      if( RayTriangle( ray, triangle, &time ) &&
+	  time >= 0.0f && time < *minTime )
+	{
+	  *minTime = time;
+	  *minTri  = i;
+	}
+    }
+}
+
+/*** Función: Primer objeto o terreno que toca un rayo ***/
+// Sin opengl: para el mouse usar CameraRay(camera.c). "maxTime" limita el
+// rayo(INFINITY: sin fin). Los modelos se prueban con sus triángulos.
+GLboolean PickScene( TERRAIN* terrain    , // Terreno del mundo(o NULL)
+		     MODEL*   models[]   , // Modelos del mundo
+		     VOLUMES* volumes[]  , // Volúmenes del mundo
+		     GLuint   nObjects   , // No. de objetos del mundo
+		     RAY      ray        , // Rayo
+		     GLfloat  maxTime    , // Largo del rayo
+		     PICK*    pick       ) // Resultado
+{
+  GLfloat minTime = maxTime;
+  GLint   minTri  = -1;
+  VECTOR  pos;
+  unsigned int i;
+
+  pick->object = -2;
+
+  /* Terreno: cada mosaico acorta el rayo */
+  for( ; terrain != NULL; terrain = terrain->next )
+    if( TerrainRay( terrain, ray, minTime, &minTime, &pos ) )
+      {
+	pick->object = -1;
+	pick->normal = GetNormal( terrain, pos.x, pos.z );
+      }
+
+  /* Modelos: caja del objeto y luego su jerarquía */
+  for( i = 0; i < nObjects; i++ )
+    {
+      GLfloat t0 = 0.0f, t1 = minTime;
+      if( models[i] == NULL || models[i]->bvhCount == 0 ||
+	  !RayBox( ray, volumes[i]->box, &t0, &t1 ) )
+	continue;
+      UpdateTriangleCache( models[i], volumes[i] );
+      minTri = -1;
+      PickBVH( models[i], volumes[i], 0, ray, &minTime, &minTri );
+      if( minTri >= 0 )
+	{
+	  VECTOR* v    = &volumes[i]->triangles[minTri * 3];
+	  pick->object = i;
+	  pick->normal = NormalizeVector( CrossProduct( ResVector( v[1], v[0] ),
+							ResVector( v[2], v[0] ) ) );
+	}
+    }
+
+  if( pick->object == -2 )
+    return GL_FALSE;
+
+  /* Normal contra el rayo */
+  if( DotProduct( pick->normal, ray.u ) > 0.0f )
+    pick->normal = MulVector( pick->normal, -1.0f );
+  pick->time     = minTime;
+  pick->position = SumVector( ray.p0, MulVector( ray.u, minTime ) );
+  return GL_TRUE;
+}
+
+/*_______*/
+
+/*--- Volumen de visión ---*/
+
+/*** Función: Objetos visibles desde un volumen de visión ***/
+// Primero la esfera; si toca un plano se decide con la caja. Escribe los
+// índices visibles en "visible"(de tamaño nObjects) y devuelve cuántos son.
+GLuint CullVolumes( const FRUSTUM* frustum,
+		    VOLUMES*       volumes[],  // Volúmenes de los objetos
+		    GLuint         nObjects ,
+		    GLuint*        visible  ,  // Salida: índices visibles
+		    CULLSTATS*     stats    )  // Conteos(puede ser NULL)
+{
+  CULLSTATS count = { 0, 0, 0, 0 };
+  unsigned int i;
+  for( i = 0; i < nObjects; i++ )
+    {
+      if( volumes[i] == NULL )
+	continue;
+      count.tested++;
+
+      GLint res = SphereInFrustum( frustum, volumes[i]->sphere );
+      if( res == FRUSTUM_OUTSIDE )
+	{
+	  count.culledSphere++;
+	  continue;
+	}
+      if( res == FRUSTUM_INTERSECT &&
+	  BoxInFrustum( frustum, volumes[i]->box ) == FRUSTUM_OUTSIDE )
+	{
+	  count.culledBox++;
+	  continue;
+	}
+      visible[count.visible++] = i;
+    }
+
+  if( stats != NULL )
+    *stats = count;
+  return count.visible;
+}
+
+/*_______*/
+
 /*** Función: Crea una lista de ejecución para dibujar el "bounding box" ***/
 GLuint RenderBoundingBox( VECTOR* boxMin, VECTOR* boxMax, MATERIAL* boxMaterial )
 {
@@ -1,13 +1,14 @@
 #include "opengl.c"
 #include "openal.c"
 #include "math.c"
+#include "thread.c"
 #include "model.c"
 #include "fonts.c"
 #include "camera.c"
+#include "shader.c"
 #include "terrain.c"
 #include "pSystem.c"
 #include "sprite.c"
-#include "shader.c"
 #include "shadow.c"
 #include "skybox.c"
 #include "collision.c"
@@ -167,21 +168,20 @@ void Init( void )
     
 
     //Espada
-    glPushMatrix();
-    //LoadModel( "models/flyingSword.3DS", "textures", GL_FALSE, &modeloEspada );
-    LoadModel( "models/sword7.3ds", "textures", GL_FALSE, &modeloEspada );
-    glTranslatef(1.0f, 0.0f, -3.0f);
+    //LoadModel( "models/flyingSword.3DS", "textures", GL_TRUE, GL_FALSE, &modeloEspada );
+    LoadModel( "models/sword7.3ds", "textures", GL_TRUE, GL_FALSE, &modeloEspada );
+    GLfloat swordMatrix[16];
+    TranslationMatrix(1.0f, 0.0f, -3.0f, swordMatrix);
     //glScalef(0.01f, 0.01f, 0.01f);
 
-    BoundingVolumes(&modeloEspada, &volumesEspada, NULL, GL_TRUE);
-    glPopMatrix();
+    BoundingVolumes(&modeloEspada, &volumesEspada, swordMatrix, GL_TRUE);
     
     
     
     // Terreno
-    InitTerrain(&terrain,"resources/hell.raw", "textures/greengrass.jpg",GL_FALSE, &terrainMtrl,64,64,50.0f,1.0f);
+    InitTerrain(NULL, &terrain,"resources/hell.raw", "textures/greengrass.jpg",GL_FALSE, &terrainMtrl,64,64,50.0f,1.0f);
     // agua
-//    InitTerrain(&agua,"resources/agua.raw", "textures/agua.png",GL_FALSE, &aguaMtrl,64,64,50.0f,0.1f);
+//    InitTerrain(NULL, &agua,"resources/agua.raw", "textures/agua.png",GL_FALSE, &aguaMtrl,64,64,50.0f,0.1f);
     
     // SKYBOX
     InitSkybox(&skybox,"textures/skybox.png");
@@ -610,7 +610,7 @@ void Video( float elapsed )
     glRotatef(angY, 0.0f, 1.0f, 0.0f);
     glRotatef(angZ, 0.0f, 0.0f, 1.0f);
     
-    glCallList(modeloEspada.modelList);
+    DrawModel(&modeloEspada);
     glPopMatrix();
     /*________*/
     
@@ -642,9 +642,13 @@ void Video( float elapsed )
     
     /*Terreno*/
     glPushMatrix();
+    FRUSTUM frustum = CameraFrustum(&cam, 50.0f/zoom, (GLfloat)WIDTH / (GLfloat)HEIGHT,
+                                    1.0f, 2000.0f);
+    SelectTerrainLOD(&terrain, cam.pos, &frustum,
+                     TerrainLODFactor(50.0f/zoom, HEIGHT, 2.0f), NULL);
     SetMaterial( &terrain.material );
     glBindTexture(GL_TEXTURE_2D, terrain.textureID);
-    glCallList( terrain.terrainList );
+    RenderTerrain( &terrain );
     glPopMatrix();
     
     
@@ -656,7 +660,9 @@ void Video( float elapsed )
     glEnable(GL_BLEND);
     SetMaterial( &agua.material );
     glBindTexture(GL_TEXTURE_2D, agua.textureID);
-    glCallList( agua.terrainList );
+    SelectTerrainLOD(&agua, cam.pos, &frustum,
+                     TerrainLODFactor(50.0f/zoom, HEIGHT, 2.0f), NULL);
+    RenderTerrain( &agua );
     glDisable(GL_BLEND);
     glPopMatrix();
     
@@ -0,0 +1,507 @@
+/*****************************/
+/**     ----------------    **/
+/**     collisionBench.c    **/
+/**     ----------------    **/
+/**  Medición de colisiones **/
+/**  sin ventana ni opengl  **/
+/*****************************/
+
+#include "opengl.c"
+#include "math.c"
+#include "thread.c"
+#include "model.c"
+#include "camera.c"
+#include "shader.c"
+#include "terrain.c"
+#include "collision.c"
+
+/* Especificaciones */
+#define FRAME_TIME (1.0f / 60.0f) // Paso fijo de la simulación
+#define MAX_PATHS  8              // Recorridos a medir
+#define TILE_CELLS 16             // Celdas por mosaico con -T
+#define TILE_RANGE 1              // Mosaicos residentes alrededor de la cámara
+
+//---   Estructuras   ---//
+
+/*** Estructura de Dato: PATH ***/
+// Posiciones deseadas de la cámara, una por cuadro
+typedef struct path
+{
+  char    name[64]; // Nombre para el reporte
+  VECTOR* points;   // Posición en cada cuadro
+  GLuint  count;    // Número de cuadros
+} PATH;
+
+/*_________*/
+
+
+/*** Opciones(línea de comandos) ***/
+char*     terrainFile = "coastMountain64.raw";
+GLuint    terrainSize = 64;
+GLfloat   cellSpacing = 10.0f;
+char*     modelFile   = "models/Wooden Box.obj";
+GLfloat   modelScale  = 4.0f;
+GLuint    nCopies     = 64;
+GLuint    nFrames     = 2000;
+char*     pathFile    = NULL;
+GLboolean useCache    = GL_TRUE;
+GLboolean exact       = GL_FALSE;
+char*     tileFile    = NULL;
+GLuint    nActors     = 32;
+GLuint    nThreads    = 0;
+
+/*** Colisiones **/
+GLfloat epsilon    = 0.1f;
+GLfloat iterations = 10;
+VECTOR  gravity    = { 0.0f, -9.8f, 0.0f };
+GLfloat vel        = 30.0f;
+VECTOR  cameraAxes = { 2.0f, 5.0f, 2.0f };
+
+/*** Mundo ***/
+TERRAIN      terrain;
+TERRAINSTREAM stream;
+MODEL        model;
+GLuint       nObjs;
+MODEL**      objList;
+VOLUMES**    objVolumes;
+VOLUMES      cameraVolumes;
+AABBTREE     objTree;
+CONTACTCACHE cameraContacts;
+CAMERA       cam;
+
+/*** Actores(CollisionAndResponseBatch) ***/
+WORKERPOOL    workers;
+VOLUMES*      actorVolumes;
+CONTACTCACHE* actorContacts;
+ACTOR*        actors;
+
+/*** Recorridos ***/
+PATH   paths[MAX_PATHS];
+GLuint nPaths = 0;
+
+
+/*** Función: Tiempo monotónico en segundos ***/
+double BenchTime( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*** Función: Comparación de latencias para qsort ***/
+int CompareLatency( const void* a, const void* b )
+{
+  GLfloat x = *(const GLfloat*)a, y = *(const GLfloat*)b;
+  return ( x > y ) - ( x < y );
+}
+
+/*** Función: Percentil "p" de un arreglo ordenado(rango más cercano) ***/
+GLfloat Percentile( GLfloat* sorted, GLuint count, GLfloat p )
+{
+  GLint index = (GLint)ceil( p * count ) - 1;
+  return sorted[ MAXVALUE( index, 0 ) ];
+}
+
+/*** Función: Punto sobre el terreno a la altura de la cámara ***/
+VECTOR GroundPoint( GLfloat x, GLfloat z )
+{
+  GLfloat extent = ( terrainSize - 1 ) * cellSpacing - 1.0f;
+  x = MAXVALUE( 1.0f, MINVALUE( x, extent ) );
+  z = MAXVALUE( 1.0f, MINVALUE( z, extent ) );
+  VECTOR p = { x, GetHeight( &terrain, x, z ) + cameraAxes.y + 1.0f, z };
+  return p;
+}
+
+/*** Función: Reserva un recorrido nuevo ***/
+PATH* NewPath( const char* name, GLuint count )
+{
+  PATH* path = &paths[nPaths++];
+  strncpy( path->name, name, sizeof(path->name) - 1 );
+  path->name[sizeof(path->name) - 1] = '\0';
+  path->points = malloc( sizeof(VECTOR) * count );
+  path->count  = count;
+  return path;
+}
+
+/*** Función: Recorridos generados(círculo, barrido y caminata) ***/
+void ScriptedPaths( void )
+{
+  GLfloat extent = ( terrainSize - 1 ) * cellSpacing;
+  GLfloat step   = vel * FRAME_TIME;
+  unsigned int i;
+
+  /* Círculo alrededor del centro */
+  PATH* circle = NewPath( "circle", nFrames );
+  GLfloat radius = extent * 0.35f;
+  for( i = 0; i < nFrames; i++ )
+    {
+      GLfloat angle = i * step / radius;
+      circle->points[i] = GroundPoint( extent * 0.5f + radius * cos( angle ),
+				       extent * 0.5f + radius * sin( angle ) );
+    }
+
+  /* Barrido en zigzag por las filas de modelos */
+  PATH* sweep = NewPath( "sweep", nFrames );
+  GLfloat x = 0.0f, z = extent * 0.1f, dir = 1.0f;
+  for( i = 0; i < nFrames; i++ )
+    {
+      x += dir * step;
+      if( x < 0.0f || x > extent )
+	{
+	  dir = -dir;
+	  x  += 2.0f * dir * step;
+	  z  += extent * 0.1f;
+	  if( z > extent )
+	    z = extent * 0.1f;
+	}
+      sweep->points[i] = GroundPoint( x, z );
+    }
+
+  /* Caminata aleatoria(semilla fija para que sea repetible) */
+  PATH* walk = NewPath( "random", nFrames );
+  GLfloat heading = 0.0f;
+  x = z = extent * 0.5f;
+  srand( 1 );
+  for( i = 0; i < nFrames; i++ )
+    {
+      heading += ( rand() / (GLfloat)RAND_MAX - 0.5f ) * 0.5f;
+      x += cos( heading ) * step;
+      z += sin( heading ) * step;
+      if( x < 0.0f || x > extent || z < 0.0f || z > extent )
+	heading += M_PI;
+      walk->points[i] = GroundPoint( x, z );
+    }
+
+  /* Parado junto al modelo del centro: sólo la gravedad */
+  PATH*  still = NewPath( "still", nFrames );
+  GLuint side  = (GLuint)ceil( sqrt( nCopies ) );
+  x = z = extent * 0.5f;
+  if( nCopies > 0 )
+    {
+      GLuint   center = MINVALUE( ( side / 2 ) * side + side / 2 + 1, nCopies );
+      VOLUMES* next   = objVolumes[center];
+      x = next->box.max.x + cameraAxes.x + 1.0f;
+      z = ( next->box.min.z + next->box.max.z ) * 0.5f;
+    }
+  for( i = 0; i < nFrames; i++ )
+    still->points[i] = GroundPoint( x, z );
+
+  /* Caminata lenta en línea recta desde el mismo lugar(1/4 de "vel") */
+  PATH* slow = NewPath( "slow", nFrames );
+  for( i = 0; i < nFrames; i++ )
+    slow->points[i] = GroundPoint( x + i * step * 0.25f, z );
+}
+
+/*** Función: Recorrido grabado("x y z" por línea, ver ejercicio.c) ***/
+void RecordedPath( const char* file )
+{
+  FILE* in = fopen( file, "r" );
+  if( in == NULL )
+    {
+      PrintError( "Could not open the camera path", GL_FALSE );
+      return;
+    }
+
+  GLuint capacity = 1024, count = 0;
+  VECTOR p;
+  PATH*  path = NewPath( file, capacity );
+  while( fscanf( in, "%f %f %f", &p.x, &p.y, &p.z ) == 3 )
+    {
+      if( count == capacity )
+	{
+	  capacity    *= 2;
+	  path->points = realloc( path->points, sizeof(VECTOR) * capacity );
+	}
+      path->points[count++] = p;
+    }
+  path->count = count;
+  fclose( in );
+}
+
+/*** Función: Uso del programa ***/
+void Usage( void )
+{
+  fprintf( stderr,
+	   "usage: %s [-t heightmap] [-s vertsPerSide] [-m model] [-n copies]\n"
+	   "       [-f frames] [-p camera.path] [-x(exact triangles)] [-c(no cache)]\n"
+	   "       [-T tiles(streamed terrain, written from the heightmap)]\n"
+	   "       [-a actors(batch, 0: none)] [-j threads(batch)]\n",
+	   g_Argv[0] );
+  exit( 1 );
+}
+
+/*** Inicialización de recursos ***/
+void Init( void )
+{
+  /* Opciones */
+  int option;
+  while( ( option = getopt( g_Argc, g_Argv, "t:s:m:n:f:p:xcT:a:j:h" ) ) != -1 )
+    switch( option )
+      {
+      case 't': terrainFile = optarg;       break;
+      case 's': terrainSize = atoi( optarg ); break;
+      case 'm': modelFile   = optarg;       break;
+      case 'n': nCopies     = atoi( optarg ); break;
+      case 'f': nFrames     = atoi( optarg ); break;
+      case 'p': pathFile    = optarg;       break;
+      case 'x': exact       = GL_TRUE;      break;
+      case 'c': useCache    = GL_FALSE;     break;
+      case 'T': tileFile    = optarg;       break;
+      case 'a': nActors     = atoi( optarg ); break;
+      case 'j': nThreads    = atoi( optarg ); break;
+      default : Usage();
+      }
+  if( terrainSize < 2 || nFrames < 2 )
+    Usage();
+
+  /* Terreno y modelo, sólo geometría */
+  if( !LoadTerrainGeometry( NULL, &terrain, terrainFile, GL_FALSE,
+			    terrainSize, terrainSize, cellSpacing, 1.0f ) ||
+      !LoadModelCollision( modelFile, GL_FALSE, &model ) )
+    exit( 1 );
+  model.exactCollision = exact;
+
+  /* Terreno por mosaicos: el completo sólo ubica modelos y recorridos */
+  if( tileFile != NULL &&
+      ( !ConvertTerrainTiles( terrainFile, terrainSize, terrainSize,
+			      TILE_CELLS, tileFile ) ||
+	!OpenTerrainStream( &stream, tileFile, cellSpacing, 1.0f, TILE_RANGE ) ) )
+    exit( 1 );
+
+  /* Mundo: la cámara y "nCopies" copias del modelo en una cuadrícula */
+  nObjs      = nCopies + 1;
+  objList    = calloc( nObjs, sizeof(MODEL*) );
+  objVolumes = calloc( nObjs, sizeof(VOLUMES*) );
+  InitAABBTree( &objTree, 1.0f );
+
+  memset( &cameraVolumes, 0, sizeof(VOLUMES) );
+  cam.pos = GroundPoint( 0.0f, 0.0f );
+  CreateCameraVolume( cam, cameraAxes, &cameraVolumes );
+  InitContactCache( &cameraContacts, 5.0f );
+  if( useCache )
+    cameraVolumes.contacts = &cameraContacts;
+  objVolumes[0] = &cameraVolumes;
+  InsertVolumes( &objTree, &cameraVolumes, 0 );
+
+  GLfloat     extent = ( terrainSize - 1 ) * cellSpacing;
+  GLuint      side   = (GLuint)ceil( sqrt( nCopies ) );
+  VECTORARRAY places;
+  unsigned int i;
+  InitVectorArray( &places, nCopies );
+  for( i = 0; i < nCopies; i++ )
+    {
+      places.x[i] = ( i % side + 0.5f ) * extent / side;
+      places.z[i] = ( i / side + 0.5f ) * extent / side;
+    }
+  GetHeights( &terrain, &places, places.y, NULL );
+  for( i = 1; i < nObjs; i++ )
+    {
+      GLfloat matrix[16] = { modelScale, 0.0f, 0.0f, places.x[i - 1],
+			     0.0f, modelScale, 0.0f, places.y[i - 1],
+			     0.0f, 0.0f, modelScale, places.z[i - 1],
+			     0.0f, 0.0f, 0.0f, 1.0f };
+      objList[i]    = &model;
+      objVolumes[i] = calloc( 1, sizeof(VOLUMES) );
+      BoundingVolumes( &model, objVolumes[i], matrix, GL_FALSE );
+      InsertVolumes( &objTree, objVolumes[i], i );
+    }
+  FreeVectorArray( &places );
+
+  /* Actores fuera de la lista del mundo, con su propia caché */
+  if( nThreads == 0 )
+    nThreads = CountProcessors();
+  InitWorkerPool( &workers, nThreads - 1 );
+  actorVolumes  = calloc( nActors + 1, sizeof(VOLUMES) );
+  actorContacts = calloc( nActors + 1, sizeof(CONTACTCACHE) );
+  actors        = calloc( nActors + 1, sizeof(ACTOR) );
+  for( i = 0; i < nActors; i++ )
+    {
+      InitContactCache( &actorContacts[i], 5.0f );
+      if( useCache )
+	actorVolumes[i].contacts = &actorContacts[i];
+      actors[i].volumes = &actorVolumes[i];
+      actors[i].object  = -1;
+    }
+
+  /* Recorridos */
+  ScriptedPaths();
+  if( pathFile != NULL )
+    RecordedPath( pathFile );
+
+  printf( "Terrain %dx%d%s, %d copies of '%s'(%d triangles, %d hulls), %s, %s\n",
+	  terrainSize, terrainSize, tileFile != NULL ? " streamed" : "",
+	  nCopies, modelFile, model.indexCount / 3,
+	  model.hullCount, exact ? "exact triangles" : "convex hulls",
+	  useCache ? "contact cache" : "no cache" );
+  if( nActors > 0 )
+    printf( "%d actors in batches, %d threads\n", nActors, nThreads );
+}
+
+/*** Liberación de recursos ***/
+void Free( void )
+{
+  unsigned int i;
+  for( i = 0; i < nPaths; i++ )
+    free( paths[i].points );
+  for( i = 1; i < nObjs; i++ )
+    {
+      FreeVolumes( objVolumes[i] );
+      free( objVolumes[i] );
+    }
+  free( objList );
+  free( objVolumes );
+  FreeAABBTree( &objTree );
+  FreeContactCache( &cameraContacts );
+  for( i = 0; i < nActors; i++ )
+    FreeContactCache( &actorContacts[i] );
+  free( actorVolumes );
+  free( actorContacts );
+  free( actors );
+  FreeWorkerPool( &workers );
+  FreeModel( &model );
+  FreeTerrain( &terrain );
+  FreeTerrainStream( &stream );
+}
+
+/*** Función: Reproduce un recorrido y guarda la latencia de cada consulta ***/
+// Cada cuadro son dos consultas, como en ejercicio.c: movimiento y gravedad.
+// Con -T los mosaicos se cargan antes de medir cada cuadro.
+GLuint ReplayPath( PATH* path, GLfloat* latencies )
+{
+  TERRAIN* world = &terrain;
+  GLuint   count = 0;
+  unsigned int i;
+
+  cam.pos = path->points[0];
+  CreateCameraVolume( cam, cameraAxes, &cameraVolumes );
+  for( i = 1; i < path->count; i++ )
+    {
+      VECTOR disp[2] = { ResVector( path->points[i], path->points[i - 1] ),
+			 MulVector( gravity, FRAME_TIME ) };
+      unsigned int k;
+      if( tileFile != NULL )
+	{
+	  if( WaitTerrainStream( &stream, cam.pos ) )
+	    cameraContacts.valid = GL_FALSE;
+	  world = stream.resident;
+	}
+      for( k = 0; k < 2; k++ )
+	{
+	  double start = BenchTime();
+	  CollisionAndResponse( iterations, epsilon,
+				&cam, world, objList, objVolumes,
+				nObjs, 0, disp[k] );
+	  latencies[count++] = ( BenchTime() - start ) * 1000000.0;
+	}
+    }
+  return count;
+}
+
+/*** Función: Posición deseada del actor "k" en el cuadro "i" ***/
+// Los actores recorren el círculo de "circle" repartidos en el ángulo
+VECTOR ActorPoint( GLuint k, GLuint i )
+{
+  GLfloat extent = ( terrainSize - 1 ) * cellSpacing;
+  GLfloat radius = extent * 0.35f;
+  GLfloat angle  = 2.0f * M_PI * k / nActors + i * vel * FRAME_TIME / radius;
+  return GroundPoint( extent * 0.5f + radius * cos( angle ),
+		      extent * 0.5f + radius * sin( angle ) );
+}
+
+/*** Función: Mueve todos los actores en lotes y guarda su latencia ***/
+// Cada cuadro son dos lotes: movimiento y gravedad. Siempre sobre el
+// terreno completo. "final" recibe la posición final de cada actor.
+GLuint ReplayActors( WORKERPOOL* pool, GLfloat* latencies, VECTOR* final )
+{
+  GLuint count = 0;
+  unsigned int i, k;
+
+  for( k = 0; k < nActors; k++ )
+    {
+      CAMERA actor = cam;
+      actor.pos = ActorPoint( k, 0 );
+      CreateCameraVolume( actor, cameraAxes, &actorVolumes[k] );
+      actorContacts[k].valid = GL_FALSE;
+    }
+  for( i = 1; i < nFrames; i++ )
+    {
+      for( k = 0; k < nActors; k++ )
+	actors[k].displacement = ResVector( ActorPoint( k, i ),
+					    ActorPoint( k, i - 1 ) );
+      double start = BenchTime();
+      CollisionAndResponseBatch( pool, iterations, epsilon, &terrain,
+				 objList, objVolumes, nObjs, actors, nActors );
+      latencies[count++] = ( BenchTime() - start ) * 1000000.0;
+
+      for( k = 0; k < nActors; k++ )
+	actors[k].displacement = MulVector( gravity, FRAME_TIME );
+      start = BenchTime();
+      CollisionAndResponseBatch( pool, iterations, epsilon, &terrain,
+				 objList, objVolumes, nObjs, actors, nActors );
+      latencies[count++] = ( BenchTime() - start ) * 1000000.0;
+    }
+  for( k = 0; k < nActors; k++ )
+    final[k] = actorVolumes[k].ellipsoid.center;
+  return count;
+}
+
+/*** Función: Imprime una línea del reporte ***/
+void Report( const char* name, GLfloat* latencies, GLuint count )
+{
+  double total = 0.0;
+  unsigned int i;
+  for( i = 0; i < count; i++ )
+    total += latencies[i];
+  qsort( latencies, count, sizeof(GLfloat), CompareLatency );
+  printf( "%-24s %9d %12.0f %9.2f %9.2f %9.2f\n", name, count,
+	  count / ( total / 1000000.0 ), Percentile( latencies, count, 0.5f ),
+	  Percentile( latencies, count, 0.99f ), latencies[count - 1] );
+}
+
+/*** Loop: mide todos los recorridos y termina ***/
+void Loop( float elapsed )
+{
+  GLuint total = 0, count = 0;
+  unsigned int i;
+  for( i = 0; i < nPaths; i++ )
+    total += ( paths[i].count - 1 ) * 2;
+  GLfloat* latencies = malloc( sizeof(GLfloat) * MAXVALUE( total, nFrames * 2 ) );
+  GLfloat* all       = malloc( sizeof(GLfloat) * MAXVALUE( total, 1 ) );
+
+  printf( "%-24s %9s %12s %9s %9s %9s\n", "path", "queries", "queries/s",
+	  "p50(us)", "p99(us)", "max(us)" );
+  for( i = 0; i < nPaths; i++ )
+    {
+      if( paths[i].count < 2 )
+	continue;
+      GLuint n = ReplayPath( &paths[i], latencies );
+      memcpy( &all[count], latencies, sizeof(GLfloat) * n );
+      count += n;
+      Report( paths[i].name, latencies, n );
+    }
+  if( count > 0 )
+    Report( "total", all, count );
+
+  /* Lotes de actores: con hilos y luego sin grupo, deben coincidir */
+  if( nActors > 0 )
+    {
+      VECTOR* threaded = malloc( sizeof(VECTOR) * nActors );
+      VECTOR* serial   = malloc( sizeof(VECTOR) * nActors );
+      GLuint  n        = ReplayActors( &workers, latencies, threaded );
+      char    name[64];
+      snprintf( name, sizeof(name), "batch(%d actors)", nActors );
+      Report( name, latencies, n );
+      ReplayActors( NULL, latencies, serial );
+      if( memcmp( threaded, serial, sizeof(VECTOR) * nActors ) != 0 )
+	{
+	  printf( "batch: threaded and serial positions differ\n" );
+	  exit( 1 );
+	}
+      free( threaded );
+      free( serial );
+    }
+
+  free( latencies );
+  free( all );
+  g_ExitProgram = GL_TRUE;
+}
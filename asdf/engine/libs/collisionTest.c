@@ -0,0 +1,166 @@
+/*****************************/
+/**     ---------------     **/
+/**     collisionTest.c     **/
+/**     ---------------     **/
+/**  CollisionDetectionTri4 **/
+/**  contra la versión      **/
+/**  escalar                **/
+/*****************************/
+
+#include "opengl.c"
+#include "math.c"
+#include "thread.c"
+#include "model.c"
+#include "camera.c"
+#include "shader.c"
+#include "terrain.c"
+#include "collision.c"
+
+/*** Opciones(línea de comandos) ***/
+GLuint nBatches = 1000000;
+GLuint seed     = 1;
+
+/*** Resultados ***/
+GLuint nHits       = 0;
+GLuint nMismatches = 0;
+
+
+/*** Función: Número al azar en [a,b] ***/
+GLfloat RandomRange( GLfloat a, GLfloat b )
+{
+  return a + ( b - a ) * ( rand() / (GLfloat)RAND_MAX );
+}
+
+/*** Función: Punto al azar alrededor de "c" ***/
+VECTOR RandomPoint( VECTOR c, GLfloat radius )
+{
+  VECTOR p = { c.x + RandomRange( -radius, radius ),
+	       c.y + RandomRange( -radius, radius ),
+	       c.z + RandomRange( -radius, radius ) };
+  return p;
+}
+
+/*** Función: Compara floats bit a bit(NaN igual a NaN) ***/
+GLboolean SameFloat( GLfloat a, GLfloat b )
+{
+  return ( isnan( a ) && isnan( b ) ) || memcmp( &a, &b, sizeof(GLfloat) ) == 0;
+}
+
+/*** Función: Uso del programa ***/
+void Usage( void )
+{
+  fprintf( stderr, "usage: %s [-n batches] [-s seed]\n", g_Argv[0] );
+  exit( 1 );
+}
+
+/*** Inicialización de recursos ***/
+void Init( void )
+{
+  /* Opciones */
+  int option;
+  while( ( option = getopt( g_Argc, g_Argv, "n:s:h" ) ) != -1 )
+    switch( option )
+      {
+      case 'n': nBatches = atoi( optarg ); break;
+      case 's': seed     = atoi( optarg ); break;
+      default : Usage();
+      }
+  if( nBatches < 1 )
+    Usage();
+#ifdef __SSE2__
+  printf( "CollisionDetectionTri4(SSE2) vs CollisionDetectionTri, %d batches\n",
+	  nBatches );
+#else
+  printf( "CollisionDetectionTri4(scalar) vs CollisionDetectionTri, %d batches\n",
+	  nBatches );
+#endif
+}
+
+/*** Liberación de recursos ***/
+void Free( void )
+{
+}
+
+/*** Función: Prueba un lote al azar con las dos versiones ***/
+// Cada 7 lotes hay triángulos degenerados y cada 11 el desplazamiento es
+// cero. Algunos lotes empiezan con un tiempo ya encontrado.
+void TestBatch( GLuint index )
+{
+  TRIBATCH batch;
+  VECTOR   tri[4][3];
+  VECTOR   axes   = { RandomRange( 0.5f, 3.0f ), RandomRange( 0.5f, 5.0f ),
+		      RandomRange( 0.5f, 3.0f ) };
+  VECTOR   center = RandomPoint( (VECTOR){ 0.0f, 0.0f, 0.0f }, 5.0f );
+  VECTOR   pos    = RandomPoint( center, 8.0f );
+  VECTOR   disp   = RandomPoint( (VECTOR){ 0.0f, 0.0f, 0.0f }, 6.0f );
+  GLfloat  start  = index % 5 == 0 ? RandomRange( 0.0f, 1.0f ) : INFINITY;
+  unsigned int i, j;
+
+  batch.count = 1 + rand() % 4;
+  for( i = 0; i < batch.count; i++ )
+    {
+      for( j = 0; j < 3; j++ )
+	tri[i][j] = RandomPoint( center, 4.0f );
+      if( index % 7 == 0 )
+	tri[i][2] = tri[i][ rand() % 2 ];
+      SetBatchTriangle( &batch, i, tri[i][0], tri[i][1], tri[i][2] );
+    }
+  if( index % 11 == 0 )
+    disp.x = disp.y = disp.z = 0.0f;
+  VECTOR ePos  = DivVector( pos, axes );
+  VECTOR eDisp = DivVector( disp, axes );
+
+  /* Escalar: un triángulo a la vez, el más temprano en orden */
+  GLfloat   scalarTime  = start;
+  VECTOR    scalarPos   = { NAN, NAN, NAN };
+  GLboolean scalarFound = GL_FALSE;
+  for( i = 0; i < batch.count; i++ )
+    {
+      GLfloat  time = INFINITY;
+      VECTOR   p    = { NAN, NAN, NAN };
+      TRIANGLE eTri = { DivVector( tri[i][0], axes ),
+			DivVector( tri[i][1], axes ),
+			DivVector( tri[i][2], axes ) };
+      if( CollisionDetectionTri( eTri, ePos, eDisp, &time, &p ) && scalarTime > time )
+	{
+	  scalarTime  = time;
+	  scalarPos   = p;
+	  scalarFound = GL_TRUE;
+	}
+    }
+
+  /* Lote */
+  GLfloat   batchTime  = start;
+  VECTOR    batchPos   = { NAN, NAN, NAN };
+  GLboolean batchFound = CollisionDetectionTri4( &batch, axes, ePos, eDisp,
+						 &batchTime, &batchPos );
+
+  if( scalarFound )
+    nHits++;
+  if( scalarFound != batchFound || !SameFloat( scalarTime, batchTime ) ||
+      ( scalarFound && ( !SameFloat( scalarPos.x, batchPos.x ) ||
+			 !SameFloat( scalarPos.y, batchPos.y ) ||
+			 !SameFloat( scalarPos.z, batchPos.z ) ) ) )
+    {
+      if( nMismatches < 10 )
+	printf( "batch %d: hit %d/%d time %.9g/%.9g pos(%g %g %g)/(%g %g %g)\n",
+		index, scalarFound, batchFound, scalarTime, batchTime,
+		scalarPos.x, scalarPos.y, scalarPos.z,
+		batchPos.x, batchPos.y, batchPos.z );
+      nMismatches++;
+    }
+}
+
+/*** Loop: prueba todos los lotes y termina(1 si hay diferencias) ***/
+void Loop( float elapsed )
+{
+  unsigned int i;
+  srand( seed );
+  for( i = 0; i < nBatches; i++ )
+    TestBatch( i );
+
+  printf( "%d hits, %d mismatches\n", nHits, nMismatches );
+  if( nMismatches > 0 )
+    exit( 1 );
+  g_ExitProgram = GL_TRUE;
+}
@@ -1,13 +1,14 @@
 #include "opengl.c"
 #include "openal.c"
 #include "math.c"
+#include "thread.c"
 #include "model.c"
 #include "fonts.c"
 #include "camera.c"
+#include "shader.c"
 #include "terrain.c"
 #include "pSystem.c"
 #include "sprite.c"
-#include "shader.c"
 #include "shadow.c"
 #include "skybox.c"
 #include "collision.c"
@@ -30,6 +31,9 @@ char    fpsText[10];
 char    timeText[15];
 char    collisionText[20];
 char    posText[50];
+char    aimText[60];
+char    cullText[30];
+char    terrainText[50];
 
 /*** Colisiones **/
 GLboolean collision  = GL_FALSE;
@@ -49,6 +53,13 @@ MATERIAL boxMaterial = {BLUE, BLUE, BLACK, BLACK, 0.0f};
 GLuint   nObjs = 2;
 MODEL*   objList[2]    = { NULL, &model };
 VOLUMES* objVolumes[2] = { &cameraVolumes, &modelVolumes };
+AABBTREE objTree; // Árbol de cajas de los objetos
+CONTACTCACHE cameraContacts; // Triángulos cercanos a la cámara
+PICK      aim;                // Lo que hay en la mira(centro de la pantalla)
+GLboolean aiming = GL_FALSE;  // La mira toca algo
+GLuint    visibleObjs[2];     // Objetos dentro del volumen de visión
+CULLSTATS cullStats;          // Conteos del último cuadro
+TERRAINSTATS terrainStats;    // Trozos y triángulos del terreno dibujados
 
 /*** Camara ***/
 CAMERA cam = { {  50.0f, 20.0f, 600.0f }, // pos
@@ -65,6 +76,7 @@ CAMERA cam = { {  50.0f, 20.0f, 600.0f }, // pos
 GLfloat vel = 30.0f; // Velocidad de movimiento
 GLfloat sen = 10.0f; // Sensibilidad del mouse
 VECTOR  cameraAxes = { 2.0f, 5.0f, 2.0f }; // Ejes de elipse rodeante
+FILE*   camPath    = NULL; // Grabación del recorrido(tecla R, collisionBench -p)
 
 /*** Luces ***/
 // Sol
@@ -75,6 +87,11 @@ DIRLIGHT dirLight = { WHITE, WHITE, BLACK,
 /*** Terreno ***/
 TERRAIN  terrain;
 MATERIAL terrainMtrl = {GRAY, GRAY, BLACK, BLACK, 0.0f};
+TERRAINSPLAT terrainSplat; // Arena, pasto y roca por altura y pendiente
+GLboolean    splatting;    // Sin GLSL se usa una sola textura
+
+/*** Hilos de trabajo ***/
+WORKERPOOL workers;
 
 /*** Skybox ***/
 SKYBOX skybox;
@@ -100,8 +117,11 @@ void Init( void )
   fontArial = OpenFont( "arial.ttf", 16 );
   SetFontStyle( fontArial, TTF_STYLE_NORMAL );
 
-  // Modelo
-  LoadModel( "models/Wooden Box.obj", "textures", GL_FALSE, &model );
+  // Hilos para el modelo y el terreno(todos los procesadores)
+  InitWorkerPool( &workers, CountProcessors() - 1 );
+
+  // Modelo(OBJ leído sin assimp)
+  LoadModelOBJ( &workers, "models/Wooden Box.obj", "textures", GL_TRUE, GL_FALSE, &model );
   BoundingVolumes( &model, &modelVolumes, NULL, GL_FALSE );
   // Bounding Box
   boxMaterial.diffuse.a = 0.2f;
@@ -111,10 +131,29 @@ void Init( void )
   
   // Cámara
   CreateCameraVolume( cam, cameraAxes, &cameraVolumes );
+  InitContactCache( &cameraContacts, 5.0f );
+  cameraVolumes.contacts = &cameraContacts;
+
+  // Árbol de objetos
+  InitAABBTree( &objTree, 1.0f );
+  InsertVolumes( &objTree, &cameraVolumes, 0 );
+  InsertVolumes( &objTree, &modelVolumes , 1 );
 
   // Terreno
-  InitTerrain( &terrain, "coastMountain64.raw", "textures/grass.png", 
-	       GL_FALSE, &terrainMtrl, 64, 64, 10.0f, 1.0f );
+  splatting = InitTerrainSplat( &terrainSplat, "textures/WHITEASH.TGA",
+				"textures/grass.png", "textures/bark.jpg",
+				30.0f, 0.35f, 10.0f, 40.0f );
+  if( splatting )
+    {
+      LoadTerrainGeometry( &workers, &terrain, "coastMountain64.raw",
+			   GL_FALSE, 64, 64, 10.0f, 1.0f );
+      terrain.material = terrainMtrl;
+    }
+  else
+    InitTerrain( &workers, &terrain, "coastMountain64.raw", "textures/grass.png", 
+		 GL_FALSE, &terrainMtrl, 64, 64, 10.0f, 1.0f );
+  // Se dibuja con vértices compactos; las consultas siguen en flotantes
+  CompactTerrain( &workers, &terrain );
 
   // Skybox
   InitSkybox( &skybox, "textures/skybox.png" );
@@ -129,14 +168,24 @@ void Free( void )
 
   // Libero el modelo
   FreeModel( &model );
+  FreeVolumes( &modelVolumes );
+  FreeAABBTree( &objTree );
+  FreeContactCache( &cameraContacts );
   glDeleteLists( boundingBox, 1 );
 
-  // Libero el terreno
+  // Libero el terreno y los hilos
   FreeTerrain( &terrain );
+  if( splatting )
+    FreeTerrainSplat( &terrainSplat );
+  FreeWorkerPool( &workers );
 
   // Libero el skybox
   FreeSkybox( &skybox );
 
+  // Cierro la grabación del recorrido
+  if( camPath != NULL )
+    fclose( camPath );
+
   // Último
   FreeOpenAL();
   FreeOpenGL();
@@ -172,6 +221,16 @@ void Input( float elapsed )
 	    case SDLK_a:
 	      cam.strafeinv = GL_FALSE;
 	      break;
+	    case SDLK_r:
+	      // Grabo o dejo de grabar el recorrido de la cámara
+	      if( camPath == NULL )
+		camPath = fopen( "camera.path", "w" );
+	      else
+		{
+		  fclose( camPath );
+		  camPath = NULL;
+		}
+	      break;
 	    default:
 	      PrintError( "Unhandled KEYUP event", GL_TRUE );
 	    }
@@ -196,11 +255,28 @@ void Input( float elapsed )
 	    case SDLK_a:
 	      cam.strafeinv = GL_TRUE;
 	      break;
+	    case SDLK_r:
+	      break;
 	    default:
 	      PrintError( "Unhandled KEYDOWN event", GL_TRUE );
 	    }
 	  break;
 
+	/* Click: cráter donde apunta la mira */
+	case SDL_MOUSEBUTTONDOWN:
+	  break;
+	case SDL_MOUSEBUTTONUP:
+	  if( event.button.button == SDL_BUTTON_LEFT && aiming && aim.object < 0 )
+	    {
+	      TERRAINCRATER crater = { aim.position.x, aim.position.z, 40.0f, 15.0f };
+	      BOX area = { { crater.x - crater.radius, 0.0f, crater.z - crater.radius },
+			   { crater.x + crater.radius, 0.0f, crater.z + crater.radius } };
+	      BOX dirty;
+	      if( DeformTerrain( &terrain, area, CraterBrush, &crater, &dirty ) )
+		InvalidateContactCache( &cameraContacts, dirty );
+	    }
+	  break;
+
 	/* Movimiento del mouse */
 	case SDL_MOUSEMOTION:
 	  {
@@ -236,8 +312,9 @@ void Logic( float elapsed )
   if( !passed )
     {
       // Escalación
-      glScalef( 4.0f, 4.0f, 4.0f );
-      BoundingVolumes( objList[1], objVolumes[1], NULL, GL_FALSE );
+      GLfloat scale[16];
+      ScaleMatrix( 4.0f, 4.0f, 4.0f, scale );
+      BoundingVolumes( objList[1], objVolumes[1], scale, GL_FALSE );
       // Traslación
       VECTOR disp = { 50.0f, GetHeight( &terrain, 50.0f, 550.0f ), 550.0f };
       UpdateVolumes( objVolumes[1], disp );
@@ -282,6 +359,15 @@ void Logic( float elapsed )
 			&cam, &terrain, objList, objVolumes,
 			nObjs, 0, disp );
 
+  /* Mira: rayo desde el centro de la pantalla, sin leer el z-buffer */
+  RAY ray = CameraRay( &cam, 45.0f, WIDTH, HEIGHT, WIDTH / 2, HEIGHT / 2 );
+  aiming  = PickScene( &terrain, objList, objVolumes, nObjs,
+		       ray, 1500.0f, &aim );
+
+  /* Grabación del recorrido */
+  if( camPath != NULL )
+    fprintf( camPath, "%f %f %f\n", cam.pos.x, cam.pos.y, cam.pos.z );
+
   /* Tiempo total transcurrido */
   totalTime += elapsed;
 }
@@ -317,22 +403,40 @@ void Video( float elapsed )
   SetDirLight( GL_LIGHT0, &dirLight );
   glEnable( GL_LIGHT0 );
   
-  /*** Modelo ***/
-  glPushMatrix();
+  /*** Modelos visibles ***/
+  FRUSTUM frustum = CameraFrustum( &cam, 45.0f, (GLfloat)WIDTH / (GLfloat)HEIGHT,
+				   1.0f, 1500.0f );
+  GLuint  nVisible = CullVolumes( &frustum, objVolumes, nObjs, visibleObjs,
+				  &cullStats );
+  unsigned int i;
+  for( i = 0; i < nVisible; i++ )
+    {
+      GLuint obj = visibleObjs[i];
+      if( objList[obj] == NULL ) // La cámara
+	continue;
+      glPushMatrix();
 
-  glMultTransposeMatrixf( modelVolumes.matrix );
-  glCallList( model.modelList );
-  //glCallList( boundingBox );
+      glMultTransposeMatrixf( objVolumes[obj]->matrix );
+      DrawModel( objList[obj] );
+      //glCallList( boundingBox );
 
-  glPopMatrix();
+      glPopMatrix();
+    }
   /*________*/
 
   /*** Terreno ***/
   glPushMatrix(); // Guardo la cámara
 
+  SelectTerrainLOD( &terrain, cam.pos, &frustum,
+		    TerrainLODFactor( 45.0f, HEIGHT, 2.0f ), &terrainStats );
   SetMaterial( &terrain.material );
-  glBindTexture( GL_TEXTURE_2D, terrain.textureID );
-  glCallList( terrain.terrainList );
+  if( splatting )
+    RenderTerrainSplat( &terrain, &terrainSplat );
+  else
+    {
+      glBindTexture( GL_TEXTURE_2D, terrain.textureID );
+      RenderTerrain( &terrain );
+    }
 
   glPopMatrix(); // Restauro la cámara
   /*________*/
@@ -351,7 +455,7 @@ void Video( float elapsed )
   /* Time */
   sprintf( timeText, "Time: %.2fs", totalTime );
   RenderText( timeText, fontArial, 0,
-  	      GetFontLineSkip( fontArial ), &fontColor, GL_FALSE );
+	      GetFontLineSkip( fontArial ), &fontColor, GL_FALSE );
 
   /* Colisión */
   sprintf( collisionText, "Near: %s", near ? "True" : "False" );
@@ -373,6 +477,25 @@ void Video( float elapsed )
 	   modelVolumes.sphere.center.z );
   RenderText( posText, fontArial, WIDTH - 280,
 	      GetFontLineSkip( fontArial ) , &fontColor, GL_FALSE );
+
+  /* Mira */
+  if( aiming )
+    sprintf( aimText, "Aim: %s x=%.1f y=%.1f z=%.1f",
+	     aim.object < 0 ? "terrain" : "model",
+	     aim.position.x, aim.position.y, aim.position.z );
+  else
+    sprintf( aimText, "Aim: nothing" );
+  RenderText( aimText, fontArial, WIDTH - 280,
+	      GetFontLineSkip( fontArial ) * 2, &fontColor, GL_FALSE );
+
+  /* Objetos visibles */
+  sprintf( cullText, "Visible: %d/%d", cullStats.visible, cullStats.tested );
+  RenderText( cullText, fontArial, WIDTH - 280,
+	      GetFontLineSkip( fontArial ) * 3, &fontColor, GL_FALSE );
+  sprintf( terrainText, "Terrain: %d/%d chunks, %d tris", terrainStats.visible,
+	   terrainStats.chunks, terrainStats.triangles );
+  RenderText( terrainText, fontArial, WIDTH - 280,
+	      GetFontLineSkip( fontArial ) * 4, &fontColor, GL_FALSE );
     
   /* Ejecutar comandos en cola */
   glFlush();
@@ -36,6 +36,16 @@
 #define MAXVALUE(x,y) (x > y ? x : y )
 #define INTERVAL(x) (x >= 0.0f && x <= 1.0f)
 
+/*** Resultado de las pruebas contra el volumen de visión ***/
+#define FRUSTUM_OUTSIDE   0
+#define FRUSTUM_INTERSECT 1
+#define FRUSTUM_INSIDE    2
+
+/*** Versión AVX de las operaciones en lote(se elige al arrancar) ***/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_AVX 1
+#endif
+
 /*_______*/
 
 
@@ -116,6 +126,46 @@ typedef struct box
     VECTOR max; // Extremo máximo
 } BOX;
 
+/*** Estructura de Dato: QUATERNION ***/
+typedef struct quaternion
+{
+    GLfloat x, y, z; // Parte vectorial
+    GLfloat w;       // Parte escalar
+} QUATERNION;
+
+/*** Estructura de Dato: FRUSTUM ***/
+// Volumen de visión: izquierdo, derecho, abajo, arriba, cercano y lejano,
+// con las normales hacia adentro(n.p + d >= 0 dentro)
+typedef struct frustum
+{
+    PLANE planes[6];
+} FRUSTUM;
+
+/*** Estructura de Dato: VECTORARRAY ***/
+// Vectores en columnas(SoA), cada columna alineada a 32 bytes
+typedef struct vectorarray
+{
+    GLfloat* x;     // Componentes x
+    GLfloat* y;     // Componentes y
+    GLfloat* z;     // Componentes z
+    GLuint   count; // Número de vectores
+} VECTORARRAY;
+
+/*** Estructura de Dato: VECTORKERNELS ***/
+// Versión de las operaciones en lote(escalar, SSE2 o AVX)
+typedef struct vectorkernels
+{
+    const char* name;
+    void (*transform)( const GLfloat*, const VECTORARRAY*, VECTORARRAY*,
+		       GLuint );
+    void (*dot)      ( const VECTORARRAY*, const VECTORARRAY*, GLfloat*,
+		       GLuint );
+    void (*cross)    ( const VECTORARRAY*, const VECTORARRAY*, VECTORARRAY*,
+		       GLuint );
+    void (*normalize)( const VECTORARRAY*, VECTORARRAY*, GLuint );
+    void (*bound)    ( const VECTORARRAY*, BOX*, GLuint );
+} VECTORKERNELS;
+
 /*** Estructura de Dato: NORMAL_VERTEX ***/
 typedef struct normal_tex_vertex
 {
@@ -345,14 +395,11 @@ VECTOR TransformCoordFromMatrix( VECTOR v, GLfloat* M )
   return res;
 }
 
-/*** Función: Transforma un punto en base a la matriz del espacio visual  ***/
-VECTOR TransformCoord( VECTOR v )
+/*** Función: Transforma un punto con una matriz en el orden de opengl ***/
+VECTOR TransformCoord( VECTOR v, GLfloat* M )
 {
-  GLfloat M[16];
   VECTOR res;
   
-  glGetFloatv( GL_MODELVIEW_MATRIX, M );
-  
   res.x = (v.x * M[0] + v.y * M[4] + v.z * M[ 8] + M[12]);
   res.y = (v.x * M[1] + v.y * M[5] + v.z * M[ 9] + M[13]);
   res.z = (v.x * M[2] + v.y * M[6] + v.z * M[10] + M[14]);
@@ -377,6 +424,596 @@ void PrintError( const char* msg, GLboolean warning )
 
 /*---------------*/
 
+/*--- MATRICES Y CUATERNIONES ---*/
+// Matrices de 4x4 por filas(la transpuesta de opengl) como en VOLUMES:
+// la traslación va en M[3], M[7] y M[11]
+
+/*** Función: Cuaternión de un giro de "angle" grados en "axis" ***/
+QUATERNION AxisAngleQuaternion( GLfloat angle, VECTOR axis )
+{
+  QUATERNION q = { 0.0f, 0.0f, 0.0f, 1.0f };
+  GLfloat    norm = NormVector( axis );
+  if( norm == 0.0f )
+    return q;
+
+  GLfloat half = angle * (GLfloat)M_PI / 360.0f;
+  GLfloat s    = sinf( half ) / norm;
+  q.x = axis.x * s;
+  q.y = axis.y * s;
+  q.z = axis.z * s;
+  q.w = cosf( half );
+  return q;
+}
+
+/*** Función: Producto de cuaterniones(primero gira q2, luego q1) ***/
+QUATERNION MulQuaternion( QUATERNION q1, QUATERNION q2 )
+{
+  QUATERNION res;
+  res.x = q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y;
+  res.y = q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x;
+  res.z = q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w;
+  res.w = q1.w * q2.w - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z;
+  return res;
+}
+
+/*** Función: Normaliza un cuaternión ***/
+QUATERNION NormalizeQuaternion( QUATERNION q )
+{
+  GLfloat norm = sqrtf( q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w );
+  q.x /= norm;
+  q.y /= norm;
+  q.z /= norm;
+  q.w /= norm;
+  return q;
+}
+
+/*** Función: Gira un vector con un cuaternión unitario ***/
+VECTOR RotateVector( QUATERNION q, VECTOR v )
+{
+  // v' = v + 2w(u x v) + 2u x (u x v)
+  VECTOR u = { q.x, q.y, q.z };
+  VECTOR t = MulVector( CrossProduct( u, v ), 2.0f );
+  return SumVector( SumVector( v, MulVector( t, q.w ) ), CrossProduct( u, t ) );
+}
+
+/*** Función: Matriz identidad ***/
+void IdentityMatrix( GLfloat* M )
+{
+  memset( M, 0, sizeof(GLfloat) * 16 );
+  M[0] = M[5] = M[10] = M[15] = 1.0f;
+}
+
+/*** Función: Matriz de traslación(como glTranslatef) ***/
+void TranslationMatrix( GLfloat x, GLfloat y, GLfloat z, GLfloat* M )
+{
+  IdentityMatrix( M );
+  M[3]  = x;
+  M[7]  = y;
+  M[11] = z;
+}
+
+/*** Función: Matriz de escalación(como glScalef) ***/
+void ScaleMatrix( GLfloat x, GLfloat y, GLfloat z, GLfloat* M )
+{
+  IdentityMatrix( M );
+  M[0]  = x;
+  M[5]  = y;
+  M[10] = z;
+}
+
+/*** Función: Matriz de giro de un cuaternión unitario ***/
+void QuaternionMatrix( QUATERNION q, GLfloat* M )
+{
+  IdentityMatrix( M );
+  M[0]  = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
+  M[1]  =        2.0f * (q.x * q.y - q.z * q.w);
+  M[2]  =        2.0f * (q.x * q.z + q.y * q.w);
+  M[4]  =        2.0f * (q.x * q.y + q.z * q.w);
+  M[5]  = 1.0f - 2.0f * (q.x * q.x + q.z * q.z);
+  M[6]  =        2.0f * (q.y * q.z - q.x * q.w);
+  M[8]  =        2.0f * (q.x * q.z - q.y * q.w);
+  M[9]  =        2.0f * (q.y * q.z + q.x * q.w);
+  M[10] = 1.0f - 2.0f * (q.x * q.x + q.y * q.y);
+}
+
+/*** Función: Matriz de giro de "angle" grados en "axis"(como glRotatef) ***/
+void RotationMatrix( GLfloat angle, VECTOR axis, GLfloat* M )
+{
+  QuaternionMatrix( AxisAngleQuaternion( angle, axis ), M );
+}
+
+/*** Función: Multiplica dos matrices, R = A * B(como glMultMatrix) ***/
+// R puede ser A o B
+void MultiplyMatrix( const GLfloat* A, const GLfloat* B, GLfloat* R )
+{
+  GLfloat T[16];
+  unsigned int i;
+#ifdef __SSE2__
+  // Cada fila de R es una combinación de las filas de B
+  __m128 b0 = _mm_loadu_ps( B     ), b1 = _mm_loadu_ps( B + 4  );
+  __m128 b2 = _mm_loadu_ps( B + 8 ), b3 = _mm_loadu_ps( B + 12 );
+  for( i = 0; i < 4; i++ )
+    {
+      const GLfloat* a = A + 4 * i;
+      __m128 row = _mm_mul_ps( _mm_set1_ps( a[0] ), b0 );
+      row = _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( a[1] ), b1 ) );
+      row = _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( a[2] ), b2 ) );
+      row = _mm_add_ps( row, _mm_mul_ps( _mm_set1_ps( a[3] ), b3 ) );
+      _mm_storeu_ps( T + 4 * i, row );
+    }
+#else
+  unsigned int j;
+  for( i = 0; i < 4; i++ )
+    for( j = 0; j < 4; j++ )
+      T[4*i+j] = A[4*i  ] * B[j  ] + A[4*i+1] * B[j+4 ] +
+		 A[4*i+2] * B[j+8] + A[4*i+3] * B[j+12];
+#endif
+  memcpy( R, T, sizeof(GLfloat) * 16 );
+}
+
+/*** Función: Cota de la mayor escala de la parte lineal de una matriz ***/
+// Gershgorin sobre los productos punto de las columnas: exacta si son
+// ortogonales(giro y escalación), mayor si hay deformación
+GLfloat MatrixScale( const GLfloat* M )
+{
+  VECTOR  c0 = { M[0], M[4], M[ 8] };
+  VECTOR  c1 = { M[1], M[5], M[ 9] };
+  VECTOR  c2 = { M[2], M[6], M[10] };
+  GLfloat d01 = fabsf( DotProduct( c0, c1 ) );
+  GLfloat d02 = fabsf( DotProduct( c0, c2 ) );
+  GLfloat d12 = fabsf( DotProduct( c1, c2 ) );
+  GLfloat r0  = Norm2Vector( c0 ) + d01 + d02;
+  GLfloat r1  = Norm2Vector( c1 ) + d01 + d12;
+  GLfloat r2  = Norm2Vector( c2 ) + d02 + d12;
+  return sqrt( MAXVALUE( r0, MAXVALUE( r1, r2 ) ) );
+}
+
+/*** Función: Transpone una matriz(pasa del orden de opengl al de filas) ***/
+// R puede ser M
+void TransposeMatrix( const GLfloat* M, GLfloat* R )
+{
+  GLfloat T[16];
+  unsigned int i, j;
+  for( i = 0; i < 4; i++ )
+    for( j = 0; j < 4; j++ )
+      T[4*j+i] = M[4*i+j];
+  memcpy( R, T, sizeof(GLfloat) * 16 );
+}
+
+/*---------------*/
+
+/*--- LOTES DE VECTORES(SoA) ---*/
+// Cada operación tiene una versión escalar que procesa desde "first" hasta
+// el final; las versiones SSE2/AVX procesan bloques de 4/8 y dejan el resto
+// a la escalar. Los resultados son iguales a los de las funciones de arriba.
+
+/*** Función: Reserva un arreglo de "count" vectores ***/
+GLboolean InitVectorArray( VECTORARRAY* array, GLuint count )
+{
+  size_t column = ((size_t)count + 7) & ~(size_t)7; // Múltiplo de 8
+  void*  data   = NULL;
+
+  memset( array, 0, sizeof(VECTORARRAY) );
+  if( posix_memalign( &data, 32, sizeof(GLfloat) * 3 * (column ? column : 8) ) )
+    {
+      PrintError( "Could not allocate the vector array", GL_FALSE );
+      return GL_FALSE;
+    }
+  array->x     = data;
+  array->y     = array->x + column;
+  array->z     = array->y + column;
+  array->count = count;
+  return GL_TRUE;
+}
+
+/*** Función: Libera un arreglo de vectores ***/
+void FreeVectorArray( VECTORARRAY* array )
+{
+  free( array->x );
+  memset( array, 0, sizeof(VECTORARRAY) );
+}
+
+/*** Función: Copia "count" vectores(AoS) a un arreglo ***/
+void LoadVectorArray( VECTORARRAY* array, const VECTOR* v, GLuint count )
+{
+  unsigned int i;
+  for( i = 0; i < count; i++ )
+    {
+      array->x[i] = v[i].x;
+      array->y[i] = v[i].y;
+      array->z[i] = v[i].z;
+    }
+}
+
+/*** Función: Vector "i" de un arreglo ***/
+VECTOR GetVectorArray( const VECTORARRAY* array, GLuint i )
+{
+  VECTOR v = { array->x[i], array->y[i], array->z[i] };
+  return v;
+}
+
+/*** Función: Transforma puntos con una matriz por filas(escalar) ***/
+void TransformVectorsC( const GLfloat* M, const VECTORARRAY* in,
+			VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i < in->count; i++ )
+    {
+      VECTOR v = TransformCoordFromMatrix( GetVectorArray( in, i ),
+					   (GLfloat*)M );
+      out->x[i] = v.x;
+      out->y[i] = v.y;
+      out->z[i] = v.z;
+    }
+}
+
+/*** Función: Productos punto(escalar) ***/
+void DotVectorsC( const VECTORARRAY* a, const VECTORARRAY* b, GLfloat* out,
+		  GLuint first )
+{
+  unsigned int i;
+  for( i = first; i < a->count; i++ )
+    out[i] = DotProduct( GetVectorArray( a, i ), GetVectorArray( b, i ) );
+}
+
+/*** Función: Productos cruz(escalar) ***/
+void CrossVectorsC( const VECTORARRAY* a, const VECTORARRAY* b,
+		    VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i < a->count; i++ )
+    {
+      VECTOR v = CrossProduct( GetVectorArray( a, i ), GetVectorArray( b, i ) );
+      out->x[i] = v.x;
+      out->y[i] = v.y;
+      out->z[i] = v.z;
+    }
+}
+
+/*** Función: Normaliza vectores(escalar) ***/
+void NormalizeVectorsC( const VECTORARRAY* in, VECTORARRAY* out,
+			GLuint first )
+{
+  unsigned int i;
+  for( i = first; i < in->count; i++ )
+    {
+      VECTOR v = NormalizeVector( GetVectorArray( in, i ) );
+      out->x[i] = v.x;
+      out->y[i] = v.y;
+      out->z[i] = v.z;
+    }
+}
+
+/*** Función: Extiende una caja con los puntos(escalar) ***/
+void BoundVectorsC( const VECTORARRAY* in, BOX* box, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i < in->count; i++ )
+    {
+      box->min.x = MINVALUE( in->x[i], box->min.x );
+      box->min.y = MINVALUE( in->y[i], box->min.y );
+      box->min.z = MINVALUE( in->z[i], box->min.z );
+      box->max.x = MAXVALUE( in->x[i], box->max.x );
+      box->max.y = MAXVALUE( in->y[i], box->max.y );
+      box->max.z = MAXVALUE( in->z[i], box->max.z );
+    }
+}
+
+#ifdef __SSE2__
+#define SIMD_DOT(ax,ay,az,bx,by,bz) \
+  _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ), \
+	      _mm_mul_ps( az, bz ) )
+
+/*** Función: Transforma puntos con una matriz por filas(SSE2) ***/
+void TransformVectorsSSE( const GLfloat* M, const VECTORARRAY* in,
+			  VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 4 <= in->count; i += 4 )
+    {
+      __m128 x = _mm_load_ps( in->x + i );
+      __m128 y = _mm_load_ps( in->y + i );
+      __m128 z = _mm_load_ps( in->z + i );
+#define SSE_ROW(r) _mm_add_ps( _mm_add_ps( _mm_add_ps(			\
+	  _mm_mul_ps( x, _mm_set1_ps( M[r  ] ) ),			\
+	  _mm_mul_ps( y, _mm_set1_ps( M[r+1] ) ) ),			\
+	  _mm_mul_ps( z, _mm_set1_ps( M[r+2] ) ) ), _mm_set1_ps( M[r+3] ) )
+      _mm_store_ps( out->x + i, SSE_ROW(0) );
+      _mm_store_ps( out->y + i, SSE_ROW(4) );
+      _mm_store_ps( out->z + i, SSE_ROW(8) );
+#undef SSE_ROW
+    }
+  TransformVectorsC( M, in, out, i );
+}
+
+/*** Función: Productos punto(SSE2) ***/
+void DotVectorsSSE( const VECTORARRAY* a, const VECTORARRAY* b, GLfloat* out,
+		    GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 4 <= a->count; i += 4 )
+    _mm_storeu_ps( out + i, SIMD_DOT( _mm_load_ps( a->x + i ),
+				      _mm_load_ps( a->y + i ),
+				      _mm_load_ps( a->z + i ),
+				      _mm_load_ps( b->x + i ),
+				      _mm_load_ps( b->y + i ),
+				      _mm_load_ps( b->z + i ) ) );
+  DotVectorsC( a, b, out, i );
+}
+
+/*** Función: Productos cruz(SSE2) ***/
+void CrossVectorsSSE( const VECTORARRAY* a, const VECTORARRAY* b,
+		      VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 4 <= a->count; i += 4 )
+    {
+      __m128 ax = _mm_load_ps( a->x + i ), bx = _mm_load_ps( b->x + i );
+      __m128 ay = _mm_load_ps( a->y + i ), by = _mm_load_ps( b->y + i );
+      __m128 az = _mm_load_ps( a->z + i ), bz = _mm_load_ps( b->z + i );
+      _mm_store_ps( out->x + i, _mm_sub_ps( _mm_mul_ps( ay, bz ),
+					    _mm_mul_ps( az, by ) ) );
+      _mm_store_ps( out->y + i, _mm_sub_ps( _mm_mul_ps( az, bx ),
+					    _mm_mul_ps( ax, bz ) ) );
+      _mm_store_ps( out->z + i, _mm_sub_ps( _mm_mul_ps( ax, by ),
+					    _mm_mul_ps( ay, bx ) ) );
+    }
+  CrossVectorsC( a, b, out, i );
+}
+
+/*** Función: Normaliza vectores(SSE2) ***/
+void NormalizeVectorsSSE( const VECTORARRAY* in, VECTORARRAY* out,
+			  GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 4 <= in->count; i += 4 )
+    {
+      __m128 x = _mm_load_ps( in->x + i );
+      __m128 y = _mm_load_ps( in->y + i );
+      __m128 z = _mm_load_ps( in->z + i );
+      __m128 n = _mm_sqrt_ps( SIMD_DOT( x, y, z, x, y, z ) );
+      _mm_store_ps( out->x + i, _mm_div_ps( x, n ) );
+      _mm_store_ps( out->y + i, _mm_div_ps( y, n ) );
+      _mm_store_ps( out->z + i, _mm_div_ps( z, n ) );
+    }
+  NormalizeVectorsC( in, out, i );
+}
+
+/*** Función: Extiende una caja con los puntos(SSE2) ***/
+void BoundVectorsSSE( const VECTORARRAY* in, BOX* box, GLuint first )
+{
+  unsigned int i = first;
+  if( i + 4 <= in->count )
+    {
+      GLfloat lane[6][4];
+      unsigned int j;
+      __m128 minX = _mm_load_ps( in->x + i ), maxX = minX;
+      __m128 minY = _mm_load_ps( in->y + i ), maxY = minY;
+      __m128 minZ = _mm_load_ps( in->z + i ), maxZ = minZ;
+      for( i += 4; i + 4 <= in->count; i += 4 )
+	{
+	  __m128 x = _mm_load_ps( in->x + i );
+	  __m128 y = _mm_load_ps( in->y + i );
+	  __m128 z = _mm_load_ps( in->z + i );
+	  minX = _mm_min_ps( minX, x ); maxX = _mm_max_ps( maxX, x );
+	  minY = _mm_min_ps( minY, y ); maxY = _mm_max_ps( maxY, y );
+	  minZ = _mm_min_ps( minZ, z ); maxZ = _mm_max_ps( maxZ, z );
+	}
+      _mm_storeu_ps( lane[0], minX ); _mm_storeu_ps( lane[1], maxX );
+      _mm_storeu_ps( lane[2], minY ); _mm_storeu_ps( lane[3], maxY );
+      _mm_storeu_ps( lane[4], minZ ); _mm_storeu_ps( lane[5], maxZ );
+      for( j = 0; j < 4; j++ )
+	{
+	  box->min.x = MINVALUE( lane[0][j], box->min.x );
+	  box->max.x = MAXVALUE( lane[1][j], box->max.x );
+	  box->min.y = MINVALUE( lane[2][j], box->min.y );
+	  box->max.y = MAXVALUE( lane[3][j], box->max.y );
+	  box->min.z = MINVALUE( lane[4][j], box->min.z );
+	  box->max.z = MAXVALUE( lane[5][j], box->max.z );
+	}
+    }
+  BoundVectorsC( in, box, i );
+}
+#endif
+
+#ifdef VECTOR_AVX
+/*** Función: Transforma puntos con una matriz por filas(AVX) ***/
+__attribute__((target("avx")))
+void TransformVectorsAVX( const GLfloat* M, const VECTORARRAY* in,
+			  VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 8 <= in->count; i += 8 )
+    {
+      __m256 x = _mm256_load_ps( in->x + i );
+      __m256 y = _mm256_load_ps( in->y + i );
+      __m256 z = _mm256_load_ps( in->z + i );
+#define AVX_ROW(r) _mm256_add_ps( _mm256_add_ps( _mm256_add_ps(		\
+	  _mm256_mul_ps( x, _mm256_set1_ps( M[r  ] ) ),			\
+	  _mm256_mul_ps( y, _mm256_set1_ps( M[r+1] ) ) ),		\
+	  _mm256_mul_ps( z, _mm256_set1_ps( M[r+2] ) ) ),		\
+	  _mm256_set1_ps( M[r+3] ) )
+      _mm256_store_ps( out->x + i, AVX_ROW(0) );
+      _mm256_store_ps( out->y + i, AVX_ROW(4) );
+      _mm256_store_ps( out->z + i, AVX_ROW(8) );
+#undef AVX_ROW
+    }
+  TransformVectorsC( M, in, out, i );
+}
+
+#define AVX_DOT(ax,ay,az,bx,by,bz)					\
+  _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ax, bx ),		\
+				_mm256_mul_ps( ay, by ) ),		\
+		 _mm256_mul_ps( az, bz ) )
+
+/*** Función: Productos punto(AVX) ***/
+__attribute__((target("avx")))
+void DotVectorsAVX( const VECTORARRAY* a, const VECTORARRAY* b, GLfloat* out,
+		    GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 8 <= a->count; i += 8 )
+    _mm256_storeu_ps( out + i, AVX_DOT( _mm256_load_ps( a->x + i ),
+					_mm256_load_ps( a->y + i ),
+					_mm256_load_ps( a->z + i ),
+					_mm256_load_ps( b->x + i ),
+					_mm256_load_ps( b->y + i ),
+					_mm256_load_ps( b->z + i ) ) );
+  DotVectorsC( a, b, out, i );
+}
+
+/*** Función: Productos cruz(AVX) ***/
+__attribute__((target("avx")))
+void CrossVectorsAVX( const VECTORARRAY* a, const VECTORARRAY* b,
+		      VECTORARRAY* out, GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 8 <= a->count; i += 8 )
+    {
+      __m256 ax = _mm256_load_ps( a->x + i ), bx = _mm256_load_ps( b->x + i );
+      __m256 ay = _mm256_load_ps( a->y + i ), by = _mm256_load_ps( b->y + i );
+      __m256 az = _mm256_load_ps( a->z + i ), bz = _mm256_load_ps( b->z + i );
+      _mm256_store_ps( out->x + i, _mm256_sub_ps( _mm256_mul_ps( ay, bz ),
+						  _mm256_mul_ps( az, by ) ) );
+      _mm256_store_ps( out->y + i, _mm256_sub_ps( _mm256_mul_ps( az, bx ),
+						  _mm256_mul_ps( ax, bz ) ) );
+      _mm256_store_ps( out->z + i, _mm256_sub_ps( _mm256_mul_ps( ax, by ),
+						  _mm256_mul_ps( ay, bx ) ) );
+    }
+  CrossVectorsC( a, b, out, i );
+}
+
+/*** Función: Normaliza vectores(AVX) ***/
+__attribute__((target("avx")))
+void NormalizeVectorsAVX( const VECTORARRAY* in, VECTORARRAY* out,
+			  GLuint first )
+{
+  unsigned int i;
+  for( i = first; i + 8 <= in->count; i += 8 )
+    {
+      __m256 x = _mm256_load_ps( in->x + i );
+      __m256 y = _mm256_load_ps( in->y + i );
+      __m256 z = _mm256_load_ps( in->z + i );
+      __m256 n = _mm256_sqrt_ps( AVX_DOT( x, y, z, x, y, z ) );
+      _mm256_store_ps( out->x + i, _mm256_div_ps( x, n ) );
+      _mm256_store_ps( out->y + i, _mm256_div_ps( y, n ) );
+      _mm256_store_ps( out->z + i, _mm256_div_ps( z, n ) );
+    }
+  NormalizeVectorsC( in, out, i );
+}
+
+/*** Función: Extiende una caja con los puntos(AVX) ***/
+__attribute__((target("avx")))
+void BoundVectorsAVX( const VECTORARRAY* in, BOX* box, GLuint first )
+{
+  unsigned int i = first;
+  if( i + 8 <= in->count )
+    {
+      GLfloat lane[6][8];
+      unsigned int j;
+      __m256 minX = _mm256_load_ps( in->x + i ), maxX = minX;
+      __m256 minY = _mm256_load_ps( in->y + i ), maxY = minY;
+      __m256 minZ = _mm256_load_ps( in->z + i ), maxZ = minZ;
+      for( i += 8; i + 8 <= in->count; i += 8 )
+	{
+	  __m256 x = _mm256_load_ps( in->x + i );
+	  __m256 y = _mm256_load_ps( in->y + i );
+	  __m256 z = _mm256_load_ps( in->z + i );
+	  minX = _mm256_min_ps( minX, x ); maxX = _mm256_max_ps( maxX, x );
+	  minY = _mm256_min_ps( minY, y ); maxY = _mm256_max_ps( maxY, y );
+	  minZ = _mm256_min_ps( minZ, z ); maxZ = _mm256_max_ps( maxZ, z );
+	}
+      _mm256_storeu_ps( lane[0], minX ); _mm256_storeu_ps( lane[1], maxX );
+      _mm256_storeu_ps( lane[2], minY ); _mm256_storeu_ps( lane[3], maxY );
+      _mm256_storeu_ps( lane[4], minZ ); _mm256_storeu_ps( lane[5], maxZ );
+      for( j = 0; j < 8; j++ )
+	{
+	  box->min.x = MINVALUE( lane[0][j], box->min.x );
+	  box->max.x = MAXVALUE( lane[1][j], box->max.x );
+	  box->min.y = MINVALUE( lane[2][j], box->min.y );
+	  box->max.y = MAXVALUE( lane[3][j], box->max.y );
+	  box->min.z = MINVALUE( lane[4][j], box->min.z );
+	  box->max.z = MAXVALUE( lane[5][j], box->max.z );
+	}
+    }
+  BoundVectorsC( in, box, i );
+}
+#endif
+
+/*** Versiones de las operaciones en lote ***/
+const VECTORKERNELS scalarKernels = { "escalar", TransformVectorsC,
+				      DotVectorsC, CrossVectorsC,
+				      NormalizeVectorsC, BoundVectorsC };
+#ifdef __SSE2__
+const VECTORKERNELS sseKernels    = { "SSE2", TransformVectorsSSE,
+				      DotVectorsSSE, CrossVectorsSSE,
+				      NormalizeVectorsSSE, BoundVectorsSSE };
+#endif
+#ifdef VECTOR_AVX
+const VECTORKERNELS avxKernels    = { "AVX", TransformVectorsAVX,
+				      DotVectorsAVX, CrossVectorsAVX,
+				      NormalizeVectorsAVX, BoundVectorsAVX };
+#endif
+
+/*** Versión en uso(escalar hasta llamar a InitVectorKernels) ***/
+VECTORKERNELS vectorKernels = { "escalar", TransformVectorsC,
+				DotVectorsC, CrossVectorsC,
+				NormalizeVectorsC, BoundVectorsC };
+
+/*** Función: Elige la versión de las operaciones en lote ***/
+void InitVectorKernels( void )
+{
+  vectorKernels = scalarKernels;
+#ifdef __SSE2__
+  vectorKernels = sseKernels;
+#endif
+#ifdef VECTOR_AVX
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx" ) )
+    vectorKernels = avxKernels;
+#endif
+}
+
+/*** Función: out[i] = M * in[i](M por filas, out puede ser in) ***/
+void TransformVectors( const GLfloat* M, const VECTORARRAY* in,
+		       VECTORARRAY* out )
+{
+  out->count = in->count;
+  vectorKernels.transform( M, in, out, 0 );
+}
+
+/*** Función: out[i] = a[i] . b[i] ***/
+void DotVectors( const VECTORARRAY* a, const VECTORARRAY* b, GLfloat* out )
+{
+  vectorKernels.dot( a, b, out, 0 );
+}
+
+/*** Función: out[i] = a[i] x b[i](out puede ser a o b) ***/
+void CrossVectors( const VECTORARRAY* a, const VECTORARRAY* b,
+		   VECTORARRAY* out )
+{
+  out->count = a->count;
+  vectorKernels.cross( a, b, out, 0 );
+}
+
+/*** Función: out[i] = in[i] / |in[i]|(out puede ser in) ***/
+void NormalizeVectors( const VECTORARRAY* in, VECTORARRAY* out )
+{
+  out->count = in->count;
+  vectorKernels.normalize( in, out, 0 );
+}
+
+/*** Función: Caja mínima de los puntos(vacía si no hay puntos) ***/
+BOX BoundVectors( const VECTORARRAY* in )
+{
+  BOX box = { {  INFINITY,  INFINITY,  INFINITY },
+	      { -INFINITY, -INFINITY, -INFINITY } };
+  vectorKernels.bound( in, &box, 0 );
+  return box;
+}
+
+/*---------------*/
+
 /*** Función: Verifica si un punto está dentro de una caja ***/
 GLboolean PointInsideBox( BOX b, VECTOR p )
 {
@@ -385,15 +1022,120 @@ GLboolean PointInsideBox( BOX b, VECTOR p )
 	  ( p.z >= b.min.z && p.z <= b.max.z ) );
 }
 
+/*** Función: Verifica si 2 cajas se solapan ***/
+GLboolean BoxOverlap( BOX b1, BOX b2 )
+{
+  return( ( b1.min.x <= b2.max.x && b1.max.x >= b2.min.x ) &&
+	  ( b1.min.y <= b2.max.y && b1.max.y >= b2.min.y ) &&
+	  ( b1.min.z <= b2.max.z && b1.max.z >= b2.min.z ) );
+}
+
+/*** Función: Verifica si una caja contiene completamente a otra ***/
+GLboolean BoxContains( BOX outer, BOX inner )
+{
+  return( outer.min.x <= inner.min.x && outer.max.x >= inner.max.x &&
+	  outer.min.y <= inner.min.y && outer.max.y >= inner.max.y &&
+	  outer.min.z <= inner.min.z && outer.max.z >= inner.max.z );
+}
+
+/*** Función: Caja que envuelve a 2 cajas ***/
+BOX MergeBox( BOX b1, BOX b2 )
+{
+  BOX res;
+  res.min.x = MINVALUE( b1.min.x, b2.min.x );
+  res.min.y = MINVALUE( b1.min.y, b2.min.y );
+  res.min.z = MINVALUE( b1.min.z, b2.min.z );
+  res.max.x = MAXVALUE( b1.max.x, b2.max.x );
+  res.max.y = MAXVALUE( b1.max.y, b2.max.y );
+  res.max.z = MAXVALUE( b1.max.z, b2.max.z );
+  return res;
+}
+
+/*** Función: Recorta [t0, t1] al tiempo en que o + d*t está en [min, max] ***/
+// Devuelve GL_FALSE si el intervalo queda vacío
+GLboolean ClipInterval( GLfloat  o  , GLfloat  d  ,  // Origen y dirección
+			GLfloat  min, GLfloat  max,  // Franja
+			GLfloat* t0 , GLfloat* t1 )  // Intervalo a recortar
+{
+  if( d == 0.0f )
+    return o >= min && o <= max && *t0 <= *t1;
+
+  GLfloat ta = ( min - o ) / d;
+  GLfloat tb = ( max - o ) / d;
+  *t0 = MAXVALUE( *t0, MINVALUE( ta, tb ) );
+  *t1 = MINVALUE( *t1, MAXVALUE( ta, tb ) );
+  return *t0 <= *t1;
+}
+
+/*** Función: Tramo [t0, t1] de un rayo dentro de una caja ***/
+// Recorta el tramo recibido; GL_FALSE si el rayo no toca la caja en él
+GLboolean RayBox( RAY ray, BOX box, GLfloat* t0, GLfloat* t1 )
+{
+  return ClipInterval( ray.p0.x, ray.u.x, box.min.x, box.max.x, t0, t1 ) &&
+    ClipInterval( ray.p0.y, ray.u.y, box.min.y, box.max.y, t0, t1 ) &&
+    ClipInterval( ray.p0.z, ray.u.z, box.min.z, box.max.z, t0, t1 );
+}
+
+/*** Función: Área superficial de una caja ***/
+GLfloat BoxArea( BOX b )
+{
+  VECTOR d = ResVector( b.max, b.min );
+  return 2.0f * ( d.x * d.y + d.y * d.z + d.z * d.x );
+}
+
+/*--- Volumen de visión ---*/
+
+/*** Función: Posición de una esfera respecto al volumen de visión ***/
+GLint SphereInFrustum( const FRUSTUM* frustum, SPHERE sphere )
+{
+  GLint res = FRUSTUM_INSIDE;
+  unsigned int i;
+  for( i = 0; i < 6; i++ )
+    {
+      GLfloat dist = DotProduct( frustum->planes[i].n, sphere.center ) +
+	frustum->planes[i].d;
+      if( dist < -sphere.radius )
+	return FRUSTUM_OUTSIDE;
+      if( dist < sphere.radius )
+	res = FRUSTUM_INTERSECT;
+    }
+  return res;
+}
+
+/*** Función: Posición de una caja respecto al volumen de visión ***/
+// Por plano sólo se prueban la esquina más adentro y la más afuera
+GLint BoxInFrustum( const FRUSTUM* frustum, BOX box )
+{
+  GLint res = FRUSTUM_INSIDE;
+  unsigned int i;
+  for( i = 0; i < 6; i++ )
+    {
+      VECTOR n    = frustum->planes[i].n;
+      VECTOR pIn  = { n.x >= 0.0f ? box.max.x : box.min.x,
+		      n.y >= 0.0f ? box.max.y : box.min.y,
+		      n.z >= 0.0f ? box.max.z : box.min.z };
+      VECTOR pOut = { n.x >= 0.0f ? box.min.x : box.max.x,
+		      n.y >= 0.0f ? box.min.y : box.max.y,
+		      n.z >= 0.0f ? box.min.z : box.max.z };
+      if( DotProduct( n, pIn ) + frustum->planes[i].d < 0.0f )
+	return FRUSTUM_OUTSIDE;
+      if( DotProduct( n, pOut ) + frustum->planes[i].d < 0.0f )
+	res = FRUSTUM_INTERSECT;
+    }
+  return res;
+}
+
 /*--- Picking ---*/
 
 /*** Función: Devuelve el rayo creado desde un punto x,y en la ventana **/
+// La dirección no depende de la profundidad del pixel: se usa el plano
+// lejano en vez de leer el z-buffer(glReadPixels detiene el pipeline).
+// Sin opengl: CameraRay(camera.c) y PickScene(collision.c).
 RAY PickingRay( GLdouble x, GLdouble y )
 {
   RAY      res;
   GLdouble nearx, neary, nearz;
   GLdouble farx , fary , farz;
-  GLfloat  depth;
   
   GLdouble model[16];
   GLdouble proj[16];
@@ -404,19 +1146,13 @@ RAY PickingRay( GLdouble x, GLdouble y )
   glGetDoublev( GL_PROJECTION_MATRIX, proj );
   glGetIntegerv( GL_VIEWPORT, view );
 
-  /* Valor de produndidad del pixel xy */
-  glReadPixels( x, view[3] - y,
-		1, 1,
-		GL_DEPTH_COMPONENT,
-		GL_FLOAT, &depth );
-
   /* Punto en el plano cercano */
-  gluUnProject( x, view[3] - y, 0,
+  gluUnProject( x, view[3] - y, 0.0,
 		model, proj, view,
 		&nearx, &neary, &nearz );
 
   /* Punto en el plano lejano */
-  gluUnProject( x, view[3] - y, (GLdouble)depth,
+  gluUnProject( x, view[3] - y, 1.0,
 		model, proj, view,
 		&farx, &fary, &farz );
 
@@ -456,8 +1192,78 @@ GLboolean TestRaySphere( RAY ray, SPHERE sphere )
     return GL_FALSE;
 }
 
+/*** Función: Intersección de un rayo con un triángulo(ambas caras) ***/
+// El punto es ray.p0 + ray.u * time; "time" puede ser negativo
+GLboolean RayTriangle( RAY ray, TRIANGLE triangle, GLfloat* time )
+{
+  VECTOR  e1  = ResVector( triangle.p1, triangle.p0 );
+  VECTOR  e2  = ResVector( triangle.p2, triangle.p0 );
+  VECTOR  p   = CrossProduct( ray.u, e2 );
+  GLfloat det = DotProduct( e1, p );
+
+  // Rayo paralelo al plano
+  if( fabs( det ) < 1e-12f )
+    return GL_FALSE;
+
+  // Coordenadas baricéntricas
+  VECTOR  s = ResVector( ray.p0, triangle.p0 );
+  GLfloat u = DotProduct( s, p ) / det;
+  if( u < 0.0f || u > 1.0f )
+    return GL_FALSE;
+  VECTOR  q = CrossProduct( s, e1 );
+  GLfloat v = DotProduct( ray.u, q ) / det;
+  if( v < 0.0f || u + v > 1.0f )
+    return GL_FALSE;
+
+  *time = DotProduct( e2, q ) / det;
+  return GL_TRUE;
+}
+
 /*---------------*/
 
+/*--- VÉRTICES COMPACTOS ---*/
+
+/*** Función: Flotante a half float(GL_HALF_FLOAT_ARB) ***/
+// Redondea al par más cercano; lo que pasa de 65504 queda en infinito
+GLushort FloatToHalf( GLfloat f )
+{
+  union { GLfloat f; GLuint u; } bits = { f };
+  GLuint   sign = bits.u & 0x80000000u;
+  GLuint   x    = bits.u ^ sign;
+  GLushort h;
+
+  if( x >= 0x47800000u )
+    // Infinito, NaN o muy grande
+    h = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+  else if( x < 0x38800000u )
+    {
+      // Subnormal en half: la suma flotante alinea y redondea la mantisa
+      union { GLfloat f; GLuint u; } magic = { 0.5f };
+      bits.u = x;
+      bits.f += magic.f;
+      h = (GLushort)( bits.u - magic.u );
+    }
+  else
+    {
+      // Normal: cambia el sesgo del exponente y redondea 13 bits
+      x -= ( 127 - 15 ) << 23;
+      x += 0xfff + ( ( x >> 13 ) & 1 );
+      h = (GLushort)( x >> 13 );
+    }
+  return h | (GLushort)( sign >> 16 );
+}
+
+/*** Función: Normal en 4 bytes con signo(GL_BYTE, el último en 0) ***/
+void PackNormal( VECTOR n, GLbyte* out )
+{
+  out[0] = (GLbyte)lrintf( MINVALUE( MAXVALUE( n.x, -1.0f ), 1.0f ) * 127.0f );
+  out[1] = (GLbyte)lrintf( MINVALUE( MAXVALUE( n.y, -1.0f ), 1.0f ) * 127.0f );
+  out[2] = (GLbyte)lrintf( MINVALUE( MAXVALUE( n.z, -1.0f ), 1.0f ) * 127.0f );
+  out[3] = 0;
+}
+
+/*-------------*/
+
 /*** Función: Escalar un color ***/
 void MulColor( const COLOR* color, GLfloat k, COLOR* out )
 {
@@ -0,0 +1,246 @@
+/*****************************/
+/**      ------------       **/
+/**      modelBench.c       **/
+/**      ------------       **/
+/**  Lectura de modelos OBJ **/
+/**  con y sin assimp       **/
+/*****************************/
+
+#include "opengl.c"
+#include "math.c"
+#include "thread.c"
+#include "model.c"
+
+/*** Opciones(línea de comandos) ***/
+char*  modelFile  = NULL;  // NULL: malla generada en BENCH_OBJ
+GLuint gridSize   = 512;   // Cuadros por lado de la malla generada
+GLuint nRuns      = 5;
+GLuint maxThreads = 0;     // 0: todos los procesadores
+
+#define BENCH_OBJ "modelBench.obj"
+
+
+/*** Función: Tiempo monotónico en segundos ***/
+double BenchTime( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*** Función: Uso del programa ***/
+void Usage( void )
+{
+  fprintf( stderr, "usage: %s [-m model.obj] [-s gridSize] [-r runs] [-j maxThreads]\n",
+	   g_Argv[0] );
+  exit( 1 );
+}
+
+/*** Función: Escribe una malla de colinas en BENCH_OBJ ***/
+// Cuadros con v/vt/vn como los que exporta un editor(semilla fija)
+void WriteBenchOBJ( void )
+{
+  FILE* file = fopen( BENCH_OBJ, "w" );
+  unsigned int i, j;
+  if( file == NULL )
+    {
+      PrintError( "Could not create the benchmark model", GL_FALSE );
+      exit( 1 );
+    }
+
+  srand( 1 );
+  fprintf( file, "# modelBench %dx%d\no grid\n", gridSize, gridSize );
+  for( i = 0; i <= gridSize; i++ )
+    for( j = 0; j <= gridSize; j++ )
+      {
+	GLfloat x = i * 0.5f, z = j * 0.5f;
+	GLfloat y = 4.0f * sin( i * 0.07f ) * cos( j * 0.05f ) + rand() % 100 * 0.001f;
+	VECTOR  n = { -0.28f * cos( i * 0.07f ) * cos( j * 0.05f ), 1.0f,
+		      0.2f * sin( i * 0.07f ) * sin( j * 0.05f ) };
+	n = NormalizeVector( n );
+	fprintf( file, "v %f %f %f\nvt %f %f\nvn %f %f %f\n", x, y, z,
+		 (GLfloat)i / gridSize, (GLfloat)j / gridSize, n.x, n.y, n.z );
+      }
+  for( i = 0; i < gridSize; i++ )
+    for( j = 0; j < gridSize; j++ )
+      {
+	GLuint a = i * (gridSize + 1) + j + 1, b = a + gridSize + 1;
+	fprintf( file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+		 a, a, a, a + 1, a + 1, a + 1, b + 1, b + 1, b + 1, b, b, b );
+      }
+  fclose( file );
+}
+
+/*** Inicialización de recursos ***/
+void Init( void )
+{
+  /* Opciones */
+  int option;
+  while( ( option = getopt( g_Argc, g_Argv, "m:s:r:j:h" ) ) != -1 )
+    switch( option )
+      {
+      case 'm': modelFile  = optarg;         break;
+      case 's': gridSize   = atoi( optarg ); break;
+      case 'r': nRuns      = atoi( optarg ); break;
+      case 'j': maxThreads = atoi( optarg ); break;
+      default : Usage();
+      }
+  if( gridSize < 1 || nRuns < 1 )
+    Usage();
+  if( maxThreads == 0 )
+    maxThreads = CountProcessors();
+  if( modelFile == NULL )
+    {
+      WriteBenchOBJ();
+      modelFile = BENCH_OBJ;
+    }
+
+  struct stat info;
+  if( stat( modelFile, &info ) != 0 )
+    {
+      PrintError( "Could not open the model", GL_FALSE );
+      exit( 1 );
+    }
+  printf( "Model '%s'(%.2f MB), best of %d runs\n", modelFile,
+	  info.st_size / 1048576.0, nRuns );
+}
+
+/*** Liberación de recursos ***/
+void Free( void )
+{
+  if( strcmp( modelFile, BENCH_OBJ ) == 0 )
+    remove( BENCH_OBJ );
+}
+
+/*** Función: Mejor tiempo(ms) de importar con assimp ***/
+// Lo que hace LoadModel sin caché, sin texturas ni buffers de opengl
+double AssimpTime( GLuint* nTriangles )
+{
+  double best = INFINITY;
+  unsigned int r;
+  for( r = 0; r < nRuns; r++ )
+    {
+      MODEL        model;
+      MODELBUILD   build = { NULL, NULL, 0 };
+      MODELVERTEX* vertices;
+      GLuint*      indices;
+      GLuint       nVertices, nIndices;
+      struct aiMatrix4x4 matrix;
+
+      double start = BenchTime();
+      const struct aiScene* scene = aiImportFile( modelFile, MODEL_IMPORT_FLAGS );
+      if( scene == NULL )
+	{
+	  PrintError( aiGetErrorString(), GL_FALSE );
+	  exit( 1 );
+	}
+      memset( &model, 0, sizeof(MODEL) );
+      aiIdentityMatrix4( &matrix );
+      CollectModel( scene, scene->mRootNode, matrix, &model, &build, GL_FALSE );
+      BuildModelBuffers( &model, &build, &vertices, &nVertices, &indices, &nIndices );
+      ModelBounds( &model );
+      BuildModelBVH( &model, GL_FALSE );
+      SelectModelHulls( &model, GL_FALSE );
+      aiReleaseImport( scene );
+      best = MINVALUE( best, ( BenchTime() - start ) * 1000.0 );
+
+      *nTriangles = nIndices / 3;
+      free( build.meshes );
+      free( build.transformations );
+      free( vertices );
+      free( indices );
+      FreeModel( &model );
+    }
+  return best;
+}
+
+/*** Función: Mejor tiempo(ms) de ImportModelOBJ con "nThreads" hilos ***/
+// 0 hilos: todo en el hilo principal, sin grupo
+double ObjTime( GLuint nThreads, GLuint* nTriangles )
+{
+  WORKERPOOL pool;
+  double     best = INFINITY;
+  unsigned int r;
+
+  if( nThreads > 0 )
+    InitWorkerPool( &pool, nThreads - 1 );
+  for( r = 0; r < nRuns; r++ )
+    {
+      MODEL        model;
+      MODELVERTEX* vertices;
+      GLuint*      indices;
+      GLuint       nVertices, nIndices;
+      char*        textures;
+
+      double start = BenchTime();
+      if( !ImportModelOBJ( nThreads > 0 ? &pool : NULL, modelFile, &model, &textures,
+			   &vertices, &nVertices, &indices, &nIndices, GL_FALSE ) )
+	break;
+      best = MINVALUE( best, ( BenchTime() - start ) * 1000.0 );
+
+      *nTriangles = nIndices / 3;
+      free( textures );
+      free( vertices );
+      free( indices );
+      FreeModel( &model );
+    }
+  if( nThreads > 0 )
+    FreeWorkerPool( &pool );
+  return best;
+}
+
+/*** Función: Mide OptimizeModelBuffers con el modelo leído ***/
+void OptimizeTimes( void )
+{
+  MODEL        model;
+  MODELVERTEX* vertices;
+  GLuint*      indices;
+  GLuint       nVertices, nIndices;
+  char*        textures;
+  GLfloat      acmr[2], atvr[2];
+
+  if( !ImportModelOBJ( NULL, modelFile, &model, &textures, &vertices, &nVertices,
+		       &indices, &nIndices, GL_FALSE ) )
+    return;
+  VertexCacheStats( &model, indices, nVertices, &acmr[0], &atvr[0] );
+  double start = BenchTime();
+  OptimizeModelBuffers( &model, vertices, nVertices, indices, nIndices, GL_FALSE );
+  double time  = ( BenchTime() - start ) * 1000.0;
+  VertexCacheStats( &model, indices, nVertices, &acmr[1], &atvr[1] );
+
+  printf( "\nOptimizeModelBuffers %.2f ms(%d-entry vertex cache)\n", time,
+	  VERTEX_CACHE_SIZE );
+  printf( "ACMR %8.3f -> %.3f\n", acmr[0], acmr[1] );
+  printf( "ATVR %8.3f -> %.3f\n", atvr[0], atvr[1] );
+  free( textures );
+  free( vertices );
+  free( indices );
+  FreeModel( &model );
+}
+
+/*** Loop: mide assimp y el lector de OBJ con 1, 2, 4... hilos y termina ***/
+void Loop( float elapsed )
+{
+  GLuint nTriangles = 0, nThreads;
+  double assimp     = AssimpTime( &nTriangles );
+  double serial;
+
+  printf( "%-8s %-8s %10s %12s %8s\n", "loader", "threads", "load(ms)",
+	  "Mtris/s", "speedup" );
+  printf( "%-8s %-8s %10.2f %12.2f %8.2f\n", "assimp", "main", assimp,
+	  nTriangles / assimp / 1000.0, 1.0 );
+  serial = ObjTime( 0, &nTriangles );
+  printf( "%-8s %-8s %10.2f %12.2f %8.2f\n", "obj", "main", serial,
+	  nTriangles / serial / 1000.0, assimp / serial );
+  for( nThreads = 1; ; nThreads = MINVALUE( nThreads * 2, maxThreads ) )
+    {
+      double time = ObjTime( nThreads, &nTriangles );
+      printf( "%-8s %-8d %10.2f %12.2f %8.2f\n", "obj", nThreads, time,
+	      nTriangles / time / 1000.0, assimp / time );
+      if( nThreads == maxThreads )
+	break;
+    }
+  printf( "%d triangles\n", nTriangles );
+  OptimizeTimes();
+  g_ExitProgram = GL_TRUE;
+}
@@ -6,8 +6,92 @@
 /**  rización de terrenos **/
 /***************************/
 
+//---   Definiciones   ---//
+
+/*** Trozos del terreno ***/
+#define TERRAIN_CHUNK 32 // Celdas por lado de un trozo
+#define TERRAIN_LODS  5  // Niveles de detalle: pasos de 1, 2, 4, 8 y 16 celdas
+
+/*** Armado en paralelo ***/
+#define TERRAIN_BAND 64 // Filas de vértices por tarea de BuildTerrainGeometry
+
+/*** Vértices compactos(CompactTerrain) ***/
+#define TERRAIN_PAGE  7   // Trozos por lado de una página: menos de 65536 vértices
+#define TERRAIN_STEPS 128 // Pasos de la ubicación por celda(potencia de 2: exacto)
+
+/*** Mosaicos en disco(TERRAINSTREAM) ***/
+#define TERRAIN_TILE_MAGIC   "TTL1" // Firma del archivo de mosaicos
+#define TERRAIN_TILE_EMPTY    0     // Sólo en el archivo
+#define TERRAIN_TILE_QUEUED   1     // Pedido al hilo de carga
+#define TERRAIN_TILE_RESIDENT 2     // En la lista de residentes
+
+/*** Texturas por altura y pendiente(TERRAINSPLAT) ***/
+#define TERRAIN_SPLAT_VERTEX   "shaders/terrainSplat.vert"
+#define TERRAIN_SPLAT_FRAGMENT "shaders/terrainSplat.frag"
+#define TERRAIN_SPLAT_LAYERS   3 // Arena, pasto y roca
+
+/*_______*/
+
+
 //---   Estructuras   ---//
 
+/*** Estructura de dato: HEIGHTRANGE ***/
+// Altura mínima y máxima de un bloque de celdas
+typedef struct heightrange
+{
+    GLfloat min;
+    GLfloat max;
+}HEIGHTRANGE;
+
+/*** Estructura de dato: TERRAINCHUNK ***/
+// Bloque de celdas que se dibuja con un solo nivel de detalle
+typedef struct terrainchunk
+{
+    GLuint    row, col;            // Primera celda(Z, X)
+    GLuint    rows, cols;          // Celdas en Z y X
+    GLuint    levels;              // Niveles posibles(el paso divide al trozo)
+    GLfloat   error[TERRAIN_LODS]; // Mayor error de altura de cada nivel
+    BOX       box;                 // Caja de los vértices
+    GLuint    lod;                 // Nivel elegido(SelectTerrainLOD)
+    GLboolean visible;             // Toca el volumen de visión
+    GLuint    page;                // Página con sus vértices(CompactTerrain)
+}TERRAINCHUNK;
+
+/*** Estructura de dato: TERRAINVERTEX ***/
+// NORMAL_TEX_VERTEX en 12 bytes en vez de 32 para dibujar. La ubicación va
+// en pasos de cellSpacing / TERRAIN_STEPS desde el origen de su página y
+// la textura la genera opengl desde la ubicación.
+typedef struct terrainvertex
+{
+    GLshort p[4]; // Ubicación(X, Y, Z y relleno)
+    GLbyte  n[4]; // Normal(PackNormal)
+}TERRAINVERTEX;
+
+/*** Estructura de dato: TERRAINPAGE ***/
+// Bloque de TERRAIN_PAGE x TERRAIN_PAGE trozos con su copia de los
+// vértices en TERRAINVERTEX, que se dibuja con índices de 16 bits. Las
+// páginas vecinas repiten la fila o columna que comparten.
+typedef struct terrainpage
+{
+    GLuint         row, col;   // Primer vértice(Z, X) en el terreno
+    GLuint         rows, cols; // Vértices en Z y X
+    GLint          base;       // Altura del paso 0, en pasos
+    VECTOR         origin;     // Ubicación del paso 0
+    TERRAINVERTEX* vertices;   // rows x cols
+    GLuint         drawFirst;  // Índices del último SelectTerrainLOD
+    GLuint         drawCount;  // (en TERRAIN.drawShorts)
+}TERRAINPAGE;
+
+/*** Estructura de dato: TERRAINSTATS ***/
+// Resultado de SelectTerrainLOD
+typedef struct terrainstats
+{
+    GLuint chunks;               // Trozos del terreno
+    GLuint visible;              // Trozos dibujados
+    GLuint triangles;            // Triángulos dibujados
+    GLuint levels[TERRAIN_LODS]; // Trozos dibujados en cada nivel
+}TERRAINSTATS;
+
 /*** Estructura de dato: TERRAIN ***/
 typedef struct terrain
 {
@@ -19,126 +103,499 @@ typedef struct terrain
     NORMAL_TEX_VERTEX* vertexBuffer;
     MATERIAL           material;
     GLuint             textureID;
-    GLuint             terrainList;
+    GLboolean          repeatTex;
+    GLboolean          heightColors;  // La textura se generó de las alturas
+    HEIGHTRANGE*       pyramid;       // Alturas por bloque: nivel 0 por celda,
+    GLuint*            pyramidLevel;  // cada nivel junta 2x2 del anterior;
+    GLuint             pyramidLevels; // inicio de cada nivel en "pyramid"
+    TERRAINCHUNK*      chunks;        // Trozos(chunkRows x chunkCols)
+    GLuint             chunkRows;
+    GLuint             chunkCols;
+    GLuint*            drawBuffer;    // Índices del último SelectTerrainLOD
+    GLushort*          drawShorts;    // Los mismos por página(con "pages")
+    GLuint             drawCount;
+    GLuint             drawCapacity;
+    TERRAINPAGE*       pages;         // Vértices compactos(NULL: se dibuja
+    GLuint             pageRows;      // con vertexBuffer)
+    GLuint             pageCols;
+    GLfloat            originX;       // Esquina(X, Z) en el mundo: 0 salvo
+    GLfloat            originZ;       // en los mosaicos de TERRAINSTREAM
+    struct terrain*    next;          // Siguiente mosaico residente(o NULL)
 }TERRAIN;
 
+/*** Tipo: Pincel de DeformTerrain ***/
+// Devuelve la nueva altura del vértice(X, Z) que hoy mide "height"
+typedef GLfloat (*TERRAINBRUSH)( void* data, GLfloat x, GLfloat z, GLfloat height );
+
+/*** Estructura de dato: TERRAINCRATER ***/
+// Datos de CraterBrush
+typedef struct terraincrater
+{
+    GLfloat x, z;   // Centro
+    GLfloat radius;
+    GLfloat depth;  // Profundidad en el centro
+}TERRAINCRATER;
+
+/*** Estructura de dato: TERRAINSPLAT ***/
+// Mezcla en un shader texturas repetidas según la altura y la pendiente, sin
+// una textura por mapa: sirve igual para mosaicos y terrenos deformados
+typedef struct terrainsplat
+{
+    GLuint  program;
+    GLuint  layers[TERRAIN_SPLAT_LAYERS]; // Arena, pasto y roca
+    GLint   uniforms[5];                  // Parámetros de abajo y vertexOrigin
+    GLfloat sandHeight;                   // Altura donde la arena pasa a pasto
+    GLfloat rockSlope;                    // Pendiente(1 - normal.y) de la roca
+    GLfloat blend;                        // Ancho de la transición arena-pasto
+    GLfloat tileSize;                     // Unidades del mundo por repetición
+}TERRAINSPLAT;
+
+/*** Estructura de dato: TERRAINBUILD ***/
+// Datos de las tareas de BuildTerrainGeometry
+typedef struct terrainbuild
+{
+    TERRAIN* terrain;
+    GLfloat  heightScale;
+    GLuint   level;       // Nivel de la pirámide que se arma
+}TERRAINBUILD;
+
+/*** Estructura de dato: TERRAINTILEHEADER ***/
+// Inicio del archivo de mosaicos. Le siguen tilesX x tilesZ mosaicos de
+// (tileCells + 1)^2 alturas cada uno, por filas; los mosaicos vecinos
+// repiten la fila o columna que comparten. Orden de bytes de la máquina.
+typedef struct terraintileheader
+{
+    char   magic[4];    // TERRAIN_TILE_MAGIC
+    GLuint vertsPerRow; // Tamaño del mapa completo
+    GLuint vertsPerCol;
+    GLuint tileCells;   // Celdas por lado de un mosaico
+    GLuint tilesX;      // Mosaicos en X y Z
+    GLuint tilesZ;
+}TERRAINTILEHEADER;
+
+/*** Estructura de dato: TERRAINSTREAM ***/
+// Terreno por mosaicos desde un archivo mapeado en memoria. Un hilo arma
+// los mosaicos alrededor de la cámara; "resident" es la lista(TERRAIN.next)
+// que se usa como un terreno para colisiones, alturas y dibujo.
+typedef struct terrainstream
+{
+    TERRAINTILEHEADER header;
+    GLfloat        cellSpacing;
+    GLfloat        heightScale;
+    GLuint         radius;     // Mosaicos residentes alrededor de la cámara
+    unsigned char* map;        // Archivo mapeado
+    size_t         mapSize;
+    GLubyte*       state;      // TERRAIN_TILE_* de cada mosaico
+    TERRAIN**      tiles;      // Geometría de cada mosaico residente
+    TERRAIN*       resident;   // Lista de residentes(puede ser NULL)
+    GLuint         nResident;
+    // Sólo del hilo principal lo de arriba; lo de abajo usa el mutex
+    SDL_Thread*    thread;     // Hilo de carga
+    SDL_mutex*     mutex;
+    SDL_cond*      wake;       // Hay pedidos
+    SDL_cond*      done;       // Se terminó un mosaico
+    GLuint*        requests;   // Mosaicos pedidos
+    GLuint         nRequests;
+    GLuint         loading;    // Mosaicos en el hilo de carga
+    GLuint*        readyTiles; // Mosaicos terminados
+    TERRAIN**      ready;
+    GLuint         nReady;
+    GLint          centerX;    // Mosaico de la cámara
+    GLint          centerZ;
+    GLboolean      quit;       // El hilo debe salir
+    GLboolean      compact;    // CompactTerrain en cada mosaico(se pone
+				// antes del primer UpdateTerrainStream)
+}TERRAINSTREAM;
+
 /*_______*/
 
 
 //--- Funciones ---//
 
-/*** Función: Inicializa un terreno ***/
-void InitTerrain( TERRAIN*  terrain,
-		  char*     terrainFile,
-		  char*     terrainTexture,
-		  GLboolean repeatTex,
-		  MATERIAL* terrainMtrl,
-		  GLuint    vertsPerRow,
-		  GLuint    vertsPerCol,
-		  GLuint    cellSpacing,
-		  GLfloat   heightScale )
+/*** Función: Bloques por lado de un nivel de la pirámide ***/
+void TerrainLevelSize( TERRAIN* terrain, GLuint level,
+		       GLuint*  rows, GLuint* cols ) // Bloques en Z y X
 {
-    /* Características */
-    terrain->vertsPerRow = vertsPerRow;
-    terrain->vertsPerCol = vertsPerCol;
-    terrain->cellSpacing = cellSpacing;
-    terrain->material    = *terrainMtrl;
+    *rows = ((terrain->vertsPerCol - 2) >> level) + 1;
+    *cols = ((terrain->vertsPerRow - 2) >> level) + 1;
+}
 
-    /* Memoria para el heightMap */
-    terrain->heightMap = (unsigned char*)calloc( vertsPerRow * vertsPerCol,
-						 sizeof(unsigned char) );
+/*** Función: Alturas de un bloque de la pirámide ***/
+HEIGHTRANGE* TerrainBlock( TERRAIN* terrain, GLuint level, GLuint row, GLuint col )
+{
+    GLuint rows, cols;
+    TerrainLevelSize( terrain, level, &rows, &cols );
+    return &terrain->pyramid[ terrain->pyramidLevel[level] + row * cols + col ];
+}
 
-    /* Leo el heightMap */
-    FILE* file = fopen( terrainFile, "r" );
-    fread( terrain->heightMap, sizeof(unsigned char), vertsPerRow * vertsPerCol, file );
-    fclose( file );
+/*** Función: Bloques [first, last) de la fila "i" de un nivel de la pirámide ***/
+// El nivel 0 sale de las 4 esquinas de cada celda y los demás de sus 2x2
+// bloques hijos, que ya deben estar listos
+void BuildPyramidRow( TERRAIN* terrain, GLuint level, GLuint i,
+		      GLuint first, GLuint last )
+{
+    HEIGHTRANGE* range = TerrainBlock( terrain, level, i, 0 );
+    GLuint childRows, childCols;
+    unsigned int j, k;
 
-    /* Escalo el heightmap */
-    unsigned int h;
-    for( h = 0; h < vertsPerRow * vertsPerCol; h++ )
-	terrain->heightMap[h] *= heightScale;
+    if( level == 0 )
+    {
+	NORMAL_TEX_VERTEX* top    = &terrain->vertexBuffer[ i * terrain->vertsPerRow ];
+	NORMAL_TEX_VERTEX* bottom = top + terrain->vertsPerRow;
+	for( j = first; j < last; j++ )
+	{
+	    range[j].min = MINVALUE( MINVALUE( top[j].p.y,    top[j + 1].p.y ),
+				     MINVALUE( bottom[j].p.y, bottom[j + 1].p.y ) );
+	    range[j].max = MAXVALUE( MAXVALUE( top[j].p.y,    top[j + 1].p.y ),
+				     MAXVALUE( bottom[j].p.y, bottom[j + 1].p.y ) );
+	}
+	return;
+    }
+
+    TerrainLevelSize( terrain, level - 1, &childRows, &childCols );
+    HEIGHTRANGE* child = TerrainBlock( terrain, level - 1, 0, 0 );
+    for( j = first; j < last; j++ )
+    {
+	range[j].min =  INFINITY;
+	range[j].max = -INFINITY;
+	for( k = 0; k < 4; k++ )
+	    if( 2 * i + k / 2 < childRows && 2 * j + k % 2 < childCols )
+	    {
+		HEIGHTRANGE* c = &child[ (2 * i + k / 2) * childCols + 2 * j + k % 2 ];
+		range[j].min = MINVALUE( range[j].min, c->min );
+		range[j].max = MAXVALUE( range[j].max, c->max );
+	    }
+    }
+}
 
+/*** Función: Bloques de una banda de la pirámide(tarea de WORKERPOOL) ***/
+// Arma TERRAIN_BAND filas del nivel build->level
+void BuildPyramidBand( void* data, GLuint band )
+{
+    TERRAINBUILD* build = data;
+    GLuint rows, cols;
+    unsigned int i;
 
-    /* Calculo los vértices */
-    terrain->vertexBuffer = (NORMAL_TEX_VERTEX*)calloc( vertsPerRow * vertsPerCol,
-							sizeof(NORMAL_TEX_VERTEX) );
-    GLfloat uTexDelta = 1.0f / (vertsPerRow - 1);
-    GLfloat vTexDelta = 1.0f / (vertsPerCol - 1);
-    unsigned int i, j;
+    TerrainLevelSize( build->terrain, build->level, &rows, &cols );
+    for( i = band * TERRAIN_BAND; i < MINVALUE( (band + 1) * TERRAIN_BAND, rows ); i++ )
+	BuildPyramidRow( build->terrain, build->level, i, 0, cols );
+}
+
+/*** Función: Construye la pirámide de alturas mínimas y máximas ***/
+// Cada nivel se reparte en bandas entre los hilos de "pool"(NULL: en orden)
+void BuildTerrainPyramid( WORKERPOOL* pool, TERRAIN* terrain )
+{
+    GLuint rows, cols, total = 0, level = 0;
+    TERRAINBUILD build = { terrain, 1.0f, 0 };
 
-    for( i = 0; i < vertsPerCol; i++ )
+    /* Niveles hasta llegar a un solo bloque */
+    do
     {
-	for( j = 0; j < vertsPerRow; j++ )
+	TerrainLevelSize( terrain, level++, &rows, &cols );
+	total += rows * cols;
+    }while( rows > 1 || cols > 1 );
+    terrain->pyramidLevels = level;
+    terrain->pyramidLevel  = (GLuint*)malloc( sizeof(GLuint) * level );
+    terrain->pyramid       = (HEIGHTRANGE*)malloc( sizeof(HEIGHTRANGE) * total );
+
+    /* Cada nivel necesita al anterior terminado */
+    terrain->pyramidLevel[0] = 0;
+    for( level = 0; level < terrain->pyramidLevels; level++ )
+    {
+	TerrainLevelSize( terrain, level, &rows, &cols );
+	if( level + 1 < terrain->pyramidLevels )
+	    terrain->pyramidLevel[level + 1] = terrain->pyramidLevel[level] + rows * cols;
+	build.level = level;
+	RunWorkerPool( pool, BuildPyramidBand, &build,
+		       ( rows + TERRAIN_BAND - 1 ) / TERRAIN_BAND );
+    }
+}
+
+/*** Función: Número de trozos para "cells" celdas ***/
+// Si sobra una sola celda se agrega al último trozo
+GLuint TerrainChunkCount( GLuint cells )
+{
+    GLuint n = cells / TERRAIN_CHUNK;
+    if( n == 0 || cells % TERRAIN_CHUNK >= 2 )
+	n++;
+    return n;
+}
+
+/*** Función: Altura de un vértice del trozo(coordenadas locales) ***/
+GLfloat ChunkHeight( TERRAIN* terrain, TERRAINCHUNK* chunk, GLuint x, GLuint z )
+{
+    return terrain->vertexBuffer[ (chunk->row + z) * terrain->vertsPerRow +
+				  chunk->col + x ].p.y;
+}
+
+/*** Función: Mayor error de altura de un trozo con paso "step" ***/
+// Cada celda grande se parte como las celdas del terreno(ABC y BDC)
+GLfloat ChunkError( TERRAIN* terrain, TERRAINCHUNK* chunk, GLuint step )
+{
+    GLfloat error = 0.0f;
+    unsigned int x, z, u, v;
+    for( z = 0; z < chunk->rows; z += step )
+	for( x = 0; x < chunk->cols; x += step )
 	{
-	    NORMAL_TEX_VERTEX v;
-	    v.p.x = j * cellSpacing;
-	    v.p.y = terrain->heightMap[ (i * vertsPerRow) + j ];
-	    v.p.z = i * cellSpacing;
-	    v.n.x = 0.0f;
-	    v.n.y = 0.0f;
-	    v.n.z = 0.0f;
-	    v.t.u = j * ( repeatTex? 1 : uTexDelta );
-	    v.t.v = i * ( repeatTex? 1 : vTexDelta );
-	    terrain->vertexBuffer[ (i * vertsPerRow) + j ] = v;
+	    GLfloat hA = ChunkHeight( terrain, chunk, x       , z        );
+	    GLfloat hB = ChunkHeight( terrain, chunk, x + step, z        );
+	    GLfloat hC = ChunkHeight( terrain, chunk, x       , z + step );
+	    GLfloat hD = ChunkHeight( terrain, chunk, x + step, z + step );
+	    for( v = 0; v <= step; v++ )
+		for( u = 0; u <= step; u++ )
+		{
+		    GLfloat fu = (GLfloat)u / step, fv = (GLfloat)v / step;
+		    GLfloat h  = u + v <= step ?
+			hA + (hB - hA) * fu + (hC - hA) * fv :
+			hD + (hC - hD) * (1.0f - fu) + (hB - hD) * (1.0f - fv);
+		    h = fabsf( ChunkHeight( terrain, chunk, x + u, z + v ) - h );
+		    error = MAXVALUE( error, h );
+		}
+	}
+    return error;
+}
+
+/*** Función: Caja y errores por nivel de un trozo(tarea de WORKERPOOL) ***/
+void BuildTerrainChunk( void* data, GLuint index )
+{
+    TERRAIN* terrain  = data;
+    GLuint   cellRows = terrain->vertsPerCol - 1;
+    GLuint   cellCols = terrain->vertsPerRow - 1;
+    GLuint   i        = index / terrain->chunkCols;
+    GLuint   j        = index % terrain->chunkCols;
+    unsigned int x, z, level;
+
+    TERRAINCHUNK* chunk = &terrain->chunks[index];
+    chunk->row  = i * TERRAIN_CHUNK;
+    chunk->col  = j * TERRAIN_CHUNK;
+    chunk->rows = i + 1 == terrain->chunkRows ? cellRows - chunk->row : TERRAIN_CHUNK;
+    chunk->cols = j + 1 == terrain->chunkCols ? cellCols - chunk->col : TERRAIN_CHUNK;
+
+    /* Caja */
+    chunk->box.min.x = terrain->originX + chunk->col * terrain->cellSpacing;
+    chunk->box.min.z = terrain->originZ + chunk->row * terrain->cellSpacing;
+    chunk->box.max.x = terrain->originX + (chunk->col + chunk->cols) * terrain->cellSpacing;
+    chunk->box.max.z = terrain->originZ + (chunk->row + chunk->rows) * terrain->cellSpacing;
+    chunk->box.min.y =  INFINITY;
+    chunk->box.max.y = -INFINITY;
+    for( z = 0; z <= chunk->rows; z++ )
+	for( x = 0; x <= chunk->cols; x++ )
+	{
+	    GLfloat h = ChunkHeight( terrain, chunk, x, z );
+	    chunk->box.min.y = MINVALUE( chunk->box.min.y, h );
+	    chunk->box.max.y = MAXVALUE( chunk->box.max.y, h );
 	}
+
+    /* Niveles: el paso divide al trozo y deja al menos 2x2 celdas */
+    chunk->levels   = 1;
+    chunk->error[0] = 0.0f;
+    for( level = 1; level < TERRAIN_LODS; level++ )
+    {
+	GLuint step = 1 << level;
+	if( chunk->rows % step != 0 || chunk->cols % step != 0 ||
+	    chunk->rows / step < 2  || chunk->cols / step < 2 )
+	    break;
+	// El error no baja al subir de nivel
+	chunk->error[level] = MAXVALUE( chunk->error[level - 1],
+					ChunkError( terrain, chunk, step ) );
+	chunk->levels++;
     }
+}
+
+/*** Función: Divide el terreno en trozos con su caja y errores por nivel ***/
+void BuildTerrainChunks( WORKERPOOL* pool, TERRAIN* terrain )
+{
+    terrain->chunkRows = TerrainChunkCount( terrain->vertsPerCol - 1 );
+    terrain->chunkCols = TerrainChunkCount( terrain->vertsPerRow - 1 );
+    terrain->chunks    = (TERRAINCHUNK*)calloc( terrain->chunkRows * terrain->chunkCols,
+						sizeof(TERRAINCHUNK) );
+    terrain->drawBuffer   = NULL;
+    terrain->drawShorts   = NULL;
+    terrain->drawCount    = 0;
+    terrain->drawCapacity = 0;
+    terrain->pages        = NULL;
+
+    RunWorkerPool( pool, BuildTerrainChunk, terrain,
+		   terrain->chunkRows * terrain->chunkCols );
+}
 
-    /* Calculo las normales */
-    for( i = 0; i < vertsPerCol - 1; i++ )
+/*** Función: Escala las alturas de una banda(tarea de WORKERPOOL) ***/
+void ScaleTerrainBand( void* data, GLuint band )
+{
+    TERRAINBUILD* build   = data;
+    TERRAIN*      terrain = build->terrain;
+    GLuint first = band * TERRAIN_BAND * terrain->vertsPerRow;
+    GLuint last  = MINVALUE( (band + 1) * TERRAIN_BAND, terrain->vertsPerCol ) *
+	terrain->vertsPerRow;
+    unsigned int h;
+    for( h = first; h < last; h++ )
+	terrain->heightMap[h] *= build->heightScale;
+}
+
+/*** Función: Alturas de una fila del heightMap como flotantes ***/
+// Las filas fuera del terreno usan la del borde
+void TerrainHeightRow( TERRAIN* terrain, GLint row, GLfloat* heights )
+{
+    row = MINVALUE( MAXVALUE( row, 0 ), (GLint)terrain->vertsPerCol - 1 );
+    unsigned char* h = &terrain->heightMap[ row * terrain->vertsPerRow ];
+    unsigned int j;
+    for( j = 0; j < terrain->vertsPerRow; j++ )
+	heights[j] = h[j];
+}
+
+/*** Función: Suma las normales de los triángulos de una celda ***/
+// Celda con esquina en h[r][c]; cada normal(C-A)x(B-A) y (B-D)x(C-D) va
+// dividida por el espaciado "s" y su largo es proporcional al área
+void AddCellNormal( VECTOR* n, GLfloat h[3][3], GLuint r, GLuint c,
+		    GLboolean abc, GLboolean bdc, GLfloat s )
+{
+    if( abc )
     {
-	for( j = 0; j < vertsPerRow - 1; j++ )
-	{
-	    /*
-	      A---B
-	      |  /|
-	      | / |
-	      |/  |
-	      C---D
-	    */
-	    VECTOR n;
-	    POINT A, B, C;
+	n->x -= h[r][c + 1] - h[r][c];
+	n->y += s;
+	n->z -= h[r + 1][c] - h[r][c];
+    }
+    if( bdc )
+    {
+	n->x += h[r + 1][c] - h[r + 1][c + 1];
+	n->y += s;
+	n->z += h[r][c + 1] - h[r + 1][c + 1];
+    }
+}
+
+/*** Función: Normal suave(sin normalizar) de un vértice ***/
+// Suma de las normales de los hasta 6 triángulos que lo tocan, pesadas por
+// su área. "h" son las alturas de los 3x3 vértices alrededor(h[1][1] es el
+// vértice); north, south, west y east dicen si hay vecinos de ese lado.
+VECTOR TerrainNormalSum( GLfloat h[3][3], GLboolean north, GLboolean south,
+			 GLboolean west, GLboolean east, GLfloat s )
+{
+    VECTOR n = { 0.0f, 0.0f, 0.0f };
+    AddCellNormal( &n, h, 0, 0, GL_FALSE, north && west, s );         // Vértice D
+    AddCellNormal( &n, h, 0, 1, north && east, north && east, s );    // C
+    AddCellNormal( &n, h, 1, 0, south && west, south && west, s );    // B
+    AddCellNormal( &n, h, 1, 1, south && east, GL_FALSE, s );         // A
+    return n;
+}
 
-	    A = terrain->vertexBuffer[ ((i + 0) * vertsPerRow) + (j + 0) ].p;
-	    B = terrain->vertexBuffer[ ((i + 0) * vertsPerRow) + (j + 1) ].p;
-	    C = terrain->vertexBuffer[ ((i + 1) * vertsPerRow) + (j + 0) ].p;
+/*** Función: Normales suaves de una fila de vértices ***/
+// "rows" son las alturas de las filas i-1, i e i+1. El interior usa la suma
+// de los 6 triángulos ya simplificada, de a 4 vértices con SSE2; los bordes
+// usan TerrainNormalSum. La normalización va con los kernels en lote.
+void TerrainNormalRow( TERRAIN* terrain, GLuint i, GLfloat* rows[3],
+		       VECTORARRAY* normals )
+{
+    GLuint   cols = terrain->vertsPerRow;
+    GLfloat  s    = terrain->cellSpacing;
+    GLfloat* N = rows[0];
+    GLfloat* C = rows[1];
+    GLfloat* S = rows[2];
+    unsigned int j = 1, k, r, c;
 
-	    VECTOR v1 = {C.x - A.x, C.y - A.y, C.z - A.z}; //C-A
-	    VECTOR v2 = {B.x - A.x, B.y - A.y, B.z - A.z}; //B-A
-	    
-	    n = CrossProduct( v1, v2 ); 
-	    n = NormalizeVector( n );
-	    terrain->vertexBuffer[ (i * vertsPerRow) + j ].n = n;
+    /* Interior: X = 2(hO - hE) + hSO - hS + hN - hNE,
+       Z = 2(hN - hS) + hO - hSO + hNE - hE, Y = 6s */
+    if( i > 0 && i + 1 < terrain->vertsPerCol )
+    {
+#ifdef __SSE2__
+	__m128 two = _mm_set1_ps( 2.0f );
+	__m128 y   = _mm_set1_ps( 6.0f * s );
+	for( ; j + 4 < cols; j += 4 )
+	{
+	    __m128 w  = _mm_loadu_ps( C + j - 1 ), e  = _mm_loadu_ps( C + j + 1 );
+	    __m128 n  = _mm_loadu_ps( N + j ),     ne = _mm_loadu_ps( N + j + 1 );
+	    __m128 sw = _mm_loadu_ps( S + j - 1 ), so = _mm_loadu_ps( S + j );
+	    __m128 x  = _mm_add_ps( _mm_mul_ps( two, _mm_sub_ps( w, e ) ),
+				    _mm_add_ps( _mm_sub_ps( sw, so ), _mm_sub_ps( n, ne ) ) );
+	    __m128 z  = _mm_add_ps( _mm_mul_ps( two, _mm_sub_ps( n, so ) ),
+				    _mm_add_ps( _mm_sub_ps( w, sw ), _mm_sub_ps( ne, e ) ) );
+	    _mm_storeu_ps( normals->x + j, x );
+	    _mm_storeu_ps( normals->y + j, y );
+	    _mm_storeu_ps( normals->z + j, z );
+	}
+#endif
+	for( ; j + 1 < cols; j++ )
+	{
+	    normals->x[j] = 2.0f * ( C[j - 1] - C[j + 1] ) +
+		( ( S[j - 1] - S[j] ) + ( N[j] - N[j + 1] ) );
+	    normals->y[j] = 6.0f * s;
+	    normals->z[j] = 2.0f * ( N[j] - S[j] ) +
+		( ( C[j - 1] - S[j - 1] ) + ( N[j + 1] - C[j + 1] ) );
 	}
     }
 
-    // Última fila
-    for( j = 0; j < vertsPerRow - 1; j++ )
+    /* Bordes: primera y última columna, o toda la fila */
+    for( k = 0; k < cols; k++ )
     {
-	/*
-	  A---B
-	  |  /|
-	  | / |
-	  |/  |
-	  C---D
-	*/
-	VECTOR n;
-	POINT C, A, B;
-	
-	C = terrain->vertexBuffer[ (vertsPerCol - 1) * vertsPerRow + j + 0 ].p;
-	A = terrain->vertexBuffer[ (vertsPerCol - 2) * vertsPerRow + j + 0 ].p;
-	B = terrain->vertexBuffer[ (vertsPerCol - 2) * vertsPerRow + j + 1 ].p;
-	
-	VECTOR v1 = {B.x - C.x, B.y - C.y, B.z - C.z}; //B-C
-	VECTOR v2 = {A.x - C.x, A.y - C.y, A.z - C.z}; //A-C
-	
-	n = CrossProduct( v1, v2 ); 
-	n = NormalizeVector( n );
-	terrain->vertexBuffer[ (vertsPerCol - 1) * vertsPerRow + j ].n = n;
-    }
-
-    // Última columna
-    for( i = 0; i < vertsPerCol - 1; i++ )
+	if( k > 0 && k + 1 < cols && i > 0 && i + 1 < terrain->vertsPerCol )
+	    continue;
+	GLfloat h[3][3];
+	for( r = 0; r < 3; r++ )
+	    for( c = 0; c < 3; c++ )
+		h[r][c] = rows[r][ MINVALUE( MAXVALUE( (GLint)(k + c) - 1, 0 ),
+					     (GLint)cols - 1 ) ];
+	VECTOR n = TerrainNormalSum( h, i > 0, i + 1 < terrain->vertsPerCol,
+				     k > 0, k + 1 < cols, s );
+	normals->x[k] = n.x;
+	normals->y[k] = n.y;
+	normals->z[k] = n.z;
+    }
+    NormalizeVectors( normals, normals );
+}
+
+/*** Función: Coord de textura del vértice(0, 0) y avance por vértice ***/
+// Repetida sigue a la esquina(mosaicos), si no va de 0 a 1
+void TerrainTexCoords( TERRAIN* terrain, TEXCOORD* start, TEXCOORD* delta )
+{
+    delta->u = terrain->repeatTex ? 1.0f : 1.0f / (terrain->vertsPerRow - 1);
+    delta->v = terrain->repeatTex ? 1.0f : 1.0f / (terrain->vertsPerCol - 1);
+    start->u = terrain->repeatTex ? terrain->originX / terrain->cellSpacing : 0.0f;
+    start->v = terrain->repeatTex ? terrain->originZ / terrain->cellSpacing : 0.0f;
+}
+
+/*** Función: Vértices, normales e índices de una banda(tarea de WORKERPOOL) ***/
+void BuildTerrainBand( void* data, GLuint band )
+{
+    TERRAINBUILD* build   = data;
+    TERRAIN*      terrain = build->terrain;
+    GLuint  vertsPerRow = terrain->vertsPerRow;
+    GLuint  vertsPerCol = terrain->vertsPerCol;
+    GLfloat cellSpacing = terrain->cellSpacing;
+    GLuint  first = band * TERRAIN_BAND;
+    GLuint  last  = MINVALUE( first + TERRAIN_BAND, vertsPerCol );
+    unsigned int i, j;
+
+    /* Texturas */
+    TEXCOORD texStart, texDelta;
+    TerrainTexCoords( terrain, &texStart, &texDelta );
+
+    /* Filas de alturas i-1, i e i+1 y normales de una fila */
+    VECTORARRAY normals;
+    GLfloat*    heights = (GLfloat*)malloc( sizeof(GLfloat) * vertsPerRow * 3 );
+    GLfloat*    rows[3] = { heights, heights + vertsPerRow, heights + 2 * vertsPerRow };
+    InitVectorArray( &normals, vertsPerRow );
+    TerrainHeightRow( terrain, (GLint)first - 1, rows[0] );
+    TerrainHeightRow( terrain, first, rows[1] );
+
+    for( i = first; i < last; i++ )
     {
+	TerrainHeightRow( terrain, i + 1, rows[2] );
+	TerrainNormalRow( terrain, i, rows, &normals );
+
+	/* Vértices */
+	NORMAL_TEX_VERTEX* v = &terrain->vertexBuffer[ i * vertsPerRow ];
+	for( j = 0; j < vertsPerRow; j++ )
+	{
+	    v[j].p.x = terrain->originX + j * cellSpacing;
+	    v[j].p.y = rows[1][j];
+	    v[j].p.z = terrain->originZ + i * cellSpacing;
+	    v[j].n.x = normals.x[j];
+	    v[j].n.y = normals.y[j];
+	    v[j].n.z = normals.z[j];
+	    v[j].t.u = texStart.u + j * texDelta.u;
+	    v[j].t.v = texStart.v + i * texDelta.v;
+	}
+
+	/* Índices de la fila de celdas de abajo */
 	/*
 	  A---B
 	  |  /|
@@ -146,71 +603,279 @@ void InitTerrain( TERRAIN*  terrain,
 	  |/  |
 	  C---D
 	*/
-	VECTOR n;
-	POINT B, D, C;
-	
-	B = terrain->vertexBuffer[ (vertsPerRow * (i + 0)) + (vertsPerCol - 1) ].p;
-	D = terrain->vertexBuffer[ (vertsPerRow * (i + 1)) + (vertsPerCol - 1) ].p;
-	C = terrain->vertexBuffer[ (vertsPerRow * (i + 1)) + (vertsPerCol - 2) ].p;
-	
-	VECTOR v1 = {C.x - B.x, C.y - B.y, C.z - B.z}; //C-B
-	VECTOR v2 = {D.x - B.x, D.y - B.y, D.z - B.z}; //D-B
-	
-	n = CrossProduct( v1, v2 ); 
-	n = NormalizeVector( n );
-	terrain->vertexBuffer[ (vertsPerRow * (i + 0)) + (vertsPerCol - 1) ].n = n;
-    }
-
-    // Normal: extrema derecha inferior
+	if( i + 1 < vertsPerCol )
+	    for( j = 0; j < vertsPerRow - 1; j++ )
+	    {
+		GLuint* index = &terrain->indexBuffer[ (i * (vertsPerRow - 1) + j) * 2 * 3 ];
+		// Triángulo 1(ABC)
+		index[0] = ((i + 0) * vertsPerRow + j) + 0;
+		index[1] = ((i + 0) * vertsPerRow + j) + 1;
+		index[2] = ((i + 1) * vertsPerRow + j) + 0;
+		// Triángulo 2(BDC)
+		index[3] = ((i + 0) * vertsPerRow + j) + 1;
+		index[4] = ((i + 1) * vertsPerRow + j) + 1;
+		index[5] = ((i + 1) * vertsPerRow + j) + 0;
+	    }
+
+	/* Siguiente fila */
+	GLfloat* top = rows[0];
+	rows[0] = rows[1];
+	rows[1] = rows[2];
+	rows[2] = top;
+    }
+    FreeVectorArray( &normals );
+    free( heights );
+}
+
+/*** Función: Arma la geometría desde el heightMap ya leído ***/
+// Usa las características del terreno(tamaño, espaciado, esquina y
+// textura). El trabajo se reparte en bandas de TERRAIN_BAND filas entre
+// los hilos de "pool"(NULL: todo en el hilo que llama).
+void BuildTerrainGeometry( WORKERPOOL* pool, TERRAIN* terrain, GLfloat heightScale )
+{
+    GLuint       bands = ( terrain->vertsPerCol + TERRAIN_BAND - 1 ) / TERRAIN_BAND;
+    TERRAINBUILD build = { terrain, heightScale, 0 };
+
+    terrain->vertexBuffer = (NORMAL_TEX_VERTEX*)malloc( terrain->vertsPerRow * terrain->vertsPerCol *
+							sizeof(NORMAL_TEX_VERTEX) );
+    terrain->indexBuffer  = (GLuint*)malloc( (terrain->vertsPerRow - 1) * (terrain->vertsPerCol - 1) *
+					     2 * 3 * sizeof( GLuint ) );
+
+    /* Alturas escaladas antes de las normales: las bandas leen a sus vecinas */
+    RunWorkerPool( pool, ScaleTerrainBand, &build, bands );
+    RunWorkerPool( pool, BuildTerrainBand, &build, bands );
+
+    /* Pirámide de alturas para rayos y esferas */
+    BuildTerrainPyramid( pool, terrain );
+
+    /* Trozos para el nivel de detalle */
+    BuildTerrainChunks( pool, terrain );
+}
+
+/*** Función: Carga la geometría de un terreno(sin opengl) ***/
+// Sirve para colisiones sin ventana; InitTerrain agrega textura y lista.
+// "pool" reparte el armado(NULL: en el hilo que llama).
+GLboolean LoadTerrainGeometry( WORKERPOOL* pool,
+			       TERRAIN*  terrain,
+			       char*     terrainFile,
+			       GLboolean repeatTex,
+			       GLuint    vertsPerRow,
+			       GLuint    vertsPerCol,
+			       GLuint    cellSpacing,
+			       GLfloat   heightScale )
+{
+    /* Características */
+    terrain->vertsPerRow  = vertsPerRow;
+    terrain->vertsPerCol  = vertsPerCol;
+    terrain->cellSpacing  = cellSpacing;
+    terrain->textureID    = 0;
+    terrain->repeatTex    = repeatTex;
+    terrain->heightColors = GL_FALSE;
+    terrain->originX      = 0.0f;
+    terrain->originZ      = 0.0f;
+    terrain->next         = NULL;
+
+    /* Leo el heightMap */
+    FILE* file = fopen( terrainFile, "r" );
+    if( file == NULL )
     {
-	/*
-	  A---B
-	  |  /|
-	  | / |
-	  |/  |
-	  C---D
-	*/
-	VECTOR n;
-	POINT D, B, C;
-	
-	D = terrain->vertexBuffer[ (vertsPerCol - 1) * vertsPerRow + vertsPerRow - 1 ].p;
-	B = terrain->vertexBuffer[ (vertsPerCol - 2) * vertsPerRow + vertsPerRow - 1 ].p;
-	C = terrain->vertexBuffer[ (vertsPerCol - 1) * vertsPerRow + vertsPerRow - 2 ].p;
-	
-	VECTOR v1 = {B.x - D.x, B.y - D.y, B.z - D.z}; //B-D
-	VECTOR v2 = {C.x - D.x, C.y - D.y, C.z - D.z}; //C-D
-	
-	n = CrossProduct( v1, v2 ); 
-	n = NormalizeVector( n );
-	terrain->vertexBuffer[ (vertsPerCol - 1) * vertsPerRow + vertsPerRow - 1 ].n = n;
-    }
-
-    /* Índices */
-    terrain->indexBuffer = (GLuint*)calloc( (vertsPerRow - 1) * (vertsPerCol - 1) * 2 * 3,
-					    sizeof( GLuint ) );
-
-    for( i = 0; i < vertsPerCol - 1; i++ )
-    {
-	for( j = 0; j < vertsPerRow - 1; j++ )
-	{
-	    /*
-	      A---B
-	      |  /|
-	      | / |
-	      |/  |
-	      C---D
-	    */
-	    unsigned int base = (i * (vertsPerRow - 1) + j) * 2 * 3;
-	    // Triángulo 1(ABC)
-	    terrain->indexBuffer[ base + 0 ] = ((i + 0) * vertsPerRow + j) + 0;
-	    terrain->indexBuffer[ base + 1 ] = ((i + 0) * vertsPerRow + j) + 1;
-	    terrain->indexBuffer[ base + 2 ] = ((i + 1) * vertsPerRow + j) + 0;
-	    // Triángulo 2(BDC)
-	    terrain->indexBuffer[ base + 3 ] = ((i + 0) * vertsPerRow + j) + 1;
-	    terrain->indexBuffer[ base + 4 ] = ((i + 1) * vertsPerRow + j) + 1;
-	    terrain->indexBuffer[ base + 5 ] = ((i + 1) * vertsPerRow + j) + 0;
+	PrintError( "Could not open the terrain heightmap", GL_FALSE );
+	return GL_FALSE;
+    }
+    terrain->heightMap = (unsigned char*)calloc( vertsPerRow * vertsPerCol,
+						 sizeof(unsigned char) );
+    fread( terrain->heightMap, sizeof(unsigned char), vertsPerRow * vertsPerCol, file );
+    fclose( file );
+
+    BuildTerrainGeometry( pool, terrain, heightScale );
+    return GL_TRUE;
+}
+
+/*** Función: Pasa un vértice del terreno a su página ***/
+// Devuelve GL_FALSE si la altura no cabe en los pasos de la página
+GLboolean PackTerrainVertex( TERRAIN* terrain, TERRAINPAGE* page, GLuint i, GLuint j )
+{
+    NORMAL_TEX_VERTEX* v     = &terrain->vertexBuffer[ i * terrain->vertsPerRow + j ];
+    TERRAINVERTEX*     out   = &page->vertices[ (i - page->row) * page->cols + j - page->col ];
+    // Todas las páginas redondean igual: los bordes repetidos coinciden
+    GLint              steps = (GLint)floor( v->p.y * (double)TERRAIN_STEPS /
+					     terrain->cellSpacing + 0.5 ) - page->base;
+    if( steps < -32767 || steps > 32767 )
+	return GL_FALSE;
+    out->p[0] = (GLshort)( (j - page->col) * TERRAIN_STEPS );
+    out->p[1] = (GLshort)steps;
+    out->p[2] = (GLshort)( (i - page->row) * TERRAIN_STEPS );
+    out->p[3] = 0;
+    PackNormal( v->n, out->n );
+    return GL_TRUE;
+}
+
+/*** Función: Arma los vértices de una página ***/
+// El paso 0 queda a la mitad de las alturas de la página. Devuelve
+// GL_FALSE si no caben en 16 bits.
+GLboolean PackTerrainPage( TERRAIN* terrain, TERRAINPAGE* page )
+{
+    GLfloat step = terrain->cellSpacing / TERRAIN_STEPS;
+    GLfloat min  =  INFINITY;
+    GLfloat max  = -INFINITY;
+    unsigned int i, j;
+
+    for( i = page->row; i < page->row + page->rows; i++ )
+	for( j = page->col; j < page->col + page->cols; j++ )
+	{
+	    GLfloat h = terrain->vertexBuffer[ i * terrain->vertsPerRow + j ].p.y;
+	    min = MINVALUE( min, h );
+	    max = MAXVALUE( max, h );
+	}
+    page->base     = (GLint)floorf( ( min + max ) * 0.5f / step + 0.5f );
+    page->origin.x = terrain->originX + page->col * terrain->cellSpacing;
+    page->origin.y = page->base * step;
+    page->origin.z = terrain->originZ + page->row * terrain->cellSpacing;
+
+    for( i = page->row; i < page->row + page->rows; i++ )
+	for( j = page->col; j < page->col + page->cols; j++ )
+	    if( !PackTerrainVertex( terrain, page, i, j ) )
+		return GL_FALSE;
+    return GL_TRUE;
+}
+
+/*** Función: Arma una página(tarea de WORKERPOOL) ***/
+// Si no cabe la deja sin vértices
+void BuildTerrainPage( void* data, GLuint index )
+{
+    TERRAIN*     terrain = data;
+    TERRAINPAGE* page    = &terrain->pages[index];
+    GLuint       first   = (index / terrain->pageCols) * TERRAIN_PAGE * terrain->chunkCols +
+	(index % terrain->pageCols) * TERRAIN_PAGE;
+    GLuint       rows    = MINVALUE( TERRAIN_PAGE, terrain->chunkRows - first / terrain->chunkCols );
+    GLuint       cols    = MINVALUE( TERRAIN_PAGE, terrain->chunkCols - first % terrain->chunkCols );
+    TERRAINCHUNK* last   = &terrain->chunks[ first + (rows - 1) * terrain->chunkCols + cols - 1 ];
+    unsigned int i, j;
+
+    /* Vértices de sus trozos */
+    page->row  = terrain->chunks[first].row;
+    page->col  = terrain->chunks[first].col;
+    page->rows = last->row + last->rows - page->row + 1;
+    page->cols = last->col + last->cols - page->col + 1;
+    for( i = 0; i < rows; i++ )
+	for( j = 0; j < cols; j++ )
+	    terrain->chunks[ first + i * terrain->chunkCols + j ].page = index;
+
+    page->vertices = (TERRAINVERTEX*)malloc( sizeof(TERRAINVERTEX) * page->rows * page->cols );
+    if( !PackTerrainPage( terrain, page ) )
+    {
+	free( page->vertices );
+	page->vertices = NULL;
+    }
+}
+
+/*** Función: Libera las páginas: se vuelve a dibujar con vertexBuffer ***/
+void FreeTerrainPages( TERRAIN* terrain )
+{
+    unsigned int i;
+    if( terrain->pages == NULL )
+	return;
+    for( i = 0; i < terrain->pageRows * terrain->pageCols; i++ )
+	free( terrain->pages[i].vertices );
+    free( terrain->pages );
+    free( terrain->drawShorts );
+    terrain->pages        = NULL;
+    terrain->drawShorts   = NULL;
+    terrain->drawCount    = 0;
+    terrain->drawCapacity = 0;
+}
+
+/*** Función: Vértices compactos para dibujar el terreno ***/
+// RenderTerrain dibuja cada página con TERRAINVERTEX(12 bytes en vez de
+// 32) e índices de 16 bits; alturas, rayos y colisiones siguen con
+// vertexBuffer. Se llama con la geometría armada; DeformTerrain mantiene
+// las páginas. Devuelve GL_FALSE, sin páginas, si las alturas de una
+// página no caben en 16 bits de pasos.
+GLboolean CompactTerrain( WORKERPOOL* pool, TERRAIN* terrain )
+{
+    unsigned int i;
+    FreeTerrainPages( terrain );
+    free( terrain->drawBuffer );
+    terrain->drawBuffer   = NULL;
+    terrain->drawCount    = 0;
+    terrain->drawCapacity = 0;
+
+    terrain->pageRows = ( terrain->chunkRows + TERRAIN_PAGE - 1 ) / TERRAIN_PAGE;
+    terrain->pageCols = ( terrain->chunkCols + TERRAIN_PAGE - 1 ) / TERRAIN_PAGE;
+    terrain->pages    = (TERRAINPAGE*)calloc( terrain->pageRows * terrain->pageCols,
+					      sizeof(TERRAINPAGE) );
+    RunWorkerPool( pool, BuildTerrainPage, terrain, terrain->pageRows * terrain->pageCols );
+
+    for( i = 0; i < terrain->pageRows * terrain->pageCols; i++ )
+	if( terrain->pages[i].vertices == NULL )
+	{
+	    FreeTerrainPages( terrain );
+	    return GL_FALSE;
 	}
+    return GL_TRUE;
+}
+
+/*** Función: Color de la textura generada para una altura ***/
+// Escribe el pixel RGB de 8 bits
+void TerrainHeightPixel( GLubyte* pixel, GLfloat height )
+{
+    COLOR c;
+    if( height < 42.5f )
+    {
+	COLOR t = BEACH_SAND;
+	c = t;
+    }
+    else if( height < 85.0f )
+    {
+	COLOR t = LIGHT_YELLOW_GREEN;
+	c = t;
+    }
+    else if( height < 127.5f )
+    {
+	COLOR t = PUREGREEN;
+	c = t;
     }
+    else if( height < 170.0f )
+    {
+	COLOR t = DARK_YELLOW_GREEN;
+	c = t;
+    }
+    else if( height < 212.5f )
+    {
+	COLOR t = DARKBROWN;
+	c = t;
+    }
+    else
+    {
+	COLOR t = WHITE;
+	c = t;
+    }
+    // Pongo el color en entero
+    pixel[0] = (GLubyte)(c.r * 255.0f);
+    pixel[1] = (GLubyte)(c.g * 255.0f);
+    pixel[2] = (GLubyte)(c.b * 255.0f);
+}
+
+/*** Función: Inicializa un terreno ***/
+// Con terrainTexture = NULL colorea por alturas en una textura del tamaño del
+// mapa; con TERRAINSPLAT basta LoadTerrainGeometry y el material
+void InitTerrain( WORKERPOOL* pool,
+		  TERRAIN*  terrain,
+		  char*     terrainFile,
+		  char*     terrainTexture,
+		  GLboolean repeatTex,
+		  MATERIAL* terrainMtrl,
+		  GLuint    vertsPerRow,
+		  GLuint    vertsPerCol,
+		  GLuint    cellSpacing,
+		  GLfloat   heightScale )
+{
+    /* Geometría */
+    if( !LoadTerrainGeometry( pool, terrain, terrainFile, repeatTex,
+			      vertsPerRow, vertsPerCol, cellSpacing, heightScale ) )
+	return;
+    terrain->material = *terrainMtrl;
+    unsigned int i, j;
 
     /* Coloreado de terreno */
     if( terrainTexture != NULL )
@@ -221,49 +886,13 @@ void InitTerrain( TERRAIN*  terrain,
 	// Genero la textura
 	glGenTextures( 1, &(terrain->textureID) );
 
-	GLubyte pixelData[ vertsPerRow * vertsPerCol * sizeof(GLubyte) * 3 ];
+	// En el heap: un mapa grande no cabe en la pila
+	GLubyte* pixelData = (GLubyte*)malloc( vertsPerRow * vertsPerCol * sizeof(GLubyte) * 3 );
 	for( i = 0; i < vertsPerCol; i++ )
-	{
 	    for( j = 0; j < vertsPerRow; j++ )
-	    {
-		GLfloat height = terrain->heightMap[ (i * vertsPerRow) + j ];
-		COLOR c;
-		if( height < 42.5f )
-		{
-		    COLOR t = BEACH_SAND;
-		    c = t;
-		}
-		else if( height < 85.0f )
-		{
-		    COLOR t = LIGHT_YELLOW_GREEN;
-		    c = t;
-		}
-		else if( height < 127.5f )
-		{
-		    COLOR t = PUREGREEN;
-		    c = t;
-		}
-		else if( height < 170.0f )
-		{
-		    COLOR t = DARK_YELLOW_GREEN;
-		    c = t;
-		}
-		else if( height < 212.5f )
-		{
-		    COLOR t = DARKBROWN;
-		    c = t;
-		}
-		else
-		{
-		    COLOR t = WHITE;
-		    c = t;
-		}
-		// Pongo el color en entero
-		pixelData[ (i * vertsPerRow + j) * 3 + 0 ] = (GLubyte)(c.r * 255.0f);
-		pixelData[ (i * vertsPerRow + j) * 3 + 1 ] = (GLubyte)(c.g * 255.0f);
-		pixelData[ (i * vertsPerRow + j) * 3 + 2 ] = (GLubyte)(c.b * 255.0f);
-	    }
-	}
+		TerrainHeightPixel( &pixelData[ (i * vertsPerRow + j) * 3 ],
+				    terrain->vertexBuffer[ i * vertsPerRow + j ].p.y );
+	terrain->heightColors = GL_TRUE;
 
 	// Cargo la textura en memoria
 	glBindTexture( GL_TEXTURE_2D, terrain->textureID );
@@ -283,34 +912,322 @@ void InitTerrain( TERRAIN*  terrain,
 		      GL_RGB,
 		      GL_UNSIGNED_BYTE,
 		      pixelData );
+	free( pixelData );
     }
+}
 
-    /* Compilación de la lista de dibujo */
-    // Creo la lista
-    terrain->terrainList = glGenLists( 1 );
-    
-    // Habilito el uso de arreglos de vértices, normales y texturas
-    glEnableClientState( GL_VERTEX_ARRAY );
-    glEnableClientState( GL_NORMAL_ARRAY );
-    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
-    glDisableClientState( GL_COLOR_ARRAY );
-
-    // Buffers
-    // Pongo el buffer de vértices en memoria de video
-    glVertexPointer( 3, GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].p );
-    // Pongo el buffer de normales en memoria de video
-    glNormalPointer( GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].n );
-    // Pongo el buffer de coordenadas de textura en memoria de video
-    glTexCoordPointer( 2, GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].t );
-
-    /* Inicia los comandos de la lista */
-    glNewList( terrain->terrainList, GL_COMPILE );
-    glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT );
-
-    // Textura
-    glEnable( GL_TEXTURE_2D );
-    if( repeatTex )
-    {
+/*** Función: Libera los recursos de un terreno ***/
+void FreeTerrain( TERRAIN* terrain )
+{
+    free( terrain->heightMap );
+    free( terrain->vertexBuffer );
+    free( terrain->indexBuffer );
+    free( terrain->pyramid );
+    free( terrain->pyramidLevel );
+    free( terrain->chunks );
+    free( terrain->drawBuffer );
+    FreeTerrainPages( terrain );
+    // Sin textura no hay recursos de opengl(LoadTerrainGeometry)
+    if( terrain->textureID == 0 )
+	return;
+    glDeleteTextures( 1, &terrain->textureID );
+}
+
+/*** Función: Factor de nivel de detalle para SelectTerrainLOD ***/
+// Un error de altura "e" a distancia "d" se ve de e * height / (2 tan(fovy/2) d)
+// pixeles; el factor incluye el error permitido en pixeles
+GLfloat TerrainLODFactor( GLfloat fovy, GLint height, GLfloat pixelError )
+{
+    return height / ( 2.0f * tanf( fovy * 0.5f * M_PI / 180.0f ) * pixelError );
+}
+
+/*** Función: Agrega un triángulo de un trozo(coordenadas locales) ***/
+// Se ordena como los triángulos del terreno completo(ABC y BDC). Con
+// páginas el índice es dentro de la página del trozo.
+void AddChunkTriangle( TERRAIN* terrain, TERRAINCHUNK* chunk,
+		       GLuint x0, GLuint z0, GLuint x1, GLuint z1,
+		       GLuint x2, GLuint z2 )
+{
+    GLint  cross  = ((GLint)x1 - (GLint)x0) * ((GLint)z2 - (GLint)z0) -
+	((GLint)z1 - (GLint)z0) * ((GLint)x2 - (GLint)x0);
+    GLuint stride = terrain->vertsPerRow;
+    GLuint base   = chunk->row * stride + chunk->col;
+    GLuint index[3];
+
+    if( terrain->pages != NULL )
+    {
+	TERRAINPAGE* page = &terrain->pages[ chunk->page ];
+	stride = page->cols;
+	base   = (chunk->row - page->row) * stride + chunk->col - page->col;
+    }
+    index[0] = base + z0 * stride + x0;
+    index[1] = base + z1 * stride + x1;
+    index[2] = base + z2 * stride + x2;
+    if( cross < 0 )
+    {
+	index[1] = base + z2 * stride + x2;
+	index[2] = base + z1 * stride + x1;
+    }
+
+    if( terrain->pages != NULL )
+    {
+	GLushort* out = &terrain->drawShorts[ terrain->drawCount ];
+	out[0] = (GLushort)index[0];
+	out[1] = (GLushort)index[1];
+	out[2] = (GLushort)index[2];
+    }
+    else
+	memcpy( &terrain->drawBuffer[ terrain->drawCount ], index, sizeof(index) );
+    terrain->drawCount += 3;
+}
+
+/*** Función: Punto de un borde del trozo ***/
+// "t" avanza por el borde y "d" entra al trozo; bordes: 0 arriba(z = 0),
+// 1 abajo(z = rows), 2 izquierda(x = 0), 3 derecha(x = cols)
+void ChunkEdgePoint( TERRAINCHUNK* chunk, GLuint edge, GLuint t, GLuint d,
+		     GLuint* x, GLuint* z )
+{
+    switch( edge )
+    {
+    case 0: *x = t;               *z = d;               break;
+    case 1: *x = t;               *z = chunk->rows - d; break;
+    case 2: *x = d;               *z = t;               break;
+    default:*x = chunk->cols - d; *z = t;               break;
+    }
+}
+
+/*** Función: Une un borde del trozo(paso "outer") con su interior("step") ***/
+// Sólo usa los vértices del borde que usa el vecino, así no hay grietas
+void ZipChunkEdge( TERRAIN* terrain, TERRAINCHUNK* chunk, GLuint edge,
+		   GLuint step, GLuint outer )
+{
+    GLuint length = edge < 2 ? chunk->cols : chunk->rows;
+    GLuint o = 0, in = step; // Vértice actual del borde y de la línea interior
+    GLuint x0, z0, x1, z1, x2, z2;
+
+    while( o < length || in < length - step )
+    {
+	ChunkEdgePoint( chunk, edge, o, 0, &x0, &z0 );
+	ChunkEdgePoint( chunk, edge, in, step, &x2, &z2 );
+	if( in >= length - step || ( o < length && o + outer <= in + step ) )
+	{
+	    // Avanza el borde
+	    ChunkEdgePoint( chunk, edge, o + outer, 0, &x1, &z1 );
+	    o += outer;
+	}
+	else
+	{
+	    // Avanza la línea interior
+	    ChunkEdgePoint( chunk, edge, in + step, step, &x1, &z1 );
+	    in += step;
+	}
+	AddChunkTriangle( terrain, chunk, x0, z0, x1, z1, x2, z2 );
+    }
+}
+
+/*** Función: Agrega los triángulos de un trozo con su nivel de detalle ***/
+void AddChunk( TERRAIN* terrain, GLuint row, GLuint col )
+{
+    TERRAINCHUNK* chunk = &terrain->chunks[ row * terrain->chunkCols + col ];
+    GLuint step = 1 << chunk->lod;
+    unsigned int x, z, e;
+
+    /* Espacio para el peor caso(todas las celdas) */
+    GLuint needed = terrain->drawCount + chunk->rows * chunk->cols * 2 * 3;
+    if( needed > terrain->drawCapacity )
+    {
+	terrain->drawCapacity = MAXVALUE( needed, terrain->drawCapacity * 2 );
+	if( terrain->pages != NULL )
+	    terrain->drawShorts = (GLushort*)realloc( terrain->drawShorts,
+						      sizeof(GLushort) * terrain->drawCapacity );
+	else
+	    terrain->drawBuffer = (GLuint*)realloc( terrain->drawBuffer,
+						    sizeof(GLuint) * terrain->drawCapacity );
+    }
+
+    /* Trozo de una celda de ancho: sin borde ni interior */
+    if( chunk->rows / step < 2 || chunk->cols / step < 2 )
+    {
+	for( z = 0; z < chunk->rows; z += step )
+	    for( x = 0; x < chunk->cols; x += step )
+	    {
+		AddChunkTriangle( terrain, chunk, x, z, x + step, z, x, z + step );
+		AddChunkTriangle( terrain, chunk, x + step, z, x + step, z + step,
+				  x, z + step );
+	    }
+	return;
+    }
+
+    /* Interior */
+    for( z = step; z + 2 * step <= chunk->rows; z += step )
+	for( x = step; x + 2 * step <= chunk->cols; x += step )
+	{
+	    AddChunkTriangle( terrain, chunk, x, z, x + step, z, x, z + step );
+	    AddChunkTriangle( terrain, chunk, x + step, z, x + step, z + step,
+			      x, z + step );
+	}
+
+    /* Bordes: con el paso mayor entre el trozo y su vecino. El borde del
+       terreno usa todos sus vértices para calzar con un mosaico vecino */
+    GLint neighbor[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    for( e = 0; e < 4; e++ )
+    {
+	GLint  nRow  = (GLint)row + neighbor[e][0];
+	GLint  nCol  = (GLint)col + neighbor[e][1];
+	GLuint outer = 1;
+	if( nRow >= 0 && nRow < (GLint)terrain->chunkRows &&
+	    nCol >= 0 && nCol < (GLint)terrain->chunkCols )
+	    outer = MAXVALUE( step, 1u << terrain->chunks[ nRow * terrain->chunkCols +
+							 nCol ].lod );
+	ZipChunkEdge( terrain, chunk, e, step, outer );
+    }
+}
+
+/*** Función: Agrega los trozos visibles de un rango de trozos ***/
+// Filas [row0, row1) y columnas [col0, col1); suma a "count"
+void AddVisibleChunks( TERRAIN* terrain, GLuint row0, GLuint row1,
+		       GLuint col0, GLuint col1, TERRAINSTATS* count )
+{
+    unsigned int i, j;
+    for( i = row0; i < row1; i++ )
+	for( j = col0; j < col1; j++ )
+	{
+	    TERRAINCHUNK* chunk = &terrain->chunks[ i * terrain->chunkCols + j ];
+	    if( !chunk->visible )
+		continue;
+	    AddChunk( terrain, i, j );
+	    count->visible++;
+	    count->levels[ chunk->lod ]++;
+	}
+}
+
+/*** Función: Elige el nivel de cada trozo de un mosaico ***/
+// Suma sus trozos y triángulos a "count"(ver SelectTerrainLOD)
+void SelectTileLOD( TERRAIN*       terrain  ,
+		    VECTOR         eye      ,
+		    const FRUSTUM* frustum  ,
+		    GLfloat        lodFactor,
+		    TERRAINSTATS*  count    )
+{
+    GLuint chunks = terrain->chunkRows * terrain->chunkCols;
+    unsigned int i;
+    count->chunks += chunks;
+
+    /* Nivel y visibilidad */
+    for( i = 0; i < chunks; i++ )
+    {
+	TERRAINCHUNK* chunk = &terrain->chunks[i];
+	// Distancia de la cámara a la caja
+	VECTOR  d    = { MAXVALUE( 0.0f, MAXVALUE( chunk->box.min.x - eye.x,
+						   eye.x - chunk->box.max.x ) ),
+			 MAXVALUE( 0.0f, MAXVALUE( chunk->box.min.y - eye.y,
+						   eye.y - chunk->box.max.y ) ),
+			 MAXVALUE( 0.0f, MAXVALUE( chunk->box.min.z - eye.z,
+						   eye.z - chunk->box.max.z ) ) };
+	GLfloat dist = NormVector( d );
+
+	chunk->lod = 0;
+	while( chunk->lod + 1 < chunk->levels &&
+	       chunk->error[ chunk->lod + 1 ] * lodFactor <= dist )
+	    chunk->lod++;
+	chunk->visible = frustum == NULL ||
+	    BoxInFrustum( frustum, chunk->box ) != FRUSTUM_OUTSIDE;
+    }
+
+    /* Índices de los trozos visibles: seguidos por página si las hay */
+    terrain->drawCount = 0;
+    if( terrain->pages == NULL )
+	AddVisibleChunks( terrain, 0, terrain->chunkRows, 0, terrain->chunkCols, count );
+    else
+	for( i = 0; i < terrain->pageRows * terrain->pageCols; i++ )
+	{
+	    TERRAINPAGE* page = &terrain->pages[i];
+	    GLuint       row  = (i / terrain->pageCols) * TERRAIN_PAGE;
+	    GLuint       col  = (i % terrain->pageCols) * TERRAIN_PAGE;
+	    page->drawFirst = terrain->drawCount;
+	    AddVisibleChunks( terrain, row, MINVALUE( row + TERRAIN_PAGE, terrain->chunkRows ),
+			      col, MINVALUE( col + TERRAIN_PAGE, terrain->chunkCols ), count );
+	    page->drawCount = terrain->drawCount - page->drawFirst;
+	}
+    count->triangles += terrain->drawCount / 3;
+}
+
+/*** Función: Elige el nivel de cada trozo y arma los índices visibles ***/
+// El nivel es el más grueso cuyo error se ve de a lo más un pixel permitido
+// (TerrainLODFactor). Los trozos fuera de "frustum"(puede ser NULL) no se
+// dibujan pero sí eligen nivel, para que sus vecinos visibles no tengan grietas.
+// Con una lista de mosaicos(TERRAIN.next) se eligen todos.
+GLuint SelectTerrainLOD( TERRAIN*       terrain  ,
+			 VECTOR         eye      ,  // Posición de la cámara
+			 const FRUSTUM* frustum  ,
+			 GLfloat        lodFactor,
+			 TERRAINSTATS*  stats    )  // Conteos(puede ser NULL)
+{
+    TERRAINSTATS count;
+    memset( &count, 0, sizeof(TERRAINSTATS) );
+    for( ; terrain != NULL; terrain = terrain->next )
+	SelectTileLOD( terrain, eye, frustum, lodFactor, &count );
+
+    if( stats != NULL )
+	*stats = count;
+    return count.triangles;
+}
+
+/*** Función: Dibuja las páginas de un mosaico(CompactTerrain) ***/
+// Los pasos de la ubicación se deshacen en la matriz y en "origin"(el
+// vertexOrigin de un shader, -1 sin shader). Con "texGen" la textura sale
+// de la ubicación como en vertexBuffer.
+void RenderTerrainPages( TERRAIN* terrain, GLint origin, GLboolean texGen )
+{
+    GLfloat  step = terrain->cellSpacing / TERRAIN_STEPS;
+    TEXCOORD texStart, texDelta;
+    unsigned int i;
+
+    TerrainTexCoords( terrain, &texStart, &texDelta );
+    for( i = 0; i < terrain->pageRows * terrain->pageCols; i++ )
+    {
+	TERRAINPAGE* page = &terrain->pages[i];
+	if( page->drawCount == 0 )
+	    continue;
+
+	glPushMatrix();
+	glTranslatef( page->origin.x, page->origin.y, page->origin.z );
+	glScalef( step, step, step );
+	if( origin >= 0 )
+	    glUniform4f( origin, page->origin.x, page->origin.y, page->origin.z, step );
+	if( texGen )
+	{
+	    GLfloat s[4] = { texDelta.u / TERRAIN_STEPS, 0.0f, 0.0f,
+			     texStart.u + page->col * texDelta.u };
+	    GLfloat t[4] = { 0.0f, 0.0f, texDelta.v / TERRAIN_STEPS,
+			     texStart.v + page->row * texDelta.v };
+	    glTexGenfv( GL_S, GL_OBJECT_PLANE, s );
+	    glTexGenfv( GL_T, GL_OBJECT_PLANE, t );
+	}
+
+	glVertexPointer( 3, GL_SHORT, sizeof(TERRAINVERTEX), page->vertices[0].p );
+	glNormalPointer( GL_BYTE, sizeof(TERRAINVERTEX), page->vertices[0].n );
+	glDrawRangeElements( GL_TRIANGLES, 0, page->rows * page->cols - 1, page->drawCount,
+			     GL_UNSIGNED_SHORT, &terrain->drawShorts[ page->drawFirst ] );
+	glPopMatrix();
+    }
+}
+
+/*** Función: Dibuja los mosaicos de RenderTerrain y RenderTerrainSplat ***/
+// "origin" es el vertexOrigin del shader activo(-1 sin shader)
+void RenderTerrainTiles( TERRAIN* terrain, GLint origin )
+{
+    if( terrain == NULL )
+	return;
+    // Coordenadas de textura generadas de las páginas, salvo que ya se generen
+    GLboolean texGen = !glIsEnabled( GL_TEXTURE_GEN_S );
+    glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+
+    // Textura
+    glEnable( GL_TEXTURE_2D );
+    if( terrain->repeatTex )
+    {
 	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
 	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
     }
@@ -320,34 +1237,177 @@ void InitTerrain( TERRAIN*  terrain,
 	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP );
     }
 
-    // Renderización
-    glDrawElements( GL_TRIANGLES, (terrain->vertsPerRow - 1) * (terrain->vertsPerCol - 1) * 2 * 3,
-		    GL_UNSIGNED_INT, terrain->indexBuffer );
+    // Arreglos de vértices, normales y texturas
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_NORMAL_ARRAY );
+    glDisableClientState( GL_COLOR_ARRAY );
+    for( ; terrain != NULL; terrain = terrain->next )
+    {
+	if( terrain->pages != NULL )
+	{
+	    // Normales más cortas por la escala de la matriz
+	    glEnable( GL_NORMALIZE );
+	    glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	    if( texGen )
+	    {
+		glTexGeni( GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR );
+		glTexGeni( GL_T, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR );
+		glEnable( GL_TEXTURE_GEN_S );
+		glEnable( GL_TEXTURE_GEN_T );
+	    }
+	    RenderTerrainPages( terrain, origin, texGen );
+	    continue;
+	}
+	if( texGen )
+	{
+	    glDisable( GL_TEXTURE_GEN_S );
+	    glDisable( GL_TEXTURE_GEN_T );
+	}
+	if( origin >= 0 )
+	    glUniform4f( origin, 0.0f, 0.0f, 0.0f, 1.0f );
+	glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+	glVertexPointer( 3, GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].p );
+	glNormalPointer( GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].n );
+	glTexCoordPointer( 2, GL_FLOAT, sizeof(NORMAL_TEX_VERTEX), &terrain->vertexBuffer[0].t );
 
-    /* Terminan los comandos de la lista */
+	// Renderización
+	glDrawElements( GL_TRIANGLES, terrain->drawCount, GL_UNSIGNED_INT,
+			terrain->drawBuffer );
+    }
+
+    glPopClientAttrib();
     glPopAttrib();
-    glEndList();
 }
 
-/*** Función: Libera los recursos de un terreno ***/
-void FreeTerrain( TERRAIN* terrain )
+/*** Función: Dibuja los trozos elegidos en el último SelectTerrainLOD ***/
+// Usa la textura y el material activos, como la lista del terreno; dibuja
+// también los mosaicos que le siguen(TERRAIN.next)
+void RenderTerrain( TERRAIN* terrain )
 {
-    free( terrain->heightMap );
-    free( terrain->vertexBuffer );
-    free( terrain->indexBuffer );
-    glDeleteTextures( 1, &terrain->textureID );
-    glDeleteLists( terrain->terrainList, 1 );
+    RenderTerrainTiles( terrain, -1 );
+}
+
+/*** Función: Prepara el shader y las texturas de TERRAINSPLAT ***/
+// Devuelve GL_FALSE si no se pudo armar el shader: hay que usar InitTerrain
+GLboolean InitTerrainSplat( TERRAINSPLAT* splat,
+			    char*         sandTexture,
+			    char*         grassTexture,
+			    char*         rockTexture,
+			    GLfloat       sandHeight,
+			    GLfloat       rockSlope,
+			    GLfloat       blend,
+			    GLfloat       tileSize )
+{
+    const char* samplers[TERRAIN_SPLAT_LAYERS] = { "sandTex", "grassTex", "rockTex" };
+    char*       files[TERRAIN_SPLAT_LAYERS];
+    GLuint      vertex, fragment;
+    unsigned int i;
+
+    memset( splat, 0, sizeof(TERRAINSPLAT) );
+    splat->sandHeight = sandHeight;
+    splat->rockSlope  = rockSlope;
+    splat->blend      = blend;
+    splat->tileSize   = tileSize;
+
+    /* Shader */
+    vertex   = CreateShader( TERRAIN_SPLAT_VERTEX, GL_VERTEX_SHADER );
+    fragment = CreateShader( TERRAIN_SPLAT_FRAGMENT, GL_FRAGMENT_SHADER );
+    if( vertex != 0 && fragment != 0 )
+	splat->program = CreateProgram( 2, vertex, fragment );
+    // El programa guarda lo que necesita de los shaders
+    if( vertex != 0 )
+	glDeleteShader( vertex );
+    if( fragment != 0 )
+	glDeleteShader( fragment );
+    if( splat->program == 0 )
+	return GL_FALSE;
+
+    /* Texturas: se repiten en el mundo */
+    files[0] = sandTexture;
+    files[1] = grassTexture;
+    files[2] = rockTexture;
+    glUseProgram( splat->program );
+    for( i = 0; i < TERRAIN_SPLAT_LAYERS; i++ )
+    {
+	splat->layers[i] = LoadTexture( files[i] );
+	glBindTexture( GL_TEXTURE_2D, splat->layers[i] );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+	// Capa i en la unidad i + 1: la 0 queda para RenderTerrain
+	glUniform1i( glGetUniformLocation( splat->program, samplers[i] ), i + 1 );
+    }
+    glBindTexture( GL_TEXTURE_2D, 0 );
+    glUseProgram( 0 );
+
+    /* Parámetros que se pueden cambiar entre cuadros */
+    splat->uniforms[0] = glGetUniformLocation( splat->program, "sandHeight" );
+    splat->uniforms[1] = glGetUniformLocation( splat->program, "rockSlope" );
+    splat->uniforms[2] = glGetUniformLocation( splat->program, "blend" );
+    splat->uniforms[3] = glGetUniformLocation( splat->program, "tileSize" );
+    splat->uniforms[4] = glGetUniformLocation( splat->program, "vertexOrigin" );
+    return GL_TRUE;
+}
+
+/*** Función: Libera el shader y las texturas de TERRAINSPLAT ***/
+void FreeTerrainSplat( TERRAINSPLAT* splat )
+{
+    glDeleteTextures( TERRAIN_SPLAT_LAYERS, splat->layers );
+    glDeleteProgram( splat->program );
+    memset( splat, 0, sizeof(TERRAINSPLAT) );
+}
+
+/*** Función: Dibuja un terreno mezclando las capas de TERRAINSPLAT ***/
+// Como RenderTerrain, con el material activo; no usa la textura del terreno
+void RenderTerrainSplat( TERRAIN* terrain, TERRAINSPLAT* splat )
+{
+    unsigned int i;
+    glPushAttrib( GL_TEXTURE_BIT );
+
+    glUseProgram( splat->program );
+    glUniform1f( splat->uniforms[0], splat->sandHeight );
+    glUniform1f( splat->uniforms[1], splat->rockSlope );
+    glUniform1f( splat->uniforms[2], splat->blend );
+    glUniform1f( splat->uniforms[3], splat->tileSize );
+    for( i = 0; i < TERRAIN_SPLAT_LAYERS; i++ )
+    {
+	glActiveTexture( GL_TEXTURE1 + i );
+	glBindTexture( GL_TEXTURE_2D, splat->layers[i] );
+    }
+    glActiveTexture( GL_TEXTURE0 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    RenderTerrainTiles( terrain, splat->uniforms[4] );
+
+    glUseProgram( 0 );
+    glPopAttrib();
+}
+
+/*** Función: Mosaico de una lista(TERRAIN.next) que contiene un punto(XZ) ***/
+// Si ninguno lo contiene devuelve el primero: un terreno solo no cambia
+TERRAIN* TerrainTileAt( TERRAIN* terrain, GLfloat x, GLfloat z )
+{
+    TERRAIN* tile;
+    for( tile = terrain; tile != NULL; tile = tile->next )
+	if( x >= tile->originX && z >= tile->originZ &&
+	    x <= tile->originX + (tile->vertsPerRow - 1) * tile->cellSpacing &&
+	    z <= tile->originZ + (tile->vertsPerCol - 1) * tile->cellSpacing )
+	    return tile;
+    return terrain;
 }
 
 /*** Función: Obtener altura con una coordenada(XZ) ***/
+// Con una lista de mosaicos sólo lee el que contiene al punto. Lee los
+// vértices y no el heightMap, que guarda las deformaciones redondeadas.
 GLfloat GetHeight( TERRAIN* terrain, GLfloat x, GLfloat z )
 {
-    x /= terrain->cellSpacing;
-    z /= terrain->cellSpacing;
+    terrain = TerrainTileAt( terrain, x, z );
+    x = (x - terrain->originX) / terrain->cellSpacing;
+    z = (z - terrain->originZ) / terrain->cellSpacing;
 
-    /* Coordenadas del cuadro */
-    GLuint row = floorf(x);
-    GLuint col = floorf(z);
+    /* Coordenadas del cuadro(el borde usa la última celda) */
+    GLuint row = MINVALUE( MAXVALUE( floorf(x), 0.0f ), terrain->vertsPerRow - 2 );
+    GLuint col = MINVALUE( MAXVALUE( floorf(z), 0.0f ), terrain->vertsPerCol - 2 );
 
     /*
       A---B
@@ -356,10 +1416,10 @@ GLfloat GetHeight( TERRAIN* terrain, GLfloat x, GLfloat z )
       |/ 2|
       C---D
     */
-    GLfloat A = terrain->heightMap[ ((col + 0) * terrain->vertsPerRow) + (row + 0) ];
-    GLfloat B = terrain->heightMap[ ((col + 0) * terrain->vertsPerRow) + (row + 1) ];
-    GLfloat C = terrain->heightMap[ ((col + 1) * terrain->vertsPerRow) + (row + 0) ];
-    GLfloat D = terrain->heightMap[ ((col + 1) * terrain->vertsPerRow) + (row + 1) ];
+    GLfloat A = terrain->vertexBuffer[ ((col + 0) * terrain->vertsPerRow) + (row + 0) ].p.y;
+    GLfloat B = terrain->vertexBuffer[ ((col + 0) * terrain->vertsPerRow) + (row + 1) ].p.y;
+    GLfloat C = terrain->vertexBuffer[ ((col + 1) * terrain->vertsPerRow) + (row + 0) ].p.y;
+    GLfloat D = terrain->vertexBuffer[ ((col + 1) * terrain->vertsPerRow) + (row + 1) ].p.y;
     
     GLfloat height = 0.0f;
     GLfloat dx     = x - row;
@@ -382,3 +1442,1066 @@ GLfloat GetHeight( TERRAIN* terrain, GLfloat x, GLfloat z )
     
     return height;
 }
+
+/*** Función: Normal del triángulo bajo una coordenada(XZ) ***/
+// Mismos triángulos que GetHeight; fuera del terreno usa la celda del borde
+VECTOR GetNormal( TERRAIN* terrain, GLfloat x, GLfloat z )
+{
+    terrain = TerrainTileAt( terrain, x, z );
+    x = (x - terrain->originX) / terrain->cellSpacing;
+    z = (z - terrain->originZ) / terrain->cellSpacing;
+
+    /* Coordenadas del cuadro */
+    GLfloat col = MINVALUE( MAXVALUE( floorf(x), 0.0f ), terrain->vertsPerRow - 2 );
+    GLfloat row = MINVALUE( MAXVALUE( floorf(z), 0.0f ), terrain->vertsPerCol - 2 );
+    GLuint  base = (GLuint)row * terrain->vertsPerRow + (GLuint)col;
+
+    /*
+      A---B
+      |1 /|
+      | / |
+      |/ 2|
+      C---D
+    */
+    GLfloat A = terrain->vertexBuffer[ base ].p.y;
+    GLfloat B = terrain->vertexBuffer[ base + 1 ].p.y;
+    GLfloat C = terrain->vertexBuffer[ base + terrain->vertsPerRow ].p.y;
+    GLfloat D = terrain->vertexBuffer[ base + terrain->vertsPerRow + 1 ].p.y;
+    GLfloat s = terrain->cellSpacing;
+
+    VECTOR n;
+    /* Triángulo 1: (C-A)x(B-A) */
+    if( (x - col) + (z - row) < 1.0f )
+    {
+	n.x = -s * (B - A);
+	n.y =  s * s;
+	n.z = -s * (C - A);
+    }
+    /* Triángulo 2: (B-D)x(C-D) */
+    else
+    {
+	n.x = s * (C - D);
+	n.y = s * s;
+	n.z = s * (B - D);
+    }
+    return NormalizeVector( n );
+}
+
+/*** Función: Alturas y normales de puntos seguidos de un mismo terreno ***/
+// Puntos [first, last) de "points". Cada punto se lleva al borde si cae
+// fuera y se pesa en su triángulo(ABC o BDC) con coordenadas
+// baricéntricas; la normal queda sin normalizar. De a 4 puntos con SSE2.
+void SampleTerrainRun( TERRAIN*           terrain,
+		       const VECTORARRAY* points ,
+		       GLuint             first  ,
+		       GLuint             last   ,
+		       GLfloat*           heights,
+		       VECTORARRAY*       normals )
+{
+    NORMAL_TEX_VERTEX* vertices = terrain->vertexBuffer;
+    GLuint  vertsPerRow = terrain->vertsPerRow;
+    GLfloat invSpacing  = 1.0f / terrain->cellSpacing;
+    GLfloat maxX = vertsPerRow - 1, maxZ = terrain->vertsPerCol - 1;
+    unsigned int i = first, k, v;
+
+#ifdef __SSE2__
+    __m128 zero  = _mm_setzero_ps(), one = _mm_set1_ps( 1.0f );
+    __m128 inv   = _mm_set1_ps( invSpacing );
+    __m128 ox    = _mm_set1_ps( terrain->originX ), oz = _mm_set1_ps( terrain->originZ );
+    __m128 edgeX = _mm_set1_ps( maxX ),        edgeZ = _mm_set1_ps( maxZ );
+    __m128 cellX = _mm_set1_ps( maxX - 1.0f ), cellZ = _mm_set1_ps( maxZ - 1.0f );
+    for( ; i + 4 <= last; i += 4 )
+    {
+	/* Coordenadas en celdas, llevadas al borde */
+	__m128 x = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( points->x + i ), ox ), inv );
+	__m128 z = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( points->z + i ), oz ), inv );
+	x = _mm_min_ps( _mm_max_ps( x, zero ), edgeX );
+	z = _mm_min_ps( _mm_max_ps( z, zero ), edgeZ );
+
+	/* Celda(el borde usa la última) y posición dentro de ella */
+	__m128i col = _mm_cvttps_epi32( _mm_min_ps( x, cellX ) );
+	__m128i row = _mm_cvttps_epi32( _mm_min_ps( z, cellZ ) );
+	__m128  dx  = _mm_sub_ps( x, _mm_cvtepi32_ps( col ) );
+	__m128  dz  = _mm_sub_ps( z, _mm_cvtepi32_ps( row ) );
+
+	/* Pesos de A, B, C y D: triángulo 1 si dx + dz < 1 */
+	__m128 sum = _mm_add_ps( dx, dz );
+	__m128 abc = _mm_cmplt_ps( sum, one );
+	__m128 w[4];
+	w[0] = _mm_and_ps( abc, _mm_sub_ps( _mm_sub_ps( one, dx ), dz ) );
+	w[1] = _mm_or_ps( _mm_and_ps( abc, dx ), _mm_andnot_ps( abc, _mm_sub_ps( one, dz ) ) );
+	w[2] = _mm_or_ps( _mm_and_ps( abc, dz ), _mm_andnot_ps( abc, _mm_sub_ps( one, dx ) ) );
+	w[3] = _mm_andnot_ps( abc, _mm_sub_ps( sum, one ) );
+
+	/* Esquinas de las 4 celdas(sin gather en SSE2) */
+	GLint   cols[4], rows[4];
+	GLfloat h[4][4], nx[4][4], ny[4][4], nz[4][4]; // [esquina][punto]
+	_mm_storeu_si128( (__m128i*)cols, col );
+	_mm_storeu_si128( (__m128i*)rows, row );
+	for( k = 0; k < 4; k++ )
+	{
+	    NORMAL_TEX_VERTEX* corner[4];
+	    corner[0] = &vertices[ rows[k] * vertsPerRow + cols[k] ];
+	    corner[1] = corner[0] + 1;
+	    corner[2] = corner[0] + vertsPerRow;
+	    corner[3] = corner[2] + 1;
+	    for( v = 0; v < 4; v++ )
+	    {
+		h [v][k] = corner[v]->p.y;
+		nx[v][k] = corner[v]->n.x;
+		ny[v][k] = corner[v]->n.y;
+		nz[v][k] = corner[v]->n.z;
+	    }
+	}
+
+	__m128 height = zero, normX = zero, normY = zero, normZ = zero;
+	for( v = 0; v < 4; v++ )
+	{
+	    height = _mm_add_ps( height, _mm_mul_ps( w[v], _mm_loadu_ps( h[v] ) ) );
+	    normX  = _mm_add_ps( normX,  _mm_mul_ps( w[v], _mm_loadu_ps( nx[v] ) ) );
+	    normY  = _mm_add_ps( normY,  _mm_mul_ps( w[v], _mm_loadu_ps( ny[v] ) ) );
+	    normZ  = _mm_add_ps( normZ,  _mm_mul_ps( w[v], _mm_loadu_ps( nz[v] ) ) );
+	}
+	_mm_storeu_ps( heights + i, height );
+	if( normals != NULL )
+	{
+	    _mm_storeu_ps( normals->x + i, normX );
+	    _mm_storeu_ps( normals->y + i, normY );
+	    _mm_storeu_ps( normals->z + i, normZ );
+	}
+    }
+#endif
+
+    /* Resto: las mismas operaciones de a un punto */
+    for( ; i < last; i++ )
+    {
+	GLfloat x = ( points->x[i] - terrain->originX ) * invSpacing;
+	GLfloat z = ( points->z[i] - terrain->originZ ) * invSpacing;
+	x = MINVALUE( MAXVALUE( x, 0.0f ), maxX );
+	z = MINVALUE( MAXVALUE( z, 0.0f ), maxZ );
+
+	GLint   col = (GLint)MINVALUE( x, maxX - 1.0f );
+	GLint   row = (GLint)MINVALUE( z, maxZ - 1.0f );
+	GLfloat dx  = x - col;
+	GLfloat dz  = z - row;
+
+	GLfloat w[4];
+	if( dx + dz < 1.0f )
+	{
+	    w[0] = ( 1.0f - dx ) - dz;
+	    w[1] = dx;
+	    w[2] = dz;
+	    w[3] = 0.0f;
+	}
+	else
+	{
+	    w[0] = 0.0f;
+	    w[1] = 1.0f - dz;
+	    w[2] = 1.0f - dx;
+	    w[3] = ( dx + dz ) - 1.0f;
+	}
+
+	NORMAL_TEX_VERTEX* corner[4];
+	corner[0] = &vertices[ row * vertsPerRow + col ];
+	corner[1] = corner[0] + 1;
+	corner[2] = corner[0] + vertsPerRow;
+	corner[3] = corner[2] + 1;
+
+	VECTOR  n = { 0.0f, 0.0f, 0.0f };
+	GLfloat height = 0.0f;
+	for( v = 0; v < 4; v++ )
+	{
+	    height += w[v] * corner[v]->p.y;
+	    n.x    += w[v] * corner[v]->n.x;
+	    n.y    += w[v] * corner[v]->n.y;
+	    n.z    += w[v] * corner[v]->n.z;
+	}
+	heights[i] = height;
+	if( normals != NULL )
+	{
+	    normals->x[i] = n.x;
+	    normals->y[i] = n.y;
+	    normals->z[i] = n.z;
+	}
+    }
+}
+
+/*** Función: Alturas y normales de muchas coordenadas(XZ) ***/
+// Lee X y Z de "points"; la Y no se usa y "heights" puede ser points->y.
+// Fuera del terreno se usa el borde más cercano. Las normales se
+// interpolan entre las de los vértices; "normals"(o NULL) debe tener
+// points->count vectores. Con una lista de mosaicos los puntos seguidos
+// que caen en el mismo mosaico se calculan juntos.
+void GetHeights( TERRAIN*           terrain,
+		 const VECTORARRAY* points ,
+		 GLfloat*           heights,
+		 VECTORARRAY*       normals )
+{
+    GLuint first, last;
+    for( first = 0; first < points->count; first = last )
+    {
+	TERRAIN* tile = TerrainTileAt( terrain, points->x[first], points->z[first] );
+	last = first + 1;
+	if( terrain->next == NULL )
+	    last = points->count;
+	else
+	    while( last < points->count &&
+		   TerrainTileAt( terrain, points->x[last], points->z[last] ) == tile )
+		last++;
+	SampleTerrainRun( tile, points, first, last, heights, normals );
+    }
+    if( normals != NULL )
+	NormalizeVectors( normals, normals );
+}
+
+/*** Función: Rango de celdas del terreno que cubre una caja(XZ) ***/
+// Devuelve GL_FALSE si la caja queda fuera del terreno
+GLboolean TerrainCellRange( TERRAIN* terrain,
+			    BOX      box,
+			    GLuint*  minRow, GLuint* maxRow,   // Filas(Z)
+			    GLuint*  minCol, GLuint* maxCol )  // Columnas(X)
+{
+    GLfloat width = (terrain->vertsPerRow - 1) * terrain->cellSpacing;
+    GLfloat depth = (terrain->vertsPerCol - 1) * terrain->cellSpacing;
+
+    /* Caja relativa a la esquina del terreno */
+    box.min.x -= terrain->originX;
+    box.max.x -= terrain->originX;
+    box.min.z -= terrain->originZ;
+    box.max.z -= terrain->originZ;
+
+    /* Caja fuera del terreno */
+    if( box.max.x < 0.0f || box.min.x > width ||
+	box.max.z < 0.0f || box.min.z > depth )
+	return GL_FALSE;
+
+    /* Celdas que tocan la caja(incluye los bordes compartidos) */
+    GLfloat x0 = ceilf( box.min.x / terrain->cellSpacing ) - 1.0f;
+    GLfloat x1 = floorf( box.max.x / terrain->cellSpacing );
+    GLfloat z0 = ceilf( box.min.z / terrain->cellSpacing ) - 1.0f;
+    GLfloat z1 = floorf( box.max.z / terrain->cellSpacing );
+
+    GLfloat lastCol = terrain->vertsPerRow - 2;
+    GLfloat lastRow = terrain->vertsPerCol - 2;
+
+    *minCol = (GLuint)MINVALUE( MAXVALUE( x0, 0.0f ), lastCol );
+    *maxCol = (GLuint)MINVALUE( MAXVALUE( x1, 0.0f ), lastCol );
+    *minRow = (GLuint)MINVALUE( MAXVALUE( z0, 0.0f ), lastRow );
+    *maxRow = (GLuint)MINVALUE( MAXVALUE( z1, 0.0f ), lastRow );
+
+    return GL_TRUE;
+}
+
+/*** Función: Los 2 triángulos de una celda(fila en Z, columna en X) ***/
+void TerrainCellTriangles( TERRAIN* terrain, GLuint row, GLuint col,
+			   TRIANGLE triangles[2] )
+{
+    GLuint* index = &terrain->indexBuffer[ (row * (terrain->vertsPerRow - 1) + col) * 2 * 3 ];
+    unsigned int k;
+    for( k = 0; k < 2; k++ )
+    {
+	POINT  p0 = terrain->vertexBuffer[ index[k * 3 + 0] ].p;
+	POINT  p1 = terrain->vertexBuffer[ index[k * 3 + 1] ].p;
+	POINT  p2 = terrain->vertexBuffer[ index[k * 3 + 2] ].p;
+	TRIANGLE t = { { p0.x, p0.y, p0.z },
+		       { p1.x, p1.y, p1.z },
+		       { p2.x, p2.y, p2.z } };
+	triangles[k] = t;
+    }
+}
+
+/*** Función: Intersección de un rayo con el terreno ***/
+// Recorre los bloques bajo el rayo con un DDA 2D(XZ). Un bloque cuyo
+// rango de alturas no cruza la altura del rayo se salta entero; si la
+// cruza se baja un nivel de la pirámide hasta llegar a una celda.
+// El punto es ray.p0 + ray.u * time, con time en [0, maxTime].
+GLboolean TerrainRay( TERRAIN* terrain,
+		      RAY      ray    ,
+		      GLfloat  maxTime, // INFINITY: rayo sin fin
+		      GLfloat* outTime, // Tiempo de la intersección
+		      VECTOR*  outPos ) // Punto de la intersección
+{
+    GLint  top  = terrain->pyramidLevels - 1;
+    GLint  cols = terrain->vertsPerRow - 1;
+    GLint  rows = terrain->vertsPerCol - 1;
+
+    /* Rayo en unidades de celda(XZ) */
+    GLfloat ox = (ray.p0.x - terrain->originX) / terrain->cellSpacing;
+    GLfloat oz = (ray.p0.z - terrain->originZ) / terrain->cellSpacing;
+    GLfloat dx = ray.u.x  / terrain->cellSpacing;
+    GLfloat dz = ray.u.z  / terrain->cellSpacing;
+
+    /* Tramo del rayo sobre el terreno */
+    GLfloat t    = 0.0f;
+    GLfloat tEnd = maxTime;
+    if( !ClipInterval( ox, dx, 0.0f, cols, &t, &tEnd ) ||
+	!ClipInterval( oz, dz, 0.0f, rows, &t, &tEnd ) )
+	return GL_FALSE;
+
+    /* DDA desde el bloque raíz */
+    GLint level = top;
+    GLint col   = 0;
+    GLint row   = 0;
+    GLint stepX = dx > 0.0f ? 1 : -1;
+    GLint stepZ = dz > 0.0f ? 1 : -1;
+    for( ;; )
+    {
+	GLuint  levelRows, levelCols;
+	GLfloat size = (GLfloat)(1 << level);
+
+	/* Tiempo de salida del bloque */
+	GLfloat tx = dx == 0.0f ? INFINITY :
+	    ( ( col + ( dx > 0.0f ) ) * size - ox ) / dx;
+	GLfloat tz = dz == 0.0f ? INFINITY :
+	    ( ( row + ( dz > 0.0f ) ) * size - oz ) / dz;
+	GLfloat tExit = MINVALUE( MINVALUE( tx, tz ), tEnd );
+
+	/* Altura del rayo dentro del bloque */
+	GLfloat y0 = ray.p0.y + ray.u.y * t;
+	GLfloat y1 = ray.p0.y + ray.u.y * tExit;
+	HEIGHTRANGE* range = TerrainBlock( terrain, level, row, col );
+	if( MINVALUE( y0, y1 ) <= range->max && MAXVALUE( y0, y1 ) >= range->min )
+	{
+	    /* Bajo al hijo que contiene el punto de entrada */
+	    if( level > 0 )
+	    {
+		level--;
+		size *= 0.5f;
+		TerrainLevelSize( terrain, level, &levelRows, &levelCols );
+		GLfloat cx = floorf( ( ox + dx * t ) / size );
+		GLfloat cz = floorf( ( oz + dz * t ) / size );
+		col = (GLint)MINVALUE( MAXVALUE( cx, 2 * col ),
+				       MINVALUE( 2 * col + 1, (GLint)levelCols - 1 ) );
+		row = (GLint)MINVALUE( MAXVALUE( cz, 2 * row ),
+				       MINVALUE( 2 * row + 1, (GLint)levelRows - 1 ) );
+		continue;
+	    }
+
+	    /* Celda: los 2 triángulos */
+	    TRIANGLE triangles[2];
+	    GLfloat  time, minTime = INFINITY;
+	    unsigned int k;
+	    TerrainCellTriangles( terrain, row, col, triangles );
+	    for( k = 0; k < 2; k++ )
+		if( RayTriangle( ray, triangles[k], &time ) &&
+		    time >= 0.0f && time <= maxTime )
+		    minTime = MINVALUE( minTime, time );
+	    if( minTime != INFINITY )
+	    {
+		*outTime = minTime;
+		*outPos  = SumVector( ray.p0, MulVector( ray.u, minTime ) );
+		return GL_TRUE;
+	    }
+	}
+
+	/* Siguiente bloque en el nivel actual */
+	if( tExit >= tEnd )
+	    return GL_FALSE;
+	GLint oldCol = col, oldRow = row;
+	t = tExit;
+	if( tx <= tz )
+	    col += stepX;
+	if( tz <= tx )
+	    row += stepZ;
+	TerrainLevelSize( terrain, level, &levelRows, &levelCols );
+	if( col < 0 || row < 0 || col >= (GLint)levelCols || row >= (GLint)levelRows )
+	    return GL_FALSE;
+
+	/* Subo un nivel si el bloque nuevo es de otro padre */
+	if( level < top && ( (col >> 1) != (oldCol >> 1) ||
+			     (row >> 1) != (oldRow >> 1) ) )
+	{
+	    level++;
+	    col >>= 1;
+	    row >>= 1;
+	}
+    }
+}
+
+/*** Función: Intersección de un segmento con el terreno ***/
+// "outTime" en [0, 1] desde "start" hasta "end"
+GLboolean TerrainSegment( TERRAIN* terrain,
+			  VECTOR   start  ,
+			  VECTOR   end    ,
+			  GLfloat* outTime, // Tiempo de la intersección
+			  VECTOR*  outPos ) // Punto de la intersección
+{
+    RAY ray = { start, ResVector( end, start ) };
+    return TerrainRay( terrain, ray, 1.0f, outTime, outPos );
+}
+
+/*** Función: Vértices de un terreno dentro de un área(XZ) ***/
+// Las columnas y filas se cuentan en la cuadrícula del mundo y luego se
+// pasan al terreno, para que los mosaicos vecinos tomen los mismos
+// vértices del borde. Devuelve GL_FALSE si el área no toca el terreno.
+GLboolean TerrainVertexRange( TERRAIN* terrain,
+			      BOX      area,
+			      GLuint*  minRow, GLuint* maxRow,   // Filas(Z)
+			      GLuint*  minCol, GLuint* maxCol )  // Columnas(X)
+{
+    GLfloat s    = terrain->cellSpacing;
+    GLfloat col0 = floorf( terrain->originX / s + 0.5f );
+    GLfloat row0 = floorf( terrain->originZ / s + 0.5f );
+    GLfloat x0 = ceilf( area.min.x / s ) - col0, x1 = floorf( area.max.x / s ) - col0;
+    GLfloat z0 = ceilf( area.min.z / s ) - row0, z1 = floorf( area.max.z / s ) - row0;
+    GLfloat lastCol = terrain->vertsPerRow - 1;
+    GLfloat lastRow = terrain->vertsPerCol - 1;
+
+    x0 = MAXVALUE( x0, 0.0f );
+    z0 = MAXVALUE( z0, 0.0f );
+    x1 = MINVALUE( x1, lastCol );
+    z1 = MINVALUE( z1, lastRow );
+    if( x0 > x1 || z0 > z1 )
+	return GL_FALSE;
+
+    *minCol = (GLuint)x0;
+    *maxCol = (GLuint)x1;
+    *minRow = (GLuint)z0;
+    *maxRow = (GLuint)z1;
+    return GL_TRUE;
+}
+
+/*** Función: Altura de un vértice(fila, columna) de un mosaico ***/
+// Fuera del mosaico busca el vértice en los demás de la lista. Devuelve
+// GL_FALSE si ninguno lo tiene(borde del mundo o vecino sin cargar).
+GLboolean TerrainVertexHeight( TERRAIN* list, TERRAIN* tile,
+			       GLint row, GLint col, GLfloat* height )
+{
+    GLfloat x = tile->originX + col * tile->cellSpacing;
+    GLfloat z = tile->originZ + row * tile->cellSpacing;
+    TERRAIN* other = tile;
+
+    while( row < 0 || col < 0 ||
+	   row >= (GLint)other->vertsPerCol || col >= (GLint)other->vertsPerRow )
+    {
+	other = ( other == tile ? list : other->next );
+	if( other == tile )
+	    other = other->next;
+	if( other == NULL )
+	    return GL_FALSE;
+	row = (GLint)floorf( (z - other->originZ) / other->cellSpacing + 0.5f );
+	col = (GLint)floorf( (x - other->originX) / other->cellSpacing + 0.5f );
+    }
+    *height = other->vertexBuffer[ row * other->vertsPerRow + col ].p.y;
+    return GL_TRUE;
+}
+
+/*** Función: Rehace lo que depende de las alturas en un rango de vértices ***/
+// Normales, pirámide, trozos y textura generada. El rango debe tener una
+// fila y columna más de cada lado que los vértices cambiados, porque sus
+// normales también cambian. "list" es la lista de mosaicos, para las
+// normales de los bordes. Agrega a "dirty" los vértices del rango.
+void UpdateTerrainRegion( TERRAIN* list, TERRAIN* tile,
+			  GLuint minRow, GLuint maxRow,
+			  GLuint minCol, GLuint maxCol, BOX* dirty )
+{
+    GLuint vertsPerRow = tile->vertsPerRow;
+    GLuint vertsPerCol = tile->vertsPerCol;
+    GLuint rows, cols, level;
+    unsigned int i, j, r, c;
+
+    /* Normales: cada vértice depende de sus 8 vecinos */
+    for( i = minRow; i <= maxRow; i++ )
+	for( j = minCol; j <= maxCol; j++ )
+	{
+	    NORMAL_TEX_VERTEX* v = &tile->vertexBuffer[ i * vertsPerRow + j ];
+	    GLfloat   h[3][3];
+	    GLboolean found[3][3];
+	    // Un vecino que falta toma la altura del vértice
+	    for( r = 0; r < 3; r++ )
+		for( c = 0; c < 3; c++ )
+		{
+		    h[r][c]     = v->p.y;
+		    found[r][c] = TerrainVertexHeight( list, tile, (GLint)(i + r) - 1,
+						       (GLint)(j + c) - 1, &h[r][c] );
+		}
+	    v->n = NormalizeVector( TerrainNormalSum( h, found[0][1], found[2][1],
+						      found[1][0], found[1][2],
+						      tile->cellSpacing ) );
+	    dirty->min.x = MINVALUE( dirty->min.x, v->p.x );
+	    dirty->min.y = MINVALUE( dirty->min.y, v->p.y );
+	    dirty->min.z = MINVALUE( dirty->min.z, v->p.z );
+	    dirty->max.x = MAXVALUE( dirty->max.x, v->p.x );
+	    dirty->max.y = MAXVALUE( dirty->max.y, v->p.y );
+	    dirty->max.z = MAXVALUE( dirty->max.z, v->p.z );
+	}
+
+    /* Pirámide: las celdas del rango y sus bloques padres */
+    GLuint cellRow0 = minRow;
+    GLuint cellCol0 = minCol;
+    GLuint cellRow1 = MINVALUE( maxRow, vertsPerCol - 2 );
+    GLuint cellCol1 = MINVALUE( maxCol, vertsPerRow - 2 );
+    for( level = 0; level < tile->pyramidLevels; level++ )
+	for( i = cellRow0 >> level; i <= cellRow1 >> level; i++ )
+	    BuildPyramidRow( tile, level, i, cellCol0 >> level, (cellCol1 >> level) + 1 );
+
+    /* Trozos: caja y errores de los que tienen esas celdas */
+    for( i = MINVALUE( cellRow0 / TERRAIN_CHUNK, tile->chunkRows - 1 );
+	 i <= MINVALUE( cellRow1 / TERRAIN_CHUNK, tile->chunkRows - 1 ); i++ )
+	for( j = MINVALUE( cellCol0 / TERRAIN_CHUNK, tile->chunkCols - 1 );
+	     j <= MINVALUE( cellCol1 / TERRAIN_CHUNK, tile->chunkCols - 1 ); j++ )
+	    BuildTerrainChunk( tile, i * tile->chunkCols + j );
+
+    /* Páginas: el rango o toda la página si la altura se sale de sus pasos */
+    for( i = 0; tile->pages != NULL && i < tile->pageRows * tile->pageCols; i++ )
+    {
+	TERRAINPAGE* page = &tile->pages[i];
+	GLboolean    fits = GL_TRUE;
+	if( maxRow < page->row || minRow >= page->row + page->rows ||
+	    maxCol < page->col || minCol >= page->col + page->cols )
+	    continue;
+	for( r = MAXVALUE( minRow, page->row );
+	     fits && r <= MINVALUE( maxRow, page->row + page->rows - 1 ); r++ )
+	    for( c = MAXVALUE( minCol, page->col );
+		 fits && c <= MINVALUE( maxCol, page->col + page->cols - 1 ); c++ )
+		fits = PackTerrainVertex( tile, page, r, c );
+	// Si tampoco cabe centrada se dibuja con vertexBuffer
+	if( !fits && !PackTerrainPage( tile, page ) )
+	    FreeTerrainPages( tile );
+    }
+
+    /* Textura generada: sólo el rango */
+    if( !tile->heightColors )
+	return;
+    rows = maxRow - minRow + 1;
+    cols = maxCol - minCol + 1;
+    GLubyte* pixelData = (GLubyte*)malloc( rows * cols * 3 );
+    for( i = 0; i < rows; i++ )
+	for( j = 0; j < cols; j++ )
+	    TerrainHeightPixel( &pixelData[ (i * cols + j) * 3 ],
+				tile->vertexBuffer[ (minRow + i) * vertsPerRow + minCol + j ].p.y );
+    glPushAttrib( GL_TEXTURE_BIT );
+    glPushClientAttrib( GL_CLIENT_PIXEL_STORE_BIT );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glBindTexture( GL_TEXTURE_2D, tile->textureID );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, minCol, minRow, cols, rows,
+		     GL_RGB, GL_UNSIGNED_BYTE, pixelData );
+    glPopClientAttrib();
+    glPopAttrib();
+    free( pixelData );
+}
+
+/*** Función: Cambia las alturas de los vértices dentro de un área(XZ) ***/
+// "brush" da la nueva altura de cada vértice del área(la Y no se usa).
+// Sólo se rehace lo que tocan esos vértices: normales, pirámide, trozos y
+// textura generada. Con una lista de mosaicos cambia todos los que toca
+// el área; los de un TERRAINSTREAM pierden el cambio si se descargan.
+// "dirty" recibe la caja de los triángulos que cambiaron, antes y después,
+// para InvalidateContactCache. Devuelve GL_FALSE si no tocó ningún vértice.
+GLboolean DeformTerrain( TERRAIN*     terrain,
+			 BOX          area   ,
+			 TERRAINBRUSH brush  ,
+			 void*        data   ,
+			 BOX*         dirty  )
+{
+    GLboolean changed = GL_FALSE;
+    GLuint    minRow, maxRow, minCol, maxCol;
+    TERRAIN*  tile;
+    unsigned int i, j;
+
+    dirty->min.x = dirty->min.y = dirty->min.z =  INFINITY;
+    dirty->max.x = dirty->max.y = dirty->max.z = -INFINITY;
+
+    /* Alturas de todos los mosaicos antes de las normales: comparten bordes */
+    for( tile = terrain; tile != NULL; tile = tile->next )
+    {
+	if( !TerrainVertexRange( tile, area, &minRow, &maxRow, &minCol, &maxCol ) )
+	    continue;
+	GLfloat s    = tile->cellSpacing;
+	GLfloat col0 = floorf( tile->originX / s + 0.5f );
+	GLfloat row0 = floorf( tile->originZ / s + 0.5f );
+	for( i = minRow; i <= maxRow; i++ )
+	    for( j = minCol; j <= maxCol; j++ )
+	    {
+		NORMAL_TEX_VERTEX* v = &tile->vertexBuffer[ i * tile->vertsPerRow + j ];
+		// En la cuadrícula del mundo: igual en los mosaicos vecinos
+		GLfloat h = brush( data, (col0 + j) * s, (row0 + i) * s, v->p.y );
+		// La altura de antes también cuenta
+		dirty->min.y = MINVALUE( dirty->min.y, v->p.y );
+		dirty->max.y = MAXVALUE( dirty->max.y, v->p.y );
+		v->p.y = h;
+		tile->heightMap[ i * tile->vertsPerRow + j ] =
+		    (unsigned char)MINVALUE( MAXVALUE( h + 0.5f, 0.0f ), 255.0f );
+	    }
+	changed = GL_TRUE;
+    }
+    if( !changed )
+	return GL_FALSE;
+
+    /* El resto con una celda más: puede tocar a un mosaico vecino */
+    area.min.x -= terrain->cellSpacing;
+    area.min.z -= terrain->cellSpacing;
+    area.max.x += terrain->cellSpacing;
+    area.max.z += terrain->cellSpacing;
+    for( tile = terrain; tile != NULL; tile = tile->next )
+	if( TerrainVertexRange( tile, area, &minRow, &maxRow, &minCol, &maxCol ) )
+	    UpdateTerrainRegion( terrain, tile, minRow, maxRow, minCol, maxCol, dirty );
+    return GL_TRUE;
+}
+
+/*** Función: Pincel de cráter(TERRAINCRATER) ***/
+// Baja las alturas hasta "depth" en el centro, con borde suave
+GLfloat CraterBrush( void* data, GLfloat x, GLfloat z, GLfloat height )
+{
+    TERRAINCRATER* crater = data;
+    GLfloat dx = x - crater->x;
+    GLfloat dz = z - crater->z;
+    GLfloat d  = ( dx * dx + dz * dz ) / ( crater->radius * crater->radius );
+    if( d >= 1.0f )
+	return height;
+    return height - crater->depth * ( 1.0f - d ) * ( 1.0f - d );
+}
+
+/*** Función: Bytes de un mosaico en el archivo ***/
+size_t TerrainTileBytes( TERRAINTILEHEADER* header )
+{
+    return (size_t)(header->tileCells + 1) * (header->tileCells + 1);
+}
+
+/*** Función: Alturas de un mosaico dentro del archivo mapeado ***/
+unsigned char* TerrainTileData( TERRAINSTREAM* stream, GLuint tile )
+{
+    return stream->map + sizeof(TERRAINTILEHEADER) +
+	tile * TerrainTileBytes( &stream->header );
+}
+
+/*** Función: Altura escalada de un vértice del mapa completo ***/
+// Igual que BuildTerrainGeometry: el heightMap guarda la altura escalada
+GLfloat TerrainStreamSample( TERRAINSTREAM* stream, GLuint row, GLuint col )
+{
+    GLuint tileCells = stream->header.tileCells;
+    GLuint tz = MINVALUE( row / tileCells, stream->header.tilesZ - 1 );
+    GLuint tx = MINVALUE( col / tileCells, stream->header.tilesX - 1 );
+    unsigned char* data = TerrainTileData( stream, tz * stream->header.tilesX + tx );
+    unsigned char  h    = data[ (row - tz * tileCells) * (tileCells + 1) +
+				col - tx * tileCells ];
+    h *= stream->heightScale;
+    return h;
+}
+
+/*** Función: Normal de un vértice del mapa completo ***/
+// Como TerrainNormalRow, con los vecinos de los mosaicos de al lado
+VECTOR TerrainStreamNormal( TERRAINSTREAM* stream, GLuint row, GLuint col )
+{
+    GLint   lastRow = stream->header.vertsPerCol - 1;
+    GLint   lastCol = stream->header.vertsPerRow - 1;
+    GLfloat h[3][3];
+    unsigned int r, c;
+    for( r = 0; r < 3; r++ )
+	for( c = 0; c < 3; c++ )
+	    h[r][c] = TerrainStreamSample( stream,
+					   MINVALUE( MAXVALUE( (GLint)(row + r) - 1, 0 ), lastRow ),
+					   MINVALUE( MAXVALUE( (GLint)(col + c) - 1, 0 ), lastCol ) );
+    return NormalizeVector( TerrainNormalSum( h, row > 0, (GLint)row < lastRow,
+					      col > 0, (GLint)col < lastCol,
+					      stream->cellSpacing ) );
+}
+
+/*** Función: Convierte un heightmap(.raw) al archivo de mosaicos ***/
+// El .raw se mapea en memoria: no se lee entero
+GLboolean ConvertTerrainTiles( char*  terrainFile,
+			       GLuint vertsPerRow,
+			       GLuint vertsPerCol,
+			       GLuint tileCells  ,  // Celdas por lado de un mosaico
+			       char*  tileFile   )
+{
+    /* Heightmap mapeado */
+    size_t size = (size_t)vertsPerRow * vertsPerCol;
+    int    fd   = open( terrainFile, O_RDONLY );
+    struct stat info;
+    if( fd < 0 || fstat( fd, &info ) != 0 || (size_t)info.st_size < size )
+    {
+	PrintError( "Could not open the terrain heightmap", GL_FALSE );
+	if( fd >= 0 )
+	    close( fd );
+	return GL_FALSE;
+    }
+    unsigned char* heights = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( heights == MAP_FAILED )
+    {
+	PrintError( "Could not map the terrain heightmap", GL_FALSE );
+	return GL_FALSE;
+    }
+
+    FILE* file = fopen( tileFile, "wb" );
+    if( file == NULL )
+    {
+	PrintError( "Could not create the terrain tiles", GL_FALSE );
+	munmap( heights, size );
+	return GL_FALSE;
+    }
+
+    /* Encabezado */
+    TERRAINTILEHEADER header;
+    memset( &header, 0, sizeof(TERRAINTILEHEADER) );
+    memcpy( header.magic, TERRAIN_TILE_MAGIC, 4 );
+    header.vertsPerRow = vertsPerRow;
+    header.vertsPerCol = vertsPerCol;
+    header.tileCells   = tileCells;
+    header.tilesX      = ( vertsPerRow - 2 ) / tileCells + 1;
+    header.tilesZ      = ( vertsPerCol - 2 ) / tileCells + 1;
+    fwrite( &header, sizeof(TERRAINTILEHEADER), 1, file );
+
+    /* Mosaicos: lo que sale del mapa repite el borde */
+    unsigned char* tile = (unsigned char*)malloc( TerrainTileBytes( &header ) );
+    unsigned int tx, tz, i, j;
+    for( tz = 0; tz < header.tilesZ; tz++ )
+	for( tx = 0; tx < header.tilesX; tx++ )
+	{
+	    for( i = 0; i <= tileCells; i++ )
+		for( j = 0; j <= tileCells; j++ )
+		{
+		    GLuint row = MINVALUE( tz * tileCells + i, vertsPerCol - 1 );
+		    GLuint col = MINVALUE( tx * tileCells + j, vertsPerRow - 1 );
+		    tile[ i * (tileCells + 1) + j ] = heights[ row * vertsPerRow + col ];
+		}
+	    fwrite( tile, 1, TerrainTileBytes( &header ), file );
+	}
+    free( tile );
+    munmap( heights, size );
+
+    if( fclose( file ) != 0 )
+    {
+	PrintError( "Could not write the terrain tiles", GL_FALSE );
+	return GL_FALSE;
+    }
+    return GL_TRUE;
+}
+
+/*** Función: Arma la geometría de un mosaico(hilo de carga) ***/
+// Las normales del borde usan los mosaicos vecinos, así quedan como en el
+// terreno completo y no se ve la costura
+TERRAIN* LoadTerrainTile( TERRAINSTREAM* stream, GLuint tile )
+{
+    TERRAINTILEHEADER* header = &stream->header;
+    GLuint tileCells = header->tileCells;
+    GLuint col0 = (tile % header->tilesX) * tileCells;
+    GLuint row0 = (tile / header->tilesX) * tileCells;
+    unsigned char* data = TerrainTileData( stream, tile );
+    unsigned int i, j;
+
+    /* Características */
+    TERRAIN* terrain = (TERRAIN*)calloc( 1, sizeof(TERRAIN) );
+    terrain->vertsPerRow = MINVALUE( tileCells, header->vertsPerRow - 1 - col0 ) + 1;
+    terrain->vertsPerCol = MINVALUE( tileCells, header->vertsPerCol - 1 - row0 ) + 1;
+    terrain->cellSpacing = stream->cellSpacing;
+    terrain->repeatTex   = GL_TRUE;
+    terrain->originX     = col0 * stream->cellSpacing;
+    terrain->originZ     = row0 * stream->cellSpacing;
+
+    /* Alturas desde el archivo mapeado */
+    terrain->heightMap = (unsigned char*)malloc( terrain->vertsPerRow * terrain->vertsPerCol );
+    for( i = 0; i < terrain->vertsPerCol; i++ )
+	memcpy( &terrain->heightMap[ i * terrain->vertsPerRow ],
+		&data[ i * (tileCells + 1) ], terrain->vertsPerRow );
+    BuildTerrainGeometry( NULL, terrain, stream->heightScale );
+
+    /* Normales del borde, como en el mapa completo */
+    for( i = 0; i < terrain->vertsPerCol; i++ )
+	for( j = 0; j < terrain->vertsPerRow; j++ )
+	    if( i == 0 || j == 0 ||
+		i + 1 == terrain->vertsPerCol || j + 1 == terrain->vertsPerRow )
+		terrain->vertexBuffer[ i * terrain->vertsPerRow + j ].n =
+		    TerrainStreamNormal( stream, row0 + i, col0 + j );
+    if( stream->compact )
+	CompactTerrain( NULL, terrain );
+    return terrain;
+}
+
+/*** Función: Avisa al sistema si un mosaico se usará pronto o ya no ***/
+void AdviseTerrainTile( TERRAINSTREAM* stream, GLuint tile, int advice )
+{
+    size_t page  = sysconf( _SC_PAGESIZE );
+    size_t start = TerrainTileData( stream, tile ) - stream->map;
+    size_t end   = start + TerrainTileBytes( &stream->header );
+    start -= start % page;
+    posix_madvise( stream->map + start, end - start, advice );
+}
+
+/*** Función: Ciclo del hilo de carga ***/
+// Arma primero el pedido más cercano a la cámara
+int TerrainStreamThread( void* data )
+{
+    TERRAINSTREAM* stream = data;
+    unsigned int i;
+
+    SDL_mutexP( stream->mutex );
+    while( !stream->quit )
+    {
+	if( stream->nRequests == 0 )
+	{
+	    SDL_CondWait( stream->wake, stream->mutex );
+	    continue;
+	}
+
+	/* Pedido más cercano */
+	GLuint best = 0, bestDist = ~0u;
+	for( i = 0; i < stream->nRequests; i++ )
+	{
+	    GLint  tx   = stream->requests[i] % stream->header.tilesX;
+	    GLint  tz   = stream->requests[i] / stream->header.tilesX;
+	    GLuint dist = abs( tx - stream->centerX ) + abs( tz - stream->centerZ );
+	    if( dist < bestDist )
+	    {
+		best     = i;
+		bestDist = dist;
+	    }
+	}
+	GLuint tile = stream->requests[best];
+	stream->requests[best] = stream->requests[ --stream->nRequests ];
+	stream->loading++;
+
+	/* Se arma sin el mutex: el archivo sólo se lee */
+	SDL_mutexV( stream->mutex );
+	TERRAIN* terrain = LoadTerrainTile( stream, tile );
+	SDL_mutexP( stream->mutex );
+
+	stream->readyTiles[ stream->nReady ] = tile;
+	stream->ready[ stream->nReady++ ]    = terrain;
+	stream->loading--;
+	SDL_CondBroadcast( stream->done );
+    }
+    SDL_mutexV( stream->mutex );
+    return 0;
+}
+
+/*** Función: Abre un archivo de mosaicos y su hilo de carga ***/
+// No carga nada hasta UpdateTerrainStream
+GLboolean OpenTerrainStream( TERRAINSTREAM* stream     ,
+			     char*          tileFile   ,
+			     GLfloat        cellSpacing,
+			     GLfloat        heightScale,
+			     GLuint         radius     )  // Mosaicos alrededor
+{
+    memset( stream, 0, sizeof(TERRAINSTREAM) );
+
+    /* Archivo mapeado */
+    struct stat info;
+    int fd = open( tileFile, O_RDONLY );
+    if( fd < 0 || fstat( fd, &info ) != 0 ||
+	(size_t)info.st_size < sizeof(TERRAINTILEHEADER) )
+    {
+	PrintError( "Could not open the terrain tiles", GL_FALSE );
+	if( fd >= 0 )
+	    close( fd );
+	return GL_FALSE;
+    }
+    stream->mapSize = info.st_size;
+    stream->map     = mmap( NULL, stream->mapSize, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( stream->map == MAP_FAILED )
+    {
+	PrintError( "Could not map the terrain tiles", GL_FALSE );
+	stream->map = NULL;
+	return GL_FALSE;
+    }
+
+    /* Encabezado */
+    TERRAINTILEHEADER* header = &stream->header;
+    memcpy( header, stream->map, sizeof(TERRAINTILEHEADER) );
+    if( memcmp( header->magic, TERRAIN_TILE_MAGIC, 4 ) != 0 ||
+	header->tileCells == 0 || header->tilesX == 0 || header->tilesZ == 0 ||
+	stream->mapSize < sizeof(TERRAINTILEHEADER) +
+	(size_t)header->tilesX * header->tilesZ * TerrainTileBytes( header ) )
+    {
+	PrintError( "Invalid terrain tiles", GL_FALSE );
+	munmap( stream->map, stream->mapSize );
+	stream->map = NULL;
+	return GL_FALSE;
+    }
+
+    /* Mosaicos y colas */
+    GLuint nTiles = header->tilesX * header->tilesZ;
+    stream->cellSpacing = cellSpacing;
+    stream->heightScale = heightScale;
+    stream->radius      = radius;
+    stream->state       = (GLubyte*)calloc( nTiles, sizeof(GLubyte) );
+    stream->tiles       = (TERRAIN**)calloc( nTiles, sizeof(TERRAIN*) );
+    stream->requests    = (GLuint*)malloc( sizeof(GLuint) * nTiles );
+    stream->readyTiles  = (GLuint*)malloc( sizeof(GLuint) * nTiles );
+    stream->ready       = (TERRAIN**)malloc( sizeof(TERRAIN*) * nTiles );
+
+    /* Hilo de carga */
+    stream->mutex  = SDL_CreateMutex();
+    stream->wake   = SDL_CreateCond();
+    stream->done   = SDL_CreateCond();
+    stream->thread = SDL_CreateThread( TerrainStreamThread, stream );
+    return GL_TRUE;
+}
+
+/*** Función: El mosaico está a lo más a "radius" del de la cámara ***/
+GLboolean TerrainTileWanted( TERRAINSTREAM* stream, GLuint tile )
+{
+    GLint tx = tile % stream->header.tilesX;
+    GLint tz = tile / stream->header.tilesX;
+    return abs( tx - stream->centerX ) <= (GLint)stream->radius &&
+	abs( tz - stream->centerZ ) <= (GLint)stream->radius;
+}
+
+/*** Función: Libera un mosaico residente o terminado ***/
+void FreeTerrainTile( TERRAINSTREAM* stream, GLuint tile, TERRAIN* terrain )
+{
+    FreeTerrain( terrain );
+    free( terrain );
+    stream->tiles[tile] = NULL;
+    stream->state[tile] = TERRAIN_TILE_EMPTY;
+    AdviseTerrainTile( stream, tile, POSIX_MADV_DONTNEED );
+}
+
+/*** Función: Pide los mosaicos alrededor de la cámara y suelta los lejanos ***/
+// Sólo en el hilo principal, entre consultas: aquí cambia la lista de
+// residentes. Devuelve GL_TRUE si cambió; las CONTACTCACHE que la usan
+// deben invalidarse(valid = GL_FALSE).
+GLboolean UpdateTerrainStream( TERRAINSTREAM* stream, VECTOR eye )
+{
+    TERRAINTILEHEADER* header = &stream->header;
+    GLfloat   tileSize = header->tileCells * stream->cellSpacing;
+    GLboolean changed  = GL_FALSE;
+    GLboolean wake     = GL_FALSE;
+    GLint     tx, tz;
+    unsigned int i;
+
+    SDL_mutexP( stream->mutex );
+
+    /* Mosaico de la cámara */
+    stream->centerX = MINVALUE( MAXVALUE( (GLint)floorf( eye.x / tileSize ), 0 ),
+				(GLint)header->tilesX - 1 );
+    stream->centerZ = MINVALUE( MAXVALUE( (GLint)floorf( eye.z / tileSize ), 0 ),
+				(GLint)header->tilesZ - 1 );
+
+    /* Mosaicos terminados: a la lista si todavía se quieren */
+    for( i = 0; i < stream->nReady; i++ )
+    {
+	GLuint tile = stream->readyTiles[i];
+	if( !TerrainTileWanted( stream, tile ) )
+	{
+	    FreeTerrainTile( stream, tile, stream->ready[i] );
+	    continue;
+	}
+	stream->tiles[tile]       = stream->ready[i];
+	stream->tiles[tile]->next = stream->resident;
+	stream->resident          = stream->tiles[tile];
+	stream->state[tile]       = TERRAIN_TILE_RESIDENT;
+	stream->nResident++;
+	changed = GL_TRUE;
+    }
+    stream->nReady = 0;
+
+    /* Pedidos que ya no se quieren */
+    for( i = 0; i < stream->nRequests; i++ )
+	if( !TerrainTileWanted( stream, stream->requests[i] ) )
+	{
+	    stream->state[ stream->requests[i] ] = TERRAIN_TILE_EMPTY;
+	    stream->requests[i--] = stream->requests[ --stream->nRequests ];
+	}
+
+    /* Pedidos nuevos */
+    for( tz = stream->centerZ - (GLint)stream->radius;
+	 tz <= stream->centerZ + (GLint)stream->radius; tz++ )
+	for( tx = stream->centerX - (GLint)stream->radius;
+	     tx <= stream->centerX + (GLint)stream->radius; tx++ )
+	{
+	    if( tx < 0 || tz < 0 || tx >= (GLint)header->tilesX || tz >= (GLint)header->tilesZ )
+		continue;
+	    GLuint tile = tz * header->tilesX + tx;
+	    if( stream->state[tile] != TERRAIN_TILE_EMPTY )
+		continue;
+	    stream->state[tile] = TERRAIN_TILE_QUEUED;
+	    stream->requests[ stream->nRequests++ ] = tile;
+	    AdviseTerrainTile( stream, tile, POSIX_MADV_WILLNEED );
+	    wake = GL_TRUE;
+	}
+    if( wake )
+	SDL_CondSignal( stream->wake );
+    SDL_mutexV( stream->mutex );
+
+    /* Residentes lejanos: fuera de la lista */
+    TERRAIN** link = &stream->resident;
+    while( *link != NULL )
+    {
+	TERRAIN* terrain = *link;
+	GLuint   tile    = (GLuint)( terrain->originZ / tileSize + 0.5f ) * header->tilesX +
+	    (GLuint)( terrain->originX / tileSize + 0.5f );
+	if( TerrainTileWanted( stream, tile ) )
+	{
+	    link = &terrain->next;
+	    continue;
+	}
+	*link = terrain->next;
+	FreeTerrainTile( stream, tile, terrain );
+	stream->nResident--;
+	changed = GL_TRUE;
+    }
+    return changed;
+}
+
+/*** Función: UpdateTerrainStream que espera a los mosaicos pedidos ***/
+// Para empezar sin huecos bajo la cámara
+GLboolean WaitTerrainStream( TERRAINSTREAM* stream, VECTOR eye )
+{
+    GLboolean changed = UpdateTerrainStream( stream, eye );
+    SDL_mutexP( stream->mutex );
+    while( stream->nRequests > 0 || stream->loading > 0 )
+	SDL_CondWait( stream->done, stream->mutex );
+    SDL_mutexV( stream->mutex );
+    return UpdateTerrainStream( stream, eye ) || changed;
+}
+
+/*** Función: Altura sólo si el mosaico del punto es residente ***/
+// GL_FALSE si el punto cae fuera del mapa o en un mosaico sin cargar
+GLboolean GetStreamHeight( TERRAINSTREAM* stream, GLfloat x, GLfloat z,
+			   GLfloat* height )
+{
+    TERRAINTILEHEADER* header = &stream->header;
+    GLfloat tileSize = header->tileCells * stream->cellSpacing;
+    if( x < 0.0f || z < 0.0f ||
+	x > (header->vertsPerRow - 1) * stream->cellSpacing ||
+	z > (header->vertsPerCol - 1) * stream->cellSpacing )
+	return GL_FALSE;
+
+    GLuint tx = MINVALUE( (GLuint)( x / tileSize ), header->tilesX - 1 );
+    GLuint tz = MINVALUE( (GLuint)( z / tileSize ), header->tilesZ - 1 );
+    TERRAIN* terrain = stream->tiles[ tz * header->tilesX + tx ];
+    if( terrain == NULL )
+	return GL_FALSE;
+    *height = GetHeight( terrain, x, z );
+    return GL_TRUE;
+}
+
+/*** Función: Cierra el archivo de mosaicos y libera los residentes ***/
+void FreeTerrainStream( TERRAINSTREAM* stream )
+{
+    unsigned int i;
+    if( stream->map == NULL )
+	return;
+
+    /* Termino el hilo de carga */
+    SDL_mutexP( stream->mutex );
+    stream->quit = GL_TRUE;
+    SDL_CondSignal( stream->wake );
+    SDL_mutexV( stream->mutex );
+    SDL_WaitThread( stream->thread, NULL );
+
+    /* Mosaicos */
+    for( i = 0; i < stream->nReady; i++ )
+	FreeTerrainTile( stream, stream->readyTiles[i], stream->ready[i] );
+    while( stream->resident != NULL )
+    {
+	TERRAIN* next = stream->resident->next;
+	FreeTerrain( stream->resident );
+	free( stream->resident );
+	stream->resident = next;
+    }
+
+    SDL_DestroyCond( stream->wake );
+    SDL_DestroyCond( stream->done );
+    SDL_DestroyMutex( stream->mutex );
+    munmap( stream->map, stream->mapSize );
+    free( stream->state );
+    free( stream->tiles );
+    free( stream->requests );
+    free( stream->readyTiles );
+    free( stream->ready );
+    memset( stream, 0, sizeof(TERRAINSTREAM) );
+}
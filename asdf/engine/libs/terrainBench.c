@@ -0,0 +1,320 @@
+/*****************************/
+/**      --------------     **/
+/**      terrainBench.c     **/
+/**      --------------     **/
+/**  Armado y consultas de  **/
+/**  terrenos sin ventana   **/
+/*****************************/
+
+#include "opengl.c"
+#include "math.c"
+#include "thread.c"
+#include "model.c"
+#include "camera.c"
+#include "shader.c"
+#include "terrain.c"
+
+/*** Opciones(línea de comandos) ***/
+char*   terrainFile = NULL;  // NULL: heightmap generado
+GLuint  terrainSize = 2049;
+GLfloat cellSpacing = 10.0f;
+GLuint  nRuns       = 5;
+GLuint  maxThreads  = 0;     // 0: todos los procesadores
+GLuint  nQueries    = 1000000;
+GLuint  nCraters    = 1000;
+
+/*** Heightmap original(BuildTerrainGeometry lo escala) ***/
+unsigned char* heights;
+
+
+/*** Función: Tiempo monotónico en segundos ***/
+double BenchTime( void )
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+/*** Función: Uso del programa ***/
+void Usage( void )
+{
+  fprintf( stderr,
+	   "usage: %s [-t heightmap] [-s vertsPerSide] [-r runs] [-j maxThreads]"
+	   " [-q queries] [-c craters]\n",
+	   g_Argv[0] );
+  exit( 1 );
+}
+
+/*** Inicialización de recursos ***/
+void Init( void )
+{
+  /* Opciones */
+  int option;
+  while( ( option = getopt( g_Argc, g_Argv, "t:s:r:j:q:c:h" ) ) != -1 )
+    switch( option )
+      {
+      case 't': terrainFile = optarg;         break;
+      case 's': terrainSize = atoi( optarg ); break;
+      case 'r': nRuns       = atoi( optarg ); break;
+      case 'j': maxThreads  = atoi( optarg ); break;
+      case 'q': nQueries    = atoi( optarg ); break;
+      case 'c': nCraters    = atoi( optarg ); break;
+      default : Usage();
+      }
+  if( terrainSize < 2 || nRuns < 1 )
+    Usage();
+  if( maxThreads == 0 )
+    maxThreads = CountProcessors();
+
+  /* Heightmap: del archivo o colinas con ruido(semilla fija) */
+  size_t samples = (size_t)terrainSize * terrainSize;
+  heights = malloc( samples );
+  if( terrainFile != NULL )
+    {
+      FILE* file = fopen( terrainFile, "rb" );
+      if( file == NULL || fread( heights, 1, samples, file ) != samples )
+	{
+	  PrintError( "Could not read the terrain heightmap", GL_FALSE );
+	  exit( 1 );
+	}
+      fclose( file );
+    }
+  else
+    {
+      unsigned int i, j;
+      srand( 1 );
+      for( i = 0; i < terrainSize; i++ )
+	for( j = 0; j < terrainSize; j++ )
+	  heights[ i * terrainSize + j ] =
+	    (unsigned char)( 120.0f + 60.0f * sin( i * 0.07f ) * cos( j * 0.05f ) +
+			     30.0f * sin( i * 0.31f + j * 0.17f ) + rand() % 5 );
+    }
+
+  printf( "Terrain %dx%d(%.2f Msamples), %s kernels, best of %d runs\n",
+	  terrainSize, terrainSize, samples / 1000000.0, vectorKernels.name, nRuns );
+}
+
+/*** Liberación de recursos ***/
+void Free( void )
+{
+  free( heights );
+}
+
+/*** Función: Mejor tiempo(ms) de armar el terreno con "nThreads" hilos ***/
+// 0 hilos: todo en el hilo principal, sin grupo
+double BuildTime( GLuint nThreads )
+{
+  WORKERPOOL pool;
+  double     best = INFINITY;
+  size_t     samples = (size_t)terrainSize * terrainSize;
+  unsigned int r;
+
+  if( nThreads > 0 )
+    InitWorkerPool( &pool, nThreads - 1 );
+  for( r = 0; r < nRuns; r++ )
+    {
+      TERRAIN terrain;
+      memset( &terrain, 0, sizeof(TERRAIN) );
+      terrain.vertsPerRow = terrainSize;
+      terrain.vertsPerCol = terrainSize;
+      terrain.cellSpacing = cellSpacing;
+      terrain.heightMap   = malloc( samples );
+      memcpy( terrain.heightMap, heights, samples );
+
+      double start = BenchTime();
+      BuildTerrainGeometry( nThreads > 0 ? &pool : NULL, &terrain, 1.0f );
+      best = MINVALUE( best, ( BenchTime() - start ) * 1000.0 );
+      FreeTerrain( &terrain );
+    }
+  if( nThreads > 0 )
+    FreeWorkerPool( &pool );
+  return best;
+}
+
+/*** Función: Mide las consultas de altura y normal en puntos al azar ***/
+// Uno por uno(GetHeight y GetNormal) contra el lote(GetHeights)
+void QueryTimes( void )
+{
+  TERRAIN     terrain;
+  VECTORARRAY points, normals;
+  GLfloat*    out     = malloc( sizeof(GLfloat) * nQueries );
+  size_t      samples = (size_t)terrainSize * terrainSize;
+  GLfloat     extent  = ( terrainSize - 1 ) * cellSpacing;
+  GLfloat     check   = 0.0f;
+  double      oneByOne = INFINITY, heightsOnly = INFINITY, withNormals = INFINITY;
+  unsigned int i, r;
+
+  memset( &terrain, 0, sizeof(TERRAIN) );
+  terrain.vertsPerRow = terrainSize;
+  terrain.vertsPerCol = terrainSize;
+  terrain.cellSpacing = cellSpacing;
+  terrain.heightMap   = malloc( samples );
+  memcpy( terrain.heightMap, heights, samples );
+  BuildTerrainGeometry( NULL, &terrain, 1.0f );
+
+  InitVectorArray( &points, nQueries );
+  InitVectorArray( &normals, nQueries );
+  srand( 2 );
+  for( i = 0; i < nQueries; i++ )
+    {
+      points.x[i] = extent * rand() / RAND_MAX;
+      points.z[i] = extent * rand() / RAND_MAX;
+    }
+
+  for( r = 0; r < nRuns; r++ )
+    {
+      double start = BenchTime();
+      for( i = 0; i < nQueries; i++ )
+	{
+	  out[i] = GetHeight( &terrain, points.x[i], points.z[i] );
+	  check += GetNormal( &terrain, points.x[i], points.z[i] ).y;
+	}
+      oneByOne = MINVALUE( oneByOne, BenchTime() - start );
+
+      start = BenchTime();
+      GetHeights( &terrain, &points, out, NULL );
+      heightsOnly = MINVALUE( heightsOnly, BenchTime() - start );
+
+      start = BenchTime();
+      GetHeights( &terrain, &points, out, &normals );
+      withNormals = MINVALUE( withNormals, BenchTime() - start );
+    }
+
+  printf( "\n%d random queries(ns/point)\n", nQueries );
+  printf( "GetHeight+GetNormal %8.2f\n", oneByOne    * 1e9 / nQueries );
+  printf( "GetHeights          %8.2f\n", heightsOnly * 1e9 / nQueries );
+  printf( "GetHeights+normals  %8.2f\n", withNormals * 1e9 / nQueries );
+  if( check < 0.0f )
+    printf( "%f\n", check ); // Que el compilador no quite GetNormal
+
+  FreeVectorArray( &points );
+  FreeVectorArray( &normals );
+  FreeTerrain( &terrain );
+  free( out );
+}
+
+/*** Función: Mide cráteres al azar contra rearmar todo el terreno ***/
+void DeformTimes( void )
+{
+  TERRAIN terrain;
+  size_t  samples = (size_t)terrainSize * terrainSize;
+  GLfloat extent  = ( terrainSize - 1 ) * cellSpacing;
+  double  deform  = 0.0, rebuild;
+  unsigned int i;
+
+  memset( &terrain, 0, sizeof(TERRAIN) );
+  terrain.vertsPerRow = terrainSize;
+  terrain.vertsPerCol = terrainSize;
+  terrain.cellSpacing = cellSpacing;
+  terrain.heightMap   = malloc( samples );
+  memcpy( terrain.heightMap, heights, samples );
+  double start = BenchTime();
+  BuildTerrainGeometry( NULL, &terrain, 1.0f );
+  rebuild = BenchTime() - start;
+
+  srand( 3 );
+  for( i = 0; i < nCraters; i++ )
+    {
+      // Radio de 8 celdas: 17x17 vértices
+      TERRAINCRATER crater = { extent * rand() / RAND_MAX, extent * rand() / RAND_MAX,
+			       8.0f * cellSpacing, 10.0f };
+      BOX area = { { crater.x - crater.radius, 0.0f, crater.z - crater.radius },
+		   { crater.x + crater.radius, 0.0f, crater.z + crater.radius } };
+      BOX dirty;
+      start = BenchTime();
+      DeformTerrain( &terrain, area, CraterBrush, &crater, &dirty );
+      deform += BenchTime() - start;
+    }
+
+  printf( "\n%d craters of 17x17 vertices\n", nCraters );
+  printf( "DeformTerrain       %8.2f us/crater\n", deform * 1e6 / nCraters );
+  printf( "full rebuild        %8.2f us\n", rebuild * 1e6 );
+  FreeTerrain( &terrain );
+}
+
+/*** Función: Mide CompactTerrain y los bytes que se dibujan con y sin él ***/
+// Vista desde el centro del terreno, 1 pixel de error en 1080 líneas
+void CompactTimes( void )
+{
+  TERRAIN terrain[2];
+  size_t  samples = (size_t)terrainSize * terrainSize;
+  GLfloat extent  = ( terrainSize - 1 ) * cellSpacing;
+  VECTOR  eye     = { extent * 0.5f, 300.0f, extent * 0.5f };
+  double  select[2] = { INFINITY, INFINITY }, compact;
+  size_t  vertexBytes[2], indexBytes[2];
+  unsigned int c, i, r;
+
+  for( c = 0; c < 2; c++ )
+    {
+      memset( &terrain[c], 0, sizeof(TERRAIN) );
+      terrain[c].vertsPerRow = terrainSize;
+      terrain[c].vertsPerCol = terrainSize;
+      terrain[c].cellSpacing = cellSpacing;
+      terrain[c].heightMap   = malloc( samples );
+      memcpy( terrain[c].heightMap, heights, samples );
+      BuildTerrainGeometry( NULL, &terrain[c], 1.0f );
+    }
+  double start = BenchTime();
+  if( !CompactTerrain( NULL, &terrain[1] ) )
+    {
+      PrintError( "The terrain does not fit in compact pages", GL_FALSE );
+      FreeTerrain( &terrain[0] );
+      FreeTerrain( &terrain[1] );
+      return;
+    }
+  compact = ( BenchTime() - start ) * 1000.0;
+
+  for( c = 0; c < 2; c++ )
+    for( r = 0; r < nRuns; r++ )
+      {
+	start = BenchTime();
+	SelectTerrainLOD( &terrain[c], eye, NULL, TerrainLODFactor( 45.0f, 1080, 1.0f ),
+			  NULL );
+	select[c] = MINVALUE( select[c], ( BenchTime() - start ) * 1000.0 );
+      }
+  vertexBytes[0] = samples * sizeof(NORMAL_TEX_VERTEX);
+  vertexBytes[1] = 0;
+  for( i = 0; i < terrain[1].pageRows * terrain[1].pageCols; i++ )
+    vertexBytes[1] += terrain[1].pages[i].rows * terrain[1].pages[i].cols *
+      sizeof(TERRAINVERTEX);
+  indexBytes[0] = terrain[0].drawCount * sizeof(GLuint);
+  indexBytes[1] = terrain[1].drawCount * sizeof(GLushort);
+
+  printf( "\nCompactTerrain %.2f ms(%dx%d pages)\n", compact, terrain[1].pageRows,
+	  terrain[1].pageCols );
+  printf( "%-8s %12s %12s %14s\n", "layout", "vertices(MB)", "indices(KB)",
+	  "select(ms)" );
+  printf( "%-8s %12.2f %12.2f %14.2f\n", "float", vertexBytes[0] / 1048576.0,
+	  indexBytes[0] / 1024.0, select[0] );
+  printf( "%-8s %12.2f %12.2f %14.2f\n", "compact", vertexBytes[1] / 1048576.0,
+	  indexBytes[1] / 1024.0, select[1] );
+  FreeTerrain( &terrain[0] );
+  FreeTerrain( &terrain[1] );
+}
+
+/*** Loop: mide con 1, 2, 4... hilos y termina ***/
+void Loop( float elapsed )
+{
+  double msamples = (double)terrainSize * terrainSize / 1000000.0;
+  double serial   = BuildTime( 0 );
+  GLuint nThreads;
+
+  printf( "%-8s %10s %14s %12s %8s\n", "threads", "build(ms)", "ms/Msample",
+	  "Msamples/s", "speedup" );
+  printf( "%-8s %10.2f %14.2f %12.2f %8.2f\n", "main", serial, serial / msamples,
+	  msamples / serial * 1000.0, 1.0 );
+  for( nThreads = 1; ; nThreads = MINVALUE( nThreads * 2, maxThreads ) )
+    {
+      double time = BuildTime( nThreads );
+      printf( "%-8d %10.2f %14.2f %12.2f %8.2f\n", nThreads, time, time / msamples,
+	      msamples / time * 1000.0, serial / time );
+      if( nThreads == maxThreads )
+	break;
+    }
+  if( nQueries > 0 )
+    QueryTimes();
+  if( nCraters > 0 )
+    DeformTimes();
+  CompactTimes();
+  g_ExitProgram = GL_TRUE;
+}
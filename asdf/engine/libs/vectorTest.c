@@ -0,0 +1,261 @@
+/*****************************/
+/**      ------------       **/
+/**      vectorTest.c       **/
+/**      ------------       **/
+/**  Operaciones en lote    **/
+/**  (escalar, SSE2 y AVX)  **/
+/**  contra las de VECTOR   **/
+/*****************************/
+
+#include "opengl.c"
+#include "math.c"
+#include "thread.c"
+#include "model.c"
+#include "camera.c"
+#include "shader.c"
+#include "terrain.c"
+#include "collision.c"
+
+/* Especificaciones */
+#define MAX_KERNELS 3  // Versiones a probar
+#define EDGE_COUNT  36 // Largos 0..35 en las primeras rondas
+
+/*** Opciones(línea de comandos) ***/
+GLuint nRounds = 20000;
+GLuint seed    = 1;
+
+/*** Versiones disponibles en esta máquina ***/
+const VECTORKERNELS* kernels[MAX_KERNELS];
+GLuint               nKernels = 0;
+
+/*** Resultados ***/
+GLuint nChecks     = 0;
+GLuint nMismatches = 0;
+
+
+/*** Función: Número al azar en [a,b] ***/
+GLfloat RandomRange( GLfloat a, GLfloat b )
+{
+  return a + ( b - a ) * ( rand() / (GLfloat)RAND_MAX );
+}
+
+/*** Función: Componente al azar ***/
+// Casi siempre en [-100,100]; a veces cero(con signo), muy chica o muy
+// grande para llegar a subnormales e infinitos al multiplicar
+GLfloat RandomValue( void )
+{
+  switch( rand() % 16 )
+    {
+    case 0:  return 0.0f;
+    case 1:  return -0.0f;
+    case 2:  return RandomRange( -1.0f, 1.0f ) * 1e-20f;
+    case 3:  return RandomRange( -1.0f, 1.0f ) * 1e20f;
+    default: return RandomRange( -100.0f, 100.0f );
+    }
+}
+
+/*** Función: Vector al azar(uno de cada cinco es cero) ***/
+VECTOR RandomVector( void )
+{
+  VECTOR v = { 0.0f, 0.0f, 0.0f };
+  if( rand() % 5 == 0 )
+    return v;
+  v.x = RandomValue();
+  v.y = RandomValue();
+  v.z = RandomValue();
+  return v;
+}
+
+/*** Función: Compara floats bit a bit(NaN igual a NaN) ***/
+GLboolean SameFloat( GLfloat a, GLfloat b )
+{
+  return ( isnan( a ) && isnan( b ) ) || memcmp( &a, &b, sizeof(GLfloat) ) == 0;
+}
+
+/*** Función: Compara un valor con el de referencia ***/
+void Check( const char* op, GLuint count, GLuint i, GLfloat expected,
+	    GLfloat value, GLboolean exact )
+{
+  nChecks++;
+  if( exact ? SameFloat( expected, value )
+	    : ( expected == value || ( isnan( expected ) && isnan( value ) ) ) )
+    return;
+  if( nMismatches < 10 )
+    printf( "%s %s: count %d, [%d] %.9g/%.9g\n", vectorKernels.name, op,
+	    count, i, expected, value );
+  nMismatches++;
+}
+
+/*** Función: Compara un arreglo con vectores de referencia ***/
+void CheckVectors( const char* op, const VECTORARRAY* array,
+		   const VECTOR* expected, GLuint count )
+{
+  unsigned int i;
+  for( i = 0; i < count; i++ )
+    {
+      Check( op, count, i, expected[i].x, array->x[i], GL_TRUE );
+      Check( op, count, i, expected[i].y, array->y[i], GL_TRUE );
+      Check( op, count, i, expected[i].z, array->z[i], GL_TRUE );
+    }
+}
+
+/*** Función: Uso del programa ***/
+void Usage( void )
+{
+  fprintf( stderr, "usage: %s [-n rounds] [-s seed]\n", g_Argv[0] );
+  exit( 1 );
+}
+
+/*** Inicialización de recursos ***/
+void Init( void )
+{
+  /* Opciones */
+  int option;
+  while( ( option = getopt( g_Argc, g_Argv, "n:s:h" ) ) != -1 )
+    switch( option )
+      {
+      case 'n': nRounds = atoi( optarg ); break;
+      case 's': seed    = atoi( optarg ); break;
+      default : Usage();
+      }
+  if( nRounds < 1 )
+    Usage();
+
+  /* Todas las versiones que corren aquí */
+  kernels[nKernels++] = &scalarKernels;
+#ifdef __SSE2__
+  kernels[nKernels++] = &sseKernels;
+#endif
+#ifdef VECTOR_AVX
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx" ) )
+    kernels[nKernels++] = &avxKernels;
+  else
+    printf( "AVX not supported, skipped\n" );
+#endif
+
+  printf( "Batch vector operations vs VECTOR functions, %d rounds:", nRounds );
+  unsigned int i;
+  for( i = 0; i < nKernels; i++ )
+    printf( " %s", kernels[i]->name );
+  printf( "\n" );
+}
+
+/*** Liberación de recursos ***/
+void Free( void )
+{
+}
+
+/*** Función: Prueba todas las operaciones de una versión ***/
+// Cada operación se prueba también sobre el mismo arreglo(out == in)
+void TestKernels( const VECTORKERNELS* k, GLuint count, VECTOR* va,
+		  VECTOR* vb, GLfloat* M )
+{
+  VECTORARRAY a, b, out;
+  VECTOR*     expected = calloc( count + 1, sizeof(VECTOR) );
+  GLfloat*    dots     = calloc( count + 1, sizeof(GLfloat) );
+  unsigned int i;
+
+  InitVectorArray( &a, count );
+  InitVectorArray( &b, count );
+  InitVectorArray( &out, count );
+  LoadVectorArray( &a, va, count );
+  LoadVectorArray( &b, vb, count );
+  vectorKernels = *k;
+
+  /* Transformación */
+  for( i = 0; i < count; i++ )
+    expected[i] = TransformCoordFromMatrix( va[i], M );
+  TransformVectors( M, &a, &out );
+  CheckVectors( "transform", &out, expected, count );
+  LoadVectorArray( &out, va, count );
+  TransformVectors( M, &out, &out );
+  CheckVectors( "transform(in place)", &out, expected, count );
+
+  /* Producto punto */
+  for( i = 0; i < count; i++ )
+    dots[i] = NAN;
+  DotVectors( &a, &b, dots );
+  for( i = 0; i < count; i++ )
+    Check( "dot", count, i, DotProduct( va[i], vb[i] ), dots[i], GL_TRUE );
+
+  /* Producto cruz */
+  for( i = 0; i < count; i++ )
+    expected[i] = CrossProduct( va[i], vb[i] );
+  CrossVectors( &a, &b, &out );
+  CheckVectors( "cross", &out, expected, count );
+  LoadVectorArray( &out, va, count );
+  CrossVectors( &out, &b, &out );
+  CheckVectors( "cross(in place)", &out, expected, count );
+
+  /* Normalización(los vectores cero dan NaN en las dos) */
+  for( i = 0; i < count; i++ )
+    expected[i] = NormalizeVector( va[i] );
+  NormalizeVectors( &a, &out );
+  CheckVectors( "normalize", &out, expected, count );
+  LoadVectorArray( &out, va, count );
+  NormalizeVectors( &out, &out );
+  CheckVectors( "normalize(in place)", &out, expected, count );
+
+  /* Caja: mínimo y máximo(0 y -0 son iguales) */
+  BOX box = { {  INFINITY,  INFINITY,  INFINITY },
+	      { -INFINITY, -INFINITY, -INFINITY } };
+  for( i = 0; i < count; i++ )
+    {
+      box.min.x = MINVALUE( va[i].x, box.min.x );
+      box.min.y = MINVALUE( va[i].y, box.min.y );
+      box.min.z = MINVALUE( va[i].z, box.min.z );
+      box.max.x = MAXVALUE( va[i].x, box.max.x );
+      box.max.y = MAXVALUE( va[i].y, box.max.y );
+      box.max.z = MAXVALUE( va[i].z, box.max.z );
+    }
+  BOX bound = BoundVectors( &a );
+  Check( "bound min.x", count, 0, box.min.x, bound.min.x, GL_FALSE );
+  Check( "bound min.y", count, 0, box.min.y, bound.min.y, GL_FALSE );
+  Check( "bound min.z", count, 0, box.min.z, bound.min.z, GL_FALSE );
+  Check( "bound max.x", count, 0, box.max.x, bound.max.x, GL_FALSE );
+  Check( "bound max.y", count, 0, box.max.y, bound.max.y, GL_FALSE );
+  Check( "bound max.z", count, 0, box.max.z, bound.max.z, GL_FALSE );
+
+  FreeVectorArray( &a );
+  FreeVectorArray( &b );
+  FreeVectorArray( &out );
+  free( expected );
+  free( dots );
+}
+
+/*** Loop: prueba todas las rondas y termina(1 si hay diferencias) ***/
+// Las primeras rondas recorren los largos 0..35(con y sin resto de 4 y 8)
+void Loop( float elapsed )
+{
+  unsigned int round, i;
+  srand( seed );
+  for( round = 0; round < nRounds; round++ )
+    {
+      GLuint  count = round < 2 * EDGE_COUNT ? round % EDGE_COUNT
+					     : rand() % 100;
+      VECTOR* va = malloc( sizeof(VECTOR) * ( count + 1 ) );
+      VECTOR* vb = malloc( sizeof(VECTOR) * ( count + 1 ) );
+      GLfloat M[16];
+      for( i = 0; i < count; i++ )
+	{
+	  va[i] = RandomVector();
+	  vb[i] = RandomVector();
+	}
+      for( i = 0; i < 12; i++ )
+	M[i] = RandomRange( -10.0f, 10.0f );
+      M[12] = M[13] = M[14] = 0.0f;
+      M[15] = 1.0f;
+
+      for( i = 0; i < nKernels; i++ )
+	TestKernels( kernels[i], count, va, vb, M );
+      free( va );
+      free( vb );
+    }
+
+  InitVectorKernels();
+  printf( "%d checks, %d mismatches\n", nChecks, nMismatches );
+  if( nMismatches > 0 )
+    exit( 1 );
+  g_ExitProgram = GL_TRUE;
+}
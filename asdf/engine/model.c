@@ -8,6 +8,35 @@
 
 //--- Definiciones ---//
 #define AI_CONFIG_PP_RVC_FLAGS (aiComponent_ANIMATIONS|aiComponent_BONEWEIGHTS|aiComponent_LIGHTS|aiComponent_CAMERAS)
+#define MODEL_IMPORT_FLAGS     (aiProcess_OptimizeGraph            | \
+				aiProcess_RemoveComponent          | \
+				aiProcess_CalcTangentSpace         | \
+				aiProcess_JoinIdenticalVertices    | \
+				aiProcess_FixInfacingNormals       | \
+				aiProcess_GenSmoothNormals         | \
+				aiProcess_RemoveRedundantMaterials | \
+				aiProcess_Triangulate              | \
+				aiProcess_SortByPType              | \
+				aiProcess_FlipWindingOrder)
+
+/*** Caché binario(MODELCACHEHEADER) ***/
+#define MODEL_CACHE_MAGIC   "MDL1"      // Firma del archivo
+#define MODEL_CACHE_VERSION 2           // Cambia con el formato o el armado
+#define MODEL_CACHE_EXT     ".mdlcache" // Se agrega al nombre del modelo
+#define MODEL_CACHE_NAME    256         // Largo máximo del nombre de una textura
+
+/*** Orden de dibujo(OptimizeModelBuffers) ***/
+#define VERTEX_CACHE_SIZE      16    // Entradas del caché de vértices(FIFO)
+#define VERTEX_CACHE_THRESHOLD 1.05f // ACMR que se cede para ordenar contra el overdraw
+
+/*** Vértices compactos(MODELCOMPACT) ***/
+#define MODEL_COMPACT_UV 4.0f // Mayor |coord de textura| en half float(error <= 1/1024)
+
+/*** Lectura de OBJ sin assimp(LoadModelOBJ) ***/
+#define OBJ_CHUNK_BYTES    (256 * 1024) // Bytes del archivo por tarea
+#define OBJ_EVENT_MATERIAL 0            // usemtl
+#define OBJ_EVENT_OBJECT   1            // o, g
+#define OBJ_EVENT_LIBRARY  2            // mtllib
 
 //--- Estructuras ---//
 
@@ -22,157 +51,1059 @@ typedef struct properties
   GLenum    texOp;
 } PROPERTIES;
 
+/*** Estructura de dato: MODELVERTEX ***/
+// Vértice intercalado del buffer de vértices(VBO) del modelo
+typedef struct modelvertex
+{
+  POINT    p; // Ubicación(espacio local)
+  VECTOR   n; // Normal
+  TEXCOORD t; // Coord de textura
+  COLOR    c; // Color
+} MODELVERTEX;
+
+/*** Estructura de dato: MODELCOMPACT ***/
+// MODELVERTEX en 20 bytes en vez de 48 para el buffer de dibujo. La
+// posición va en pasos de MODEL.drawScale desde MODEL.drawOrigin.
+typedef struct modelcompact
+{
+  GLshort  p[4]; // Ubicación(X, Y, Z y relleno)
+  GLbyte   n[4]; // Normal(PackNormal)
+  GLushort t[2]; // Coord de textura en half float
+  GLubyte  c[4]; // Color
+} MODELCOMPACT;
+
+/*** Estructura de dato: MODELGROUP ***/
+// Índices que se dibujan con un solo glDrawElements: un material, un tipo
+// de primitiva y los mismos atributos
+typedef struct modelgroup
+{
+  GLuint    material;  // Índice del material
+  GLenum    mode;      // GL_POINTS, GL_LINES ó GL_TRIANGLES
+  GLuint    first;     // Primer índice(en el buffer de índices)
+  GLuint    count;     // Número de índices
+  GLboolean normals;   // Los vértices tienen normal
+  GLboolean texCoords; // Los vértices tienen coord de textura
+  GLboolean colors;    // Los vértices tienen color
+} MODELGROUP;
+
+/*** Estructura de dato: MODELBUILD ***/
+// Meshes a dibujar que junta CollectModel para BuildModelBuffers
+typedef struct modelbuild
+{
+  const struct aiMesh** meshes;
+  struct aiMatrix4x4*   transformations; // Del mesh al espacio local
+  GLuint                count;
+} MODELBUILD;
+
+/*** Estructura de dato: MODELCLUSTER ***/
+// Triángulos seguidos de Tipsify que se mueven juntos(OrderTriangleClusters)
+typedef struct modelcluster
+{
+  GLuint  first;  // Primer triángulo
+  GLuint  count;  // Número de triángulos
+  GLfloat area;   // Doble del área
+  VECTOR  center; // Centro pesado por área
+  VECTOR  normal; // Suma de normales(pesadas por área)
+  GLfloat key;    // Qué tanto mira hacia afuera de la malla
+} MODELCLUSTER;
+
+/*** Estructura de dato: BVHNODE ***/
+// Nodo de la jerarquía de volúmenes del modelo(espacio local).
+// El hijo izquierdo es el nodo siguiente; una hoja tiene count > 0.
+typedef struct bvhnode
+{
+  BOX    box;   // Caja del nodo
+  GLuint right; // Índice del hijo derecho
+  GLuint first; // Primer triángulo(en bvhTriangles)
+  GLuint count; // Número de triángulos(0 en nodos internos)
+} BVHNODE;
+
+/*** Estructura de dato: HULL ***/
+// Envolvente convexa de un mesh(espacio local) para colisiones
+typedef struct hull
+{
+  VECTOR*   points;     // Puntos de la envolvente
+  GLuint    pointCount; // Número de puntos
+  GLboolean authored;   // Viene del archivo(mesh "UCX_...")
+} HULL;
+
+/*** Estructura de dato: MODELCACHEHEADER ***/
+// Inicio del caché de un modelo. Le siguen, sin relleno: materiales,
+// grupos, vértices e índices de dibujo, vértices e índices de colisión, la
+// jerarquía con su orden de triángulos, las envolventes y sus puntos.
+// Orden de bytes de la máquina.
+typedef struct modelcacheheader
+{
+  char               magic[4];      // MODEL_CACHE_MAGIC
+  GLuint             version;       // MODEL_CACHE_VERSION
+  unsigned long long sourceHash;    // ModelSourceHash del archivo original
+  GLuint             importFlags;   // MODEL_IMPORT_FLAGS al importarlo
+  GLuint             materialCount;
+  GLuint             groupCount;
+  GLuint             drawVertices;  // MODELVERTEX del buffer de vértices
+  GLuint             drawIndices;
+  GLuint             vertexCount;   // Geometría de colisión
+  GLuint             indexCount;
+  GLuint             bvhCount;
+  GLuint             bvhTriangles;
+  GLuint             hullCount;
+  GLuint             hullPoints;    // Puntos de todas las envolventes
+  BOX                bounds;
+  SPHERE             sphere;
+} MODELCACHEHEADER;
+
+/*** Estructura de dato: MODELCACHEMATERIAL ***/
+typedef struct modelcachematerial
+{
+  MATERIAL   material;
+  PROPERTIES properties;
+  char       texture[MODEL_CACHE_NAME]; // Textura difusa("" sin textura)
+} MODELCACHEMATERIAL;
+
+/*** Estructura de dato: MODELCACHEHULL ***/
+typedef struct modelcachehull
+{
+  GLuint pointCount;
+  GLuint authored;
+} MODELCACHEHULL;
+
+/*** Estructura de dato: OBJCORNER ***/
+// Esquina de una cara: posición, coord de textura y normal(-1: no tiene).
+// Un índice negativo del archivo se guarda relativo al inicio del trozo.
+typedef struct objcorner
+{
+  GLint   index[3];
+  GLubyte relative; // Bit i: index[i] es relativo al trozo
+} OBJCORNER;
+
+/*** Estructura de dato: OBJEVENT ***/
+// usemtl, o/g ó mtllib entre las caras de un trozo
+typedef struct objevent
+{
+  GLuint      type;   // OBJ_EVENT_*
+  GLuint      face;   // Caras del trozo antes del evento
+  GLuint      corner; // Esquinas del trozo antes del evento
+  const char* name;   // En el archivo mapeado, sin '\0'
+  GLuint      length;
+} OBJEVENT;
+
+/*** Estructura de dato: OBJCHUNK ***/
+// Líneas del archivo que lee una tarea de ParseObjChunk
+typedef struct objchunk
+{
+  const char* begin;
+  const char* end;
+  GLfloat*    positions;  // x, y, z
+  GLfloat*    texCoords;  // u, v
+  GLfloat*    normals;    // x, y, z
+  OBJCORNER*  corners;
+  GLuint*     faces;      // Esquinas de cada cara
+  OBJEVENT*   events;
+  GLuint      nPositions, nTexCoords, nNormals, nCorners, nFaces, nEvents;
+  GLuint      maxPositions, maxTexCoords, maxNormals, maxCorners, maxFaces, maxEvents;
+  GLuint      basePosition; // Primer elemento en los arreglos de OBJIMPORT
+  GLuint      baseTexCoord;
+  GLuint      baseNormal;
+  GLuint      baseCorner;
+  GLuint      baseFace;
+  GLboolean   error;        // Índice fuera de rango
+} OBJCHUNK;
+
+/*** Estructura de dato: OBJMATERIAL ***/
+typedef struct objmaterial
+{
+  char       name[MODEL_CACHE_NAME];
+  MATERIAL   material;
+  PROPERTIES properties;
+  char       texture[MODEL_CACHE_NAME]; // map_Kd("" sin textura)
+  GLboolean  used;                      // Alguna cara lo usa
+} OBJMATERIAL;
+
+/*** Estructura de dato: OBJMESH ***/
+// Caras seguidas con el mismo objeto y material
+typedef struct objmesh
+{
+  GLuint       material;    // Índice en OBJIMPORT.materials
+  GLboolean    hull;        // Objeto "UCX_...": envolvente de colisión
+  GLuint       firstFace;
+  GLuint       nFaces;
+  GLuint       firstCorner;
+  GLboolean    normals;     // El archivo las trae en todas las esquinas
+  GLboolean    texCoords;
+  MODELVERTEX* vertices;    // Lo de abajo lo arma BuildObjMesh
+  GLuint       nVertices;
+  GLuint*      triangles;   // Índices del mesh, 3 por triángulo
+  GLuint       nTriangles;
+} OBJMESH;
+
+/*** Estructura de dato: OBJKEY ***/
+// Entrada de las tablas hash de BuildObjMesh(key[0] = -1: libre)
+typedef struct objkey
+{
+  GLint  key[3];
+  GLuint value;
+} OBJKEY;
+
+/*** Estructura de dato: OBJIMPORT ***/
+// Datos de las tareas de ImportModelOBJ
+typedef struct objimport
+{
+  const char*  data;        // Archivo mapeado
+  size_t       size;
+  OBJCHUNK*    chunks;
+  GLuint       nChunks;
+  GLfloat*     positions;   // Todo el archivo, en orden
+  GLfloat*     texCoords;
+  GLfloat*     normals;
+  OBJCORNER*   corners;
+  GLuint*      faces;
+  GLuint       nPositions, nTexCoords, nNormals, nCorners, nFaces;
+  OBJMATERIAL* materials;   // De los mtllib; el último es el de omisión
+  GLuint       nMaterials;
+  OBJMESH*     meshes;
+  GLuint       nMeshes;
+} OBJIMPORT;
+
 /*** Estructura de dato: MODEL ***/
 typedef struct model
 {
-  GLuint      modelList;    // Lista de comandos opengl del model
+  GLuint      vertexObject; // Buffer de vértices en opengl(MODELVERTEX)
+  GLuint      indexObject;  // Buffer de índices en opengl
+  GLenum      indexType;    // GL_UNSIGNED_SHORT si hay a lo más 65536 vértices
+  GLboolean   compact;      // El buffer de vértices tiene MODELCOMPACT
+  VECTOR      drawOrigin;   // Ubicación de MODELCOMPACT: drawOrigin + p * drawScale
+  GLfloat     drawScale;
+  MODELGROUP* groups;       // Grupos de índices por material
+  GLuint      groupCount;   // Número de grupos
   GLuint*     textureIDs;   // Lista de los ID's de las texturas
   MATERIAL*   materials;    // Lista de materiales
   PROPERTIES* properties;   // Material Properties
+  GLuint      materialCount; // Número de materiales
   VECTOR*     vertexBuffer; // Buffer de Vértices
   GLuint      vertexCount;  // Número de Vértices
   GLuint*     indexBuffer;  // Buffer de Índices
   GLuint      indexCount;   // Número de Índices
+  BVHNODE*    bvh;          // Jerarquía de volúmenes de los triángulos
+  GLuint      bvhCount;     // Número de nodos
+  GLuint*     bvhTriangles; // Triángulos ordenados por hoja
+  HULL*       hulls;        // Envolventes convexas para colisiones
+  GLuint      hullCount;    // Número de envolventes
+  GLboolean   exactCollision; // Colisión con los triángulos, no envolventes
+  BOX         bounds;       // Caja de los vértices(espacio local)
+  SPHERE      sphere;       // Esfera de los vértices(espacio local)
 } MODEL;
 /*__________*/
 
 
 //--- Funciones ---//
 
-/*** Función: Renderiza recursivamente un modelo y guarda su geometría ***/
-void RenderModel( const struct aiScene* scene,
-		  const struct aiNode*  node,
-		  struct aiMatrix4x4    matrix,
-		  MODEL* modelStruct, GLboolean verbose )
+/*** Función: Agrega una envolvente convexa al modelo ***/
+// Si no viene del archivo se simplifica a los vértices extremos en 26
+// direcciones(caras, aristas y esquinas de un cubo).
+void AddModelHull( MODEL* modelStruct, VECTOR* vertices, GLuint count,
+		   GLboolean authored )
+{
+  if( count == 0 )
+    return;
+
+  modelStruct->hulls = realloc( modelStruct->hulls,
+				sizeof(HULL) * (modelStruct->hullCount + 1) );
+  HULL* hull = &modelStruct->hulls[modelStruct->hullCount++];
+  hull->authored   = authored;
+  hull->pointCount = 0;
+
+  if( authored )
+    {
+      hull->points = malloc( sizeof(VECTOR) * count );
+      memcpy( hull->points, vertices, sizeof(VECTOR) * count );
+      hull->pointCount = count;
+      return;
+    }
+
+  /* Vértice extremo en cada dirección(sin repetir) */
+  GLuint extremes[26];
+  int    x, y, z;
+  unsigned int i, k;
+  for( x = -1; x <= 1; x++ )
+    for( y = -1; y <= 1; y++ )
+      for( z = -1; z <= 1; z++ )
+	{
+	  if( x == 0 && y == 0 && z == 0 )
+	    continue;
+	  VECTOR  dir  = { x, y, z };
+	  GLuint  best = 0;
+	  GLfloat max  = DotProduct( vertices[0], dir );
+	  for( i = 1; i < count; i++ )
+	    if( DotProduct( vertices[i], dir ) > max )
+	      {
+		max  = DotProduct( vertices[i], dir );
+		best = i;
+	      }
+	  for( k = 0; k < hull->pointCount && extremes[k] != best; k++ );
+	  if( k == hull->pointCount )
+	    extremes[hull->pointCount++] = best;
+	}
+  hull->points = malloc( sizeof(VECTOR) * hull->pointCount );
+  for( k = 0; k < hull->pointCount; k++ )
+    hull->points[k] = vertices[extremes[k]];
+}
+
+/*** Función: Deja sólo las envolventes del archivo si hay alguna ***/
+void SelectModelHulls( MODEL* modelStruct, GLboolean verbose )
 {
+  GLuint authored = 0, points = 0;
+  unsigned int i, j;
+  for( i = 0; i < modelStruct->hullCount; i++ )
+    if( modelStruct->hulls[i].authored )
+      authored++;
+
+  if( authored > 0 )
+    for( i = 0, j = 0; i < modelStruct->hullCount; i++ )
+      {
+	if( modelStruct->hulls[i].authored )
+	  modelStruct->hulls[j++] = modelStruct->hulls[i];
+	else
+	  free( modelStruct->hulls[i].points );
+      }
+  if( authored > 0 )
+    modelStruct->hullCount = authored;
+
+  for( i = 0; i < modelStruct->hullCount; i++ )
+    points += modelStruct->hulls[i].pointCount;
   if( verbose )
-    printf( "\t\tExecuting Node '%s'\n", node->mName.data );
+    printf( "\tHulls: %d (%s), %d points\n", modelStruct->hullCount,
+	    authored > 0 ? "authored" : "generated", points );
+}
+
+/*** Función: Guarda la geometría de un mesh para colisiones ***/
+// Los meshes "UCX_..." son envolventes del archivo y no dan triángulos
+void AddMeshGeometry( const struct aiMesh* mesh,
+		      struct aiMatrix4x4*  transformation,
+		      MODEL*               modelStruct )
+{
+  unsigned int j, k;
+
+  /* Envolvente de colisión del archivo */
+  if( strncmp( mesh->mName.data, "UCX_", 4 ) == 0 )
+    {
+      VECTOR* hull = malloc( sizeof(VECTOR) * mesh->mNumVertices );
+      for( j = 0; j < mesh->mNumVertices; j++ )
+	{
+	  struct aiVector3D vertex = mesh->mVertices[j];
+	  aiTransformVecByMatrix4( &vertex, transformation );
+	  VECTOR v = { vertex.x, vertex.y, vertex.z };
+	  hull[j] = v;
+	}
+      AddModelHull( modelStruct, hull, mesh->mNumVertices, GL_TRUE );
+      free( hull );
+      return;
+    }
+
+  /* Índices: un solo realloc por mesh */
+  GLuint nIndices = 0;
+  for( j = 0; j < mesh->mNumFaces; j++ )
+    nIndices += mesh->mFaces[j].mNumIndices;
+  modelStruct->indexBuffer =
+    realloc( modelStruct->indexBuffer,
+	     sizeof(GLuint) * (modelStruct->indexCount + nIndices) );
+  for( j = 0; j < mesh->mNumFaces; j++ )
+    {
+      const struct aiFace* face = &mesh->mFaces[j];
+      for( k = 0; k < face->mNumIndices; k++ )
+	modelStruct->indexBuffer[modelStruct->indexCount + k] = 
+	  modelStruct->vertexCount + face->mIndices[k];
+      modelStruct->indexCount += face->mNumIndices;
+    }
+
+  /* Vértices */
+  modelStruct->vertexBuffer =
+    realloc( modelStruct->vertexBuffer,
+	     sizeof(VECTOR) *
+	     (modelStruct->vertexCount + mesh->mNumVertices) );
+  for( j = 0; j < mesh->mNumVertices; j++ )
+    {
+      struct aiVector3D vertex = mesh->mVertices[j];
+      aiTransformVecByMatrix4( &vertex, transformation );
+      VECTOR v = { vertex.x, vertex.y, vertex.z };
+      modelStruct->vertexBuffer[modelStruct->vertexCount + j] = v;
+    }
+  AddModelHull( modelStruct,
+		&modelStruct->vertexBuffer[modelStruct->vertexCount],
+		mesh->mNumVertices, GL_FALSE );
+
+  modelStruct->vertexCount += mesh->mNumVertices;
+}
 
-  /* Transformacion del nodo */
-  glPushMatrix();
-  glMultTransposeMatrixf( (GLfloat*)&node->mTransformation );
+/*** Función: Guarda recursivamente la geometría de colisión ***/
+// Con build != NULL junta también los meshes a dibujar(BuildModelBuffers)
+void CollectModel( const struct aiScene* scene,
+		   const struct aiNode*  node,
+		   struct aiMatrix4x4    matrix,
+		   MODEL* modelStruct, MODELBUILD* build, GLboolean verbose )
+{
+  if( verbose )
+    printf( "\t\tCollecting Node '%s'\n", node->mName.data );
 
   struct aiMatrix4x4 transformation = matrix;
   aiMultiplyMatrix4( &transformation, &node->mTransformation );
 
-  /* Meshes */
   unsigned int i;
   for( i = 0; i < node->mNumMeshes; i++ )
     {
       const struct aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-      unsigned int matIndex = mesh->mMaterialIndex;
+      AddMeshGeometry( mesh, &transformation, modelStruct );
+      // Envolvente de colisión del archivo: no se dibuja
+      if( build == NULL || mesh->mNumFaces == 0 ||
+	  strncmp( mesh->mName.data, "UCX_", 4 ) == 0 )
+	continue;
 
-      if( verbose )
-	printf( "\t\t\tRendering Mesh No.%d - '%s'\n", i, mesh->mName.data );     
+      build->meshes = realloc( build->meshes,
+			       sizeof(struct aiMesh*) * (build->count + 1) );
+      build->transformations = realloc( build->transformations,
+					sizeof(struct aiMatrix4x4) *
+					(build->count + 1) );
+      build->meshes[build->count]          = mesh;
+      build->transformations[build->count] = transformation;
+      build->count++;
+    }
+  for( i = 0; i < node->mNumChildren; i++ )
+    CollectModel( scene, node->mChildren[i], transformation,
+		  modelStruct, build, verbose );
+}
 
-      /* Propiedades */
-      if( mesh->mNormals == NULL )
-	glDisable( GL_LIGHTING );
-      else
-	glEnable( GL_LIGHTING );
-      if( mesh->mTextureCoords == NULL )
-	glDisable( GL_TEXTURE_2D );
-      else
-	glEnable( GL_TEXTURE_2D );
-      if( modelStruct->properties[matIndex].wireframe )
-	glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-      else
-	glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
-      if( modelStruct->properties[matIndex].culling )
-	glEnable( GL_CULL_FACE );
-      else
-	glDisable( GL_CULL_FACE );
-       if( modelStruct->properties[matIndex].flat )
-	 glShadeModel( GL_FLAT );
-      else
-	glShadeModel( GL_SMOOTH );
-      if( modelStruct->properties[matIndex].transparency )
-	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-      else
-	glBlendFunc( GL_ONE, GL_ONE );
-      if( modelStruct->properties[matIndex].blending )
-	glEnable( GL_BLEND );
-      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
-		       modelStruct->properties[matIndex].texOp );
-      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
-		       modelStruct->properties[matIndex].texOp );
+/*** Función: Matriz para las normales de un nodo ***/
+// Cofactores de la 3x3: la inversa transpuesta por el determinante. Con el
+// signo del determinante basta normalizar, como GL_NORMALIZE con la lista.
+void ModelNormalMatrix( const struct aiMatrix4x4* m, GLfloat n[3][3] )
+{
+  unsigned int i, j;
+  n[0][0] = m->b2 * m->c3 - m->b3 * m->c2;
+  n[0][1] = m->b3 * m->c1 - m->b1 * m->c3;
+  n[0][2] = m->b1 * m->c2 - m->b2 * m->c1;
+  n[1][0] = m->c2 * m->a3 - m->c3 * m->a2;
+  n[1][1] = m->c3 * m->a1 - m->c1 * m->a3;
+  n[1][2] = m->c1 * m->a2 - m->c2 * m->a1;
+  n[2][0] = m->a2 * m->b3 - m->a3 * m->b2;
+  n[2][1] = m->a3 * m->b1 - m->a1 * m->b3;
+  n[2][2] = m->a1 * m->b2 - m->a2 * m->b1;
+  if( m->a1 * n[0][0] + m->a2 * n[0][1] + m->a3 * n[0][2] < 0.0f )
+    for( i = 0; i < 3; i++ )
+      for( j = 0; j < 3; j++ )
+	n[i][j] = -n[i][j];
+}
 
-      /* Material */
-      SetMaterial( &modelStruct->materials[matIndex] );
+/*** Función: Grupo de índices con el material, primitiva y atributos ***/
+// Lo crea si no hay ninguno
+GLuint ModelGroupIndex( MODEL* modelStruct, MODELGROUP group )
+{
+  unsigned int i;
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      MODELGROUP* g = &modelStruct->groups[i];
+      if( g->material == group.material && g->mode == group.mode &&
+	  g->normals == group.normals && g->texCoords == group.texCoords &&
+	  g->colors == group.colors )
+	return i;
+    }
+  modelStruct->groups = realloc( modelStruct->groups,
+				 sizeof(MODELGROUP) * (modelStruct->groupCount + 1) );
+  modelStruct->groups[modelStruct->groupCount] = group;
+  return modelStruct->groupCount++;
+}
+
+/*** Función: Grupo de índices de un mesh ***/
+GLuint ModelMeshGroup( MODEL* modelStruct, const struct aiMesh* mesh )
+{
+  MODELGROUP group;
+  group.material  = mesh->mMaterialIndex;
+  group.first     = 0;
+  group.count     = 0;
+  group.normals   = mesh->mNormals != NULL;
+  group.texCoords = mesh->mTextureCoords[0] != NULL;
+  group.colors    = mesh->mColors[0] != NULL;
+  // aiProcess_SortByPType: un solo tipo de primitiva por mesh
+  switch( mesh->mFaces[0].mNumIndices )
+    {
+    case 1 : group.mode = GL_POINTS   ; break;
+    case 2 : group.mode = GL_LINES    ; break;
+    default: group.mode = GL_TRIANGLES; break;
+    }
+  return ModelGroupIndex( modelStruct, group );
+}
+
+/*** Función: Arma los vértices e índices de dibujo del modelo ***/
+// Los vértices quedan en espacio local y los índices agrupados por
+// material; un recorrido para contar y otro para llenar. El que llama
+// libera "vertices" e "indices".
+void BuildModelBuffers( MODEL*        modelStruct,
+			MODELBUILD*   build      ,
+			MODELVERTEX** vertexData ,
+			GLuint*       vertexTotal,
+			GLuint**      indexData  ,
+			GLuint*       indexTotal )
+{
+  GLuint*      meshGroup = malloc( sizeof(GLuint) * build->count );
+  GLuint*      cursor;
+  GLuint       nVertices = 0, nIndices = 0, base = 0;
+  MODELVERTEX* vertices;
+  GLuint*      indices;
+  unsigned int i, j, k;
+
+  /* Grupos y tamaños */
+  modelStruct->groups     = NULL;
+  modelStruct->groupCount = 0;
+  for( i = 0; i < build->count; i++ )
+    {
+      const struct aiMesh* mesh = build->meshes[i];
+      meshGroup[i] = ModelMeshGroup( modelStruct, mesh );
+      MODELGROUP* group = &modelStruct->groups[meshGroup[i]];
+      GLuint      size  = mesh->mFaces[0].mNumIndices;
+      for( j = 0; j < mesh->mNumFaces; j++ )
+	if( mesh->mFaces[j].mNumIndices == size )
+	  group->count += size;
+      nVertices += mesh->mNumVertices;
+    }
+  cursor = malloc( sizeof(GLuint) * (modelStruct->groupCount + 1) );
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      modelStruct->groups[i].first = nIndices;
+      cursor[i]  = nIndices;
+      nIndices  += modelStruct->groups[i].count;
+    }
+
+  /* Vértices e índices */
+  vertices = calloc( nVertices + 1, sizeof(MODELVERTEX) );
+  indices  = malloc( sizeof(GLuint) * (nIndices + 1) );
+  for( i = 0; i < build->count; i++ )
+    {
+      const struct aiMesh* mesh = build->meshes[i];
+      GLuint  size = mesh->mFaces[0].mNumIndices;
+      GLfloat normalMatrix[3][3];
+      ModelNormalMatrix( &build->transformations[i], normalMatrix );
+
+      for( j = 0; j < mesh->mNumVertices; j++ )
+	{
+	  MODELVERTEX*      v      = &vertices[base + j];
+	  struct aiVector3D vertex = mesh->mVertices[j];
+	  aiTransformVecByMatrix4( &vertex, &build->transformations[i] );
+	  v->p.x = vertex.x;
+	  v->p.y = vertex.y;
+	  v->p.z = vertex.z;
+	  if( mesh->mNormals != NULL )
+	    {
+	      struct aiVector3D n = mesh->mNormals[j];
+	      VECTOR normal = { normalMatrix[0][0] * n.x + normalMatrix[0][1] * n.y + normalMatrix[0][2] * n.z,
+				normalMatrix[1][0] * n.x + normalMatrix[1][1] * n.y + normalMatrix[1][2] * n.z,
+				normalMatrix[2][0] * n.x + normalMatrix[2][1] * n.y + normalMatrix[2][2] * n.z };
+	      if( Norm2Vector( normal ) > 0.0f )
+		v->n = NormalizeVector( normal );
+	    }
+	  if( mesh->mTextureCoords[0] != NULL )
+	    {
+	      v->t.u = mesh->mTextureCoords[0][j].x;
+	      v->t.v = mesh->mTextureCoords[0][j].y;
+	    }
+	  if( mesh->mColors[0] != NULL )
+	    memcpy( &v->c, &mesh->mColors[0][j], sizeof(COLOR) );
+	}
 
-      /* Textura */
-      glBindTexture( GL_TEXTURE_2D,
-		     modelStruct->textureIDs[matIndex] );
-      /* Caras */
-      unsigned int j;
       for( j = 0; j < mesh->mNumFaces; j++ )
 	{
-	  /* J-th Face */
 	  const struct aiFace* face = &mesh->mFaces[j];
-	  switch( face->mNumIndices )
+	  if( face->mNumIndices != size )
+	    continue;
+	  for( k = 0; k < size; k++ )
+	    indices[cursor[meshGroup[i]]++] = base + face->mIndices[k];
+	}
+      base += mesh->mNumVertices;
+    }
+
+  free( cursor );
+  free( meshGroup );
+  *vertexData  = vertices;
+  *vertexTotal = nVertices;
+  *indexData   = indices;
+  *indexTotal  = nIndices;
+}
+
+/*** Función: Fallas del caché de vértices al dibujar unos índices ***/
+// Caché FIFO de VERTEX_CACHE_SIZE: "stamps" guarda cuándo entró cada
+// vértice y "time" avanza con cada falla. Con stamps en 0 y time mayor que
+// VERTEX_CACHE_SIZE empieza vacío; sumarle VERTEX_CACHE_SIZE lo vacía.
+GLuint VertexCacheMisses( const GLuint* indices, GLuint nIndices,
+			  GLuint* stamps, GLuint* time )
+{
+  GLuint misses = 0;
+  unsigned int i;
+  for( i = 0; i < nIndices; i++ )
+    if( *time - stamps[indices[i]] > VERTEX_CACHE_SIZE )
+      {
+	stamps[indices[i]] = (*time)++;
+	misses++;
+      }
+  return misses;
+}
+
+/*** Función: ACMR y ATVR de los grupos de triángulos del modelo ***/
+// ACMR: fallas por triángulo(0.5 es lo mínimo en una malla grande); ATVR:
+// fallas por vértice usado(1 es lo mínimo). El caché se vacía entre grupos.
+void VertexCacheStats( MODEL*  modelStruct,
+		       GLuint* indices    ,
+		       GLuint  nVertices  ,
+		       GLfloat* acmr      ,
+		       GLfloat* atvr      )
+{
+  GLuint*  stamps = calloc( nVertices + 1, sizeof(GLuint) );
+  GLubyte* used   = calloc( nVertices + 1, sizeof(GLubyte) );
+  GLuint   time   = VERTEX_CACHE_SIZE + 1;
+  GLuint   misses = 0, triangles = 0, vertices = 0;
+  unsigned int i, j;
+
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      MODELGROUP* group = &modelStruct->groups[i];
+      if( group->mode != GL_TRIANGLES )
+	continue;
+      misses    += VertexCacheMisses( &indices[group->first], group->count,
+				      stamps, &time );
+      time      += VERTEX_CACHE_SIZE;
+      triangles += group->count / 3;
+      for( j = group->first; j < group->first + group->count; j++ )
+	if( !used[indices[j]] )
+	  {
+	    used[indices[j]] = GL_TRUE;
+	    vertices++;
+	  }
+    }
+  *acmr = triangles > 0 ? (GLfloat)misses / triangles : 0.0f;
+  *atvr = vertices  > 0 ? (GLfloat)misses / vertices  : 0.0f;
+  free( stamps );
+  free( used );
+}
+
+/*** Función: Ordena triángulos para el caché de vértices(Tipsify) ***/
+// Sander, Nehab y Barczak 2007: abanicos alrededor de un vértice; el
+// siguiente es el vértice recién usado que seguirá en el caché mientras se
+// terminan sus triángulos. Cada salto(callejón sin salida) empieza un
+// grupo en "starts"; devuelve cuántos hay. "out" conserva el orden de los
+// vértices de cada triángulo.
+GLuint TipsifyTriangles( const GLuint* indices,
+			 GLuint        nTriangles,
+			 GLuint        nVertices,
+			 GLuint*       out,
+			 GLuint*       starts )
+{
+  GLuint*  live      = calloc( nVertices + 1, sizeof(GLuint) );
+  GLuint*  offsets   = calloc( nVertices + 2, sizeof(GLuint) );
+  GLuint*  stamps    = calloc( nVertices + 1, sizeof(GLuint) );
+  GLuint*  adjacency = malloc( sizeof(GLuint) * (3 * nTriangles + 1) );
+  GLuint*  deadEnd   = malloc( sizeof(GLuint) * (3 * nTriangles + 1) );
+  GLubyte* emitted   = calloc( nTriangles + 1, sizeof(GLubyte) );
+  GLuint   nDeadEnd = 0, nOut = 0, nStarts = 0, cursor = 0;
+  GLuint   time     = VERTEX_CACHE_SIZE + 1;
+  GLint    fan;
+  unsigned int i, j, k;
+
+  /* Triángulos de cada vértice, en el orden original */
+  for( i = 0; i < 3 * nTriangles; i++ )
+    live[indices[i]]++;
+  for( i = 0; i < nVertices; i++ )
+    offsets[i + 1] = offsets[i] + live[i];
+  for( i = 0; i < 3 * nTriangles; i++ ) // "stamps" cuenta los ya puestos
+    adjacency[offsets[indices[i]] + stamps[indices[i]]++] = i / 3;
+  memset( stamps, 0, sizeof(GLuint) * (nVertices + 1) );
+
+  starts[nStarts++] = 0;
+  fan = nTriangles > 0 ? (GLint)indices[0] : -1;
+  while( fan >= 0 )
+    {
+      GLuint mark = nDeadEnd;
+      GLint  priority = -1;
+
+      /* Abanico: los triángulos sin dibujar del vértice */
+      for( k = offsets[fan]; k < offsets[fan + 1]; k++ )
+	{
+	  GLuint t = adjacency[k];
+	  if( emitted[t] )
+	    continue;
+	  emitted[t] = GL_TRUE;
+	  for( j = 0; j < 3; j++ )
 	    {
-	    case 1 : glBegin( GL_POINTS )   ; break;
-	    case 2 : glBegin( GL_LINES )    ; break;
-	    case 3 : glBegin( GL_TRIANGLES ); break;
-	    default: glBegin( GL_POLYGON )  ; break;
+	      GLuint v = indices[t * 3 + j];
+	      out[nOut++] = v;
+	      deadEnd[nDeadEnd++] = v;
+	      live[v]--;
+	      if( time - stamps[v] > VERTEX_CACHE_SIZE )
+		stamps[v] = time++;
 	    }
+	}
 
-	  modelStruct->indexBuffer =
-	    realloc( modelStruct->indexBuffer,
-		     sizeof(GLuint) *
-		     (modelStruct->indexCount + face->mNumIndices) );
-	  
-	  /* Índices */
-	  unsigned int k;
-	  for( k = 0; k < face->mNumIndices; k++ )
+      /* Siguiente: el que más lleva en el caché sin que se salga */
+      fan = -1;
+      for( k = mark; k < nDeadEnd; k++ )
+	{
+	  GLuint v = deadEnd[k];
+	  GLint  p = 0;
+	  if( live[v] == 0 )
+	    continue;
+	  if( time - stamps[v] + 2 * live[v] <= VERTEX_CACHE_SIZE )
+	    p = time - stamps[v];
+	  if( p > priority )
 	    {
-	      /* Geometría */
-	      modelStruct->indexBuffer[modelStruct->indexCount + k] = 
-		modelStruct->vertexCount + face->mIndices[k];
-	      
-	      /* Color */
-	      if( mesh->mColors[0] != NULL )
-		glColor4fv( (GLfloat*)&mesh->mColors[0][face->mIndices[k]] );
-	      /* Tex Coord */
-	      if( mesh->mTextureCoords[0] != NULL )
-		glTexCoord2fv( (GLfloat*)&mesh->mTextureCoords[0][face->mIndices[k]] );
-	      /* Normal */
-	      if( mesh->mNormals != NULL )
-		glNormal3fv( (GLfloat*)&mesh->mNormals[face->mIndices[k]] );
-	      /* Vertex */
-	      glVertex3fv( (GLfloat*)&mesh->mVertices[face->mIndices[k]] );
+	      priority = p;
+	      fan      = v;
 	    }
-	  glEnd();
+	}
+      if( fan >= 0 )
+	continue;
+
+      /* Callejón sin salida: vértices recientes y luego el orden original */
+      while( fan < 0 && nDeadEnd > 0 )
+	if( live[deadEnd[--nDeadEnd]] > 0 )
+	  fan = deadEnd[nDeadEnd];
+      while( fan < 0 && cursor < 3 * nTriangles )
+	if( live[indices[cursor++]] > 0 )
+	  fan = indices[cursor - 1];
+      if( fan >= 0 )
+	starts[nStarts++] = nOut / 3;
+    }
+
+  free( live );
+  free( offsets );
+  free( stamps );
+  free( adjacency );
+  free( deadEnd );
+  free( emitted );
+  return nStarts;
+}
+
+/*** Función: Compara grupos de triángulos(qsort) ***/
+// Primero los que miran más hacia afuera; empates en el orden de Tipsify
+int CompareTriangleClusters( const void* a, const void* b )
+{
+  const MODELCLUSTER* c1 = a;
+  const MODELCLUSTER* c2 = b;
+  if( c1->key != c2->key )
+    return c1->key > c2->key ? -1 : 1;
+  return c1->first < c2->first ? -1 : c1->first > c2->first;
+}
+
+/*** Función: Ordena los grupos de Tipsify contra el overdraw ***/
+// Parte cada grupo donde las fallas acumuladas bajan al ACMR del grupo por
+// VERTEX_CACHE_THRESHOLD y dibuja primero los que miran hacia afuera del
+// centro de la malla, que tapan a los de adentro(Sander et al. 2007).
+// Las caras de enfrente van en sentido horario(glFrontFace GL_CW).
+void OrderTriangleClusters( MODELVERTEX* vertices  ,
+			    GLuint       nVertices ,
+			    GLuint*      triangles ,
+			    GLuint       nTriangles,
+			    GLuint*      starts    ,
+			    GLuint       nStarts   )
+{
+  GLuint*       stamps   = calloc( nVertices + 1, sizeof(GLuint) );
+  MODELCLUSTER* clusters = malloc( sizeof(MODELCLUSTER) * (nTriangles + 1) );
+  GLuint*       copy;
+  GLuint        nClusters = 0, time = VERTEX_CACHE_SIZE + 1;
+  VECTOR        center   = { 0.0f, 0.0f, 0.0f };
+  GLfloat       area     = 0.0f;
+  unsigned int  i, j;
 
-	  modelStruct->indexCount += face->mNumIndices;
+  /* Grupos más chicos donde el caché ya rindió */
+  for( i = 0; i < nStarts; i++ )
+    {
+      GLuint  first = starts[i];
+      GLuint  last  = i + 1 < nStarts ? starts[i + 1] : nTriangles;
+      GLuint  misses, count = 0;
+      GLfloat threshold;
+      time     += VERTEX_CACHE_SIZE;
+      misses    = VertexCacheMisses( &triangles[first * 3], (last - first) * 3,
+				     stamps, &time );
+      threshold = VERTEX_CACHE_THRESHOLD * misses / (last - first);
+      time     += VERTEX_CACHE_SIZE;
+      clusters[nClusters++].first = first;
+      for( j = first, misses = 0; j < last; j++ )
+	{
+	  misses += VertexCacheMisses( &triangles[j * 3], 3, stamps, &time );
+	  count++;
+	  if( j + 1 < last && (GLfloat)misses / count <= threshold )
+	    {
+	      clusters[nClusters++].first = j + 1;
+	      time  += VERTEX_CACHE_SIZE;
+	      misses = 0;
+	      count  = 0;
+	    }
 	}
-      
-      if( modelStruct->properties[matIndex].blending )
-	glDisable( GL_BLEND );
+    }
 
-       /* Geometría */
-      modelStruct->vertexBuffer =
-	realloc( modelStruct->vertexBuffer,
-		 sizeof(VECTOR) *
-		 (modelStruct->vertexCount + mesh->mNumVertices) );
-      for( j = 0; j < mesh->mNumVertices; j++ )
+  /* Centro y dirección de cada grupo(pesados por área) */
+  for( i = 0; i < nClusters; i++ )
+    {
+      GLuint last = i + 1 < nClusters ? clusters[i + 1].first : nTriangles;
+      VECTOR sum  = { 0.0f, 0.0f, 0.0f }, normal = { 0.0f, 0.0f, 0.0f };
+      clusters[i].count = last - clusters[i].first;
+      clusters[i].area  = 0.0f;
+      for( j = clusters[i].first; j < last; j++ )
 	{
-	  struct aiVector3D vertex = mesh->mVertices[j];
-	  aiTransformVecByMatrix4( &vertex, &transformation );
-	  VECTOR v = { vertex.x, vertex.y, vertex.z };
-	  modelStruct->vertexBuffer[modelStruct->vertexCount + j] = v;
+	  POINT*  a = &vertices[triangles[j * 3    ]].p;
+	  POINT*  b = &vertices[triangles[j * 3 + 1]].p;
+	  POINT*  c = &vertices[triangles[j * 3 + 2]].p;
+	  VECTOR  ab = { b->x - a->x, b->y - a->y, b->z - a->z };
+	  VECTOR  ac = { c->x - a->x, c->y - a->y, c->z - a->z };
+	  VECTOR  n  = CrossProduct( ac, ab );
+	  GLfloat w  = NormVector( n );
+	  VECTOR  g  = { (a->x + b->x + c->x) / 3.0f, (a->y + b->y + c->y) / 3.0f,
+			 (a->z + b->z + c->z) / 3.0f };
+	  normal = SumVector( normal, n );
+	  sum    = SumVector( sum, MulVector( g, w ) );
+	  clusters[i].area += w;
 	}
+      clusters[i].center = clusters[i].area > 0.0f ?
+	MulVector( sum, 1.0f / clusters[i].area ) : sum;
+      clusters[i].normal = normal;
+      center = SumVector( center, sum );
+      area  += clusters[i].area;
+    }
+  if( area > 0.0f )
+    center = MulVector( center, 1.0f / area );
+  for( i = 0; i < nClusters; i++ )
+    {
+      GLfloat length = NormVector( clusters[i].normal );
+      clusters[i].key = length > 0.0f ?
+	DotProduct( ResVector( clusters[i].center, center ), clusters[i].normal ) / length :
+	0.0f;
+    }
+  qsort( clusters, nClusters, sizeof(MODELCLUSTER), CompareTriangleClusters );
+
+  /* Triángulos en el orden de los grupos */
+  copy = malloc( sizeof(GLuint) * 3 * nTriangles );
+  for( i = 0, j = 0; i < nClusters; j += clusters[i++].count * 3 )
+    memcpy( &copy[j], &triangles[clusters[i].first * 3],
+	    sizeof(GLuint) * 3 * clusters[i].count );
+  memcpy( triangles, copy, sizeof(GLuint) * 3 * nTriangles );
+  free( copy );
+  free( clusters );
+  free( stamps );
+}
+
+/*** Función: Optimiza el orden de dibujo de los buffers del modelo ***/
+// Por grupo de triángulos: Tipsify para el caché de vértices y sus grupos
+// ordenados contra el overdraw. Después renumera los vértices en el orden
+// en que se usan, para que se lean seguidos. Va antes de
+// UploadModelBuffers; con verbose muestra ACMR y ATVR antes y después.
+void OptimizeModelBuffers( MODEL*       modelStruct,
+			   MODELVERTEX* vertices   ,
+			   GLuint       nVertices  ,
+			   GLuint*      indices    ,
+			   GLuint       nIndices   ,
+			   GLboolean    verbose    )
+{
+  GLfloat acmr[2], atvr[2];
+  GLuint* remap;
+  GLuint  next = 0;
+  unsigned int i;
+
+  if( verbose )
+    VertexCacheStats( modelStruct, indices, nVertices, &acmr[0], &atvr[0] );
 
-      modelStruct->vertexCount += mesh->mNumVertices;
+  /* Triángulos */
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      MODELGROUP* group      = &modelStruct->groups[i];
+      GLuint      nTriangles = group->count / 3;
+      if( group->mode != GL_TRIANGLES || nTriangles < 2 )
+	continue;
+      GLuint* order   = malloc( sizeof(GLuint) * 3 * nTriangles );
+      GLuint* starts  = malloc( sizeof(GLuint) * (nTriangles + 1) );
+      GLuint  nStarts = TipsifyTriangles( &indices[group->first], nTriangles,
+					  nVertices, order, starts );
+      OrderTriangleClusters( vertices, nVertices, order, nTriangles, starts, nStarts );
+      memcpy( &indices[group->first], order, sizeof(GLuint) * 3 * nTriangles );
+      free( order );
+      free( starts );
     }
 
+  /* Vértices en el orden en que se usan */
+  remap = malloc( sizeof(GLuint) * (nVertices + 1) );
+  memset( remap, 0xff, sizeof(GLuint) * (nVertices + 1) );
+  for( i = 0; i < nIndices; i++ )
+    if( remap[indices[i]] == (GLuint)-1 )
+      remap[indices[i]] = next++;
+  for( i = 0; i < nVertices; i++ )
+    if( remap[i] == (GLuint)-1 )
+      remap[i] = next++;
+  MODELVERTEX* copy = malloc( sizeof(MODELVERTEX) * (nVertices + 1) );
+  for( i = 0; i < nVertices; i++ )
+    copy[remap[i]] = vertices[i];
+  memcpy( vertices, copy, sizeof(MODELVERTEX) * nVertices );
+  for( i = 0; i < nIndices; i++ )
+    indices[i] = remap[indices[i]];
+  free( copy );
+  free( remap );
 
-  /* Nodos hijos */
-  for( i = 0; i < node->mNumChildren; i++ )
-    RenderModel( scene, node->mChildren[i], transformation, 
-		 modelStruct, verbose );
+  if( verbose )
+    {
+      VertexCacheStats( modelStruct, indices, nVertices, &acmr[1], &atvr[1] );
+      printf( "\tVertex cache(%d entries): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+	      VERTEX_CACHE_SIZE, acmr[0], acmr[1], atvr[0], atvr[1] );
+    }
+}
+
+/*** Función: Opengl lee coordenadas de textura en half float ***/
+GLboolean HalfFloatVertices( void )
+{
+  const char* version    = (const char*)glGetString( GL_VERSION );
+  const char* extensions = (const char*)glGetString( GL_EXTENSIONS );
+  return ( version != NULL && atoi( version ) >= 3 ) ||
+    ( extensions != NULL && strstr( extensions, "GL_ARB_half_float_vertex" ) != NULL );
+}
+
+/*** Función: Vértices de dibujo en MODELCOMPACT ***/
+// La ubicación va en pasos iguales en X, Y y Z desde el centro de su caja:
+// con la escala en la matriz las normales sólo cambian de largo y
+// GL_NORMALIZE las arregla. Pone drawOrigin y drawScale. Devuelve NULL si
+// alguna coord de textura pasa de MODEL_COMPACT_UV.
+MODELCOMPACT* PackModelVertices( MODEL*       modelStruct,
+				 MODELVERTEX* vertices   ,
+				 GLuint       nVertices  )
+{
+  MODELCOMPACT* compact;
+  BOX           box = { { INFINITY, INFINITY, INFINITY },
+			{ -INFINITY, -INFINITY, -INFINITY } };
+  GLfloat       extent;
+  unsigned int  i;
+
+  /* Caja y coords de textura */
+  for( i = 0; i < nVertices; i++ )
+    {
+      POINT p = vertices[i].p;
+      if( fabsf( vertices[i].t.u ) > MODEL_COMPACT_UV ||
+	  fabsf( vertices[i].t.v ) > MODEL_COMPACT_UV )
+	return NULL;
+      box.min.x = MINVALUE( box.min.x, p.x );
+      box.min.y = MINVALUE( box.min.y, p.y );
+      box.min.z = MINVALUE( box.min.z, p.z );
+      box.max.x = MAXVALUE( box.max.x, p.x );
+      box.max.y = MAXVALUE( box.max.y, p.y );
+      box.max.z = MAXVALUE( box.max.z, p.z );
+    }
+
+  /* Pasos: el lado mayor de la caja en [-32767, 32767] */
+  extent = MAXVALUE( box.max.x - box.min.x,
+		     MAXVALUE( box.max.y - box.min.y, box.max.z - box.min.z ) );
+  modelStruct->drawScale    = extent > 0.0f ? extent / 65534.0f : 1.0f;
+  modelStruct->drawOrigin.x = ( box.min.x + box.max.x ) * 0.5f;
+  modelStruct->drawOrigin.y = ( box.min.y + box.max.y ) * 0.5f;
+  modelStruct->drawOrigin.z = ( box.min.z + box.max.z ) * 0.5f;
+
+  compact = malloc( sizeof(MODELCOMPACT) * (nVertices + 1) );
+  for( i = 0; i < nVertices; i++ )
+    {
+      MODELVERTEX*  v   = &vertices[i];
+      MODELCOMPACT* out = &compact[i];
+      GLfloat p[3] = { v->p.x - modelStruct->drawOrigin.x,
+		       v->p.y - modelStruct->drawOrigin.y,
+		       v->p.z - modelStruct->drawOrigin.z };
+      unsigned int k;
+      for( k = 0; k < 3; k++ )
+	{
+	  long q    = lrintf( p[k] / modelStruct->drawScale );
+	  out->p[k] = (GLshort)MINVALUE( MAXVALUE( q, -32767 ), 32767 );
+	}
+      out->p[3] = 0;
+      PackNormal( v->n, out->n );
+      out->t[0] = FloatToHalf( v->t.u );
+      out->t[1] = FloatToHalf( v->t.v );
+      out->c[0] = (GLubyte)lrintf( MINVALUE( MAXVALUE( v->c.r, 0.0f ), 1.0f ) * 255.0f );
+      out->c[1] = (GLubyte)lrintf( MINVALUE( MAXVALUE( v->c.g, 0.0f ), 1.0f ) * 255.0f );
+      out->c[2] = (GLubyte)lrintf( MINVALUE( MAXVALUE( v->c.b, 0.0f ), 1.0f ) * 255.0f );
+      out->c[3] = (GLubyte)lrintf( MINVALUE( MAXVALUE( v->c.a, 0.0f ), 1.0f ) * 255.0f );
+    }
+  return compact;
+}
+
+/*** Función: Sube los vértices e índices de dibujo a opengl ***/
+// Con modelStruct->compact en GL_TRUE usa MODELCOMPACT si se puede(si no,
+// lo deja en GL_FALSE). Los índices van en 16 bits si alcanzan.
+void UploadModelBuffers( MODEL*       modelStruct,
+			 MODELVERTEX* vertices   ,
+			 GLuint       nVertices  ,
+			 GLuint*      indices    ,
+			 GLuint       nIndices   ,
+			 GLboolean    verbose    )
+{
+  MODELCOMPACT* compact     = NULL;
+  GLushort*     shorts      = NULL;
+  const GLvoid* vertexData  = vertices;
+  const GLvoid* indexData   = indices;
+  size_t        vertexBytes = sizeof(MODELVERTEX) * nVertices;
+  size_t        indexBytes  = sizeof(GLuint) * nIndices;
+  unsigned int  i;
 
-  glPopMatrix(); // Restauro Cámara
+  /* Vértices compactos si se pidieron y opengl los lee */
+  if( modelStruct->compact && HalfFloatVertices() )
+    compact = PackModelVertices( modelStruct, vertices, nVertices );
+  modelStruct->compact = compact != NULL;
+  if( compact != NULL )
+    {
+      vertexData  = compact;
+      vertexBytes = sizeof(MODELCOMPACT) * nVertices;
+    }
+
+  /* Índices de 16 bits */
+  modelStruct->indexType = GL_UNSIGNED_INT;
+  if( nVertices <= 65536 )
+    {
+      shorts = malloc( sizeof(GLushort) * (nIndices + 1) );
+      for( i = 0; i < nIndices; i++ )
+	shorts[i] = (GLushort)indices[i];
+      modelStruct->indexType = GL_UNSIGNED_SHORT;
+      indexData  = shorts;
+      indexBytes = sizeof(GLushort) * nIndices;
+    }
+
+  glGenBuffers( 1, &modelStruct->vertexObject );
+  glBindBuffer( GL_ARRAY_BUFFER, modelStruct->vertexObject );
+  glBufferData( GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  glGenBuffers( 1, &modelStruct->indexObject );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, modelStruct->indexObject );
+  glBufferData( GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData, GL_STATIC_DRAW );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+  free( compact );
+  free( shorts );
+
+  if( verbose )
+    printf( "\tBuffers: %d vertices, %d indices, %d draw calls, %.1f KB%s\n",
+	    nVertices, nIndices, modelStruct->groupCount,
+	    ( vertexBytes + indexBytes ) / 1024.0, modelStruct->compact ? "(compact)" : "" );
+}
+
+/*** Función: Carga la textura difusa de un material ***/
+// textureFile = "" deja el material sin textura
+void LoadModelTexture( MODEL*      modelStruct,
+		       GLuint      material   ,
+		       const char* texturePath,
+		       const char* textureFile,
+		       GLboolean   verbose    )
+{
+  char fileName[1024];
+  modelStruct->textureIDs[material] = 0;
+  if( textureFile[0] == '\0' )
+    return;
+
+  snprintf( fileName, sizeof(fileName), "%s/%s", texturePath, textureFile );
+  if( verbose )	  
+    printf( "\tLoading Diffuse Texture '%s'\n", fileName );
+  if( access( fileName, F_OK ) == 0 )
+    {
+      modelStruct->textureIDs[material] = LoadTexture( fileName );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+		       modelStruct->properties[material].texOp );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+		       modelStruct->properties[material].texOp );
+    }
+  else
+    fprintf( stderr, "ERROR: File '%s' does not exist.\n", fileName );
 }
 
 /*** Función: Carga texturas, propiedades y materiales ***/
@@ -185,6 +1116,7 @@ void LoadMaterials( const struct aiScene* scene,
   modelStruct->materials  = calloc( scene->mNumMaterials, sizeof(MATERIAL) );
   modelStruct->properties = calloc( scene->mNumMaterials, sizeof(PROPERTIES) );
   modelStruct->textureIDs = calloc( scene->mNumMaterials, sizeof(GLuint) );
+  modelStruct->materialCount = scene->mNumMaterials;
   unsigned int i;
   for( i = 0; i < scene->mNumMaterials; i++ )
     {
@@ -300,9 +1232,8 @@ void LoadMaterials( const struct aiScene* scene,
 
       /*** Textura ***/
       int texOp;
-      struct aiString textureFile, fileName;
+      struct aiString textureFile;
       textureFile.length = 0; textureFile.data[0] = '\0';
-      fileName.length    = 0; fileName.data[0]    = '\0';
       aiGetMaterialString( material, 
 			   AI_MATKEY_TEXTURE( aiTextureType_DIFFUSE, 0 ),
 			   &textureFile );
@@ -329,113 +1260,1682 @@ void LoadMaterials( const struct aiScene* scene,
 	  break;
 	}
 
-      if( textureFile.length != 0 )
-	{
-	  fileName.length += strlen( texturePath ) + 
-	    strlen( "/" ) + textureFile.length;
-	  strcat( fileName.data, texturePath );
-	  strcat( fileName.data, "/" );
-	  strcat( fileName.data, textureFile.data );
-	  if( verbose )	  
-	    printf( "\tLoading Diffuse Texture '%s'\n",
-		    fileName.data );
-	  if( access( fileName.data, F_OK ) == 0 )
-	    modelStruct->textureIDs[i] = LoadTexture( fileName.data );
-	  else
-	    fprintf( stderr, "ERROR: File '%s' does not exist.\n", 
-		     fileName.data );
-	}
-      else
-	modelStruct->textureIDs[i] = 0;
+      LoadModelTexture( modelStruct, i, texturePath, textureFile.data, verbose );
       /*________*/
     }
 }
 
-/*** Función: Carga el modelo del archivo "modelFile" ***/
-void LoadModel( const char* modelFile,
-		const char* texturePath,
-		GLboolean   verbose,
-		MODEL*      modelStruct )
+/*** Función: Caja de un triángulo del modelo ***/
+void TriangleBox( MODEL* modelStruct, GLuint triangle, BOX* box )
 {
-  /* Cargo el modelo */
-  if( verbose )
-    printf( "Loading model '%s':\n", modelFile );
-  const struct aiScene* scene;
-  scene = aiImportFile( modelFile,
-			aiProcess_OptimizeGraph            |
-			aiProcess_RemoveComponent          |
-			aiProcess_CalcTangentSpace         |
-			aiProcess_JoinIdenticalVertices    |
-			aiProcess_FixInfacingNormals       |
-			aiProcess_GenSmoothNormals         |
-			aiProcess_RemoveRedundantMaterials |
-			aiProcess_SortByPType              |
-			aiProcess_FlipWindingOrder         );
-  if( scene == NULL )
+  GLuint* index = &modelStruct->indexBuffer[triangle * 3];
+  VECTOR  p0    = modelStruct->vertexBuffer[index[0]];
+  VECTOR  p1    = modelStruct->vertexBuffer[index[1]];
+  VECTOR  p2    = modelStruct->vertexBuffer[index[2]];
+
+  box->min.x = MINVALUE( p0.x, MINVALUE( p1.x, p2.x ) );
+  box->min.y = MINVALUE( p0.y, MINVALUE( p1.y, p2.y ) );
+  box->min.z = MINVALUE( p0.z, MINVALUE( p1.z, p2.z ) );
+  box->max.x = MAXVALUE( p0.x, MAXVALUE( p1.x, p2.x ) );
+  box->max.y = MAXVALUE( p0.y, MAXVALUE( p1.y, p2.y ) );
+  box->max.z = MAXVALUE( p0.z, MAXVALUE( p1.z, p2.z ) );
+}
+
+/*** Función: Construye recursivamente un nodo de la jerarquía ***/
+GLuint BuildBVHNode( MODEL*  modelStruct,
+		     BOX*    boxes      ,  // Caja de cada triángulo
+		     VECTOR* centers    ,  // Centro de cada triángulo
+		     GLuint  first      ,  // Primer triángulo del nodo
+		     GLuint  count      )  // Número de triángulos
+{
+  GLuint   nodeIndex = modelStruct->bvhCount++;
+  BVHNODE* node      = &modelStruct->bvh[nodeIndex];
+  GLuint*  tris      = modelStruct->bvhTriangles;
+  VECTOR   cMin      = {  INFINITY,  INFINITY,  INFINITY };
+  VECTOR   cMax      = { -INFINITY, -INFINITY, -INFINITY };
+  unsigned int i;
+
+  /* Caja del nodo y de los centros */
+  node->box.min = cMin;
+  node->box.max = cMax;
+  for( i = first; i < first + count; i++ )
     {
-      PrintError( aiGetErrorString(), GL_FALSE );
-      return;
+      BOX*   b = &boxes[tris[i]];
+      VECTOR c = centers[tris[i]];
+      node->box.min.x = MINVALUE( node->box.min.x, b->min.x );
+      node->box.min.y = MINVALUE( node->box.min.y, b->min.y );
+      node->box.min.z = MINVALUE( node->box.min.z, b->min.z );
+      node->box.max.x = MAXVALUE( node->box.max.x, b->max.x );
+      node->box.max.y = MAXVALUE( node->box.max.y, b->max.y );
+      node->box.max.z = MAXVALUE( node->box.max.z, b->max.z );
+      cMin.x = MINVALUE( cMin.x, c.x ); cMax.x = MAXVALUE( cMax.x, c.x );
+      cMin.y = MINVALUE( cMin.y, c.y ); cMax.y = MAXVALUE( cMax.y, c.y );
+      cMin.z = MINVALUE( cMin.z, c.z ); cMax.z = MAXVALUE( cMax.z, c.z );
     }
 
-  /* Contenido del modelo */
-  if( verbose )
+  /* Hoja */
+  if( count <= 4 )
     {
-      printf( "\t%d Meshes\n"   , scene->mNumMeshes );
-      printf( "\t%d Materials\n", scene->mNumMaterials );
-      printf( "\t%d Textures\n" , scene->mNumTextures );
+      node->right = 0;
+      node->first = first;
+      node->count = count;
+      return nodeIndex;
     }
 
-  /* Materiales */
-  modelStruct->textureIDs = NULL;
-  modelStruct->materials  = NULL;
-  modelStruct->properties = NULL;
-  LoadMaterials( scene, texturePath, modelStruct, verbose );
+  /* Divido en el punto medio del eje más largo de los centros */
+  VECTOR  size  = ResVector( cMax, cMin );
+  GLuint  axis  = ( size.x > size.y && size.x > size.z ) ? 0 :
+    ( size.y > size.z ? 1 : 2 );
+  GLfloat split = ( (GLfloat*)&cMin )[axis] + ( (GLfloat*)&size )[axis] * 0.5f;
+  GLuint  mid   = first;
+  for( i = first; i < first + count; i++ )
+    if( ( (GLfloat*)&centers[tris[i]] )[axis] < split )
+      {
+	GLuint t  = tris[i];
+	tris[i]   = tris[mid];
+	tris[mid] = t;
+	mid++;
+      }
+  // Centros iguales: divido por la mitad
+  if( mid == first || mid == first + count )
+    mid = first + count / 2;
 
-  struct aiMatrix4x4 matrix;
-  aiIdentityMatrix4( &matrix );
-  modelStruct->vertexBuffer = NULL;
-  modelStruct->vertexCount  = 0;
-  modelStruct->indexBuffer  = NULL;
-  modelStruct->indexCount   = 0;
+  node->first = 0;
+  node->count = 0;
+  BuildBVHNode( modelStruct, boxes, centers, first, mid - first );
+  node->right =
+    BuildBVHNode( modelStruct, boxes, centers, mid, first + count - mid );
+  return nodeIndex;
+}
+
+/*** Función: Construye la jerarquía de volúmenes de los triángulos ***/
+void BuildModelBVH( MODEL* modelStruct, GLboolean verbose )
+{
+  GLuint nTriangles = modelStruct->indexCount / 3;
+  modelStruct->bvh          = NULL;
+  modelStruct->bvhCount     = 0;
+  modelStruct->bvhTriangles = NULL;
+  if( nTriangles == 0 )
+    return;
+
+  BOX*    boxes   = malloc( sizeof(BOX) * nTriangles );
+  VECTOR* centers = malloc( sizeof(VECTOR) * nTriangles );
+  modelStruct->bvhTriangles = malloc( sizeof(GLuint) * nTriangles );
+  // Un árbol binario con hojas no vacías tiene a lo más 2n-1 nodos
+  modelStruct->bvh = malloc( sizeof(BVHNODE) * (2 * nTriangles - 1) );
+
+  unsigned int i;
+  for( i = 0; i < nTriangles; i++ )
+    {
+      TriangleBox( modelStruct, i, &boxes[i] );
+      centers[i] = MulVector( SumVector( boxes[i].min, boxes[i].max ), 0.5f );
+      modelStruct->bvhTriangles[i] = i;
+    }
+
+  BuildBVHNode( modelStruct, boxes, centers, 0, nTriangles );
+  free( boxes );
+  free( centers );
 
-  /* Creo la lista de ejecución */
   if( verbose )
-    printf( "\tCreating execution list...\n" );
-  modelStruct->modelList = glGenLists( 1 );
-
-  /*** Renderización ***/
-  glPushAttrib( GL_TRANSFORM_BIT );
-  glMatrixMode( GL_MODELVIEW );
-  glPushMatrix();
-  glLoadIdentity();
-  glNewList( modelStruct->modelList, GL_COMPILE );
-  glPushAttrib( GL_ENABLE_BIT   |
-		GL_TEXTURE_BIT  |
-		GL_LIGHTING_BIT |
-		GL_COLOR_BUFFER_BIT );
-  RenderModel( scene, scene->mRootNode, matrix, modelStruct, verbose );
-  glPopAttrib();
-  glEndList();
-  glPopMatrix();
-  glPopAttrib();
+    printf( "\tBVH: %d triangles, %d nodes\n", nTriangles, modelStruct->bvhCount );
+}
+
+/*** Función: Caja y esfera de los vértices en espacio local ***/
+// La esfera se centra en la caja; un modelo sin vértices queda en el origen
+void ModelBounds( MODEL* modelStruct )
+{
+  VECTOR      zero = { 0.0f, 0.0f, 0.0f };
+  VECTORARRAY vertices;
+  unsigned int i;
+
+  modelStruct->bounds.min    = zero;
+  modelStruct->bounds.max    = zero;
+  modelStruct->sphere.center = zero;
+  modelStruct->sphere.radius = 0.0f;
+  if( modelStruct->vertexCount == 0 ||
+      !InitVectorArray( &vertices, modelStruct->vertexCount ) )
+    return;
+
+  LoadVectorArray( &vertices, modelStruct->vertexBuffer,
+		   modelStruct->vertexCount );
+  modelStruct->bounds = BoundVectors( &vertices );
+  FreeVectorArray( &vertices );
+
+  VECTOR  center = MulVector( SumVector( modelStruct->bounds.min,
+					 modelStruct->bounds.max ), 0.5f );
+  GLfloat radius = 0.0f;
+  for( i = 0; i < modelStruct->vertexCount; i++ )
+    radius = MAXVALUE( radius, Norm2Vector( ResVector( modelStruct->vertexBuffer[i],
+						       center ) ) );
+  modelStruct->sphere.center = center;
+  modelStruct->sphere.radius = sqrt( radius );
+}
+
+/*** Función: Firma del contenido de un archivo ***/
+// FNV-1a de 64 bits sobre palabras de 8 bytes(y los bytes que sobran)
+GLboolean ModelFileHash( const char* file, unsigned long long* hash )
+{
+  struct stat        info;
+  unsigned char*     data;
+  unsigned long long word;
+  size_t             i;
+  int                fd = open( file, O_RDONLY );
+
+  *hash = 14695981039346656037ULL;
+  if( fd < 0 || fstat( fd, &info ) != 0 )
+    {
+      if( fd >= 0 )
+	close( fd );
+      return GL_FALSE;
+    }
+  if( info.st_size == 0 )
+    {
+      close( fd );
+      return GL_TRUE;
+    }
+  data = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED )
+    return GL_FALSE;
+
+  for( i = 0; i + 8 <= (size_t)info.st_size; i += 8 )
+    {
+      memcpy( &word, &data[i], 8 );
+      *hash = ( *hash ^ word ) * 1099511628211ULL;
+    }
+  for( ; i < (size_t)info.st_size; i++ )
+    *hash = ( *hash ^ data[i] ) * 1099511628211ULL;
+  munmap( data, info.st_size );
+  return GL_TRUE;
+}
+
+/*** Función: Firma de un modelo y de sus bibliotecas de materiales ***/
+// En un OBJ se mezcla la firma de cada "mtllib"(relativa al directorio del
+// modelo, como en ImportModelOBJ): editar un .mtl invalida el caché. Una
+// biblioteca que no existe cuenta con firma cero.
+GLboolean ModelSourceHash( const char* modelFile, unsigned long long* hash )
+{
+  struct stat info;
+  size_t      length = strlen( modelFile );
+  int         fd;
+
+  if( !ModelFileHash( modelFile, hash ) )
+    return GL_FALSE;
+  if( length < 4 || ( strcmp( modelFile + length - 4, ".obj" ) != 0 &&
+		      strcmp( modelFile + length - 4, ".OBJ" ) != 0 ) )
+    return GL_TRUE;
+
+  fd = open( modelFile, O_RDONLY );
+  if( fd < 0 || fstat( fd, &info ) != 0 )
+    {
+      if( fd >= 0 )
+	close( fd );
+      return GL_FALSE;
+    }
+  if( info.st_size == 0 )
+    {
+      close( fd );
+      return GL_TRUE;
+    }
+  char* data = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED )
+    return GL_FALSE;
+
+  /* Líneas "mtllib nombre", en el orden del archivo(salto de 'm' en 'm':
+     casi no hay en la geometría) */
+  const char* slash = strrchr( modelFile, '/' );
+  int         dir   = slash != NULL ? slash - modelFile + 1 : 0;
+  const char* end   = data + info.st_size;
+  const char* name  = data;
+  while( ( name = memchr( name, 'm', end - name ) ) != NULL )
+    {
+      const char* line = name++;
+      while( line > data && (line[-1] == ' ' || line[-1] == '\t') )
+	line--;
+      if( ( line > data && line[-1] != '\n' ) || end - name < 6 ||
+	  strncmp( name - 1, "mtllib", 6 ) != 0 )
+	continue;
+
+      char               mtlFile[1024];
+      unsigned long long library;
+      const char*        eol = memchr( name, '\n', end - name );
+      if( eol == NULL )
+	eol = end;
+      for( name += 5; name < eol && (*name == ' ' || *name == '\t'); name++ );
+      while( eol > name && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r') )
+	eol--;
+      snprintf( mtlFile, sizeof(mtlFile), "%.*s%.*s", dir, modelFile,
+		(int)(eol - name), name );
+      if( !ModelFileHash( mtlFile, &library ) )
+	library = 0;
+      *hash = ( *hash ^ library ) * 1099511628211ULL;
+    }
+  munmap( data, info.st_size );
+  return GL_TRUE;
+}
+
+/*** Función: Bytes del caché que describe un encabezado ***/
+size_t ModelCacheBytes( MODELCACHEHEADER* header )
+{
+  return sizeof(MODELCACHEHEADER) +
+    sizeof(MODELCACHEMATERIAL) * (size_t)header->materialCount +
+    sizeof(MODELGROUP)         * (size_t)header->groupCount    +
+    sizeof(MODELVERTEX)        * (size_t)header->drawVertices  +
+    sizeof(GLuint)             * (size_t)header->drawIndices   +
+    sizeof(VECTOR)             * (size_t)header->vertexCount   +
+    sizeof(GLuint)             * (size_t)header->indexCount    +
+    sizeof(BVHNODE)            * (size_t)header->bvhCount      +
+    sizeof(GLuint)             * (size_t)header->bvhTriangles  +
+    sizeof(MODELCACHEHULL)     * (size_t)header->hullCount     +
+    sizeof(VECTOR)             * (size_t)header->hullPoints;
+}
+
+/*** Función: Nombre del caché de un modelo(se libera con free) ***/
+char* ModelCacheName( const char* modelFile )
+{
+  char* cacheFile = malloc( strlen( modelFile ) + strlen( MODEL_CACHE_EXT ) + 1 );
+  strcpy( cacheFile, modelFile );
+  strcat( cacheFile, MODEL_CACHE_EXT );
+  return cacheFile;
+}
+
+/*** Función: Guarda un modelo recién importado en su caché ***/
+// "vertices" e "indices" son los de BuildModelBuffers
+GLboolean WriteModelCache( const char*           cacheFile ,
+			   unsigned long long    sourceHash,
+			   const struct aiScene* scene     ,
+			   MODEL*                modelStruct,
+			   MODELVERTEX*          vertices  ,
+			   GLuint                nVertices ,
+			   GLuint*               indices   ,
+			   GLuint                nIndices  )
+{
+  MODELCACHEHEADER header;
+  struct aiString  textureFile;
+  unsigned int     i;
+  FILE*            file;
+
+  /* Texturas cuyo nombre no cabe: sin caché antes que recortarlo */
+  for( i = 0; i < modelStruct->materialCount; i++ )
+    if( aiGetMaterialString( scene->mMaterials[i],
+			     AI_MATKEY_TEXTURE( aiTextureType_DIFFUSE, 0 ),
+			     &textureFile ) == AI_SUCCESS &&
+	textureFile.length >= MODEL_CACHE_NAME )
+      {
+	PrintError( "Texture name too long for the model cache", GL_TRUE );
+	return GL_FALSE;
+      }
+
+  file = fopen( cacheFile, "wb" );
+  if( file == NULL )
+    {
+      PrintError( "Could not create the model cache", GL_FALSE );
+      return GL_FALSE;
+    }
+
+  /* Encabezado */
+  memset( &header, 0, sizeof(MODELCACHEHEADER) );
+  memcpy( header.magic, MODEL_CACHE_MAGIC, 4 );
+  header.version       = MODEL_CACHE_VERSION;
+  header.sourceHash    = sourceHash;
+  header.importFlags   = MODEL_IMPORT_FLAGS;
+  header.materialCount = modelStruct->materialCount;
+  header.groupCount    = modelStruct->groupCount;
+  header.drawVertices  = nVertices;
+  header.drawIndices   = nIndices;
+  header.vertexCount   = modelStruct->vertexCount;
+  header.indexCount    = modelStruct->indexCount;
+  header.bvhCount      = modelStruct->bvhCount;
+  header.bvhTriangles  = modelStruct->bvhTriangles != NULL ? modelStruct->indexCount / 3 : 0;
+  header.hullCount     = modelStruct->hullCount;
+  for( i = 0; i < modelStruct->hullCount; i++ )
+    header.hullPoints += modelStruct->hulls[i].pointCount;
+  header.bounds        = modelStruct->bounds;
+  header.sphere        = modelStruct->sphere;
+  fwrite( &header, sizeof(MODELCACHEHEADER), 1, file );
+
+  /* Materiales: la textura se guarda por nombre */
+  for( i = 0; i < modelStruct->materialCount; i++ )
+    {
+      MODELCACHEMATERIAL material;
+      memset( &material, 0, sizeof(MODELCACHEMATERIAL) );
+      material.material   = modelStruct->materials[i];
+      material.properties = modelStruct->properties[i];
+      textureFile.length  = 0; textureFile.data[0] = '\0';
+      aiGetMaterialString( scene->mMaterials[i],
+			   AI_MATKEY_TEXTURE( aiTextureType_DIFFUSE, 0 ),
+			   &textureFile );
+      strncpy( material.texture, textureFile.data, MODEL_CACHE_NAME - 1 );
+      fwrite( &material, sizeof(MODELCACHEMATERIAL), 1, file );
+    }
+
+  /* Geometría */
+  fwrite( modelStruct->groups, sizeof(MODELGROUP), header.groupCount, file );
+  fwrite( vertices, sizeof(MODELVERTEX), nVertices, file );
+  fwrite( indices, sizeof(GLuint), nIndices, file );
+  fwrite( modelStruct->vertexBuffer, sizeof(VECTOR), header.vertexCount, file );
+  fwrite( modelStruct->indexBuffer, sizeof(GLuint), header.indexCount, file );
+  fwrite( modelStruct->bvh, sizeof(BVHNODE), header.bvhCount, file );
+  fwrite( modelStruct->bvhTriangles, sizeof(GLuint), header.bvhTriangles, file );
+  for( i = 0; i < header.hullCount; i++ )
+    {
+      MODELCACHEHULL hull = { modelStruct->hulls[i].pointCount,
+			      modelStruct->hulls[i].authored };
+      fwrite( &hull, sizeof(MODELCACHEHULL), 1, file );
+    }
+  for( i = 0; i < header.hullCount; i++ )
+    fwrite( modelStruct->hulls[i].points, sizeof(VECTOR),
+	    modelStruct->hulls[i].pointCount, file );
+
+  // Un caché a medias no debe quedar en disco
+  if( ferror( file ) | fclose( file ) )
+    {
+      PrintError( "Could not write the model cache", GL_FALSE );
+      remove( cacheFile );
+      return GL_FALSE;
+    }
+  return GL_TRUE;
+}
+
+/*** Función: Copia una sección del caché y avanza ***/
+void* ModelCacheSection( unsigned char** section, size_t size )
+{
+  void* copy = NULL;
+  if( size > 0 )
+    {
+      copy = malloc( size );
+      memcpy( copy, *section, size );
+    }
+  *section += size;
+  return copy;
+}
+
+/*** Función: Carga un modelo de su caché ***/
+// Devuelve GL_FALSE si no existe, es de otra versión o de otro archivo
+// original. Con draw = GL_FALSE sólo carga la geometría de colisión.
+GLboolean ReadModelCache( const char*        cacheFile  ,
+			  unsigned long long sourceHash ,
+			  const char*        texturePath,
+			  GLboolean          draw       ,
+			  GLboolean          verbose    ,
+			  MODEL*             modelStruct )
+{
+  MODELCACHEHEADER header;
+  struct stat      info;
+  unsigned char*   map;
+  unsigned char*   section;
+  unsigned int     i;
+  int              fd = open( cacheFile, O_RDONLY );
+
+  /* Archivo mapeado */
+  if( fd < 0 || fstat( fd, &info ) != 0 ||
+      (size_t)info.st_size < sizeof(MODELCACHEHEADER) )
+    {
+      if( fd >= 0 )
+	close( fd );
+      return GL_FALSE;
+    }
+  map = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( map == MAP_FAILED )
+    return GL_FALSE;
+
+  /* Encabezado */
+  memcpy( &header, map, sizeof(MODELCACHEHEADER) );
+  if( memcmp( header.magic, MODEL_CACHE_MAGIC, 4 ) != 0 ||
+      header.version != MODEL_CACHE_VERSION ||
+      header.sourceHash != sourceHash ||
+      header.importFlags != MODEL_IMPORT_FLAGS ||
+      (size_t)info.st_size != ModelCacheBytes( &header ) )
+    {
+      munmap( map, info.st_size );
+      return GL_FALSE;
+    }
+  // Los puntos de cada envolvente deben sumar los del encabezado
+  MODELCACHEHULL* hulls = (MODELCACHEHULL*)( map + info.st_size -
+					     sizeof(VECTOR) * header.hullPoints -
+					     sizeof(MODELCACHEHULL) * header.hullCount );
+  GLuint points = 0;
+  for( i = 0; i < header.hullCount; i++ )
+    points += hulls[i].pointCount;
+  if( points != header.hullPoints )
+    {
+      munmap( map, info.st_size );
+      return GL_FALSE;
+    }
+  if( verbose )
+    printf( "\tUsing cache '%s'\n", cacheFile );
+
+  /* Materiales y buffers de dibujo: se suben desde el mapa */
+  section = map + sizeof(MODELCACHEHEADER);
+  if( draw )
+    {
+      MODELCACHEMATERIAL* materials = (MODELCACHEMATERIAL*)section;
+      modelStruct->materialCount = header.materialCount;
+      modelStruct->materials  = calloc( header.materialCount, sizeof(MATERIAL) );
+      modelStruct->properties = calloc( header.materialCount, sizeof(PROPERTIES) );
+      modelStruct->textureIDs = calloc( header.materialCount, sizeof(GLuint) );
+      for( i = 0; i < header.materialCount; i++ )
+	{
+	  // El mapa es de sólo lectura
+	  char texture[MODEL_CACHE_NAME];
+	  memcpy( texture, materials[i].texture, MODEL_CACHE_NAME );
+	  texture[MODEL_CACHE_NAME - 1] = '\0';
+	  modelStruct->materials[i]  = materials[i].material;
+	  modelStruct->properties[i] = materials[i].properties;
+	  LoadModelTexture( modelStruct, i, texturePath, texture, verbose );
+	}
+    }
+  section += sizeof(MODELCACHEMATERIAL) * header.materialCount;
+  if( draw )
+    {
+      modelStruct->groupCount = header.groupCount;
+      modelStruct->groups     = ModelCacheSection( &section,
+						   sizeof(MODELGROUP) * header.groupCount );
+      UploadModelBuffers( modelStruct,
+			  (MODELVERTEX*)section, header.drawVertices,
+			  (GLuint*)( section + sizeof(MODELVERTEX) * header.drawVertices ),
+			  header.drawIndices, verbose );
+    }
+  else
+    section += sizeof(MODELGROUP) * header.groupCount;
+  section += sizeof(MODELVERTEX) * header.drawVertices +
+    sizeof(GLuint) * header.drawIndices;
+
+  /* Geometría de colisión */
+  modelStruct->vertexCount  = header.vertexCount;
+  modelStruct->vertexBuffer = ModelCacheSection( &section, sizeof(VECTOR) * header.vertexCount );
+  modelStruct->indexCount   = header.indexCount;
+  modelStruct->indexBuffer  = ModelCacheSection( &section, sizeof(GLuint) * header.indexCount );
+  modelStruct->bvhCount     = header.bvhCount;
+  modelStruct->bvh          = ModelCacheSection( &section, sizeof(BVHNODE) * header.bvhCount );
+  modelStruct->bvhTriangles = ModelCacheSection( &section, sizeof(GLuint) * header.bvhTriangles );
+  section += sizeof(MODELCACHEHULL) * header.hullCount;
+  modelStruct->hullCount = header.hullCount;
+  modelStruct->hulls     = calloc( header.hullCount + 1, sizeof(HULL) );
+  for( i = 0; i < header.hullCount; i++ )
+    {
+      modelStruct->hulls[i].pointCount = hulls[i].pointCount;
+      modelStruct->hulls[i].authored   = hulls[i].authored;
+      modelStruct->hulls[i].points     =
+	ModelCacheSection( &section, sizeof(VECTOR) * hulls[i].pointCount );
+    }
+  modelStruct->bounds = header.bounds;
+  modelStruct->sphere = header.sphere;
+
+  munmap( map, info.st_size );
+  return GL_TRUE;
+}
+
+/*** Función: Carga el modelo del archivo "modelFile" ***/
+// Usa "modelFile" + MODEL_CACHE_EXT si es de este archivo(y de sus .mtl);
+// si no, importa el modelo y escribe el caché. "compact" pide dibujar con
+// MODELCOMPACT.
+void LoadModel( const char* modelFile,
+		const char* texturePath,
+		GLboolean   compact,
+		GLboolean   verbose,
+		MODEL*      modelStruct )
+{
+  /* Caché */
+  if( verbose )
+    printf( "Loading model '%s':\n", modelFile );
+  memset( modelStruct, 0, sizeof(MODEL) );
+  modelStruct->compact = compact;
+  char*              cacheFile = ModelCacheName( modelFile );
+  unsigned long long hash;
+  GLboolean          hashed    = ModelSourceHash( modelFile, &hash );
+  if( hashed &&
+      ReadModelCache( cacheFile, hash, texturePath, GL_TRUE, verbose, modelStruct ) )
+    {
+      free( cacheFile );
+      if( verbose )
+	printf( "Done!\n");
+      return;
+    }
+
+  /* Cargo el modelo */
+  const struct aiScene* scene;
+  scene = aiImportFile( modelFile, MODEL_IMPORT_FLAGS );
+  if( scene == NULL )
+    {
+      PrintError( aiGetErrorString(), GL_FALSE );
+      free( cacheFile );
+      return;
+    }
+
+  /* Contenido del modelo */
+  if( verbose )
+    {
+      printf( "\t%d Meshes\n"   , scene->mNumMeshes );
+      printf( "\t%d Materials\n", scene->mNumMaterials );
+      printf( "\t%d Textures\n" , scene->mNumTextures );
+    }
+
+  /* Materiales */
+  LoadMaterials( scene, texturePath, modelStruct, verbose );
+
+  struct aiMatrix4x4 matrix;
+  aiIdentityMatrix4( &matrix );
+
+  /*** Buffers de vértices e índices ***/
+  MODELBUILD   build = { NULL, NULL, 0 };
+  MODELVERTEX* vertices;
+  GLuint*      indices;
+  GLuint       nVertices, nIndices;
+  if( verbose )
+    printf( "\tCreating vertex buffers...\n" );
+  CollectModel( scene, scene->mRootNode, matrix, modelStruct, &build, verbose );
+  BuildModelBuffers( modelStruct, &build, &vertices, &nVertices, &indices, &nIndices );
+  OptimizeModelBuffers( modelStruct, vertices, nVertices, indices, nIndices, verbose );
+  UploadModelBuffers( modelStruct, vertices, nVertices, indices, nIndices, verbose );
+  free( build.meshes );
+  free( build.transformations );
   /*_________*/  
+
+  /* Volúmenes, jerarquía y envolventes para colisiones */
+  ModelBounds( modelStruct );
+  BuildModelBVH( modelStruct, verbose );
+  SelectModelHulls( modelStruct, verbose );
+
+  /* Caché para la próxima vez */
+  if( hashed &&
+      WriteModelCache( cacheFile, hash, scene, modelStruct,
+		       vertices, nVertices, indices, nIndices ) && verbose )
+    printf( "\tWrote cache '%s'\n", cacheFile );
+  free( vertices );
+  free( indices );
+  free( cacheFile );
   
    /* Libero el modelo */
   aiReleaseImport( scene );
   if( verbose )
     printf( "Done!\n");
 }
+
+/*** Función: Carga sólo la geometría de colisión de "modelFile" ***/
+// No usa opengl: sin materiales, texturas ni buffers. Lee el caché de
+// LoadModel si lo hay, pero no lo escribe.
+GLboolean LoadModelCollision( const char* modelFile,
+			      GLboolean   verbose,
+			      MODEL*      modelStruct )
+{
+  if( verbose )
+    printf( "Loading collision model '%s':\n", modelFile );
+  memset( modelStruct, 0, sizeof(MODEL) );
+  char*              cacheFile = ModelCacheName( modelFile );
+  unsigned long long hash;
+  GLboolean          cached    = ModelSourceHash( modelFile, &hash ) &&
+    ReadModelCache( cacheFile, hash, NULL, GL_FALSE, verbose, modelStruct );
+  free( cacheFile );
+  if( cached )
+    return GL_TRUE;
+
+  const struct aiScene* scene;
+  scene = aiImportFile( modelFile, MODEL_IMPORT_FLAGS );
+  if( scene == NULL )
+    {
+      PrintError( aiGetErrorString(), GL_FALSE );
+      return GL_FALSE;
+    }
+
+  struct aiMatrix4x4 matrix;
+  aiIdentityMatrix4( &matrix );
+  CollectModel( scene, scene->mRootNode, matrix, modelStruct, NULL, verbose );
+
+  ModelBounds( modelStruct );
+  BuildModelBVH( modelStruct, verbose );
+  SelectModelHulls( modelStruct, verbose );
+
+  aiReleaseImport( scene );
+  if( verbose )
+    printf( "Done!\n");
+  return GL_TRUE;
+}
   
+/*** Función: Agranda un arreglo de la lectura de OBJ si está lleno ***/
+// Duplica la capacidad
+void* ObjReserve( void* array, GLuint count, GLuint* capacity, size_t size )
+{
+  if( count < *capacity )
+    return array;
+  *capacity = *capacity > 0 ? *capacity * 2 : 1024;
+  return realloc( array, size * *capacity );
+}
+
+/*** Función: Salta espacios y tabs sin pasar de "end" ***/
+const char* ObjSkipSpace( const char* s, const char* end )
+{
+  while( s < end && (*s == ' ' || *s == '\t') )
+    s++;
+  return s;
+}
+
+/*** Función: Lee un número decimal de un OBJ y avanza "p" ***/
+// El archivo mapeado no termina en '\0': no pasa de "end". Una mantisa de
+// hasta 19 cifras con exponente pequeño sale exacta en double; lo demás
+// (muchas cifras, exponentes grandes, "nan", "inf") lo lee strtof.
+GLfloat ObjFloat( const char** p, const char* end )
+{
+  static const double powers[] = { 1e0 , 1e1 , 1e2 , 1e3 , 1e4 , 1e5 ,
+				   1e6 , 1e7 , 1e8 , 1e9 , 1e10, 1e11,
+				   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+				   1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char*        s        = *p;
+  unsigned long long mantissa = 0;
+  int                digits   = 0, exponent = 0;
+  GLboolean          negative = GL_FALSE, seen = GL_FALSE, exact = GL_TRUE;
+
+  if( s < end && (*s == '-' || *s == '+') )
+    negative = *s++ == '-';
+  for( ; s < end && *s >= '0' && *s <= '9'; s++, seen = GL_TRUE )
+    if( digits < 19 )
+      {
+	mantissa = mantissa * 10 + (*s - '0');
+	digits  += mantissa > 0;
+      }
+    else
+      exact = GL_FALSE;
+  if( s < end && *s == '.' )
+    {
+      for( s++; s < end && *s >= '0' && *s <= '9'; s++, seen = GL_TRUE )
+	if( digits < 19 )
+	  {
+	    mantissa = mantissa * 10 + (*s - '0');
+	    digits  += mantissa > 0;
+	    exponent--;
+	  }
+	else
+	  exact = GL_FALSE;
+    }
+  if( seen && s < end && (*s == 'e' || *s == 'E') )
+    {
+      const char* e    = s + 1;
+      GLint       sign = 1, value = 0;
+      if( e < end && (*e == '-' || *e == '+') )
+	sign = *e++ == '-' ? -1 : 1;
+      if( e < end && *e >= '0' && *e <= '9' )
+	{
+	  for( ; e < end && *e >= '0' && *e <= '9'; e++ )
+	    value = MINVALUE( value * 10 + (*e - '0'), 100000 );
+	  exponent += sign * value;
+	  s = e;
+	}
+    }
+
+  if( seen && exact && mantissa < (1ULL << 53) &&
+      exponent >= -22 && exponent <= 22 )
+    {
+      double value = exponent < 0 ? (double)mantissa / powers[-exponent] :
+	(double)mantissa * powers[exponent];
+      *p = s;
+      return negative ? -value : value;
+    }
+
+  /* Caso general */
+  char  number[64];
+  char* stop;
+  int   n;
+  for( n = 0; *p + n < end && n < 63 && (*p)[n] != ' ' && (*p)[n] != '\t' &&
+	 (*p)[n] != '\r' && (*p)[n] != '\n'; n++ )
+    number[n] = (*p)[n];
+  number[n] = '\0';
+  GLfloat value = strtof( number, &stop );
+  *p += stop - number;
+  return value;
+}
+
+/*** Función: Lee un entero de un OBJ y avanza "p"(0 si no hay) ***/
+GLint ObjInt( const char** p, const char* end )
+{
+  const char* s     = *p;
+  const char* digits;
+  GLint       value = 0, sign = 1;
+  if( s < end && (*s == '-' || *s == '+') )
+    sign = *s++ == '-' ? -1 : 1;
+  for( digits = s; s < end && *s >= '0' && *s <= '9'; s++ )
+    if( value < 100000000 )
+      value = value * 10 + (*s - '0');
+  if( s == digits )
+    return 0;
+  *p = s;
+  return sign * value;
+}
+
+/*** Función: Índice de una esquina de cara(v, vt ó vn) ***/
+// Desde 1; uno negativo cuenta hacia atrás desde "count", lo leído en el
+// trozo, y queda relativo a su inicio(bit en corner->relative)
+GLint ObjIndex( GLint value, GLuint count, GLubyte bit, OBJCORNER* corner )
+{
+  if( value > 0 )
+    return value - 1;
+  corner->relative |= bit;
+  return (GLint)count + value;
+}
+
+/*** Función: Guarda un usemtl, o/g ó mtllib del trozo ***/
+void AddObjEvent( OBJCHUNK* chunk, GLuint type, const char* name,
+		  const char* eol )
+{
+  name = ObjSkipSpace( name, eol );
+  while( eol > name && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r') )
+    eol--;
+  chunk->events = ObjReserve( chunk->events, chunk->nEvents,
+			      &chunk->maxEvents, sizeof(OBJEVENT) );
+  OBJEVENT* event = &chunk->events[chunk->nEvents++];
+  event->type   = type;
+  event->face   = chunk->nFaces;
+  event->corner = chunk->nCorners;
+  event->name   = name;
+  event->length = eol - name;
+}
+
+/*** Función: Lee una línea "f" del trozo ***/
+// Las caras de menos de 3 esquinas(puntos, líneas) no se guardan
+void ParseObjFace( OBJCHUNK* chunk, const char* p, const char* eol )
+{
+  GLuint first = chunk->nCorners;
+  for( ;; )
+    {
+      OBJCORNER corner = { { -1, -1, -1 }, 0 };
+      GLint     value;
+      p = ObjSkipSpace( p, eol );
+      if( p >= eol || *p == '\r' || *p == '#' )
+	break;
+
+      value = ObjInt( &p, eol );
+      if( value == 0 )
+	{
+	  chunk->error = GL_TRUE;
+	  break;
+	}
+      corner.index[0] = ObjIndex( value, chunk->nPositions, 1, &corner );
+      if( p < eol && *p == '/' )
+	{
+	  p++;
+	  if( p < eol && *p != '/' )
+	    {
+	      if( (value = ObjInt( &p, eol )) == 0 )
+		{
+		  chunk->error = GL_TRUE;
+		  break;
+		}
+	      corner.index[1] = ObjIndex( value, chunk->nTexCoords, 2, &corner );
+	    }
+	  if( p < eol && *p == '/' )
+	    {
+	      p++;
+	      if( (value = ObjInt( &p, eol )) == 0 )
+		{
+		  chunk->error = GL_TRUE;
+		  break;
+		}
+	      corner.index[2] = ObjIndex( value, chunk->nNormals, 4, &corner );
+	    }
+	}
+      chunk->corners = ObjReserve( chunk->corners, chunk->nCorners,
+				   &chunk->maxCorners, sizeof(OBJCORNER) );
+      chunk->corners[chunk->nCorners++] = corner;
+    }
+
+  if( chunk->nCorners - first < 3 )
+    {
+      chunk->nCorners = first;
+      return;
+    }
+  chunk->faces = ObjReserve( chunk->faces, chunk->nFaces,
+			     &chunk->maxFaces, sizeof(GLuint) );
+  chunk->faces[chunk->nFaces++] = chunk->nCorners - first;
+}
+
+/*** Función: Lee las líneas de un trozo del OBJ(tarea de WORKERPOOL) ***/
+void ParseObjChunk( void* data, GLuint index )
+{
+  OBJCHUNK*   chunk = &((OBJIMPORT*)data)->chunks[index];
+  const char* s     = chunk->begin;
+  unsigned int k;
+
+  while( s < chunk->end )
+    {
+      const char* line = ObjSkipSpace( s, chunk->end );
+      const char* eol  = memchr( line, '\n', chunk->end - line );
+      const char* p    = line + 2;
+      if( eol == NULL )
+	eol = chunk->end;
+      s = eol < chunk->end ? eol + 1 : eol;
+      if( eol - line < 2 )
+	continue;
+
+      if( line[0] == 'v' && (line[1] == ' ' || line[1] == '\t') )
+	{
+	  chunk->positions = ObjReserve( chunk->positions, chunk->nPositions,
+					 &chunk->maxPositions, sizeof(GLfloat) * 3 );
+	  for( k = 0; k < 3; k++ )
+	    {
+	      p = ObjSkipSpace( p, eol );
+	      chunk->positions[chunk->nPositions * 3 + k] = ObjFloat( &p, eol );
+	    }
+	  chunk->nPositions++;
+	}
+      else if( line[0] == 'v' && line[1] == 't' )
+	{
+	  chunk->texCoords = ObjReserve( chunk->texCoords, chunk->nTexCoords,
+					 &chunk->maxTexCoords, sizeof(GLfloat) * 2 );
+	  for( k = 0; k < 2; k++ )
+	    {
+	      p = ObjSkipSpace( p, eol );
+	      chunk->texCoords[chunk->nTexCoords * 2 + k] = ObjFloat( &p, eol );
+	    }
+	  chunk->nTexCoords++;
+	}
+      else if( line[0] == 'v' && line[1] == 'n' )
+	{
+	  chunk->normals = ObjReserve( chunk->normals, chunk->nNormals,
+				       &chunk->maxNormals, sizeof(GLfloat) * 3 );
+	  for( k = 0; k < 3; k++ )
+	    {
+	      p = ObjSkipSpace( p, eol );
+	      chunk->normals[chunk->nNormals * 3 + k] = ObjFloat( &p, eol );
+	    }
+	  chunk->nNormals++;
+	}
+      else if( line[0] == 'f' && (line[1] == ' ' || line[1] == '\t') )
+	ParseObjFace( chunk, line + 1, eol );
+      else if( (line[0] == 'o' || line[0] == 'g') &&
+	       (line[1] == ' ' || line[1] == '\t' || line[1] == '\r') )
+	AddObjEvent( chunk, OBJ_EVENT_OBJECT, line + 1, eol );
+      else if( eol - line > 6 && strncmp( line, "usemtl", 6 ) == 0 )
+	AddObjEvent( chunk, OBJ_EVENT_MATERIAL, line + 6, eol );
+      else if( eol - line > 6 && strncmp( line, "mtllib", 6 ) == 0 )
+	AddObjEvent( chunk, OBJ_EVENT_LIBRARY, line + 6, eol );
+    }
+}
+
+/*** Función: Copia un trozo a los arreglos del archivo(tarea de WORKERPOOL) ***/
+// Resuelve los índices relativos y revisa que estén en rango
+void ResolveObjChunk( void* data, GLuint index )
+{
+  OBJIMPORT* import = data;
+  OBJCHUNK*  chunk  = &import->chunks[index];
+  GLuint     base[3]  = { chunk->basePosition, chunk->baseTexCoord, chunk->baseNormal };
+  GLuint     total[3] = { import->nPositions, import->nTexCoords, import->nNormals };
+  unsigned int i, k;
+
+  if( chunk->nPositions > 0 )
+    memcpy( &import->positions[chunk->basePosition * 3], chunk->positions,
+	    sizeof(GLfloat) * 3 * chunk->nPositions );
+  if( chunk->nTexCoords > 0 )
+    memcpy( &import->texCoords[chunk->baseTexCoord * 2], chunk->texCoords,
+	    sizeof(GLfloat) * 2 * chunk->nTexCoords );
+  if( chunk->nNormals > 0 )
+    memcpy( &import->normals[chunk->baseNormal * 3], chunk->normals,
+	    sizeof(GLfloat) * 3 * chunk->nNormals );
+  if( chunk->nFaces > 0 )
+    memcpy( &import->faces[chunk->baseFace], chunk->faces,
+	    sizeof(GLuint) * chunk->nFaces );
+
+  for( i = 0; i < chunk->nCorners; i++ )
+    {
+      OBJCORNER corner = chunk->corners[i];
+      for( k = 0; k < 3; k++ )
+	{
+	  if( corner.relative & (1 << k) )
+	    corner.index[k] += base[k];
+	  else if( corner.index[k] < 0 )
+	    continue;
+	  if( corner.index[k] < 0 || (GLuint)corner.index[k] >= total[k] )
+	    chunk->error = GL_TRUE;
+	}
+      corner.relative = 0;
+      import->corners[chunk->baseCorner + i] = corner;
+    }
+}
+
+/*** Función: Material de un OBJ sin valores del MTL ***/
+// Los del lector de OBJ de assimp: difuso 0.6, lo demás negro y opaco
+void ObjDefaultMaterial( OBJMATERIAL* material, const char* name )
+{
+  MATERIAL mat = { {0.0f, 0.0f, 0.0f, 1.0f},
+		   {0.6f, 0.6f, 0.6f, 1.0f},
+		   {0.0f, 0.0f, 0.0f, 1.0f},
+		   {0.0f, 0.0f, 0.0f, 1.0f},
+		   0.0f };
+  memset( material, 0, sizeof(OBJMATERIAL) );
+  strncpy( material->name, name, MODEL_CACHE_NAME - 1 );
+  material->material         = mat;
+  material->properties.texOp = GL_REPEAT;
+}
+
+/*** Función: Nombre de archivo de un map_Kd, sin sus opciones ***/
+// "-clamp on" deja la textura con GL_CLAMP_TO_EDGE
+void ObjTextureName( char* s, OBJMATERIAL* material )
+{
+  char*        end;
+  unsigned int k;
+  s += strspn( s, " \t" );
+  while( *s == '-' )
+    {
+      // -o, -s y -t llevan hasta 3 números, -mm 2 y las demás 1
+      char*     option  = s;
+      GLboolean numbers = (s[1] == 'o' || s[1] == 's' || s[1] == 't') &&
+	(s[2] == ' ' || s[2] == '\t');
+      GLuint    args    = numbers ? 3 : strncmp( s, "-mm", 3 ) == 0 ? 2 : 1;
+      s += strcspn( s, " \t" );
+      s += strspn( s, " \t" );
+      if( strncmp( option, "-clamp", 6 ) == 0 )
+	material->properties.texOp = strncmp( s, "on", 2 ) == 0 ?
+	  GL_CLAMP_TO_EDGE : GL_REPEAT;
+      for( k = 0; k < args && *s != '\0'; k++ )
+	{
+	  char* stop;
+	  strtod( s, &stop );
+	  if( numbers && (stop == s || strchr( " \t\r\n", *stop ) == NULL) )
+	    break;
+	  s += strcspn( s, " \t" );
+	  s += strspn( s, " \t" );
+	}
+    }
+  for( end = s + strlen( s ); end > s && strchr( " \t\r\n", end[-1] ) != NULL; end-- );
+  *end = '\0';
+  strncpy( material->texture, s, MODEL_CACHE_NAME - 1 );
+}
+
+/*** Función: Lee los materiales de un archivo MTL ***/
+// Claves y valores como el lector de OBJ de assimp, para dar lo mismo que
+// LoadMaterials: illum no cambia el sombreado plano ni hay dos caras
+GLboolean LoadObjMaterials( OBJIMPORT* import, const char* mtlFile )
+{
+  OBJMATERIAL* material = NULL;
+  char         line[1024];
+  FILE*        file = fopen( mtlFile, "r" );
+  if( file == NULL )
+    {
+      fprintf( stderr, "ERROR: File '%s' does not exist.\n", mtlFile );
+      return GL_FALSE;
+    }
+
+  while( fgets( line, sizeof(line), file ) != NULL )
+    {
+      char  key[32];
+      char* s = line + strspn( line, " \t" );
+      float x, y, z;
+      if( sscanf( s, "%31s", key ) != 1 || key[0] == '#' )
+	continue;
+      s += strlen( key );
+
+      if( strcmp( key, "newmtl" ) == 0 )
+	{
+	  char* end;
+	  s += strspn( s, " \t" );
+	  for( end = s + strlen( s ); end > s && strchr( " \t\r\n", end[-1] ) != NULL; end-- );
+	  *end = '\0';
+	  import->materials = realloc( import->materials, sizeof(OBJMATERIAL) *
+				       (import->nMaterials + 1) );
+	  material = &import->materials[import->nMaterials++];
+	  ObjDefaultMaterial( material, s );
+	}
+      else if( material == NULL )
+	continue;
+      else if( strcmp( key, "Ka" ) == 0 && sscanf( s, "%f %f %f", &x, &y, &z ) == 3 )
+	{
+	  COLOR ambient = { x, y, z, 1.0f };
+	  material->material.ambient = ambient;
+	}
+      else if( strcmp( key, "Kd" ) == 0 && sscanf( s, "%f %f %f", &x, &y, &z ) == 3 )
+	{
+	  COLOR diffuse = { x, y, z, 1.0f };
+	  material->material.diffuse = diffuse;
+	}
+      else if( strcmp( key, "Ks" ) == 0 && sscanf( s, "%f %f %f", &x, &y, &z ) == 3 )
+	{
+	  COLOR specular = { x, y, z, 1.0f };
+	  material->material.specular = specular;
+	}
+      else if( strcmp( key, "Ke" ) == 0 && sscanf( s, "%f %f %f", &x, &y, &z ) == 3 )
+	{
+	  COLOR emission = { x, y, z, 1.0f };
+	  material->material.emission = emission;
+	}
+      else if( strcmp( key, "Ns" ) == 0 && sscanf( s, "%f", &x ) == 1 )
+	material->material.shininess = x;
+      else if( strcmp( key, "d" ) == 0 && sscanf( s, "%f", &x ) == 1 )
+	material->properties.blending = x != 1.0f;
+      else if( strcmp( key, "Tr" ) == 0 && sscanf( s, "%f", &x ) == 1 )
+	material->properties.blending = 1.0f - x != 1.0f;
+      else if( strcmp( key, "map_Kd" ) == 0 )
+	ObjTextureName( s, material );
+    }
+  fclose( file );
+  return GL_TRUE;
+}
+
+/*** Función: Índice de un material por nombre(-1 si no está) ***/
+GLint FindObjMaterial( OBJIMPORT* import, const char* name, GLuint length )
+{
+  unsigned int i;
+  for( i = 0; i < import->nMaterials; i++ )
+    if( strlen( import->materials[i].name ) == length &&
+	strncmp( import->materials[i].name, name, length ) == 0 )
+      return i;
+  return -1;
+}
+
+/*** Función: Agrega un mesh con las caras [firstFace, lastFace) ***/
+void AddObjMesh( OBJIMPORT* import, GLuint material, GLboolean hull,
+		 GLuint firstFace, GLuint lastFace, GLuint firstCorner )
+{
+  if( lastFace == firstFace )
+    return;
+  import->meshes = realloc( import->meshes,
+			    sizeof(OBJMESH) * (import->nMeshes + 1) );
+  OBJMESH* mesh = &import->meshes[import->nMeshes++];
+  memset( mesh, 0, sizeof(OBJMESH) );
+  mesh->material    = material;
+  mesh->hull        = hull;
+  mesh->firstFace   = firstFace;
+  mesh->nFaces      = lastFace - firstFace;
+  mesh->firstCorner = firstCorner;
+  import->materials[material].used = GL_TRUE;
+}
+
+/*** Función: Posición de una entrada en una tabla hash de OBJKEY ***/
+// Busca "key" desde su hash; se detiene en ella o en una entrada libre
+GLuint FindObjKey( OBJKEY* table, GLuint mask, const GLint key[3] )
+{
+  GLuint h = (GLuint)key[0] * 73856093u ^ (GLuint)key[1] * 19349663u ^
+    (GLuint)key[2] * 83492791u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  for( h &= mask; table[h].value != (GLuint)-1; h = (h + 1) & mask )
+    if( table[h].key[0] == key[0] && table[h].key[1] == key[1] &&
+	table[h].key[2] == key[2] )
+      break;
+  return h;
+}
+
+/*** Función: Tabla hash vacía con lugar para "count" llaves ***/
+OBJKEY* InitObjKeys( GLuint count, GLuint* mask )
+{
+  GLuint  size;
+  OBJKEY* table;
+  for( size = 16; size < count * 2; size <<= 1 );
+  table = malloc( sizeof(OBJKEY) * size );
+  memset( table, 0xff, sizeof(OBJKEY) * size );
+  *mask = size - 1;
+  return table;
+}
+
+/*** Función: Vértices sin repetir y triángulos de un mesh(tarea de WORKERPOOL) ***/
+// Cada cara se parte en abanico, al revés como aiProcess_FlipWindingOrder.
+// Sin normales en el archivo se suavizan por posición como
+// aiProcess_GenSmoothNormals, con la cara en el orden del archivo.
+void BuildObjMesh( void* data, GLuint index )
+{
+  OBJIMPORT* import  = data;
+  OBJMESH*   mesh    = &import->meshes[index];
+  OBJCORNER* corners = &import->corners[mesh->firstCorner];
+  GLuint*    faces   = &import->faces[mesh->firstFace];
+  GLuint     nCorners = 0, mask, corner, t;
+  OBJKEY*    table;
+  GLuint*    cornerVertex;
+  unsigned int i, j;
+
+  mesh->normals   = GL_TRUE;
+  mesh->texCoords = GL_FALSE;
+  for( i = 0; i < mesh->nFaces; i++ )
+    {
+      mesh->nTriangles += faces[i] - 2;
+      for( j = 0; j < faces[i]; j++, nCorners++ )
+	{
+	  mesh->normals   &= corners[nCorners].index[2] >= 0;
+	  mesh->texCoords |= corners[nCorners].index[1] >= 0;
+	}
+    }
+
+  /* Vértices: uno por cada (v, vt, vn) distinto */
+  table        = InitObjKeys( nCorners, &mask );
+  cornerVertex = malloc( sizeof(GLuint) * nCorners );
+  mesh->vertices = malloc( sizeof(MODELVERTEX) * nCorners );
+  for( i = 0; i < nCorners; i++ )
+    {
+      GLint  key[3] = { corners[i].index[0],
+			mesh->texCoords ? corners[i].index[1] : -1,
+			mesh->normals   ? corners[i].index[2] : -1 };
+      GLuint h      = FindObjKey( table, mask, key );
+      if( table[h].value == (GLuint)-1 )
+	{
+	  MODELVERTEX* v = &mesh->vertices[mesh->nVertices];
+	  memset( v, 0, sizeof(MODELVERTEX) );
+	  memcpy( &v->p, &import->positions[key[0] * 3], sizeof(POINT) );
+	  if( key[1] >= 0 )
+	    memcpy( &v->t, &import->texCoords[key[1] * 2], sizeof(TEXCOORD) );
+	  if( key[2] >= 0 )
+	    {
+	      memcpy( &v->n, &import->normals[key[2] * 3], sizeof(VECTOR) );
+	      if( Norm2Vector( v->n ) > 0.0f )
+		v->n = NormalizeVector( v->n );
+	    }
+	  memcpy( table[h].key, key, sizeof(key) );
+	  table[h].value = mesh->nVertices++;
+	}
+      cornerVertex[i] = table[h].value;
+    }
+  free( table );
+
+  /* Triángulos */
+  mesh->triangles = malloc( sizeof(GLuint) * 3 * mesh->nTriangles );
+  for( i = 0, corner = 0, t = 0; i < mesh->nFaces; corner += faces[i++] )
+    for( j = 1; j + 1 < faces[i]; j++, t += 3 )
+      {
+	mesh->triangles[t    ] = cornerVertex[corner + j + 1];
+	mesh->triangles[t + 1] = cornerVertex[corner + j];
+	mesh->triangles[t + 2] = cornerVertex[corner];
+      }
+  free( cornerVertex );
+
+  /* Normales suavizadas: suma de normales de cara por posición */
+  if( !mesh->normals )
+    {
+      GLuint* slot  = malloc( sizeof(GLuint) * (mesh->nVertices + 1) );
+      VECTOR* sums  = calloc( mesh->nVertices + 1, sizeof(VECTOR) );
+      GLuint  nSlots = 0;
+      table = InitObjKeys( mesh->nVertices, &mask );
+      for( i = 0; i < mesh->nVertices; i++ )
+	{
+	  // +0.0f junta -0 con 0
+	  GLfloat p[3] = { mesh->vertices[i].p.x + 0.0f,
+			   mesh->vertices[i].p.y + 0.0f,
+			   mesh->vertices[i].p.z + 0.0f };
+	  GLint   key[3];
+	  memcpy( key, p, sizeof(key) );
+	  GLuint  h = FindObjKey( table, mask, key );
+	  if( table[h].value == (GLuint)-1 )
+	    {
+	      memcpy( table[h].key, key, sizeof(key) );
+	      table[h].value = nSlots++;
+	    }
+	  slot[i] = table[h].value;
+	}
+      free( table );
+
+      for( t = 0; t < mesh->nTriangles * 3; t += 3 )
+	{
+	  GLuint* v  = &mesh->triangles[t];
+	  POINT*  a  = &mesh->vertices[v[2]].p;
+	  POINT*  b  = &mesh->vertices[v[1]].p;
+	  POINT*  c  = &mesh->vertices[v[0]].p;
+	  VECTOR  p0 = { a->x, a->y, a->z };
+	  VECTOR  p1 = { b->x, b->y, b->z };
+	  VECTOR  p2 = { c->x, c->y, c->z };
+	  VECTOR  n  = CrossProduct( ResVector( p1, p0 ), ResVector( p2, p0 ) );
+	  if( Norm2Vector( n ) > 0.0f )
+	    n = NormalizeVector( n );
+	  for( j = 0; j < 3; j++ )
+	    sums[slot[v[j]]] = SumVector( sums[slot[v[j]]], n );
+	}
+      for( i = 0; i < mesh->nVertices; i++ )
+	if( Norm2Vector( sums[slot[i]] ) > 0.0f )
+	  mesh->vertices[i].n = NormalizeVector( sums[slot[i]] );
+      free( slot );
+      free( sums );
+    }
+}
+
+/*** Función: Libera lo que usa ImportModelOBJ ***/
+void FreeObjImport( OBJIMPORT* import )
+{
+  unsigned int i;
+  for( i = 0; i < import->nChunks; i++ )
+    {
+      OBJCHUNK* chunk = &import->chunks[i];
+      free( chunk->positions );
+      free( chunk->texCoords );
+      free( chunk->normals );
+      free( chunk->corners );
+      free( chunk->faces );
+      free( chunk->events );
+    }
+  for( i = 0; i < import->nMeshes; i++ )
+    {
+      free( import->meshes[i].vertices );
+      free( import->meshes[i].triangles );
+    }
+  free( import->chunks );
+  free( import->positions );
+  free( import->texCoords );
+  free( import->normals );
+  free( import->corners );
+  free( import->faces );
+  free( import->materials );
+  free( import->meshes );
+  if( import->size > 0 )
+    munmap( (void*)import->data, import->size );
+}
+
+/*** Función: Lee un OBJ(y sus MTL) sin assimp ni opengl ***/
+// Reparte el archivo en trozos de OBJ_CHUNK_BYTES y los meshes entre los
+// hilos de "pool"(NULL: todo en este hilo); el resultado no depende del
+// número de hilos. Llena materiales, grupos y geometría de colisión de
+// "modelStruct" como LoadModel y devuelve los buffers de dibujo como
+// BuildModelBuffers. "textures" tiene MODEL_CACHE_NAME bytes por material
+// con su textura difusa. El que llama libera "textures", "vertices" e
+// "indices".
+GLboolean ImportModelOBJ( WORKERPOOL*   pool       ,
+			  const char*   modelFile  ,
+			  MODEL*        modelStruct,
+			  char**        textures   ,
+			  MODELVERTEX** vertexData ,
+			  GLuint*       vertexTotal,
+			  GLuint**      indexData  ,
+			  GLuint*       indexTotal ,
+			  GLboolean     verbose    )
+{
+  OBJIMPORT   import;
+  struct stat info;
+  int         fd = open( modelFile, O_RDONLY );
+  unsigned int i, j;
+
+  memset( modelStruct, 0, sizeof(MODEL) );
+  memset( &import, 0, sizeof(OBJIMPORT) );
+  if( fd < 0 || fstat( fd, &info ) != 0 )
+    {
+      if( fd >= 0 )
+	close( fd );
+      PrintError( "Could not open the OBJ file", GL_FALSE );
+      return GL_FALSE;
+    }
+  import.size = info.st_size;
+  if( import.size > 0 )
+    import.data = mmap( NULL, import.size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( import.data == MAP_FAILED )
+    {
+      PrintError( "Could not map the OBJ file", GL_FALSE );
+      return GL_FALSE;
+    }
+
+  /*** Trozos: terminan al final de una línea ***/
+  const char* begin = import.data;
+  const char* end   = import.data + import.size;
+  import.nChunks = import.size / OBJ_CHUNK_BYTES + 1;
+  import.chunks  = calloc( import.nChunks, sizeof(OBJCHUNK) );
+  for( i = 0; i < import.nChunks; i++ )
+    {
+      const char* stop = import.data + import.size * (i + 1) / import.nChunks;
+      if( stop > begin )
+	while( stop < end && stop[-1] != '\n' )
+	  stop++;
+      else
+	stop = begin;
+      import.chunks[i].begin = begin;
+      import.chunks[i].end   = stop;
+      begin = stop;
+    }
+  RunWorkerPool( pool, ParseObjChunk, &import, import.nChunks );
+
+  /* Inicio de cada trozo en los arreglos del archivo */
+  for( i = 0; i < import.nChunks; i++ )
+    {
+      OBJCHUNK* chunk = &import.chunks[i];
+      chunk->basePosition = import.nPositions;
+      chunk->baseTexCoord = import.nTexCoords;
+      chunk->baseNormal   = import.nNormals;
+      chunk->baseCorner   = import.nCorners;
+      chunk->baseFace     = import.nFaces;
+      import.nPositions  += chunk->nPositions;
+      import.nTexCoords  += chunk->nTexCoords;
+      import.nNormals    += chunk->nNormals;
+      import.nCorners    += chunk->nCorners;
+      import.nFaces      += chunk->nFaces;
+    }
+  import.positions = malloc( sizeof(GLfloat) * 3 * (import.nPositions + 1) );
+  import.texCoords = malloc( sizeof(GLfloat) * 2 * (import.nTexCoords + 1) );
+  import.normals   = malloc( sizeof(GLfloat) * 3 * (import.nNormals + 1) );
+  import.corners   = malloc( sizeof(OBJCORNER) * (import.nCorners + 1) );
+  import.faces     = malloc( sizeof(GLuint) * (import.nFaces + 1) );
+  RunWorkerPool( pool, ResolveObjChunk, &import, import.nChunks );
+  for( i = 0; i < import.nChunks; i++ )
+    if( import.chunks[i].error )
+      {
+	PrintError( "Invalid face index in the OBJ file", GL_FALSE );
+	FreeObjImport( &import );
+	return GL_FALSE;
+      }
+  /*________*/
+
+  /*** Materiales y meshes, en el orden del archivo ***/
+  const char* slash = strrchr( modelFile, '/' );
+  int         dir   = slash != NULL ? slash - modelFile + 1 : 0;
+  for( i = 0; i < import.nChunks; i++ )
+    for( j = 0; j < import.chunks[i].nEvents; j++ )
+      {
+	OBJEVENT* event = &import.chunks[i].events[j];
+	char      mtlFile[1024];
+	if( event->type != OBJ_EVENT_LIBRARY )
+	  continue;
+	snprintf( mtlFile, sizeof(mtlFile), "%.*s%.*s", dir, modelFile,
+		  (int)event->length, event->name );
+	LoadObjMaterials( &import, mtlFile );
+      }
+  import.materials = realloc( import.materials, sizeof(OBJMATERIAL) *
+			      (import.nMaterials + 1) );
+  ObjDefaultMaterial( &import.materials[import.nMaterials], "DefaultMaterial" );
+  GLuint    defaultMaterial = import.nMaterials++;
+  GLuint    material = defaultMaterial;
+  GLuint    first = 0, firstCorner = 0;
+  GLboolean hull  = GL_FALSE;
+  for( i = 0; i < import.nChunks; i++ )
+    for( j = 0; j < import.chunks[i].nEvents; j++ )
+      {
+	OBJCHUNK* chunk = &import.chunks[i];
+	OBJEVENT* event = &chunk->events[j];
+	if( event->type == OBJ_EVENT_LIBRARY )
+	  continue;
+	AddObjMesh( &import, material, hull, first, chunk->baseFace + event->face,
+		    firstCorner );
+	first       = chunk->baseFace + event->face;
+	firstCorner = chunk->baseCorner + event->corner;
+	if( event->type == OBJ_EVENT_OBJECT )
+	  hull = event->length >= 4 && strncmp( event->name, "UCX_", 4 ) == 0;
+	else
+	  {
+	    GLint found = FindObjMaterial( &import, event->name, event->length );
+	    material = found >= 0 ? (GLuint)found : defaultMaterial;
+	  }
+      }
+  AddObjMesh( &import, material, hull, first, import.nFaces, firstCorner );
+  RunWorkerPool( pool, BuildObjMesh, &import, import.nMeshes );
+  if( verbose )
+    printf( "\t%d Chunks, %d Meshes\n", import.nChunks, import.nMeshes );
+  /*________*/
+
+  /*** Materiales usados: el de omisión primero, como en assimp ***/
+  GLuint* remap = malloc( sizeof(GLuint) * import.nMaterials );
+  if( import.materials[defaultMaterial].used )
+    remap[defaultMaterial] = modelStruct->materialCount++;
+  for( i = 0; i < defaultMaterial; i++ )
+    if( import.materials[i].used )
+      remap[i] = modelStruct->materialCount++;
+  modelStruct->materials  = calloc( modelStruct->materialCount + 1, sizeof(MATERIAL) );
+  modelStruct->properties = calloc( modelStruct->materialCount + 1, sizeof(PROPERTIES) );
+  modelStruct->textureIDs = calloc( modelStruct->materialCount + 1, sizeof(GLuint) );
+  *textures = calloc( modelStruct->materialCount + 1, MODEL_CACHE_NAME );
+  for( i = 0; i < import.nMaterials; i++ )
+    if( import.materials[i].used )
+      {
+	if( verbose )
+	  printf( "\tLoading Material No.%d - '%s'\n", remap[i],
+		  import.materials[i].name );
+	modelStruct->materials[remap[i]]  = import.materials[i].material;
+	modelStruct->properties[remap[i]] = import.materials[i].properties;
+	strcpy( &(*textures)[remap[i] * MODEL_CACHE_NAME], import.materials[i].texture );
+      }
+  /*________*/
+
+  /*** Buffers de dibujo agrupados por material ***/
+  GLuint*      meshGroup = malloc( sizeof(GLuint) * (import.nMeshes + 1) );
+  GLuint*      cursor;
+  GLuint       nVertices = 0, nIndices = 0, base = 0;
+  GLuint       nCollision = 0, nCollisionIndices = 0;
+  MODELVERTEX* vertices;
+  GLuint*      indices;
+  for( i = 0; i < import.nMeshes; i++ )
+    {
+      OBJMESH* mesh = &import.meshes[i];
+      if( mesh->hull )
+	continue;
+      MODELGROUP group;
+      memset( &group, 0, sizeof(MODELGROUP) );
+      group.material  = remap[mesh->material];
+      group.mode      = GL_TRIANGLES;
+      group.normals   = GL_TRUE;
+      group.texCoords = mesh->texCoords;
+      meshGroup[i] = ModelGroupIndex( modelStruct, group );
+      modelStruct->groups[meshGroup[i]].count += mesh->nTriangles * 3;
+      nVertices += mesh->nVertices;
+    }
+  cursor = malloc( sizeof(GLuint) * (modelStruct->groupCount + 1) );
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      modelStruct->groups[i].first = nIndices;
+      cursor[i]  = nIndices;
+      nIndices  += modelStruct->groups[i].count;
+    }
+  vertices = malloc( sizeof(MODELVERTEX) * (nVertices + 1) );
+  indices  = malloc( sizeof(GLuint) * (nIndices + 1) );
+  for( i = 0; i < import.nMeshes; i++ )
+    {
+      OBJMESH* mesh = &import.meshes[i];
+      if( mesh->hull )
+	continue;
+      memcpy( &vertices[base], mesh->vertices, sizeof(MODELVERTEX) * mesh->nVertices );
+      for( j = 0; j < mesh->nTriangles * 3; j++ )
+	indices[cursor[meshGroup[i]]++] = base + mesh->triangles[j];
+      base += mesh->nVertices;
+    }
+  free( cursor );
+  free( meshGroup );
+  free( remap );
+  /*________*/
+
+  /*** Geometría de colisión, mesh por mesh como AddMeshGeometry ***/
+  for( i = 0; i < import.nMeshes; i++ )
+    if( !import.meshes[i].hull )
+      {
+	nCollision        += import.meshes[i].nVertices;
+	nCollisionIndices += import.meshes[i].nTriangles * 3;
+      }
+  modelStruct->vertexBuffer = malloc( sizeof(VECTOR) * (nCollision + 1) );
+  modelStruct->indexBuffer  = malloc( sizeof(GLuint) * (nCollisionIndices + 1) );
+  for( i = 0; i < import.nMeshes; i++ )
+    {
+      OBJMESH* mesh   = &import.meshes[i];
+      VECTOR*  points = mesh->hull ? malloc( sizeof(VECTOR) * (mesh->nVertices + 1) ) :
+	&modelStruct->vertexBuffer[modelStruct->vertexCount];
+      for( j = 0; j < mesh->nVertices; j++ )
+	memcpy( &points[j], &mesh->vertices[j].p, sizeof(VECTOR) );
+      AddModelHull( modelStruct, points, mesh->nVertices, mesh->hull );
+      if( mesh->hull )
+	{
+	  free( points );
+	  continue;
+	}
+      for( j = 0; j < mesh->nTriangles * 3; j++ )
+	modelStruct->indexBuffer[modelStruct->indexCount++] =
+	  modelStruct->vertexCount + mesh->triangles[j];
+      modelStruct->vertexCount += mesh->nVertices;
+    }
+  ModelBounds( modelStruct );
+  BuildModelBVH( modelStruct, verbose );
+  SelectModelHulls( modelStruct, verbose );
+  /*________*/
+
+  FreeObjImport( &import );
+  *vertexData  = vertices;
+  *vertexTotal = nVertices;
+  *indexData   = indices;
+  *indexTotal  = nIndices;
+  return GL_TRUE;
+}
+
+/*** Función: Carga un modelo OBJ sin assimp ***/
+// Mismos materiales, buffers y colisiones que LoadModel, leyendo con los
+// hilos de "pool"(NULL: en este hilo). No usa el caché de LoadModel.
+GLboolean LoadModelOBJ( WORKERPOOL* pool       ,
+			const char* modelFile  ,
+			const char* texturePath,
+			GLboolean   compact    ,
+			GLboolean   verbose    ,
+			MODEL*      modelStruct )
+{
+  MODELVERTEX* vertices;
+  GLuint*      indices;
+  GLuint       nVertices, nIndices;
+  char*        textures;
+  unsigned int i;
+
+  if( verbose )
+    printf( "Loading model '%s':\n", modelFile );
+  if( !ImportModelOBJ( pool, modelFile, modelStruct, &textures,
+		       &vertices, &nVertices, &indices, &nIndices, verbose ) )
+    return GL_FALSE;
+  modelStruct->compact = compact;
+
+  for( i = 0; i < modelStruct->materialCount; i++ )
+    LoadModelTexture( modelStruct, i, texturePath,
+		      &textures[i * MODEL_CACHE_NAME], verbose );
+  OptimizeModelBuffers( modelStruct, vertices, nVertices, indices, nIndices, verbose );
+  UploadModelBuffers( modelStruct, vertices, nVertices, indices, nIndices, verbose );
+  free( textures );
+  free( vertices );
+  free( indices );
+  if( verbose )
+    printf( "Done!\n");
+  return GL_TRUE;
+}
+
+/*** Función: Dibuja un modelo cargado con LoadModel ***/
+// Un glDrawElements por grupo(material) con la matriz de modelo activa
+void DrawModel( MODEL* modelStruct )
+{
+  size_t indexSize = modelStruct->indexType == GL_UNSIGNED_SHORT ?
+    sizeof(GLushort) : sizeof(GLuint);
+  unsigned int i;
+  if( modelStruct->vertexObject == 0 )
+    return;
+
+  glPushAttrib( GL_ENABLE_BIT   |
+		GL_TEXTURE_BIT  |
+		GL_LIGHTING_BIT |
+		GL_POLYGON_BIT  |
+		GL_COLOR_BUFFER_BIT );
+  glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+
+  /* Arreglos intercalados */
+  glBindBuffer( GL_ARRAY_BUFFER, modelStruct->vertexObject );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, modelStruct->indexObject );
+  if( modelStruct->compact )
+    {
+      // Los pasos de la ubicación se deshacen en la matriz
+      glPushMatrix();
+      glTranslatef( modelStruct->drawOrigin.x, modelStruct->drawOrigin.y,
+		    modelStruct->drawOrigin.z );
+      glScalef( modelStruct->drawScale, modelStruct->drawScale, modelStruct->drawScale );
+      glEnable( GL_NORMALIZE );
+      glVertexPointer( 3, GL_SHORT, sizeof(MODELCOMPACT),
+		       (GLvoid*)offsetof( MODELCOMPACT, p ) );
+      glNormalPointer( GL_BYTE, sizeof(MODELCOMPACT),
+		       (GLvoid*)offsetof( MODELCOMPACT, n ) );
+      glTexCoordPointer( 2, GL_HALF_FLOAT_ARB, sizeof(MODELCOMPACT),
+			 (GLvoid*)offsetof( MODELCOMPACT, t ) );
+      glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(MODELCOMPACT),
+		      (GLvoid*)offsetof( MODELCOMPACT, c ) );
+    }
+  else
+    {
+      glVertexPointer( 3, GL_FLOAT, sizeof(MODELVERTEX),
+		       (GLvoid*)offsetof( MODELVERTEX, p ) );
+      glNormalPointer( GL_FLOAT, sizeof(MODELVERTEX),
+		       (GLvoid*)offsetof( MODELVERTEX, n ) );
+      glTexCoordPointer( 2, GL_FLOAT, sizeof(MODELVERTEX),
+			 (GLvoid*)offsetof( MODELVERTEX, t ) );
+      glColorPointer( 4, GL_FLOAT, sizeof(MODELVERTEX),
+		      (GLvoid*)offsetof( MODELVERTEX, c ) );
+    }
+  glEnableClientState( GL_VERTEX_ARRAY );
+
+  for( i = 0; i < modelStruct->groupCount; i++ )
+    {
+      MODELGROUP* group    = &modelStruct->groups[i];
+      GLuint      matIndex = group->material;
+
+      /* Propiedades */
+      if( group->normals )
+	{
+	  glEnable( GL_LIGHTING );
+	  glEnableClientState( GL_NORMAL_ARRAY );
+	}
+      else
+	{
+	  glDisable( GL_LIGHTING );
+	  glDisableClientState( GL_NORMAL_ARRAY );
+	}
+      if( group->texCoords )
+	{
+	  glEnable( GL_TEXTURE_2D );
+	  glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+	}
+      else
+	{
+	  glDisable( GL_TEXTURE_2D );
+	  glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	}
+      if( group->colors )
+	glEnableClientState( GL_COLOR_ARRAY );
+      else
+	glDisableClientState( GL_COLOR_ARRAY );
+      if( modelStruct->properties[matIndex].wireframe )
+	glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+      else
+	glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+      if( modelStruct->properties[matIndex].culling )
+	glEnable( GL_CULL_FACE );
+      else
+	glDisable( GL_CULL_FACE );
+      if( modelStruct->properties[matIndex].flat )
+	glShadeModel( GL_FLAT );
+      else
+	glShadeModel( GL_SMOOTH );
+      if( modelStruct->properties[matIndex].transparency )
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+      else
+	glBlendFunc( GL_ONE, GL_ONE );
+      if( modelStruct->properties[matIndex].blending )
+	glEnable( GL_BLEND );
+
+      /* Material y textura */
+      SetMaterial( &modelStruct->materials[matIndex] );
+      glBindTexture( GL_TEXTURE_2D, modelStruct->textureIDs[matIndex] );
+
+      glDrawElements( group->mode, group->count, modelStruct->indexType,
+		      (GLvoid*)(indexSize * group->first) );
+
+      if( modelStruct->properties[matIndex].blending )
+	glDisable( GL_BLEND );
+    }
+
+  if( modelStruct->compact )
+    glPopMatrix();
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+  glPopClientAttrib();
+  glPopAttrib();
+}
+
 /*** Función: Libera los recursos asociados con un modelo ***/
 void FreeModel( MODEL* modelStruct )
 {
-  glDeleteTextures( sizeof(modelStruct->textureIDs) / sizeof(GLuint),
-		    modelStruct->textureIDs );
-  glDeleteLists( modelStruct->modelList, 1 );
+  // Sin buffers no hay recursos de opengl(LoadModelCollision)
+  if( modelStruct->vertexObject != 0 )
+    {
+      glDeleteTextures( modelStruct->materialCount, modelStruct->textureIDs );
+      glDeleteBuffers( 1, &modelStruct->vertexObject );
+      glDeleteBuffers( 1, &modelStruct->indexObject );
+    }
+  free( modelStruct->groups );
   free( modelStruct->textureIDs );
   free( modelStruct->materials );
+  free( modelStruct->properties );
   free( modelStruct->vertexBuffer );
   free( modelStruct->indexBuffer );
+  free( modelStruct->bvh );
+  free( modelStruct->bvhTriangles );
+  unsigned int i;
+  for( i = 0; i < modelStruct->hullCount; i++ )
+    free( modelStruct->hulls[i].points );
+  free( modelStruct->hulls );
 }
 
 /*_______*/
@@ -10,10 +10,20 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 #include <SDL/SDL.h>
 #include "SDLMain.h"
 #include <SDL_image/SDL_image.h>
@@ -34,12 +44,19 @@
 /*** Variable para indicar la salida del programa ***/
 GLboolean g_ExitProgram = GL_FALSE;
 
+/*** Argumentos de la línea de comandos(para Init) ***/
+int    g_Argc = 0;
+char** g_Argv = NULL;
+
 /*** Funciones del ejercicio ***/
 // Implementadas en "Ejercicio.cpp" //
 void Init( void );
 void Free( void );
 void Loop( float elapsed );
 
+/*** Elige la versión de las operaciones en lote(math.c) ***/
+void InitVectorKernels( void );
+
 /* Función de diagnóstico de error de SDL */
 void Error_SDL( const char* error )
 {
@@ -193,6 +210,9 @@ void SetOpenGL( int width, int height      ,  // Dimensión del la ventana
 /*** Main ***/
 int main( int argc, char** argv )
 {
+  g_Argc = argc;
+  g_Argv = argv;
+  InitVectorKernels(); // Operaciones en lote según el procesador
   Init();    // Inicializo recursos
 
   /* Conteo del tiempo */
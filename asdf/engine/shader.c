@@ -17,6 +17,11 @@ GLuint CreateShader( const char* shaderSource, GLenum type )
     char* source = NULL;
     int   length = 0;
     FILE* file   = fopen( shaderSource, "r" );
+    if( file == NULL )
+    {
+	fprintf( stderr, "Error opening Shader '%s'\n", shaderSource );
+	return 0;
+    }
     fseek( file, 0, SEEK_END );
     length = ftell( file );
     rewind( file );
@@ -0,0 +1,36 @@
+// terrainSplat.frag
+// Arena abajo, pasto arriba y roca en las pendientes, repetidas en el
+// mundo; se ilumina con la luz 0 y el material activos, como la tubería fija.
+#version 120
+
+uniform sampler2D sandTex;
+uniform sampler2D grassTex;
+uniform sampler2D rockTex;
+uniform float     sandHeight; // Altura donde la arena pasa a pasto
+uniform float     rockSlope;  // Pendiente(1 - normal.y) donde empieza la roca
+uniform float     blend;      // Ancho de la transición arena-pasto
+uniform float     tileSize;   // Unidades del mundo por repetición
+
+varying vec3 worldPos;
+varying vec3 worldNormal;
+varying vec3 eyeNormal;
+
+void main()
+{
+    vec2  uv    = worldPos.xz / tileSize;
+    float slope = 1.0 - normalize( worldNormal ).y;
+
+    /* Pesos por altura y pendiente */
+    float sand = 1.0 - smoothstep( sandHeight - blend, sandHeight + blend, worldPos.y );
+    float rock = smoothstep( rockSlope - 0.05, rockSlope + 0.05, slope );
+    vec4  color = mix( texture2D( grassTex, uv ), texture2D( sandTex, uv ), sand );
+    color = mix( color, texture2D( rockTex, uv ), rock );
+
+    /* Luz direccional 0 */
+    vec3  light   = normalize( gl_LightSource[0].position.xyz );
+    float diffuse = max( dot( normalize( eyeNormal ), light ), 0.0 );
+    vec4  lit     = gl_FrontLightModelProduct.sceneColor +
+                    gl_FrontLightProduct[0].ambient +
+                    gl_FrontLightProduct[0].diffuse * diffuse;
+    gl_FragColor = vec4( color.rgb * lit.rgb, color.a );
+}
@@ -0,0 +1,19 @@
+// terrainSplat.vert
+// Posición y normal del mundo para mezclar las texturas del terreno.
+// El terreno se dibuja sin matriz de modelo: gl_Vertex está en el mundo, o
+// en pasos desde el origen de una página de vértices compactos.
+#version 120
+
+uniform vec4 vertexOrigin; // Mundo = xyz + gl_Vertex * w
+
+varying vec3 worldPos;
+varying vec3 worldNormal;
+varying vec3 eyeNormal;
+
+void main()
+{
+    worldPos    = vertexOrigin.xyz + gl_Vertex.xyz * vertexOrigin.w;
+    worldNormal = gl_Normal;
+    eyeNormal   = gl_NormalMatrix * gl_Normal;
+    gl_Position = ftransform();
+}
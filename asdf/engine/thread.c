@@ -0,0 +1,132 @@
+/*****************************/
+/**       ----------        **/
+/**        thread.c         **/
+/**       ----------        **/
+/**  Grupo de hilos para    **/
+/**  repartir trabajo       **/
+/*****************************/
+
+//---   Estructuras   ---//
+
+/*** Tipo: Tarea de un grupo de hilos ***/
+// Se llama una vez por cada índice en [0, count)
+typedef void (*WORKERJOB)( void* data, GLuint index );
+
+/*** Estructura de Dato: WORKERPOOL ***/
+typedef struct workerpool
+{
+  SDL_Thread** threads;  // Hilos de trabajo
+  GLuint       nThreads; // Número de hilos(0: todo en el hilo principal)
+  SDL_mutex*   mutex;    // Protege los campos de abajo
+  SDL_cond*    start;    // Hay tareas nuevas
+  SDL_cond*    done;     // Se terminaron las tareas
+  WORKERJOB    job;      // Tarea actual
+  void*        data;     // Datos de la tarea
+  GLuint       count;    // Número de índices
+  GLuint       next;     // Siguiente índice sin tomar
+  GLuint       pending;  // Índices sin terminar
+  GLboolean    quit;     // Los hilos deben salir
+} WORKERPOOL;
+
+/*_________*/
+
+
+//---   Funciones   ---//
+
+/*** Función: Número de procesadores en línea ***/
+GLuint CountProcessors( void )
+{
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  return n > 0 ? (GLuint)n : 1;
+}
+
+/*** Función: Toma y ejecuta índices hasta que no quede ninguno ***/
+// Se llama con el mutex tomado y lo devuelve tomado
+void RunWorkerJobs( WORKERPOOL* pool )
+{
+  while( pool->next < pool->count )
+    {
+      GLuint index = pool->next++;
+      SDL_mutexV( pool->mutex );
+      pool->job( pool->data, index );
+      SDL_mutexP( pool->mutex );
+      if( --pool->pending == 0 )
+	SDL_CondBroadcast( pool->done );
+    }
+}
+
+/*** Función: Ciclo de un hilo de trabajo ***/
+int WorkerThread( void* data )
+{
+  WORKERPOOL* pool = data;
+
+  SDL_mutexP( pool->mutex );
+  while( !pool->quit )
+    {
+      if( pool->next < pool->count )
+	RunWorkerJobs( pool );
+      else
+	SDL_CondWait( pool->start, pool->mutex );
+    }
+  SDL_mutexV( pool->mutex );
+  return 0;
+}
+
+/*** Función: Crea un grupo de hilos ***/
+// nThreads = 0 ejecuta todo en el hilo que llama a RunWorkerPool
+void InitWorkerPool( WORKERPOOL* pool, GLuint nThreads )
+{
+  unsigned int i;
+  memset( pool, 0, sizeof(WORKERPOOL) );
+  pool->mutex    = SDL_CreateMutex();
+  pool->start    = SDL_CreateCond();
+  pool->done     = SDL_CreateCond();
+  pool->nThreads = nThreads;
+  pool->threads  = malloc( sizeof(SDL_Thread*) * nThreads );
+  for( i = 0; i < nThreads; i++ )
+    pool->threads[i] = SDL_CreateThread( WorkerThread, pool );
+}
+
+/*** Función: Termina y libera un grupo de hilos ***/
+void FreeWorkerPool( WORKERPOOL* pool )
+{
+  unsigned int i;
+  SDL_mutexP( pool->mutex );
+  pool->quit = GL_TRUE;
+  SDL_CondBroadcast( pool->start );
+  SDL_mutexV( pool->mutex );
+  for( i = 0; i < pool->nThreads; i++ )
+    SDL_WaitThread( pool->threads[i], NULL );
+
+  SDL_DestroyCond( pool->start );
+  SDL_DestroyCond( pool->done );
+  SDL_DestroyMutex( pool->mutex );
+  free( pool->threads );
+  pool->threads  = NULL;
+  pool->nThreads = 0;
+}
+
+/*** Función: Ejecuta job( data, i ) para i en [0, count) y espera ***/
+// El hilo que llama también trabaja. Con pool = NULL se ejecuta en orden.
+void RunWorkerPool( WORKERPOOL* pool, WORKERJOB job, void* data, GLuint count )
+{
+  unsigned int i;
+  if( pool == NULL || pool->nThreads == 0 )
+    {
+      for( i = 0; i < count; i++ )
+	job( data, i );
+      return;
+    }
+
+  SDL_mutexP( pool->mutex );
+  pool->job     = job;
+  pool->data    = data;
+  pool->next    = 0;
+  pool->count   = count;
+  pool->pending = count;
+  SDL_CondBroadcast( pool->start );
+  RunWorkerJobs( pool );
+  while( pool->pending > 0 )
+    SDL_CondWait( pool->done, pool->mutex );
+  SDL_mutexV( pool->mutex );
+}